@@ -1,15 +1,132 @@
 #include "math.h"
+#include "string.h"
 #include "dct.h"
 
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define MMF_DCT_X86
+#endif
+
+/* Fixed-point constants for the integer iDCT: 2048*sqrt(2)*cos(k*pi/16)
+ */
+#define IDCT_W1 2841
+#define IDCT_W2 2676
+#define IDCT_W3 2408
+#define IDCT_W5 1609
+#define IDCT_W6 1108
+#define IDCT_W7 565
+
 static double __cos[8][8];
 static double __c[8];
 
-/*
+/* Fixed-point (Q11) matrices of the reduced-size iDCTs, for 4 and 2 samples per dimension */
+static int32_t __idct_scaled[2][4][4];
+
+/* Routines used by the decoder. The integer iDCT is the default one, until
+ * mmf_dct_init() picks the best one the CPU supports.
  */
-__attribute__((constructor)) void mmf_dct_init()
+MMFDCTFunctions mmf_dct_funcs = {
+    .idct_put = mmf_idct_int_put,
+    .idct_put_x2 = mmf_idct_int_put_x2,
+    .idct_put_4x4 = mmf_idct_int_put_4x4,
+    .idct_add = mmf_idct_int_add,
+    .idct_add_x2 = mmf_idct_int_add_x2,
+    .idct_add_4x4 = mmf_idct_int_add_4x4,
+    .idct_dc = mmf_idct_int_dc,
+};
+
+static inline uint8_t mmf_clamp_u8(int32_t v)
+{
+    return v > 255 ? 255 : v < 0 ? 0 : v;
+}
+
+/* Output of the horizontal passes. It is saturated like by the packs of the SIMD versions,
+ * since extreme coefficients can exceed 16 bits.
+ */
+static inline int16_t mmf_clamp_s16(int32_t v)
+{
+    return v > INT16_MAX ? INT16_MAX : v < INT16_MIN ? INT16_MIN : v;
+}
+
+/* x * 181 / 256 (1 / sqrt(2)), rounded. The product is computed unsigned, since extreme
+ * coefficients can exceed 32 bits in the vertical passes, and wraps like in the SIMD versions.
+ */
+static inline int32_t mmf_idct_mul181(int32_t x)
+{
+    return (int32_t)(181u * (uint32_t)x + 128u) >> 8;
+}
+
+/* Put variants of mmf_idct(). The reference iDCT has no sparse version,
+ * so it is used for the 4x4 blocks as well.
+ */
+static void mmf_idct_put(int16_t *block, uint8_t *dst, int32_t stride)
 {
     int i, j;
 
+    mmf_idct(block);
+
+    for (i = 0; i < 8; i++)
+        for (j = 0; j < 8; j++)
+            dst[i * stride + j] = mmf_clamp_u8(block[i * 8 + j]);
+}
+
+static void mmf_idct_put_x2(int16_t *blocks, uint8_t *dst0, int32_t stride0, uint8_t *dst1, int32_t stride1)
+{
+    mmf_idct_put(blocks, dst0, stride0);
+    mmf_idct_put(blocks + 64, dst1, stride1);
+}
+
+static void mmf_idct_add(int16_t *block, uint8_t *dst, int32_t stride)
+{
+    int i, j;
+
+    mmf_idct(block);
+
+    for (i = 0; i < 8; i++)
+        for (j = 0; j < 8; j++)
+            dst[i * stride + j] = mmf_clamp_u8(dst[i * stride + j] + block[i * 8 + j] - 128);
+}
+
+static void mmf_idct_add_x2(int16_t *blocks, uint8_t *dst0, int32_t stride0, uint8_t *dst1, int32_t stride1)
+{
+    mmf_idct_add(blocks, dst0, stride0);
+    mmf_idct_add(blocks + 64, dst1, stride1);
+}
+
+/* Two-block variants of the routines, which have no native one.
+ */
+void mmf_idct_int_put_x2(int16_t *blocks, uint8_t *dst0, int32_t stride0, uint8_t *dst1, int32_t stride1)
+{
+    mmf_idct_int_put(blocks, dst0, stride0);
+    mmf_idct_int_put(blocks + 64, dst1, stride1);
+}
+
+void mmf_idct_int_add_x2(int16_t *blocks, uint8_t *dst0, int32_t stride0, uint8_t *dst1, int32_t stride1)
+{
+    mmf_idct_int_add(blocks, dst0, stride0);
+    mmf_idct_int_add(blocks + 64, dst1, stride1);
+}
+
+#ifdef MMF_DCT_X86
+void mmf_idct_sse2_put_x2(int16_t *blocks, uint8_t *dst0, int32_t stride0, uint8_t *dst1, int32_t stride1)
+{
+    mmf_idct_sse2_put(blocks, dst0, stride0);
+    mmf_idct_sse2_put(blocks + 64, dst1, stride1);
+}
+
+void mmf_idct_sse2_add_x2(int16_t *blocks, uint8_t *dst0, int32_t stride0, uint8_t *dst1, int32_t stride1)
+{
+    mmf_idct_sse2_add(blocks, dst0, stride0);
+    mmf_idct_sse2_add(blocks + 64, dst1, stride1);
+}
+#endif
+
+/* Initializes the DCT tables, and selects the fastest iDCT for the CPU we are running on.
+ */
+__attribute__((constructor)) void mmf_dct_init()
+{
+    int i, j, m, n, scale;
+
     for (i = 0; i < 8; i++) {
         for (j = 0; j < 8; j++)
           __cos[i][j] = cos((2 * i + 1) * j * acos(-1) / 16.0);
@@ -19,6 +136,848 @@ __attribute__((constructor)) void mmf_dct_init()
         else
             __c[i] = 1 / sqrt(2);
     }
+
+    /* Each sample of the reduced iDCT is the average of the 2^scale samples, it covers in
+     * the 8-point iDCT. Averaging two neighbours turns cos((2x+1)u*pi/16) into
+     * cos(u*pi/16) * cos((2x'+1)u*pi/8), and so on for each halving.
+     */
+    for (scale = 1; scale <= 2; scale++) {
+        n = 8 >> scale;
+
+        for (i = 0; i < n; i++)
+            for (j = 0; j < n; j++) {
+                double k = __c[j] * 0.5 * cos((2 * i + 1) * j * acos(-1) / (2.0 * n));
+
+                for (m = 0; m < scale; m++)
+                    k *= cos(j * (1 << m) * acos(-1) / 16.0);
+
+                __idct_scaled[scale - 1][i][j] = (int32_t)lrint(k * 2048);
+            }
+    }
+
+    mmf_dct_set_idct(IDCT_TYPE_AUTO);
+}
+
+MMFRES mmf_dct_set_idct(MMFIDCTType type)
+{
+    #ifdef MMF_DCT_X86
+    /* Needed, since we might be called from a constructor */
+    __builtin_cpu_init();
+
+    if(type == IDCT_TYPE_AUTO) {
+        type = __builtin_cpu_supports("avx2") ? IDCT_TYPE_AVX2 :
+               __builtin_cpu_supports("sse2") ? IDCT_TYPE_SSE2 : IDCT_TYPE_INTEGER;
+    }
+    #else
+    if(type == IDCT_TYPE_AUTO) {
+        type = IDCT_TYPE_INTEGER;
+    }
+    #endif
+
+    switch(type) {
+    case IDCT_TYPE_REFERENCE:
+        mmf_dct_funcs.idct_put = mmf_idct_put;
+        mmf_dct_funcs.idct_put_x2 = mmf_idct_put_x2;
+        mmf_dct_funcs.idct_put_4x4 = mmf_idct_put;
+        mmf_dct_funcs.idct_add = mmf_idct_add;
+        mmf_dct_funcs.idct_add_x2 = mmf_idct_add_x2;
+        mmf_dct_funcs.idct_add_4x4 = mmf_idct_add;
+        mmf_dct_funcs.idct_dc = mmf_idct_dc;
+        break;
+    case IDCT_TYPE_INTEGER:
+        mmf_dct_funcs.idct_put = mmf_idct_int_put;
+        mmf_dct_funcs.idct_put_x2 = mmf_idct_int_put_x2;
+        mmf_dct_funcs.idct_put_4x4 = mmf_idct_int_put_4x4;
+        mmf_dct_funcs.idct_add = mmf_idct_int_add;
+        mmf_dct_funcs.idct_add_x2 = mmf_idct_int_add_x2;
+        mmf_dct_funcs.idct_add_4x4 = mmf_idct_int_add_4x4;
+        mmf_dct_funcs.idct_dc = mmf_idct_int_dc;
+        break;
+    #ifdef MMF_DCT_X86
+    case IDCT_TYPE_SSE2:
+        if(!__builtin_cpu_supports("sse2")) return RC_NOTIMPLEMENTED;
+
+        mmf_dct_funcs.idct_put = mmf_idct_sse2_put;
+        mmf_dct_funcs.idct_put_x2 = mmf_idct_sse2_put_x2;
+        mmf_dct_funcs.idct_put_4x4 = mmf_idct_sse2_put_4x4;
+        mmf_dct_funcs.idct_add = mmf_idct_sse2_add;
+        mmf_dct_funcs.idct_add_x2 = mmf_idct_sse2_add_x2;
+        mmf_dct_funcs.idct_add_4x4 = mmf_idct_sse2_add_4x4;
+        mmf_dct_funcs.idct_dc = mmf_idct_int_dc;
+        break;
+    case IDCT_TYPE_AVX2:
+        if(!__builtin_cpu_supports("avx2")) return RC_NOTIMPLEMENTED;
+
+        /* Single blocks fill only half of an AVX2 register, so use SSE2 for them */
+        mmf_dct_funcs.idct_put = mmf_idct_sse2_put;
+        mmf_dct_funcs.idct_put_x2 = mmf_idct_avx2_put_x2;
+        mmf_dct_funcs.idct_put_4x4 = mmf_idct_sse2_put_4x4;
+        mmf_dct_funcs.idct_add = mmf_idct_sse2_add;
+        mmf_dct_funcs.idct_add_x2 = mmf_idct_avx2_add_x2;
+        mmf_dct_funcs.idct_add_4x4 = mmf_idct_sse2_add_4x4;
+        mmf_dct_funcs.idct_dc = mmf_idct_int_dc;
+        break;
+    #else
+    case IDCT_TYPE_SSE2:
+    case IDCT_TYPE_AVX2:
+        return RC_NOTIMPLEMENTED;
+    #endif
+    default:
+        return RC_INVALIDARG;
+    }
+
+    return RC_OK;
+}
+
+/* Horizontal 1-D iDCT over a row of 8 coefficients. The output is scaled up
+ * by 8 (3 fraction bits), which are kept for the vertical pass.
+ */
+static inline void mmf_idct_int_row(int16_t *blk)
+{
+    int32_t x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    /* Shortcut for rows with DC coefficient only */
+    if (!((x1 = blk[4] * 2048) | (x2 = blk[6]) | (x3 = blk[2]) |
+          (x4 = blk[1]) | (x5 = blk[7]) | (x6 = blk[5]) | (x7 = blk[3]))) {
+        blk[0] = blk[1] = blk[2] = blk[3] = blk[4] = blk[5] = blk[6] = blk[7] = blk[0] * 8;
+        return;
+    }
+
+    x0 = (blk[0] * 2048) + 128; //for proper rounding in the fourth stage
+
+    /* First stage */
+    x8 = IDCT_W7 * (x4 + x5);
+    x4 = x8 + (IDCT_W1 - IDCT_W7) * x4;
+    x5 = x8 - (IDCT_W1 + IDCT_W7) * x5;
+    x8 = IDCT_W3 * (x6 + x7);
+    x6 = x8 - (IDCT_W3 - IDCT_W5) * x6;
+    x7 = x8 - (IDCT_W3 + IDCT_W5) * x7;
+
+    /* Second stage */
+    x8 = x0 + x1;
+    x0 -= x1;
+    x1 = IDCT_W6 * (x3 + x2);
+    x2 = x1 - (IDCT_W2 + IDCT_W6) * x2;
+    x3 = x1 + (IDCT_W2 - IDCT_W6) * x3;
+    x1 = x4 + x6;
+    x4 -= x6;
+    x6 = x5 + x7;
+    x5 -= x7;
+
+    /* Third stage */
+    x7 = x8 + x3;
+    x8 -= x3;
+    x3 = x0 + x2;
+    x0 -= x2;
+    x2 = mmf_idct_mul181(x4 + x5);
+    x4 = mmf_idct_mul181(x4 - x5);
+
+    /* Fourth stage */
+    blk[0] = mmf_clamp_s16((x7 + x1) >> 8);
+    blk[1] = mmf_clamp_s16((x3 + x2) >> 8);
+    blk[2] = mmf_clamp_s16((x0 + x4) >> 8);
+    blk[3] = mmf_clamp_s16((x8 + x6) >> 8);
+    blk[4] = mmf_clamp_s16((x8 - x6) >> 8);
+    blk[5] = mmf_clamp_s16((x0 - x4) >> 8);
+    blk[6] = mmf_clamp_s16((x3 - x2) >> 8);
+    blk[7] = mmf_clamp_s16((x7 - x1) >> 8);
+}
+
+/* Vertical 1-D iDCT over a column of 8 coefficients. It removes the fraction
+ * bits of the horizontal pass and adds the +128 level shift. The result goes
+ * to "out", so the caller can either store it back or clamp it to pixels.
+ */
+static inline void mmf_idct_int_col(const int16_t *blk, int32_t *out)
+{
+    int32_t x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    /* Shortcut for columns with DC coefficient only */
+    if (!((x1 = (blk[8*4] * 256)) | (x2 = blk[8*6]) | (x3 = blk[8*2]) |
+          (x4 = blk[8*1]) | (x5 = blk[8*7]) | (x6 = blk[8*5]) | (x7 = blk[8*3]))) {
+        out[0] = out[1] = out[2] = out[3] = out[4] = out[5] = out[6] = out[7] =
+            ((blk[8*0] + 32) >> 6) + 128;
+        return;
+    }
+
+    /* The level shift is folded in the rounding constant, since x0 contributes to every output */
+    x0 = (blk[8*0] * 256) + 8192 + (128 << 14);
+
+    /* First stage */
+    x8 = IDCT_W7 * (x4 + x5) + 4;
+    x4 = (x8 + (IDCT_W1 - IDCT_W7) * x4) >> 3;
+    x5 = (x8 - (IDCT_W1 + IDCT_W7) * x5) >> 3;
+    x8 = IDCT_W3 * (x6 + x7) + 4;
+    x6 = (x8 - (IDCT_W3 - IDCT_W5) * x6) >> 3;
+    x7 = (x8 - (IDCT_W3 + IDCT_W5) * x7) >> 3;
+
+    /* Second stage */
+    x8 = x0 + x1;
+    x0 -= x1;
+    x1 = IDCT_W6 * (x3 + x2) + 4;
+    x2 = (x1 - (IDCT_W2 + IDCT_W6) * x2) >> 3;
+    x3 = (x1 + (IDCT_W2 - IDCT_W6) * x3) >> 3;
+    x1 = x4 + x6;
+    x4 -= x6;
+    x6 = x5 + x7;
+    x5 -= x7;
+
+    /* Third stage */
+    x7 = x8 + x3;
+    x8 -= x3;
+    x3 = x0 + x2;
+    x0 -= x2;
+    x2 = mmf_idct_mul181(x4 + x5);
+    x4 = mmf_idct_mul181(x4 - x5);
+
+    /* Fourth stage */
+    out[0] = (x7 + x1) >> 14;
+    out[1] = (x3 + x2) >> 14;
+    out[2] = (x0 + x4) >> 14;
+    out[3] = (x8 + x6) >> 14;
+    out[4] = (x8 - x6) >> 14;
+    out[5] = (x0 - x4) >> 14;
+    out[6] = (x3 - x2) >> 14;
+    out[7] = (x7 - x1) >> 14;
+}
+
+/* Fixed-point implementation of inverse discrete cosine transform (Chen-Wang). It does
+ * 8 horizontal and 8 vertical 1-D transforms, instead of the 4096 multiply-adds of mmf_idct().
+ */
+void mmf_idct_int(int16_t *block)
+{
+    int32_t out[8];
+    int i, j;
+
+    for (i = 0; i < 8; i++)
+        mmf_idct_int_row(block + 8 * i);
+
+    for (i = 0; i < 8; i++) {
+        mmf_idct_int_col(block + i, out);
+
+        for (j = 0; j < 8; j++)
+            block[8 * j + i] = out[j];
+    }
+}
+
+/* Same as mmf_idct_int(), but the vertical pass stores its output
+ * directly to the destination pixels, clamped to [0..255].
+ */
+void mmf_idct_int_put(int16_t *block, uint8_t *dst, int32_t stride)
+{
+    int32_t out[8];
+    int i, j;
+
+    for (i = 0; i < 8; i++)
+        mmf_idct_int_row(block + 8 * i);
+
+    for (i = 0; i < 8; i++) {
+        mmf_idct_int_col(block + i, out);
+
+        for (j = 0; j < 8; j++)
+            dst[j * stride + i] = mmf_clamp_u8(out[j]);
+    }
+}
+
+/* Same as mmf_idct_int_put(), but the output (without the level shift) is added
+ * to the destination pixels, which hold the prediction.
+ */
+void mmf_idct_int_add(int16_t *block, uint8_t *dst, int32_t stride)
+{
+    int32_t out[8];
+    int i, j;
+
+    for (i = 0; i < 8; i++)
+        mmf_idct_int_row(block + 8 * i);
+
+    for (i = 0; i < 8; i++) {
+        mmf_idct_int_col(block + i, out);
+
+        for (j = 0; j < 8; j++)
+            dst[j * stride + i] = mmf_clamp_u8(dst[j * stride + i] + out[j] - 128);
+    }
+}
+
+/* Horizontal pass of mmf_idct_int_put_4x4(). Same as mmf_idct_int_row(), with
+ * coefficients 4..7 known to be zero.
+ */
+static inline void mmf_idct_int_row4(int16_t *blk)
+{
+    int32_t x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    if (!((x3 = blk[2]) | (x4 = blk[1]) | (x7 = blk[3]))) {
+        blk[0] = blk[1] = blk[2] = blk[3] = blk[4] = blk[5] = blk[6] = blk[7] = blk[0] * 8;
+        return;
+    }
+
+    x8 = (blk[0] * 2048) + 128;
+    x0 = x8;
+
+    /* First and second stages, with the zero terms dropped */
+    x5 = IDCT_W7 * x4;
+    x4 = IDCT_W1 * x4;
+    x6 = IDCT_W3 * x7;
+    x7 = -IDCT_W5 * x7;
+    x2 = IDCT_W6 * x3;
+    x3 = IDCT_W2 * x3;
+    x1 = x4 + x6;
+    x4 -= x6;
+    x6 = x5 + x7;
+    x5 -= x7;
+
+    /* Third stage */
+    x7 = x8 + x3;
+    x8 -= x3;
+    x3 = x0 + x2;
+    x0 -= x2;
+    x2 = mmf_idct_mul181(x4 + x5);
+    x4 = mmf_idct_mul181(x4 - x5);
+
+    /* Fourth stage */
+    blk[0] = mmf_clamp_s16((x7 + x1) >> 8);
+    blk[1] = mmf_clamp_s16((x3 + x2) >> 8);
+    blk[2] = mmf_clamp_s16((x0 + x4) >> 8);
+    blk[3] = mmf_clamp_s16((x8 + x6) >> 8);
+    blk[4] = mmf_clamp_s16((x8 - x6) >> 8);
+    blk[5] = mmf_clamp_s16((x0 - x4) >> 8);
+    blk[6] = mmf_clamp_s16((x3 - x2) >> 8);
+    blk[7] = mmf_clamp_s16((x7 - x1) >> 8);
+}
+
+/* Vertical pass of mmf_idct_int_put_4x4(). Same as mmf_idct_int_col(), with
+ * rows 4..7 known to be zero.
+ */
+static inline void mmf_idct_int_col4(const int16_t *blk, int32_t *out)
+{
+    int32_t x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    if (!((x3 = blk[8*2]) | (x4 = blk[8*1]) | (x7 = blk[8*3]))) {
+        out[0] = out[1] = out[2] = out[3] = out[4] = out[5] = out[6] = out[7] =
+            ((blk[8*0] + 32) >> 6) + 128;
+        return;
+    }
+
+    x8 = (blk[8*0] * 256) + 8192 + (128 << 14);
+    x0 = x8;
+
+    /* First and second stages, with the zero terms dropped */
+    x5 = (IDCT_W7 * x4 + 4) >> 3;
+    x4 = (IDCT_W1 * x4 + 4) >> 3;
+    x6 = (IDCT_W3 * x7 + 4) >> 3;
+    x7 = (-IDCT_W5 * x7 + 4) >> 3;
+    x2 = (IDCT_W6 * x3 + 4) >> 3;
+    x3 = (IDCT_W2 * x3 + 4) >> 3;
+    x1 = x4 + x6;
+    x4 -= x6;
+    x6 = x5 + x7;
+    x5 -= x7;
+
+    /* Third stage */
+    x7 = x8 + x3;
+    x8 -= x3;
+    x3 = x0 + x2;
+    x0 -= x2;
+    x2 = mmf_idct_mul181(x4 + x5);
+    x4 = mmf_idct_mul181(x4 - x5);
+
+    /* Fourth stage */
+    out[0] = (x7 + x1) >> 14;
+    out[1] = (x3 + x2) >> 14;
+    out[2] = (x0 + x4) >> 14;
+    out[3] = (x8 + x6) >> 14;
+    out[4] = (x8 - x6) >> 14;
+    out[5] = (x0 - x4) >> 14;
+    out[6] = (x3 - x2) >> 14;
+    out[7] = (x7 - x1) >> 14;
+}
+
+/* Reduced mmf_idct_int_put() for blocks with coefficients in the top-left 4x4 quadrant only.
+ * Rows 4..7 stay zero after the horizontal pass, so it does 4 horizontal transforms and
+ * 8 vertical ones on half of the inputs. The output is bit-exact with mmf_idct_int_put().
+ */
+void mmf_idct_int_put_4x4(int16_t *block, uint8_t *dst, int32_t stride)
+{
+    int32_t out[8];
+    int i, j;
+
+    for (i = 0; i < 4; i++)
+        mmf_idct_int_row4(block + 8 * i);
+
+    for (i = 0; i < 8; i++) {
+        mmf_idct_int_col4(block + i, out);
+
+        for (j = 0; j < 8; j++)
+            dst[j * stride + i] = mmf_clamp_u8(out[j]);
+    }
+}
+
+void mmf_idct_int_add_4x4(int16_t *block, uint8_t *dst, int32_t stride)
+{
+    int32_t out[8];
+    int i, j;
+
+    for (i = 0; i < 4; i++)
+        mmf_idct_int_row4(block + 8 * i);
+
+    for (i = 0; i < 8; i++) {
+        mmf_idct_int_col4(block + i, out);
+
+        for (j = 0; j < 8; j++)
+            dst[j * stride + i] = mmf_clamp_u8(dst[j * stride + i] + out[j] - 128);
+    }
+}
+
+/* mmf_idct_int() of a DC-only block. The row and column shortcuts
+ * reduce to ((dc << 3) + 32) >> 6, plus the level shift.
+ */
+int32_t mmf_idct_int_dc(int32_t dc)
+{
+    return ((dc + 4) >> 3) + 128;
+}
+
+#ifdef MMF_DCT_X86
+/*
+ * SIMD versions of mmf_idct_int(). They give bit-exact results with it. Since the
+ * fixed-point math needs 32-bit precision, each butterfly rotation is done with
+ * pmaddwd over interleaved pairs of coefficients, e.g. W1*x1 + W7*x7 for (x1, x7).
+ * The 1-D transform runs vertically over 8 rows at once, so the block is transposed
+ * before the horizontal pass and back after it.
+ */
+
+/* Pair of constants, to be multiplied with interleaved (a, b) coefficients by pmaddwd */
+#define IDCT_PAIR_SSE2(c0, c1) _mm_set_epi16(c1, c0, c1, c0, c1, c0, c1, c0)
+#define IDCT_PAIR_AVX2(c0, c1) _mm256_set_epi16(c1, c0, c1, c0, c1, c0, c1, c0, c1, c0, c1, c0, c1, c0, c1, c0)
+
+__attribute__((target("sse2")))
+static inline void mmf_idct_sse2_transpose(__m128i *v)
+{
+    __m128i a0 = _mm_unpacklo_epi16(v[0], v[1]);
+    __m128i a1 = _mm_unpackhi_epi16(v[0], v[1]);
+    __m128i a2 = _mm_unpacklo_epi16(v[2], v[3]);
+    __m128i a3 = _mm_unpackhi_epi16(v[2], v[3]);
+    __m128i a4 = _mm_unpacklo_epi16(v[4], v[5]);
+    __m128i a5 = _mm_unpackhi_epi16(v[4], v[5]);
+    __m128i a6 = _mm_unpacklo_epi16(v[6], v[7]);
+    __m128i a7 = _mm_unpackhi_epi16(v[6], v[7]);
+
+    __m128i b0 = _mm_unpacklo_epi32(a0, a2);
+    __m128i b1 = _mm_unpackhi_epi32(a0, a2);
+    __m128i b2 = _mm_unpacklo_epi32(a1, a3);
+    __m128i b3 = _mm_unpackhi_epi32(a1, a3);
+    __m128i b4 = _mm_unpacklo_epi32(a4, a6);
+    __m128i b5 = _mm_unpackhi_epi32(a4, a6);
+    __m128i b6 = _mm_unpacklo_epi32(a5, a7);
+    __m128i b7 = _mm_unpackhi_epi32(a5, a7);
+
+    v[0] = _mm_unpacklo_epi64(b0, b4);
+    v[1] = _mm_unpackhi_epi64(b0, b4);
+    v[2] = _mm_unpacklo_epi64(b1, b5);
+    v[3] = _mm_unpackhi_epi64(b1, b5);
+    v[4] = _mm_unpacklo_epi64(b2, b6);
+    v[5] = _mm_unpackhi_epi64(b2, b6);
+    v[6] = _mm_unpacklo_epi64(b3, b7);
+    v[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+/* 181 * x, with shifts and adds (SSE2 has no 32-bit multiply) */
+__attribute__((target("sse2")))
+static inline __m128i mmf_idct_sse2_mul181(__m128i x)
+{
+    return _mm_add_epi32(_mm_add_epi32(_mm_slli_epi32(x, 7), _mm_slli_epi32(x, 5)),
+                         _mm_add_epi32(_mm_add_epi32(_mm_slli_epi32(x, 4), _mm_slli_epi32(x, 2)), x));
+}
+
+/* 1-D transform over 4 lanes, given interleaved coefficient pairs. "col" selects between
+ * the horizontal (first) and vertical (second) pass, which differ in scaling and rounding.
+ */
+__attribute__((target("sse2")))
+static inline void mmf_idct_sse2_1d_half(__m128i p04, __m128i p17, __m128i p53, __m128i p26, __m128i *out, const int col)
+{
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    if(!col) {
+        const __m128i rnd = _mm_set1_epi32(128);
+
+        x8 = _mm_add_epi32(_mm_madd_epi16(p04, IDCT_PAIR_SSE2(2048, 2048)), rnd);
+        x0 = _mm_add_epi32(_mm_madd_epi16(p04, IDCT_PAIR_SSE2(2048, -2048)), rnd);
+        x4 = _mm_madd_epi16(p17, IDCT_PAIR_SSE2(IDCT_W1, IDCT_W7));
+        x5 = _mm_madd_epi16(p17, IDCT_PAIR_SSE2(IDCT_W7, -IDCT_W1));
+        x6 = _mm_madd_epi16(p53, IDCT_PAIR_SSE2(IDCT_W5, IDCT_W3));
+        x7 = _mm_madd_epi16(p53, IDCT_PAIR_SSE2(IDCT_W3, -IDCT_W5));
+        x2 = _mm_madd_epi16(p26, IDCT_PAIR_SSE2(IDCT_W6, -IDCT_W2));
+        x3 = _mm_madd_epi16(p26, IDCT_PAIR_SSE2(IDCT_W2, IDCT_W6));
+    } else {
+        const __m128i rnd = _mm_set1_epi32(8192 + (128 << 14));
+        const __m128i four = _mm_set1_epi32(4);
+
+        x8 = _mm_add_epi32(_mm_madd_epi16(p04, IDCT_PAIR_SSE2(256, 256)), rnd);
+        x0 = _mm_add_epi32(_mm_madd_epi16(p04, IDCT_PAIR_SSE2(256, -256)), rnd);
+        x4 = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(p17, IDCT_PAIR_SSE2(IDCT_W1, IDCT_W7)), four), 3);
+        x5 = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(p17, IDCT_PAIR_SSE2(IDCT_W7, -IDCT_W1)), four), 3);
+        x6 = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(p53, IDCT_PAIR_SSE2(IDCT_W5, IDCT_W3)), four), 3);
+        x7 = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(p53, IDCT_PAIR_SSE2(IDCT_W3, -IDCT_W5)), four), 3);
+        x2 = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(p26, IDCT_PAIR_SSE2(IDCT_W6, -IDCT_W2)), four), 3);
+        x3 = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(p26, IDCT_PAIR_SSE2(IDCT_W2, IDCT_W6)), four), 3);
+    }
+
+    /* Second stage */
+    x1 = _mm_add_epi32(x4, x6);
+    x4 = _mm_sub_epi32(x4, x6);
+    x6 = _mm_add_epi32(x5, x7);
+    x5 = _mm_sub_epi32(x5, x7);
+
+    /* Third stage */
+    x7 = _mm_add_epi32(x8, x3);
+    x8 = _mm_sub_epi32(x8, x3);
+    x3 = _mm_add_epi32(x0, x2);
+    x0 = _mm_sub_epi32(x0, x2);
+    x2 = _mm_srai_epi32(_mm_add_epi32(mmf_idct_sse2_mul181(_mm_add_epi32(x4, x5)), _mm_set1_epi32(128)), 8);
+    x4 = _mm_srai_epi32(_mm_add_epi32(mmf_idct_sse2_mul181(_mm_sub_epi32(x4, x5)), _mm_set1_epi32(128)), 8);
+
+    /* Fourth stage */
+    const int shift = col ? 14 : 8;
+
+    out[0] = _mm_srai_epi32(_mm_add_epi32(x7, x1), shift);
+    out[1] = _mm_srai_epi32(_mm_add_epi32(x3, x2), shift);
+    out[2] = _mm_srai_epi32(_mm_add_epi32(x0, x4), shift);
+    out[3] = _mm_srai_epi32(_mm_add_epi32(x8, x6), shift);
+    out[4] = _mm_srai_epi32(_mm_sub_epi32(x8, x6), shift);
+    out[5] = _mm_srai_epi32(_mm_sub_epi32(x0, x4), shift);
+    out[6] = _mm_srai_epi32(_mm_sub_epi32(x3, x2), shift);
+    out[7] = _mm_srai_epi32(_mm_sub_epi32(x7, x1), shift);
+}
+
+/* 1-D transform over 8 lanes. v[k] holds the k-th coefficient of each lane.
+ */
+__attribute__((target("sse2")))
+static inline void mmf_idct_sse2_1d(__m128i *v, const int col)
+{
+    __m128i lo[8], hi[8];
+    int i;
+
+    mmf_idct_sse2_1d_half(_mm_unpacklo_epi16(v[0], v[4]), _mm_unpacklo_epi16(v[1], v[7]),
+                          _mm_unpacklo_epi16(v[5], v[3]), _mm_unpacklo_epi16(v[2], v[6]), lo, col);
+    mmf_idct_sse2_1d_half(_mm_unpackhi_epi16(v[0], v[4]), _mm_unpackhi_epi16(v[1], v[7]),
+                          _mm_unpackhi_epi16(v[5], v[3]), _mm_unpackhi_epi16(v[2], v[6]), hi, col);
+
+    for(i = 0; i < 8; i++) {
+        v[i] = _mm_packs_epi32(lo[i], hi[i]);
+    }
+}
+
+/* Packs 8 rows of iDCT output to unsigned bytes (which clamps them to [0..255]), and stores them */
+__attribute__((target("sse2")))
+static inline void mmf_idct_sse2_store_clamped(const __m128i *v, uint8_t *dst, int32_t stride)
+{
+    int i;
+
+    for(i = 0; i < 8; i += 2) {
+        __m128i p = _mm_packus_epi16(v[i], v[i + 1]);
+
+        _mm_storel_epi64((__m128i*)(dst + i * stride), p);
+        _mm_storel_epi64((__m128i*)(dst + (i + 1) * stride), _mm_srli_si128(p, 8));
+    }
+}
+
+/* Removes the level shift from 8 rows of iDCT output, adds them to the prediction
+ * in the destination, and stores the clamped sums.
+ */
+__attribute__((target("sse2")))
+static inline void mmf_idct_sse2_store_added(const __m128i *v, uint8_t *dst, int32_t stride)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i shift = _mm_set1_epi16(128);
+    int i;
+
+    for(i = 0; i < 8; i += 2) {
+        __m128i d0 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(dst + i * stride)), zero);
+        __m128i d1 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(dst + (i + 1) * stride)), zero);
+        __m128i p = _mm_packus_epi16(_mm_add_epi16(d0, _mm_sub_epi16(v[i], shift)),
+                                     _mm_add_epi16(d1, _mm_sub_epi16(v[i + 1], shift)));
+
+        _mm_storel_epi64((__m128i*)(dst + i * stride), p);
+        _mm_storel_epi64((__m128i*)(dst + (i + 1) * stride), _mm_srli_si128(p, 8));
+    }
+}
+
+__attribute__((target("sse2")))
+static inline void mmf_idct_sse2_transform(__m128i *v, const int16_t *block)
+{
+    int i;
+
+    for(i = 0; i < 8; i++) {
+        v[i] = _mm_loadu_si128((const __m128i*)(block + 8 * i));
+    }
+
+    /* Horizontal pass on the transposed block, then vertical pass */
+    mmf_idct_sse2_transpose(v);
+    mmf_idct_sse2_1d(v, 0);
+    mmf_idct_sse2_transpose(v);
+    mmf_idct_sse2_1d(v, 1);
+}
+
+__attribute__((target("sse2")))
+void mmf_idct_sse2(int16_t *block)
+{
+    __m128i v[8];
+    int i;
+
+    mmf_idct_sse2_transform(v, block);
+
+    for(i = 0; i < 8; i++) {
+        _mm_storeu_si128((__m128i*)(block + 8 * i), v[i]);
+    }
+}
+
+__attribute__((target("sse2")))
+void mmf_idct_sse2_put(int16_t *block, uint8_t *dst, int32_t stride)
+{
+    __m128i v[8];
+
+    mmf_idct_sse2_transform(v, block);
+    mmf_idct_sse2_store_clamped(v, dst, stride);
+}
+
+__attribute__((target("sse2")))
+void mmf_idct_sse2_add(int16_t *block, uint8_t *dst, int32_t stride)
+{
+    __m128i v[8];
+
+    mmf_idct_sse2_transform(v, block);
+    mmf_idct_sse2_store_added(v, dst, stride);
+}
+
+/* Reduced mmf_idct_sse2_transform() for blocks with coefficients in the top-left 4x4 quadrant only.
+ * After the transpose, the horizontal pass has non-zero input in the low 4 lanes only.
+ */
+__attribute__((target("sse2")))
+static inline void mmf_idct_sse2_transform_4x4(__m128i *v, const int16_t *block)
+{
+    __m128i lo[8];
+    const __m128i zero = _mm_setzero_si128();
+    int i;
+
+    for(i = 0; i < 4; i++) {
+        v[i] = _mm_loadl_epi64((const __m128i*)(block + 8 * i));
+        v[i + 4] = zero;
+    }
+
+    mmf_idct_sse2_transpose(v);
+    mmf_idct_sse2_1d_half(_mm_unpacklo_epi16(v[0], zero), _mm_unpacklo_epi16(v[1], zero),
+                          _mm_unpacklo_epi16(zero, v[3]), _mm_unpacklo_epi16(v[2], zero), lo, 0);
+
+    for(i = 0; i < 8; i++) {
+        v[i] = _mm_packs_epi32(lo[i], zero);
+    }
+
+    mmf_idct_sse2_transpose(v);
+    mmf_idct_sse2_1d(v, 1);
+}
+
+__attribute__((target("sse2")))
+void mmf_idct_sse2_put_4x4(int16_t *block, uint8_t *dst, int32_t stride)
+{
+    __m128i v[8];
+
+    mmf_idct_sse2_transform_4x4(v, block);
+    mmf_idct_sse2_store_clamped(v, dst, stride);
+}
+
+__attribute__((target("sse2")))
+void mmf_idct_sse2_add_4x4(int16_t *block, uint8_t *dst, int32_t stride)
+{
+    __m128i v[8];
+
+    mmf_idct_sse2_transform_4x4(v, block);
+    mmf_idct_sse2_store_added(v, dst, stride);
+}
+
+/*
+ * AVX2 version. Each 256-bit register holds the same row of two blocks (one per 128-bit lane).
+ * All the instructions used operate within lanes, so it is the SSE2 version doing two blocks at once.
+ */
+__attribute__((target("avx2")))
+static inline void mmf_idct_avx2_transpose(__m256i *v)
+{
+    __m256i a0 = _mm256_unpacklo_epi16(v[0], v[1]);
+    __m256i a1 = _mm256_unpackhi_epi16(v[0], v[1]);
+    __m256i a2 = _mm256_unpacklo_epi16(v[2], v[3]);
+    __m256i a3 = _mm256_unpackhi_epi16(v[2], v[3]);
+    __m256i a4 = _mm256_unpacklo_epi16(v[4], v[5]);
+    __m256i a5 = _mm256_unpackhi_epi16(v[4], v[5]);
+    __m256i a6 = _mm256_unpacklo_epi16(v[6], v[7]);
+    __m256i a7 = _mm256_unpackhi_epi16(v[6], v[7]);
+
+    __m256i b0 = _mm256_unpacklo_epi32(a0, a2);
+    __m256i b1 = _mm256_unpackhi_epi32(a0, a2);
+    __m256i b2 = _mm256_unpacklo_epi32(a1, a3);
+    __m256i b3 = _mm256_unpackhi_epi32(a1, a3);
+    __m256i b4 = _mm256_unpacklo_epi32(a4, a6);
+    __m256i b5 = _mm256_unpackhi_epi32(a4, a6);
+    __m256i b6 = _mm256_unpacklo_epi32(a5, a7);
+    __m256i b7 = _mm256_unpackhi_epi32(a5, a7);
+
+    v[0] = _mm256_unpacklo_epi64(b0, b4);
+    v[1] = _mm256_unpackhi_epi64(b0, b4);
+    v[2] = _mm256_unpacklo_epi64(b1, b5);
+    v[3] = _mm256_unpackhi_epi64(b1, b5);
+    v[4] = _mm256_unpacklo_epi64(b2, b6);
+    v[5] = _mm256_unpackhi_epi64(b2, b6);
+    v[6] = _mm256_unpacklo_epi64(b3, b7);
+    v[7] = _mm256_unpackhi_epi64(b3, b7);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i mmf_idct_avx2_mul181(__m256i x)
+{
+    return _mm256_mullo_epi32(x, _mm256_set1_epi32(181));
+}
+
+__attribute__((target("avx2")))
+static inline void mmf_idct_avx2_1d_half(__m256i p04, __m256i p17, __m256i p53, __m256i p26, __m256i *out, const int col)
+{
+    __m256i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    if(!col) {
+        const __m256i rnd = _mm256_set1_epi32(128);
+
+        x8 = _mm256_add_epi32(_mm256_madd_epi16(p04, IDCT_PAIR_AVX2(2048, 2048)), rnd);
+        x0 = _mm256_add_epi32(_mm256_madd_epi16(p04, IDCT_PAIR_AVX2(2048, -2048)), rnd);
+        x4 = _mm256_madd_epi16(p17, IDCT_PAIR_AVX2(IDCT_W1, IDCT_W7));
+        x5 = _mm256_madd_epi16(p17, IDCT_PAIR_AVX2(IDCT_W7, -IDCT_W1));
+        x6 = _mm256_madd_epi16(p53, IDCT_PAIR_AVX2(IDCT_W5, IDCT_W3));
+        x7 = _mm256_madd_epi16(p53, IDCT_PAIR_AVX2(IDCT_W3, -IDCT_W5));
+        x2 = _mm256_madd_epi16(p26, IDCT_PAIR_AVX2(IDCT_W6, -IDCT_W2));
+        x3 = _mm256_madd_epi16(p26, IDCT_PAIR_AVX2(IDCT_W2, IDCT_W6));
+    } else {
+        const __m256i rnd = _mm256_set1_epi32(8192 + (128 << 14));
+        const __m256i four = _mm256_set1_epi32(4);
+
+        x8 = _mm256_add_epi32(_mm256_madd_epi16(p04, IDCT_PAIR_AVX2(256, 256)), rnd);
+        x0 = _mm256_add_epi32(_mm256_madd_epi16(p04, IDCT_PAIR_AVX2(256, -256)), rnd);
+        x4 = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(p17, IDCT_PAIR_AVX2(IDCT_W1, IDCT_W7)), four), 3);
+        x5 = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(p17, IDCT_PAIR_AVX2(IDCT_W7, -IDCT_W1)), four), 3);
+        x6 = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(p53, IDCT_PAIR_AVX2(IDCT_W5, IDCT_W3)), four), 3);
+        x7 = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(p53, IDCT_PAIR_AVX2(IDCT_W3, -IDCT_W5)), four), 3);
+        x2 = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(p26, IDCT_PAIR_AVX2(IDCT_W6, -IDCT_W2)), four), 3);
+        x3 = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(p26, IDCT_PAIR_AVX2(IDCT_W2, IDCT_W6)), four), 3);
+    }
+
+    /* Second stage */
+    x1 = _mm256_add_epi32(x4, x6);
+    x4 = _mm256_sub_epi32(x4, x6);
+    x6 = _mm256_add_epi32(x5, x7);
+    x5 = _mm256_sub_epi32(x5, x7);
+
+    /* Third stage */
+    x7 = _mm256_add_epi32(x8, x3);
+    x8 = _mm256_sub_epi32(x8, x3);
+    x3 = _mm256_add_epi32(x0, x2);
+    x0 = _mm256_sub_epi32(x0, x2);
+    x2 = _mm256_srai_epi32(_mm256_add_epi32(mmf_idct_avx2_mul181(_mm256_add_epi32(x4, x5)), _mm256_set1_epi32(128)), 8);
+    x4 = _mm256_srai_epi32(_mm256_add_epi32(mmf_idct_avx2_mul181(_mm256_sub_epi32(x4, x5)), _mm256_set1_epi32(128)), 8);
+
+    /* Fourth stage */
+    const int shift = col ? 14 : 8;
+
+    out[0] = _mm256_srai_epi32(_mm256_add_epi32(x7, x1), shift);
+    out[1] = _mm256_srai_epi32(_mm256_add_epi32(x3, x2), shift);
+    out[2] = _mm256_srai_epi32(_mm256_add_epi32(x0, x4), shift);
+    out[3] = _mm256_srai_epi32(_mm256_add_epi32(x8, x6), shift);
+    out[4] = _mm256_srai_epi32(_mm256_sub_epi32(x8, x6), shift);
+    out[5] = _mm256_srai_epi32(_mm256_sub_epi32(x0, x4), shift);
+    out[6] = _mm256_srai_epi32(_mm256_sub_epi32(x3, x2), shift);
+    out[7] = _mm256_srai_epi32(_mm256_sub_epi32(x7, x1), shift);
+}
+
+__attribute__((target("avx2")))
+static inline void mmf_idct_avx2_1d(__m256i *v, const int col)
+{
+    __m256i lo[8], hi[8];
+    int i;
+
+    mmf_idct_avx2_1d_half(_mm256_unpacklo_epi16(v[0], v[4]), _mm256_unpacklo_epi16(v[1], v[7]),
+                          _mm256_unpacklo_epi16(v[5], v[3]), _mm256_unpacklo_epi16(v[2], v[6]), lo, col);
+    mmf_idct_avx2_1d_half(_mm256_unpackhi_epi16(v[0], v[4]), _mm256_unpackhi_epi16(v[1], v[7]),
+                          _mm256_unpackhi_epi16(v[5], v[3]), _mm256_unpackhi_epi16(v[2], v[6]), hi, col);
+
+    for(i = 0; i < 8; i++) {
+        v[i] = _mm256_packs_epi32(lo[i], hi[i]);
+    }
+}
+
+__attribute__((target("avx2")))
+static inline void mmf_idct_avx2_transform_x2(__m256i *v, const int16_t *blocks)
+{
+    int i;
+
+    /* Row i of the first block goes to the low lane, row i of the second one to the high lane */
+    for(i = 0; i < 8; i++) {
+        v[i] = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(blocks + 8 * i))),
+                                       _mm_loadu_si128((const __m128i*)(blocks + 64 + 8 * i)), 1);
+    }
+
+    mmf_idct_avx2_transpose(v);
+    mmf_idct_avx2_1d(v, 0);
+    mmf_idct_avx2_transpose(v);
+    mmf_idct_avx2_1d(v, 1);
+}
+
+__attribute__((target("avx2")))
+void mmf_idct_avx2_put_x2(int16_t *blocks, uint8_t *dst0, int32_t stride0, uint8_t *dst1, int32_t stride1)
+{
+    __m256i v[8];
+    int i;
+
+    mmf_idct_avx2_transform_x2(v, blocks);
+
+    /* Pack two rows at a time to bytes. The low lane gets the rows of the first block */
+    for(i = 0; i < 8; i += 2) {
+        __m256i p = _mm256_packus_epi16(v[i], v[i + 1]);
+        __m128i p0 = _mm256_castsi256_si128(p);
+        __m128i p1 = _mm256_extracti128_si256(p, 1);
+
+        _mm_storel_epi64((__m128i*)(dst0 + i * stride0), p0);
+        _mm_storel_epi64((__m128i*)(dst0 + (i + 1) * stride0), _mm_srli_si128(p0, 8));
+        _mm_storel_epi64((__m128i*)(dst1 + i * stride1), p1);
+        _mm_storel_epi64((__m128i*)(dst1 + (i + 1) * stride1), _mm_srli_si128(p1, 8));
+    }
+}
+
+__attribute__((target("avx2")))
+void mmf_idct_avx2_add_x2(int16_t *blocks, uint8_t *dst0, int32_t stride0, uint8_t *dst1, int32_t stride1)
+{
+    const __m256i shift = _mm256_set1_epi16(128);
+    __m256i v[8];
+    int i;
+
+    mmf_idct_avx2_transform_x2(v, blocks);
+
+    /* Row i of the prediction of the first block goes to the low lane, same as the iDCT output */
+    for(i = 0; i < 8; i++) {
+        __m256i d = _mm256_cvtepu8_epi16(_mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(dst0 + i * stride0)),
+                                                            _mm_loadl_epi64((const __m128i*)(dst1 + i * stride1))));
+
+        v[i] = _mm256_add_epi16(d, _mm256_sub_epi16(v[i], shift));
+    }
+
+    for(i = 0; i < 8; i += 2) {
+        __m256i p = _mm256_packus_epi16(v[i], v[i + 1]);
+        __m128i p0 = _mm256_castsi256_si128(p);
+        __m128i p1 = _mm256_extracti128_si256(p, 1);
+
+        _mm_storel_epi64((__m128i*)(dst0 + i * stride0), p0);
+        _mm_storel_epi64((__m128i*)(dst0 + (i + 1) * stride0), _mm_srli_si128(p0, 8));
+        _mm_storel_epi64((__m128i*)(dst1 + i * stride1), p1);
+        _mm_storel_epi64((__m128i*)(dst1 + (i + 1) * stride1), _mm_srli_si128(p1, 8));
+    }
+}
+#endif // MMF_DCT_X86
+
+/* mmf_idct() of a DC-only block
+ */
+int32_t mmf_idct_dc(int32_t dc)
+{
+    return (int32_t)(dc * 0.125 + 128);
 }
 
 /* Naive implementation of inverse discrete cosine transform, a.k.a. DCT type-III
@@ -74,3 +1033,90 @@ void mmf_dct(int16_t *block)
 
     memcpy(block, buf, 128);
 }
+
+/* 4-point iDCT of the reduced transform, with butterflies. The coefficient table is symmetric:
+ * rows 0 and 3, and rows 1 and 2, have the same even terms, and opposite odd terms.
+ */
+static inline void mmf_idct_scaled_4(const int32_t (*k)[4], int32_t x0, int32_t x1, int32_t x2, int32_t x3,
+                                     int32_t *dst, int32_t step, int32_t shift)
+{
+    int32_t round = 1 << (shift - 1);
+    int32_t e0 = k[0][0] * x0 + k[0][2] * x2;
+    int32_t e1 = k[0][0] * x0 - k[0][2] * x2;
+    int32_t o0 = k[0][1] * x1 + k[0][3] * x3;
+    int32_t o1 = k[1][1] * x1 + k[1][3] * x3;
+
+    dst[0]        = (e0 + o0 + round) >> shift;
+    dst[step]     = (e1 + o1 + round) >> shift;
+    dst[2 * step] = (e1 - o1 + round) >> shift;
+    dst[3 * step] = (e0 - o0 + round) >> shift;
+}
+
+/* 2-point iDCT of the reduced transform: the sum and the difference of the two terms */
+static inline void mmf_idct_scaled_2(const int32_t (*k)[4], int32_t x0, int32_t x1, int32_t *dst, int32_t step, int32_t shift)
+{
+    int32_t round = 1 << (shift - 1);
+    int32_t e = k[0][0] * x0;
+    int32_t o = k[0][1] * x1;
+
+    dst[0]    = (e + o + round) >> shift;
+    dst[step] = (e - o + round) >> shift;
+}
+
+/* Reduced-size iDCT of the low-frequency (8 >> scale) x (8 >> scale) coefficients, without
+ * the level shift. The rows are transformed first, and kept with 6 fraction bits.
+ */
+static void mmf_idct_scaled(const int16_t *block, int32_t *out, int32_t scale)
+{
+    const int32_t (*k)[4];
+    int32_t tmp[16];
+    int i;
+
+    if (scale == 3) {
+        /* Only the DC is left, same as mmf_idct_int_dc() */
+        out[0] = (block[0] + 4) >> 3;
+        return;
+    }
+
+    k = __idct_scaled[scale - 1];
+
+    if (scale == 1) {
+        for (i = 0; i < 4; i++)
+            mmf_idct_scaled_4(k, block[i * 8], block[i * 8 + 1], block[i * 8 + 2], block[i * 8 + 3], tmp + i * 4, 1, 5);
+
+        for (i = 0; i < 4; i++)
+            mmf_idct_scaled_4(k, tmp[i], tmp[4 + i], tmp[8 + i], tmp[12 + i], out + i, 4, 17);
+    } else {
+        for (i = 0; i < 2; i++)
+            mmf_idct_scaled_2(k, block[i * 8], block[i * 8 + 1], tmp + i * 2, 1, 5);
+
+        for (i = 0; i < 2; i++)
+            mmf_idct_scaled_2(k, tmp[i], tmp[2 + i], out + i, 2, 17);
+    }
+}
+
+void mmf_idct_scaled_put(int16_t *block, uint8_t *dst, int32_t stride, int32_t scale)
+{
+    int32_t out[16];
+    int32_t n = 8 >> scale;
+    int i, j;
+
+    mmf_idct_scaled(block, out, scale);
+
+    for (j = 0; j < n; j++, dst += stride)
+        for (i = 0; i < n; i++)
+            dst[i] = mmf_clamp_u8(out[j * n + i] + 128);
+}
+
+void mmf_idct_scaled_add(int16_t *block, uint8_t *dst, int32_t stride, int32_t scale)
+{
+    int32_t out[16];
+    int32_t n = 8 >> scale;
+    int i, j;
+
+    mmf_idct_scaled(block, out, scale);
+
+    for (j = 0; j < n; j++, dst += stride)
+        for (i = 0; i < n; i++)
+            dst[i] = mmf_clamp_u8(dst[i] + out[j * n + i]);
+}
@@ -2,9 +2,122 @@
 #define DCT_H_INCLUDED
 
 #include <stdint.h>
+#include "..\mmfutil.h"
+
+/**
+ * Available iDCT implementations
+ */
+typedef enum MMFIDCTType {
+    IDCT_TYPE_AUTO      = 0x0,  //!< Fastest implementation, supported by the CPU (default)
+    IDCT_TYPE_REFERENCE,        //!< Naive floating point implementation, mmf_idct()
+    IDCT_TYPE_INTEGER,          //!< Separable fixed-point implementation, mmf_idct_int()
+    IDCT_TYPE_SSE2,             //!< SSE2 version of mmf_idct_int()
+    IDCT_TYPE_AVX2,             //!< AVX2 version of mmf_idct_int(), doing two blocks at once
+} MMFIDCTType;
+
+/**
+ * Table of the DCT routines used by the decoder. It is initialized at startup
+ * by mmf_dct_init(), depending on the CPU features (detected via cpuid),
+ * and can be changed with mmf_dct_set_idct().
+ */
+typedef struct MMFDCTFunctions {
+    /**
+     * Inverse DCT of a single 8x8 block. Same as mmf_idct(), the output is level-shifted
+     * by +128, but it is clamped to [0..255] and stored directly to the destination pixels.
+     * The coefficients are used as scratch memory.
+     *
+     * @param block Pointer to 64 coefficients in row-major order.
+     * @param dst Destination of the top-left pixel.
+     * @param stride Distance in bytes between two rows of the destination.
+     */
+    void (*idct_put)(int16_t *block, uint8_t *dst, int32_t stride);
+
+    /**
+     * Same as <i>idct_put</i>, for two consecutive blocks (128 coefficients).
+     * Each block has its own destination and stride.
+     */
+    void (*idct_put_x2)(int16_t *blocks, uint8_t *dst0, int32_t stride0, uint8_t *dst1, int32_t stride1);
+
+    /**
+     * Same as <i>idct_put</i>, for blocks whose non-zero coefficients all lie in the
+     * top-left 4x4 quadrant. It skips the work on the zero coefficients.
+     */
+    void (*idct_put_4x4)(int16_t *block, uint8_t *dst, int32_t stride);
+
+    /**
+     * Same as <i>idct_put</i>, <i>idct_put_x2</i> and <i>idct_put_4x4</i>, but the output is
+     * not level-shifted, and it is added to the destination pixels (the prediction of
+     * non-intra blocks). The sums are clamped to [0..255].
+     */
+    void (*idct_add)(int16_t *block, uint8_t *dst, int32_t stride);
+    void (*idct_add_x2)(int16_t *blocks, uint8_t *dst0, int32_t stride0, uint8_t *dst1, int32_t stride1);
+    void (*idct_add_4x4)(int16_t *block, uint8_t *dst, int32_t stride);
+
+    /**
+     * Inverse DCT of a block which has only DC coefficient. All 64 samples of
+     * such block have the same value, which is returned (level-shifted, not clamped).
+     */
+    int32_t (*idct_dc)(int32_t dc);
+} MMFDCTFunctions;
+
+extern MMFDCTFunctions mmf_dct_funcs;
 
 void mmf_dct_init();
 void mmf_idct(int16_t *dct);
+int32_t mmf_idct_dc(int32_t dc);
 void mmf_dct(int16_t *block);
 
+/**
+ * Fixed-point separable (row/column) inverse DCT, based on the Chen-Wang algorithm.
+ * It is IEEE-1180 compliant, and works in place on a 8x8 block of coefficients.
+ * The output is level-shifted by +128, same as mmf_idct().
+ *
+ * @param block Pointer to 64 coefficients in row-major order.
+ */
+void mmf_idct_int(int16_t *block);
+void mmf_idct_int_put(int16_t *block, uint8_t *dst, int32_t stride);
+void mmf_idct_int_put_x2(int16_t *blocks, uint8_t *dst0, int32_t stride0, uint8_t *dst1, int32_t stride1);
+void mmf_idct_int_put_4x4(int16_t *block, uint8_t *dst, int32_t stride);
+void mmf_idct_int_add(int16_t *block, uint8_t *dst, int32_t stride);
+void mmf_idct_int_add_x2(int16_t *blocks, uint8_t *dst0, int32_t stride0, uint8_t *dst1, int32_t stride1);
+void mmf_idct_int_add_4x4(int16_t *block, uint8_t *dst, int32_t stride);
+int32_t mmf_idct_int_dc(int32_t dc);
+
+/**
+ * Reduced-size inverse DCT, for decoding at a lower resolution. It gives the block, which
+ * the 8x8 output would be downscaled to (each sample is the average of the samples it covers),
+ * computed from the low-frequency coefficients only. The output is clamped to [0..255], and
+ * either stored with the level shift (put), or added to the destination (add).
+ *
+ * @param block Pointer to 64 coefficients in row-major order.
+ * @param dst Destination of the top-left pixel.
+ * @param stride Distance in bytes between two rows of the destination.
+ * @param scale 1 (4x4 output), 2 (2x2 output) or 3 (1x1 output, from the DC only).
+ */
+void mmf_idct_scaled_put(int16_t *block, uint8_t *dst, int32_t stride, int32_t scale);
+void mmf_idct_scaled_add(int16_t *block, uint8_t *dst, int32_t stride, int32_t scale);
+
+#if defined(__i386__) || defined(__x86_64__)
+/**
+ * SIMD versions of mmf_idct_int(), with bit-exact output. Call them only if
+ * the CPU supports the respective instruction set.
+ */
+void mmf_idct_sse2(int16_t *block);
+void mmf_idct_sse2_put(int16_t *block, uint8_t *dst, int32_t stride);
+void mmf_idct_sse2_put_x2(int16_t *blocks, uint8_t *dst0, int32_t stride0, uint8_t *dst1, int32_t stride1);
+void mmf_idct_sse2_put_4x4(int16_t *block, uint8_t *dst, int32_t stride);
+void mmf_idct_avx2_put_x2(int16_t *blocks, uint8_t *dst0, int32_t stride0, uint8_t *dst1, int32_t stride1);
+void mmf_idct_sse2_add(int16_t *block, uint8_t *dst, int32_t stride);
+void mmf_idct_sse2_add_x2(int16_t *blocks, uint8_t *dst0, int32_t stride0, uint8_t *dst1, int32_t stride1);
+void mmf_idct_sse2_add_4x4(int16_t *block, uint8_t *dst, int32_t stride);
+void mmf_idct_avx2_add_x2(int16_t *blocks, uint8_t *dst0, int32_t stride0, uint8_t *dst1, int32_t stride1);
+#endif
+
+/**
+ * Selects the iDCT implementation, used through mmf_dct_funcs.
+ * @param type One of MMFIDCTType values
+ * @return RC_OK on success, RC_NOTIMPLEMENTED if the CPU doesn't support it, RC_INVALIDARG if the type is unknown.
+ */
+MMFRES mmf_dct_set_idct(MMFIDCTType type);
+
 #endif // DCT_H_INCLUDED
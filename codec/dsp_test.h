@@ -0,0 +1,500 @@
+#ifndef DSP_TEST_H_INCLUDED
+#define DSP_TEST_H_INCLUDED
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "dct.h"
+#include "mc.h"
+#include "..\mmfconvert.h"
+#include "..\mmfscale.h"
+
+/* The SIMD implementations are selected through the function tables, like the decoder does,
+ * and compared with the portable C ones on random input. They should be bit-exact.
+ */
+
+/* Random DCT block, with <i>count</i> non-zero coefficients in the top-left <i>size</i> x <i>size</i>
+ * quadrant. The values are in the range of dequantized coefficients, [-2048..2047].
+ */
+void dsp_test_random_block(int16_t *block, int32_t count, int32_t size)
+{
+    int32_t i;
+
+    memset(block, 0, 64 * sizeof(int16_t));
+
+    for(i=0; i<count; i++) {
+        int32_t pos = (rand() % size) * 8 + rand() % size;
+
+        /* Mostly small values, like in real streams, but the extremes too */
+        block[pos] = rand() % 8 ? rand() % 601 - 300 : rand() % 4096 - 2048;
+    }
+}
+
+void dsp_test_random_pixels(uint8_t *p, int32_t size)
+{
+    int32_t i;
+
+    for(i=0; i<size; i++) {
+        p[i] = rand() & 0xFF;
+    }
+}
+
+/* Compares the iDCT routines of each implementation with mmf_idct_int() and its variants.
+ * Returns the number of failed checks.
+ */
+int dsp_test_idct()
+{
+    const MMFIDCTType types[] = { IDCT_TYPE_INTEGER, IDCT_TYPE_SSE2, IDCT_TYPE_AVX2 };
+    const char *names[] = { "integer", "sse2", "avx2" };
+
+    int16_t block[128], ref_block[128];
+    uint8_t dst[2][16 * 32], ref[2][16 * 32];
+    int failures = 0;
+    int32_t t, i, j;
+
+    for(t=0; t<3; t++) {
+        MMFRES rc = mmf_dct_set_idct(types[t]);
+
+        if(rc == RC_NOTIMPLEMENTED) {
+            printf("dsp_test_idct: %s not supported by the CPU, skipped\n", names[t]);
+            continue;
+        }
+
+        srand(1);
+
+        for(i=0; i<2000 && failures < 10; i++) {
+            int32_t count = 1 + rand() % 64;
+            int32_t size = i % 3 == 0 ? 4 : 8;
+            int32_t add = i & 1;
+
+            dsp_test_random_block(block, count, size);
+            dsp_test_random_block(block + 64, count, size);
+            memcpy(ref_block, block, sizeof(block));
+
+            dsp_test_random_pixels(dst[0], sizeof(dst));
+            memcpy(ref, dst, sizeof(dst));
+
+            /* The coefficients are scratch memory, so each routine gets its own copy */
+            if(size == 4) {
+                if(add) {
+                    mmf_dct_funcs.idct_add_4x4(block, dst[0], 32);
+                    mmf_idct_int_add_4x4(ref_block, ref[0], 32);
+                }else {
+                    mmf_dct_funcs.idct_put_4x4(block, dst[0], 32);
+                    mmf_idct_int_put_4x4(ref_block, ref[0], 32);
+                }
+            }else if(i % 3 == 1) {
+                if(add) {
+                    mmf_dct_funcs.idct_add(block, dst[0], 32);
+                    mmf_idct_int_add(ref_block, ref[0], 32);
+                }else {
+                    mmf_dct_funcs.idct_put(block, dst[0], 32);
+                    mmf_idct_int_put(ref_block, ref[0], 32);
+                }
+            }else {
+                if(add) {
+                    mmf_dct_funcs.idct_add_x2(block, dst[0], 32, dst[1] + 8, 16);
+                    mmf_idct_int_add_x2(ref_block, ref[0], 32, ref[1] + 8, 16);
+                }else {
+                    mmf_dct_funcs.idct_put_x2(block, dst[0], 32, dst[1] + 8, 16);
+                    mmf_idct_int_put_x2(ref_block, ref[0], 32, ref[1] + 8, 16);
+                }
+            }
+
+            if(memcmp(dst, ref, sizeof(dst)) != 0) {
+                printf("dsp_test_idct: %s differs from C (block %d, %d coefficients, %s)\n",
+                       names[t], (int)i, (int)count, add ? "add" : "put");
+                failures++;
+            }
+        }
+
+        for(j=-2048; j<2048; j++) {
+            if(mmf_dct_funcs.idct_dc(j) != mmf_idct_int_dc(j)) {
+                printf("dsp_test_idct: %s DC-only iDCT of %d differs from C\n", names[t], (int)j);
+                failures++;
+                break;
+            }
+        }
+    }
+
+    mmf_dct_set_idct(IDCT_TYPE_AUTO);
+
+    printf("dsp_test_idct: %s\n", failures ? "FAILED" : "passed");
+    return failures;
+}
+
+/* Random number generator of the IEEE-1180 procedure, in the range [-low..high]. */
+int32_t dsp_test_ieee1180_rand(uint32_t *seed, int32_t low, int32_t high)
+{
+    double x;
+
+    *seed = *seed * 1103515245 + 12345;
+    x = (double)(*seed & 0x7FFFFFFE) / 0x7FFFFFFF * (low + high + 1);
+
+    return (int32_t)x - low;
+}
+
+/* Double precision 8x8 DCT (forward when <i>inverse</i> is 0), which the procedure takes as the reference. */
+void dsp_test_ieee1180_dct(const double *in, double *out, int32_t inverse)
+{
+    double c[8][8], tmp[64];
+    int32_t u, x, i;
+
+    for(u=0; u<8; u++) {
+        for(x=0; x<8; x++) {
+            c[u][x] = (u == 0 ? sqrt(0.125) : 0.5) * cos((2 * x + 1) * u * acos(-1) / 16);
+        }
+    }
+
+    /* Rows, then columns */
+    for(i=0; i<64; i++) {
+        double sum = 0;
+        for(x=0; x<8; x++) {
+            sum += inverse ? c[x][i & 7] * in[(i & ~7) + x] : c[i & 7][x] * in[(i & ~7) + x];
+        }
+        tmp[i] = sum;
+    }
+
+    for(i=0; i<64; i++) {
+        double sum = 0;
+        for(x=0; x<8; x++) {
+            sum += inverse ? c[x][i >> 3] * tmp[x * 8 + (i & 7)] : c[i >> 3][x] * tmp[x * 8 + (i & 7)];
+        }
+        out[i] = sum;
+    }
+}
+
+static inline int32_t dsp_test_clip(int32_t v, int32_t low, int32_t high)
+{
+    return v < low ? low : (v > high ? high : v);
+}
+
+/* Checks the accuracy of mmf_idct_int() with the IEEE-1180 procedure: 10000 random blocks for each
+ * input range and sign, transformed by the reference DCT, are compared with the reference iDCT.
+ * The SIMD implementations are bit-exact with it (see dsp_test_idct()). Returns the number of failed checks.
+ */
+int dsp_test_idct_ieee1180()
+{
+    const int32_t ranges[3][2] = { { 256, 255 }, { 5, 5 }, { 300, 300 } };
+
+    double in[64], coeffs[64], ref[64];
+    int16_t block[64];
+    int failures = 0;
+    int32_t r, sign, n, i;
+
+    for(r=0; r<3; r++) {
+        for(sign=1; sign>=-1; sign-=2) {
+            uint32_t seed = 1;
+            int32_t peak = 0;
+            double err[64] = { 0 }, sq_err[64] = { 0 };
+            double pme = 0, pmse = 0, ome = 0, omse = 0;
+
+            for(n=0; n<10000; n++) {
+                for(i=0; i<64; i++) {
+                    in[i] = sign * dsp_test_ieee1180_rand(&seed, ranges[r][0], ranges[r][1]);
+                }
+
+                dsp_test_ieee1180_dct(in, coeffs, 0);
+
+                for(i=0; i<64; i++) {
+                    block[i] = (int16_t)dsp_test_clip((int32_t)floor(coeffs[i] + 0.5), -2048, 2047);
+                    coeffs[i] = block[i];
+                }
+
+                dsp_test_ieee1180_dct(coeffs, ref, 1);
+                mmf_idct_int(block);
+
+                for(i=0; i<64; i++) {
+                    int32_t e = dsp_test_clip(block[i] - 128, -256, 255) - dsp_test_clip((int32_t)floor(ref[i] + 0.5), -256, 255);
+
+                    if(abs(e) > peak) peak = abs(e);
+                    err[i] += e;
+                    sq_err[i] += e * e;
+                }
+            }
+
+            for(i=0; i<64; i++) {
+                if(fabs(err[i]) / 10000 > pme) pme = fabs(err[i]) / 10000;
+                if(sq_err[i] / 10000 > pmse) pmse = sq_err[i] / 10000;
+                ome += err[i];
+                omse += sq_err[i];
+            }
+
+            ome = fabs(ome) / 640000;
+            omse /= 640000;
+
+            if(peak > 1 || pmse > 0.06 || omse > 0.013 || pme > 0.015 || ome > 0.0015) {
+                printf("dsp_test_idct_ieee1180: range -%d..%d x %d: peak %d, pmse %.4f, omse %.4f, pme %.4f, ome %.5f\n",
+                       (int)ranges[r][0], (int)ranges[r][1], (int)sign, (int)peak, pmse, omse, pme, ome);
+                failures++;
+            }
+        }
+    }
+
+    /* Zero in, zero out */
+    memset(block, 0, sizeof(block));
+    mmf_idct_int(block);
+
+    for(i=0; i<64; i++) {
+        if(block[i] != 128) {
+            printf("dsp_test_idct_ieee1180: all-zero block gives %d at %d\n", (int)block[i] - 128, (int)i);
+            failures++;
+            break;
+        }
+    }
+
+    printf("dsp_test_idct_ieee1180: %s\n", failures ? "FAILED" : "passed");
+    return failures;
+}
+
+/* Compares the motion compensation routines of each implementation, for all block sizes
+ * and half-pel positions, with the C ones. Returns the number of failed checks.
+ */
+int dsp_test_mc()
+{
+    const MMFMCType types[] = { MC_TYPE_SSE2, MC_TYPE_AVX2 };
+    const char *names[] = { "sse2", "avx2" };
+
+    MMFMCFunctions c;
+    uint8_t src[48 * 48], dst[32 * 32], ref[32 * 32];
+    int failures = 0;
+    int32_t t, size, half, avg, i;
+
+    mmf_mc_set_type(MC_TYPE_C);
+    c = mmf_mc_funcs;
+
+    for(t=0; t<2; t++) {
+        if(mmf_mc_set_type(types[t]) == RC_NOTIMPLEMENTED) {
+            printf("dsp_test_mc: %s not supported by the CPU, skipped\n", names[t]);
+            continue;
+        }
+
+        srand(1);
+
+        for(size=0; size<MC_BLOCK_COUNT; size++) {
+            int32_t h = 16 >> size;
+
+            for(half=0; half<4; half++) {
+                for(avg=0; avg<2; avg++) {
+                    for(i=0; i<50; i++) {
+                        /* Unaligned source, like the vectors give it */
+                        int32_t offset = rand() % 16 + (rand() % 16) * 48;
+
+                        dsp_test_random_pixels(src, sizeof(src));
+                        dsp_test_random_pixels(dst, sizeof(dst));
+                        memcpy(ref, dst, sizeof(dst));
+
+                        if(avg) {
+                            mmf_mc_funcs.avg[size][half](dst, 32, src + offset, 48, h);
+                            c.avg[size][half](ref, 32, src + offset, 48, h);
+                        }else {
+                            mmf_mc_funcs.put[size][half](dst, 32, src + offset, 48, h);
+                            c.put[size][half](ref, 32, src + offset, 48, h);
+                        }
+
+                        if(memcmp(dst, ref, sizeof(dst)) != 0) {
+                            printf("dsp_test_mc: %s differs from C (%d pixels wide, half-pel %d, %s)\n",
+                                   names[t], (int)h, (int)half, avg ? "avg" : "put");
+                            failures++;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    mmf_mc_set_type(MC_TYPE_AUTO);
+
+    printf("dsp_test_mc: %s\n", failures ? "FAILED" : "passed");
+    return failures;
+}
+
+/* BT.601 component from limited range luminance, and the term of the chrominance, rounded and clipped */
+uint8_t dsp_test_bt601(int32_t y, double chroma)
+{
+    double x = 1.164383 * (y - 16) + chroma;
+
+    return x <= 0.0 ? 0 : x >= 255.0 ? 255 : (uint8_t)(x + 0.5);
+}
+
+/* Compares the pixel format conversions of each implementation with the C ones, on rows of
+ * several widths at unaligned addresses, and the C conversion to RGBA32 with the BT.601
+ * formulas, for all values of Y, Cb and Cr. Returns the number of failed checks.
+ */
+int dsp_test_convert()
+{
+    /* Largest difference from the BT.601 formulas, in the 8 bit components */
+    const int32_t max_error = 1;
+
+    MMFConvertFunctions c;
+    uint8_t y[2][256 + 16], u[128 + 16], v[128 + 16];
+    uint8_t dst[2][4 * 256 + 16], ref[2][4 * 256 + 16];
+    int failures = 0, error = 0;
+    int32_t i, w, cb, cr;
+
+    mmf_convert_set_type(CONVERT_TYPE_C);
+    c = mmf_convert_funcs;
+
+    /* Each row has all values of Y, and pairs of pixels share Cb and Cr */
+    for(i=0; i<256; i++) {
+        y[0][i] = i;
+        y[1][i] = 255 - i;
+    }
+
+    for(cb=0; cb<256; cb++) {
+        for(cr=0; cr<256; cr++) {
+            memset(u, cb, 128);
+            memset(v, cr, 128);
+            c.yuv420p_to_rgba32(dst[0], dst[1], y[0], y[1], u, v, 256);
+
+            for(i=0; i<2 * 256; i++) {
+                int32_t l = y[i >> 8][i & 255];
+                uint8_t *p = dst[i >> 8] + (i & 255) * 4;
+                int32_t expected[4], j;
+
+                expected[0] = dsp_test_bt601(l, 1.596027 * (cr - 128));
+                expected[1] = dsp_test_bt601(l, -0.391762 * (cb - 128) - 0.812968 * (cr - 128));
+                expected[2] = dsp_test_bt601(l, 2.017232 * (cb - 128));
+                expected[3] = 255;
+
+                for(j=0; j<4; j++) {
+                    if(abs(p[j] - expected[j]) > error) error = abs(p[j] - expected[j]);
+                }
+            }
+        }
+    }
+
+    if(error > max_error) {
+        printf("dsp_test_convert: C conversion to RGBA32 differs from BT.601 by %d\n", (int)error);
+        failures++;
+    }
+
+    if(mmf_convert_set_type(CONVERT_TYPE_SSE2) == RC_NOTIMPLEMENTED) {
+        printf("dsp_test_convert: sse2 not supported by the CPU, skipped\n");
+    }else {
+        srand(1);
+
+        for(i=0; i<200 && failures < 10; i++) {
+            int32_t offset = rand() % 16;
+
+            w = 2 + 2 * (rand() % 128);
+
+            dsp_test_random_pixels(y[0], sizeof(y));
+            dsp_test_random_pixels(u, sizeof(u));
+            dsp_test_random_pixels(v, sizeof(v));
+            dsp_test_random_pixels(dst[0], sizeof(dst));
+            memcpy(ref, dst, sizeof(dst));
+
+            if(i & 1) {
+                mmf_convert_funcs.interleave_uv(dst[0] + offset, u + offset, v + offset, w / 2);
+                c.interleave_uv(ref[0] + offset, u + offset, v + offset, w / 2);
+            }else {
+                mmf_convert_funcs.yuv420p_to_rgba32(dst[0] + offset, dst[1] + offset, y[0] + offset, y[1] + offset, u + offset, v + offset, w);
+                c.yuv420p_to_rgba32(ref[0] + offset, ref[1] + offset, y[0] + offset, y[1] + offset, u + offset, v + offset, w);
+            }
+
+            if(memcmp(dst, ref, sizeof(dst)) != 0) {
+                printf("dsp_test_convert: sse2 differs from C (%d pixels, %s)\n", (int)w, i & 1 ? "NV12" : "RGBA32");
+                failures++;
+            }
+        }
+    }
+
+    mmf_convert_set_type(CONVERT_TYPE_AUTO);
+
+    printf("dsp_test_convert: %s\n", failures ? "FAILED" : "passed");
+    return failures;
+}
+
+/* Compares the scaling routines of each implementation with the C ones, with the filters of
+ * scalers for downscaling, upscaling and narrow pictures. Returns the number of failed checks.
+ */
+int dsp_test_scale()
+{
+    const MMFScaleType types[] = { SCALE_TYPE_SSE2 };
+    const char *names[] = { "sse2" };
+
+    /* Source and destination widths (and heights) */
+    const int32_t sizes[][2] = { { 352, 176 }, { 352, 240 }, { 176, 352 }, { 720, 96 }, { 200, 62 }, { 22, 8 }, { 8, 22 } };
+
+    MMFScaleFunctions c;
+    MMFScaler *scaler = NULL;
+    uint8_t src[720], dst[720], ref[720];
+    int16_t h_dst[720], h_ref[720], ring[32][720];
+    const int16_t *rows[32];
+    int failures = 0;
+    int32_t t, size, filter, i, j;
+
+    mmf_scale_set_type(SCALE_TYPE_C);
+    c = mmf_scale_funcs;
+
+    for(t=0; t<1; t++) {
+        if(mmf_scale_set_type(types[t]) == RC_NOTIMPLEMENTED) {
+            printf("dsp_test_scale: %s not supported by the CPU, skipped\n", names[t]);
+            continue;
+        }
+
+        srand(1);
+
+        for(size=0; size<7; size++) {
+            for(filter=SCALE_FILTER_BILINEAR; filter<=SCALE_FILTER_AREA; filter++) {
+                int32_t sw = sizes[size][0], dw = sizes[size][1];
+                MMFScalePlane *p;
+
+                if(failed(mmf_scaler_create(sw, sw, dw, dw, filter, &scaler))) {
+                    printf("dsp_test_scale: failed to create a scaler of %d to %d\n", (int)sw, (int)dw);
+                    failures++;
+                    continue;
+                }
+
+                p = &scaler->planes[0];
+
+                for(i=0; i<20; i++) {
+                    dsp_test_random_pixels(src, sizeof(src));
+
+                    mmf_scale_funcs.horizontal(h_dst, src, &p->horizontal, dw);
+                    c.horizontal(h_ref, src, &p->horizontal, dw);
+
+                    if(memcmp(h_dst, h_ref, dw * sizeof(int16_t)) != 0) {
+                        printf("dsp_test_scale: %s differs from C (horizontal, %d to %d, filter %d)\n",
+                               names[t], (int)sw, (int)dw, (int)filter);
+                        failures++;
+                        break;
+                    }
+                }
+
+                /* Each row of the vertical filter, from rows of horizontally filtered random pixels */
+                for(i=0; i<dw; i++) {
+                    const int16_t *weights = p->vertical.weights + i * p->vertical.size;
+
+                    for(j=0; j<p->vertical.size; j++) {
+                        dsp_test_random_pixels(src, sizeof(src));
+                        c.horizontal(ring[j], src, &p->horizontal, dw);
+                        rows[j] = ring[j];
+                    }
+
+                    mmf_scale_funcs.vertical(dst, rows, weights, p->vertical.size, dw);
+                    c.vertical(ref, rows, weights, p->vertical.size, dw);
+
+                    if(memcmp(dst, ref, dw) != 0) {
+                        printf("dsp_test_scale: %s differs from C (vertical, %d to %d, filter %d)\n",
+                               names[t], (int)sw, (int)dw, (int)filter);
+                        failures++;
+                        break;
+                    }
+                }
+
+                mmf_scaler_free(&scaler);
+            }
+        }
+    }
+
+    mmf_scale_set_type(SCALE_TYPE_AUTO);
+
+    printf("dsp_test_scale: %s\n", failures ? "FAILED" : "passed");
+    return failures;
+}
+
+#endif // DSP_TEST_H_INCLUDED
@@ -0,0 +1,297 @@
+#include "string.h"
+#include "mc.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define MMF_MC_X86
+#endif
+
+/* Index of the half-pel position in the tables: (half_y << 1) | half_x */
+#define MC_FULL     0
+#define MC_HALF_X   1
+#define MC_HALF_Y   2
+#define MC_HALF_XY  3
+
+/* Declares a fixed-size wrapper of a generic kernel, so the compiler can unroll the rows.
+ * "avg" selects averaging with the destination, instead of overwriting it.
+ */
+#define MC_WRAPPER(name, kernel, w, half, avg) \
+    static void name(uint8_t *dst, int32_t dst_stride, const uint8_t *src, int32_t src_stride, int32_t h) \
+    { \
+        kernel(dst, dst_stride, src, src_stride, w, h, half, avg); \
+    }
+
+/* Declares the kernels of all half-pel positions for one block width */
+#define MC_WRAPPERS(op, w, kernel, suffix, avg) \
+    MC_WRAPPER(mmf_mc_##op##w##suffix,      kernel, w, MC_FULL, avg) \
+    MC_WRAPPER(mmf_mc_##op##w##_x##suffix,  kernel, w, MC_HALF_X, avg) \
+    MC_WRAPPER(mmf_mc_##op##w##_y##suffix,  kernel, w, MC_HALF_Y, avg) \
+    MC_WRAPPER(mmf_mc_##op##w##_xy##suffix, kernel, w, MC_HALF_XY, avg)
+
+/* Initializer of a table row, in the order of the half-pel positions */
+#define MC_TABLE_ROW(op, w, suffix) \
+    { mmf_mc_##op##w##suffix, mmf_mc_##op##w##_x##suffix, mmf_mc_##op##w##_y##suffix, mmf_mc_##op##w##_xy##suffix }
+
+/*
+ * Portable version
+ */
+static inline void mmf_mc_c(uint8_t *dst, int32_t dst_stride, const uint8_t *src, int32_t src_stride, int32_t w, int32_t h, int half, int avg)
+{
+    const uint8_t *right = src + (half & MC_HALF_X ? 1 : 0);
+    const uint8_t *below = src + (half & MC_HALF_Y ? src_stride : 0);
+    int i, j, v;
+
+    for(i=0; i<h; i++) {
+        if(half == MC_FULL && !avg) {
+            memcpy(dst, src, w);
+        }else {
+            for(j=0; j<w; j++) {
+                switch(half) {
+                case MC_FULL:
+                    v = src[j];
+                    break;
+                case MC_HALF_X:
+                    v = (src[j] + right[j] + 1) >> 1;
+                    break;
+                case MC_HALF_Y:
+                    v = (src[j] + below[j] + 1) >> 1;
+                    break;
+                default:
+                    v = (src[j] + src[j + 1] + below[j] + below[j + 1] + 2) >> 2;
+                    break;
+                }
+
+                dst[j] = avg ? (dst[j] + v + 1) >> 1 : v;
+            }
+        }
+
+        dst += dst_stride;
+        src += src_stride;
+        right += src_stride;
+        below += src_stride;
+    }
+}
+
+MC_WRAPPERS(put, 16, mmf_mc_c, _c, 0)
+MC_WRAPPERS(put, 8,  mmf_mc_c, _c, 0)
+MC_WRAPPERS(put, 4,  mmf_mc_c, _c, 0)
+MC_WRAPPERS(put, 2,  mmf_mc_c, _c, 0)
+MC_WRAPPERS(put, 1,  mmf_mc_c, _c, 0)
+MC_WRAPPERS(avg, 16, mmf_mc_c, _c, 1)
+MC_WRAPPERS(avg, 8,  mmf_mc_c, _c, 1)
+MC_WRAPPERS(avg, 4,  mmf_mc_c, _c, 1)
+MC_WRAPPERS(avg, 2,  mmf_mc_c, _c, 1)
+MC_WRAPPERS(avg, 1,  mmf_mc_c, _c, 1)
+
+/* Rows of the reduced resolution block sizes. They are too narrow for SIMD, so all
+ * implementations share the C ones.
+ */
+#define MC_TABLE_ROWS_SMALL(op) \
+    MC_TABLE_ROW(op, 4, _c), MC_TABLE_ROW(op, 2, _c), MC_TABLE_ROW(op, 1, _c)
+
+static const MMFMCFunctions __mc_funcs_c = {
+    .put = { MC_TABLE_ROW(put, 16, _c), MC_TABLE_ROW(put, 8, _c), MC_TABLE_ROWS_SMALL(put) },
+    .avg = { MC_TABLE_ROW(avg, 16, _c), MC_TABLE_ROW(avg, 8, _c), MC_TABLE_ROWS_SMALL(avg) },
+};
+
+#ifdef MMF_MC_X86
+/*
+ * SSE2 version. Full-pel rows are plain loads and stores. pavgb computes (a + b + 1) >> 1,
+ * which is exactly the two-tap half-pel average, and the average of the two predictions
+ * of bidirectional blocks. The four-tap one needs the wider sum, so it is done on 16-bit lanes.
+ */
+__attribute__((target("sse2")))
+static inline __m128i mmf_mc_sse2_load(const uint8_t *p, int32_t w)
+{
+    return w == 16 ? _mm_loadu_si128((const __m128i*)p) : _mm_loadl_epi64((const __m128i*)p);
+}
+
+/* Stores a row of the prediction, averaged with the one in the destination if "avg" is set */
+__attribute__((target("sse2")))
+static inline void mmf_mc_sse2_store(uint8_t *p, __m128i v, int32_t w, int avg)
+{
+    if(avg) {
+        v = _mm_avg_epu8(v, mmf_mc_sse2_load(p, w));
+    }
+
+    if(w == 16) {
+        _mm_storeu_si128((__m128i*)p, v);
+    }else {
+        _mm_storel_epi64((__m128i*)p, v);
+    }
+}
+
+__attribute__((target("sse2")))
+static inline void mmf_mc_sse2(uint8_t *dst, int32_t dst_stride, const uint8_t *src, int32_t src_stride, int32_t w, int32_t h, int half, int avg)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two = _mm_set1_epi16(2);
+    __m128i a, b, lo0, hi0, lo1, hi1;
+    int i;
+
+    switch(half) {
+    case MC_FULL:
+        for(i=0; i<h; i++, dst += dst_stride, src += src_stride) {
+            mmf_mc_sse2_store(dst, mmf_mc_sse2_load(src, w), w, avg);
+        }
+        break;
+
+    case MC_HALF_X:
+        for(i=0; i<h; i++, dst += dst_stride, src += src_stride) {
+            mmf_mc_sse2_store(dst, _mm_avg_epu8(mmf_mc_sse2_load(src, w), mmf_mc_sse2_load(src + 1, w)), w, avg);
+        }
+        break;
+
+    case MC_HALF_Y:
+        /* Each source row is loaded once, and used for two output rows */
+        a = mmf_mc_sse2_load(src, w);
+
+        for(i=0; i<h; i++, dst += dst_stride, src += src_stride) {
+            b = mmf_mc_sse2_load(src + src_stride, w);
+            mmf_mc_sse2_store(dst, _mm_avg_epu8(a, b), w, avg);
+            a = b;
+        }
+        break;
+
+    default:
+        /* Horizontal sums of the previous row are kept, like the rows above */
+        a = mmf_mc_sse2_load(src, w);
+        b = mmf_mc_sse2_load(src + 1, w);
+        lo0 = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+        hi0 = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+
+        for(i=0; i<h; i++, dst += dst_stride, src += src_stride) {
+            a = mmf_mc_sse2_load(src + src_stride, w);
+            b = mmf_mc_sse2_load(src + src_stride + 1, w);
+            lo1 = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+            hi1 = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+
+            a = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(lo0, lo1), two), 2);
+            b = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(hi0, hi1), two), 2);
+            mmf_mc_sse2_store(dst, _mm_packus_epi16(a, b), w, avg);
+
+            lo0 = lo1;
+            hi0 = hi1;
+        }
+        break;
+    }
+}
+
+MC_WRAPPERS(put, 16, mmf_mc_sse2, _sse2, 0)
+MC_WRAPPERS(put, 8,  mmf_mc_sse2, _sse2, 0)
+MC_WRAPPERS(avg, 16, mmf_mc_sse2, _sse2, 1)
+MC_WRAPPERS(avg, 8,  mmf_mc_sse2, _sse2, 1)
+
+static const MMFMCFunctions __mc_funcs_sse2 = {
+    .put = { MC_TABLE_ROW(put, 16, _sse2), MC_TABLE_ROW(put, 8, _sse2), MC_TABLE_ROWS_SMALL(put) },
+    .avg = { MC_TABLE_ROW(avg, 16, _sse2), MC_TABLE_ROW(avg, 8, _sse2), MC_TABLE_ROWS_SMALL(avg) },
+};
+
+/*
+ * AVX2 version of the four-tap 16 pixel wide kernel. A whole row fits in a register
+ * as 16-bit lanes, so it takes half the additions of the SSE2 version.
+ */
+__attribute__((target("avx2")))
+static inline __m256i mmf_mc_avx2_sum_row(const uint8_t *p)
+{
+    return _mm256_add_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)p)),
+                            _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(p + 1))));
+}
+
+/* Packs 16 words to bytes, and stores them (averaged with the destination if "avg" is set) */
+__attribute__((target("avx2")))
+static inline void mmf_mc_avx2_store(uint8_t *p, __m256i v, int avg)
+{
+    /* packus works within lanes, the permute gathers the low halves of both */
+    __m128i b = _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0x08));
+
+    if(avg) {
+        b = _mm_avg_epu8(b, _mm_loadu_si128((const __m128i*)p));
+    }
+
+    _mm_storeu_si128((__m128i*)p, b);
+}
+
+__attribute__((target("avx2")))
+static inline void mmf_mc_xy_avx2(uint8_t *dst, int32_t dst_stride, const uint8_t *src, int32_t src_stride, int32_t h, int avg)
+{
+    const __m256i two = _mm256_set1_epi16(2);
+    __m256i s0 = mmf_mc_avx2_sum_row(src), s1;
+    int i;
+
+    for(i=0; i<h; i++, dst += dst_stride, src += src_stride) {
+        s1 = mmf_mc_avx2_sum_row(src + src_stride);
+        mmf_mc_avx2_store(dst, _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(s0, s1), two), 2), avg);
+        s0 = s1;
+    }
+}
+
+__attribute__((target("avx2")))
+static void mmf_mc_put16_xy_avx2(uint8_t *dst, int32_t dst_stride, const uint8_t *src, int32_t src_stride, int32_t h)
+{
+    mmf_mc_xy_avx2(dst, dst_stride, src, src_stride, h, 0);
+}
+
+__attribute__((target("avx2")))
+static void mmf_mc_avg16_xy_avx2(uint8_t *dst, int32_t dst_stride, const uint8_t *src, int32_t src_stride, int32_t h)
+{
+    mmf_mc_xy_avx2(dst, dst_stride, src, src_stride, h, 1);
+}
+#endif // MMF_MC_X86
+
+MMFMCFunctions mmf_mc_funcs = {
+    .put = { MC_TABLE_ROW(put, 16, _c), MC_TABLE_ROW(put, 8, _c), MC_TABLE_ROWS_SMALL(put) },
+    .avg = { MC_TABLE_ROW(avg, 16, _c), MC_TABLE_ROW(avg, 8, _c), MC_TABLE_ROWS_SMALL(avg) },
+};
+
+/* Selects the fastest motion compensation for the CPU we are running on.
+ */
+__attribute__((constructor)) void mmf_mc_init()
+{
+    mmf_mc_set_type(MC_TYPE_AUTO);
+}
+
+MMFRES mmf_mc_set_type(MMFMCType type)
+{
+    #ifdef MMF_MC_X86
+    /* Needed, since we might be called from a constructor */
+    __builtin_cpu_init();
+
+    if(type == MC_TYPE_AUTO) {
+        type = __builtin_cpu_supports("avx2") ? MC_TYPE_AVX2 :
+               __builtin_cpu_supports("sse2") ? MC_TYPE_SSE2 : MC_TYPE_C;
+    }
+    #else
+    if(type == MC_TYPE_AUTO) {
+        type = MC_TYPE_C;
+    }
+    #endif
+
+    switch(type) {
+    case MC_TYPE_C:
+        mmf_mc_funcs = __mc_funcs_c;
+        break;
+    #ifdef MMF_MC_X86
+    case MC_TYPE_SSE2:
+    case MC_TYPE_AVX2:
+        if(!__builtin_cpu_supports("sse2")) return RC_NOTIMPLEMENTED;
+        if(type == MC_TYPE_AVX2 && !__builtin_cpu_supports("avx2")) return RC_NOTIMPLEMENTED;
+
+        mmf_mc_funcs = __mc_funcs_sse2;
+
+        if(type == MC_TYPE_AVX2) {
+            mmf_mc_funcs.put[MC_BLOCK_16][MC_HALF_XY] = mmf_mc_put16_xy_avx2;
+            mmf_mc_funcs.avg[MC_BLOCK_16][MC_HALF_XY] = mmf_mc_avg16_xy_avx2;
+        }
+        break;
+    #else
+    case MC_TYPE_SSE2:
+    case MC_TYPE_AVX2:
+        return RC_NOTIMPLEMENTED;
+    #endif
+    default:
+        return RC_INVALIDARG;
+    }
+
+    return RC_OK;
+}
@@ -0,0 +1,69 @@
+#ifndef MC_H_INCLUDED
+#define MC_H_INCLUDED
+
+#include <stdint.h>
+#include "..\mmfutil.h"
+
+/**
+ * Available motion compensation implementations
+ */
+typedef enum MMFMCType {
+    MC_TYPE_AUTO        = 0x0,  //!< Fastest implementation, supported by the CPU (default)
+    MC_TYPE_C,                  //!< Portable C implementation
+    MC_TYPE_SSE2,               //!< SSE2 implementation
+    MC_TYPE_AVX2,               //!< SSE2 implementation, with AVX2 for the 16 pixel wide half-pel blocks
+} MMFMCType;
+
+/* Block sizes, used as the first index of the MMFMCFunctions tables. Each one is half
+ * of the previous one, so decoding at 1/2^n scale uses the sizes n places further.
+ */
+#define MC_BLOCK_16     0   //!< 16 pixels wide (luminance)
+#define MC_BLOCK_8      1   //!< 8 pixels wide (chrominance)
+#define MC_BLOCK_4      2   //!< 4 pixels wide (reduced resolution)
+#define MC_BLOCK_2      3   //!< 2 pixels wide (reduced resolution)
+#define MC_BLOCK_1      4   //!< 1 pixel wide (reduced resolution)
+#define MC_BLOCK_COUNT  5
+
+/**
+ * Forms the prediction of a block from a reference picture.
+ *
+ * @param dst Destination of the top-left pixel.
+ * @param dst_stride Distance in bytes between two rows of the destination.
+ * @param src Top-left pixel of the reference block (at the full-pel part of the vector).
+ *            One more column and row is read for the half-pel positions.
+ * @param src_stride Distance in bytes between two rows of the reference.
+ * @param h Number of rows.
+ */
+typedef void (*MMFMCFunc)(uint8_t *dst, int32_t dst_stride, const uint8_t *src, int32_t src_stride, int32_t h);
+
+/**
+ * Table of the motion compensation routines used by the decoder. Like mmf_dct_funcs, it is
+ * initialized at startup depending on the CPU features, and can be changed with mmf_mc_set_type().
+ */
+typedef struct MMFMCFunctions {
+    /**
+     * Copies the prediction to the destination. The second index is the half-pel
+     * position: (half_y << 1) | half_x. Half-pel samples are the averages of the
+     * two or four neighbours, rounded up.
+     */
+    MMFMCFunc put[MC_BLOCK_COUNT][4];
+
+    /**
+     * Same as put, but the prediction is averaged with the destination (rounded up). Used
+     * for the second prediction of bidirectionally predicted blocks.
+     */
+    MMFMCFunc avg[MC_BLOCK_COUNT][4];
+} MMFMCFunctions;
+
+extern MMFMCFunctions mmf_mc_funcs;
+
+void mmf_mc_init();
+
+/**
+ * Selects the motion compensation implementation, used through mmf_mc_funcs.
+ * @param type One of MMFMCType values
+ * @return RC_OK on success, RC_NOTIMPLEMENTED if the CPU doesn't support it, RC_INVALIDARG if the type is unknown.
+ */
+MMFRES mmf_mc_set_type(MMFMCType type);
+
+#endif // MC_H_INCLUDED
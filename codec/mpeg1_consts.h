@@ -75,6 +75,31 @@ static const int32_t __seq_hdr_aspect_ratio[16][2] = {
     {0,     1}, //reserved
 };
 
+/* Index widths of the VLC lookup tables, which are built from the prefix tables below, and the
+ * number of entries each table takes with that width (the primary table, and the secondary tables
+ * of the longer codes). Codes up to the width are decoded with a single lookup.
+ */
+#define MPEG1_VLC_MB_ADDR_INCREMENT_BITS    8
+#define MPEG1_VLC_MB_ADDR_INCREMENT_SIZE    276
+#define MPEG1_VLC_MB_TYPE_I_BITS            2
+#define MPEG1_VLC_MB_TYPE_I_SIZE            4
+#define MPEG1_VLC_MB_TYPE_P_BITS            6
+#define MPEG1_VLC_MB_TYPE_P_SIZE            64
+#define MPEG1_VLC_MB_TYPE_B_BITS            6
+#define MPEG1_VLC_MB_TYPE_B_SIZE            64
+#define MPEG1_VLC_MB_TYPE_D_BITS            1
+#define MPEG1_VLC_MB_TYPE_D_SIZE            2
+#define MPEG1_VLC_MB_CB_PATTERN_BITS        9
+#define MPEG1_VLC_MB_CB_PATTERN_SIZE        512
+#define MPEG1_VLC_MOTION_CODE_BITS          8
+#define MPEG1_VLC_MOTION_CODE_SIZE          276
+#define MPEG1_VLC_DC_SIZE_LUMA_BITS         7
+#define MPEG1_VLC_DC_SIZE_LUMA_SIZE         128
+#define MPEG1_VLC_DC_SIZE_CHROMA_BITS       8
+#define MPEG1_VLC_DC_SIZE_CHROMA_SIZE       256
+#define MPEG1_VLC_RUN_LEVELS_BITS           9
+#define MPEG1_VLC_RUN_LEVELS_SIZE           848
+
 /* VLC Prefix table for macroblock address increment field
  */
 static const VLCPrefixEntry __vlc_mb_addr_increment[] = {
@@ -140,7 +165,7 @@ static const VLCPrefixEntry __vlc_mb_type_p[] = {
 static const VLCPrefixEntry __vlc_mb_type_b[] = {
     {0x02,   4,  0x02}, //0010
     {0x02,   3,  0x04}, //010
-    {0x02,   2,  0x05}, //10
+    {0x02,   2,  0x06}, //10
     {0x03,   4,  0x0A}, //0011
     {0x03,   6,  0x0B}, //0000 11
     {0x03,   3,  0x0C}, //011
@@ -0,0 +1,356 @@
+#include <stdint.h>
+#include <pthread.h>
+#include "string.h"
+#include "mpeg1batch.h"
+#include "..\generic\bitstream.h"
+
+/* Part of the stream, which can be decoded without the data before it */
+typedef struct {
+    /* Index entry of the first picture */
+    int32_t entry;
+
+    /* End of the part in the stream (exclusive) */
+    int64_t end;
+} MPEG1BatchSegment;
+
+/* Frames, which a thread decodes ahead of the delivery order. Beyond them, it waits
+ * for its segment's turn, so the memory doesn't grow with the size of the segments.
+ */
+#define MPEG1_BATCH_MAX_FRAMES      16
+
+/* Frames of a segment, kept by a thread until it's the segment's turn to be delivered */
+typedef struct {
+    MMFSample *samples[MPEG1_BATCH_MAX_FRAMES];
+    int32_t count;
+
+    /* The segment is at the head of the delivery order, so its frames go straight to the callback */
+    int8_t head;
+} MPEG1BatchThread;
+
+typedef struct {
+    const uint8_t *data;
+    MPEG1Index *index;
+
+    MPEG1BatchSegment *segments;
+    int32_t segment_count;
+
+    MPEG1BatchThread *threads;
+
+    MPEG1BatchCallback callback;
+    void *opaque;
+
+    /* Delivery order. Guarded by the lock. */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int32_t next_segment;
+    int64_t next_frame;
+    MMFRES rc;
+} MPEG1Batch;
+
+/*
+ * Splits the stream before each closed GOP. The headers in front of a GOP are left
+ * to the next segment, so the previous one ends before them.
+ */
+static MMFRES mpg1_batch_split(MPEG1Batch *b, int64_t size)
+{
+    MPEG1Index *idx = b->index;
+    int64_t hdr_start = -1;
+    int8_t split = 1;
+    int32_t i;
+
+    b->segments = mmf_alloc(idx->count * sizeof(MPEG1BatchSegment));
+    if(!b->segments) return RC_OUTOFMEM;
+
+    for(i=0; i<idx->count; i++) {
+        MPEG1IndexEntry *e = &idx->entries[i];
+
+        switch(e->type) {
+        case MPEG1_INDEX_SEQ_HEADER:
+        case MPEG1_INDEX_GOP:
+            if(hdr_start < 0) {
+                hdr_start = e->offset;
+            }
+
+            if(e->type == MPEG1_INDEX_GOP && e->gop.closed_flag) {
+                split = 1;
+            }
+            break;
+
+        case MPEG1_INDEX_PICTURE:
+            if(split) {
+                if(b->segment_count > 0) {
+                    b->segments[b->segment_count - 1].end = hdr_start >= 0 ? hdr_start : e->offset;
+                }
+
+                b->segments[b->segment_count].entry = i;
+                b->segments[b->segment_count].end = size;
+                b->segment_count++;
+                split = 0;
+            }
+
+            hdr_start = -1;
+            break;
+        }
+    }
+
+    return RC_OK;
+}
+
+/* Waits until the segments before <i>job</i> are delivered. Returns the state of the batch. */
+static MMFRES mpg1_batch_wait_turn(MPEG1Batch *b, int32_t job)
+{
+    MMFRES rc;
+
+    /* The previous segments were taken by other threads before this one, so they can't be
+     * waiting for it.
+     */
+    pthread_mutex_lock(&b->lock);
+
+    while(b->next_segment != job) {
+        pthread_cond_wait(&b->cond, &b->lock);
+    }
+
+    rc = b->rc;
+    pthread_mutex_unlock(&b->lock);
+
+    return rc;
+}
+
+/* Passes the frames kept by a thread to the callback. Only the thread at the head of the
+ * delivery order touches next_frame.
+ */
+static MMFRES mpg1_batch_deliver(MPEG1Batch *b, MPEG1BatchThread *t)
+{
+    MMFRES rc = RC_OK;
+    int32_t i;
+
+    for(i=0; i<t->count && succeeded(rc); i++) {
+        t->samples[i]->pts = b->next_frame;
+
+        rc = b->callback(b->opaque, t->samples[i], b->next_frame);
+        b->next_frame++;
+    }
+
+    t->count = 0;
+    return rc;
+}
+
+/* Decodes a segment. Its frames are kept by the thread until the segment is at the head of the
+ * delivery order, and delivered as they are decoded from then on.
+ */
+static MMFRES mpg1_batch_decode_segment(MPEG1Batch *b, int32_t job, MPEG1BatchThread *t)
+{
+    MPEG1DecoderContext *dec;
+    MMFRES rc;
+
+    rc = mpg1_decoder_create_from_memory(&dec, b->data, b->segments[job].end);
+    if(failed(rc)) return rc;
+
+    rc = mpg1_decoder_seek_entry(dec, b->index, b->segments[job].entry);
+
+    while(succeeded(rc)) {
+        if(!t->head) {
+            if(t->count == MPEG1_BATCH_MAX_FRAMES) {
+                rc = mpg1_batch_wait_turn(b, job);
+                t->head = 1;
+            }else {
+                pthread_mutex_lock(&b->lock);
+                t->head = b->next_segment == job;
+                rc = b->rc;
+                pthread_mutex_unlock(&b->lock);
+            }
+
+            /* Don't bother decoding, if the batch has failed already */
+            if(failed(rc)) break;
+
+            /* The frames kept so far go first */
+            if(t->head) {
+                rc = mpg1_batch_deliver(b, t);
+                if(failed(rc)) break;
+            }
+        }
+
+        /* Read the headers, so the frame size is known */
+        rc = mpg1_decode_sample(dec, NULL);
+        if(failed(rc)) break;
+
+        MMFSample *s = t->samples[t->count];
+        int32_t w, h;
+
+        mpg1_decoder_get_frame_size(dec, &w, &h);
+
+        if(s && (s->width != w || s->height != h)) {
+            mmf_sample_free(&t->samples[t->count]);
+        }
+
+        if(t->samples[t->count] == NULL) {
+            rc = mmf_allocate_video_frame(SAMPLE_FORMAT_YUV420P, w, h, &t->samples[t->count]);
+            if(failed(rc)) break;
+        }
+
+        rc = mpg1_decode_sample(dec, t->samples[t->count]);
+        if(failed(rc)) break;
+
+        t->count++;
+
+        if(t->head) {
+            rc = mpg1_batch_deliver(b, t);
+        }
+    }
+
+    mpg1_decoder_free(&dec);
+
+    return rc == RC_END_OF_STREAM ? RC_OK : rc;
+}
+
+static void mpg1_batch_job(void *ctx, int32_t job, int32_t thread)
+{
+    MPEG1Batch *b = ctx;
+    MPEG1BatchThread *t = &b->threads[thread];
+    MMFRES rc, batch_rc;
+
+    t->count = 0;
+    t->head = 0;
+
+    rc = mpg1_batch_decode_segment(b, job, t);
+
+    /* Deliver the rest of the frames, when it's our turn */
+    batch_rc = mpg1_batch_wait_turn(b, job);
+
+    if(failed(batch_rc)) {
+        rc = batch_rc;
+    }
+
+    if(succeeded(rc)) {
+        rc = mpg1_batch_deliver(b, t);
+    }
+
+    pthread_mutex_lock(&b->lock);
+
+    if(failed(rc) && succeeded(b->rc)) {
+        b->rc = rc;
+    }
+
+    b->next_segment++;
+    pthread_cond_broadcast(&b->cond);
+    pthread_mutex_unlock(&b->lock);
+}
+
+MMFRES mpg1_batch_decode(const uint8_t *data, int64_t size, int32_t threads, MPEG1BatchCallback callback, void *opaque)
+{
+    MPEG1Batch b;
+    MMFBitstream bs;
+    MMFThreadPool *pool = NULL;
+    MMFRES rc;
+    int32_t i, requested;
+
+    if(!data || size <= 0 || !callback) {
+        return RC_INVALIDARG;
+    }
+
+    if(threads < 1) {
+        threads = mmf_get_cpu_count();
+    }
+
+    requested = threads;
+
+    memset(&b, 0, sizeof(b));
+    b.data = data;
+    b.callback = callback;
+    b.opaque = opaque;
+
+    /* Find the GOPs */
+    bitstream_init_wrap(&bs, data, size);
+
+    rc = mpg1_index_build(&bs, &b.index);
+    if(failed(rc)) return rc;
+
+    rc = mpg1_batch_split(&b, size);
+    if(failed(rc)) goto done;
+
+    if(b.segment_count == 0) {
+        /* No pictures */
+        rc = RC_INVALIDDATA;
+        goto done;
+    }
+
+    if(requested > 1 && b.segment_count == 1) {
+        mmf_log(NULL, LOG_LEVEL_WARNING, "mpg1_batch_decode(): the stream has no closed GOP after the first picture, "
+                "so it can't be split and is decoded by one thread.\n");
+    }
+
+    /* There is no point to have more threads than segments */
+    if(threads > b.segment_count) {
+        threads = b.segment_count;
+    }
+
+    b.threads = mmf_allocz(threads * sizeof(MPEG1BatchThread));
+    if(!b.threads) {
+        rc = RC_OUTOFMEM;
+        goto done;
+    }
+
+    rc = mmf_threadpool_create(threads, &pool);
+    if(failed(rc)) goto done;
+
+    pthread_mutex_init(&b.lock, NULL);
+    pthread_cond_init(&b.cond, NULL);
+
+    mmf_threadpool_run(pool, mpg1_batch_job, &b, b.segment_count);
+    rc = b.rc;
+
+    if(rc == RC_OK && requested > 1 && b.segment_count == 1) {
+        rc = RC_FALSE;
+    }
+
+    pthread_cond_destroy(&b.cond);
+    pthread_mutex_destroy(&b.lock);
+
+    mmf_threadpool_free(&pool);
+
+done:
+    if(b.threads) {
+        for(i=0; i<threads; i++) {
+            int32_t j;
+
+            for(j=0; j<MPEG1_BATCH_MAX_FRAMES; j++) {
+                mmf_sample_free(&b.threads[i].samples[j]);
+            }
+        }
+
+        mmf_free(b.threads);
+    }
+
+    mmf_free(b.segments);
+    mpg1_index_free(&b.index);
+
+    return rc;
+}
+
+MMFRES mpg1_batch_decode_file(char *filename, int32_t threads, MPEG1BatchCallback callback, void *opaque)
+{
+    MMFRES rc;
+    MMFBitstream *bs = bitstream_alloc_map_file(filename, &rc);
+    if(failed(rc)) {
+        /* Threads decode from a shared buffer, so files that can't be mapped are read
+         * whole into memory. The mark at the start keeps the buffer from being flushed.
+         */
+        bs = bitstream_alloc_load_file(filename, &rc);
+        if(failed(rc)) return rc;
+
+        bitstream_set_mark(bs, 0);
+        while(succeeded(rc)) {
+            rc = bitstream_replenish(bs);
+        }
+
+        if(rc != RC_END_OF_STREAM) {
+            bitstream_free(&bs);
+            return rc;
+        }
+    }
+
+    rc = mpg1_batch_decode(bs->buffer, bs->write_index, threads, callback, opaque);
+
+    bitstream_free(&bs);
+    return rc;
+}
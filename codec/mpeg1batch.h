@@ -0,0 +1,46 @@
+/**
+ * @file mpeg1batch.h
+ *
+ * @brief      GOP-parallel batch decoding
+ * @details    Decodes a whole stream for offline processing (e.g. transcoding). The stream is
+ *             split at closed GOPs, which don't reference pictures before them, and the parts
+ *             are decoded concurrently by independent decoders. Frames are delivered to a
+ *             callback in stream order, from the calling thread or from a worker. A thread
+ *             keeps a few frames ahead of the delivery order at most, so the memory doesn't
+ *             depend on the length of the GOPs.
+ */
+
+#ifndef MPEG1BATCH_H_INCLUDED
+#define MPEG1BATCH_H_INCLUDED
+
+#include "mpeg1dec.h"
+
+/**
+ * Receives the decoded frames. The calls are serialized and come in output order, but not
+ * necessarily from the same thread. The sample is reused after the call returns.
+ * @param opaque User pointer
+ * @param sample Decoded frame (YUV420P). Its pts is set to the frame number.
+ * @param frame Number of the frame in output order
+ * @return RC_OK to continue. Any error stops the batch, and is returned by it.
+ */
+typedef MMFRES (*MPEG1BatchCallback)(void *opaque, MMFSample *sample, int64_t frame);
+
+/**
+ * Decodes a stream, which is entirely in memory.
+ * @param data Stream data
+ * @param size Size of the stream in bytes
+ * @param threads Number of decoding threads. Values less than 1 select one thread per processor.
+ * @param callback Receives the decoded frames
+ * @param opaque User pointer, given to the callback
+ * @return RC_OK when the whole stream is decoded, RC_FALSE when it is decoded by one thread, because
+ *         it has no closed GOP to split at (e.g. open-GOP streams), error otherwise.
+ */
+MMFRES mpg1_batch_decode(const uint8_t *data, int64_t size, int32_t threads, MPEG1BatchCallback callback, void *opaque);
+
+/**
+ * Same as mpg1_batch_decode(), but the stream is memory mapped from a file.
+ * Files which can't be mapped are read into memory whole.
+ */
+MMFRES mpg1_batch_decode_file(char *filename, int32_t threads, MPEG1BatchCallback callback, void *opaque);
+
+#endif // MPEG1BATCH_H_INCLUDED
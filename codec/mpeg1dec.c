@@ -1,14 +1,75 @@
-/*
- * TODO:
- *  - Rewrite iDCT routines and implement faster ones
- */
-
 #include <stdint.h>
+#include <pthread.h>
 #include "mpeg1dec.h"
 #include "math.h"
+#include "string.h"
 #include "..\generic\bitstream.h"
 #include "mpeg1_consts.h"
 #include "dct.h"
+#include "mc.h"
+#include "..\mmfconvert.h"
+
+/* Zigzag positions below this all lie in the top-left 4x4 quadrant of the block */
+#define MPEG1_IDCT_4X4_LAST         10
+
+/* Frame threading (see mpg1_decode_sample_threaded()) */
+static int32_t mpg1_picture_await_rows(MPEG1DecoderContext *dec, MPEG1Picture *p, int32_t rows);
+static void mpg1_frame_threads_wait_all(MPEG1DecoderContext *dec);
+static void mpg1_frame_threads_free(MPEG1DecoderContext *dec);
+
+/* VLC lookup tables are shared by all decoder instances. They are built once per process
+ * from the prefix tables in mpeg1_consts.h, into statically allocated storage, which is
+ * sized for the index widths there.
+ */
+static VLCTableEntry __vlc_mb_addr_increment_entries[MPEG1_VLC_MB_ADDR_INCREMENT_SIZE];
+static VLCTableEntry __vlc_mb_type_i_entries[MPEG1_VLC_MB_TYPE_I_SIZE];
+static VLCTableEntry __vlc_mb_type_p_entries[MPEG1_VLC_MB_TYPE_P_SIZE];
+static VLCTableEntry __vlc_mb_type_b_entries[MPEG1_VLC_MB_TYPE_B_SIZE];
+static VLCTableEntry __vlc_mb_type_d_entries[MPEG1_VLC_MB_TYPE_D_SIZE];
+static VLCTableEntry __vlc_mb_cb_pattern_entries[MPEG1_VLC_MB_CB_PATTERN_SIZE];
+static VLCTableEntry __vlc_motion_code_entries[MPEG1_VLC_MOTION_CODE_SIZE];
+static VLCTableEntry __vlc_dc_size_luma_entries[MPEG1_VLC_DC_SIZE_LUMA_SIZE];
+static VLCTableEntry __vlc_dc_size_chroma_entries[MPEG1_VLC_DC_SIZE_CHROMA_SIZE];
+static VLCTableEntry __vlc_run_levels_entries[MPEG1_VLC_RUN_LEVELS_SIZE];
+
+static VLCTable mpg1_vlc_mb_addr_increment;
+static VLCTable mpg1_vlc_mb_type_i;
+static VLCTable mpg1_vlc_mb_type_p;
+static VLCTable mpg1_vlc_mb_type_b;
+static VLCTable mpg1_vlc_mb_type_d;
+static VLCTable mpg1_vlc_mb_cb_pattern;
+static VLCTable mpg1_vlc_motion_code;
+static VLCTable mpg1_vlc_dc_size_luma;
+static VLCTable mpg1_vlc_dc_size_chroma;
+static VLCTable mpg1_vlc_run_levels;
+
+static pthread_once_t mpg1_vlc_tables_once = PTHREAD_ONCE_INIT;
+static MMFRES mpg1_vlc_tables_rc = RC_OK;
+
+#define MPG1_INIT_VLC_TABLE(name, prefixes, bits) do {                                           \
+    MMFRES rc = vlc_table_init_static(&mpg1_vlc_##name, __vlc_##name##_entries,                 \
+        sizeof(__vlc_##name##_entries) / sizeof(VLCTableEntry), prefixes, 0, bits);             \
+    if(failed(rc)) {                                                                            \
+        mpg1_vlc_tables_rc = rc;                                                                \
+        return;                                                                                 \
+    }                                                                                           \
+} while(0)
+
+/* Builds the shared VLC lookup tables. Called once per process, through pthread_once().
+ */
+static void mpg1_init_vlc_tables(void)
+{
+    MPG1_INIT_VLC_TABLE(mb_addr_increment, __vlc_mb_addr_increment, MPEG1_VLC_MB_ADDR_INCREMENT_BITS);
+    MPG1_INIT_VLC_TABLE(mb_type_i, __vlc_mb_type_i, MPEG1_VLC_MB_TYPE_I_BITS);
+    MPG1_INIT_VLC_TABLE(mb_type_p, __vlc_mb_type_p, MPEG1_VLC_MB_TYPE_P_BITS);
+    MPG1_INIT_VLC_TABLE(mb_type_b, __vlc_mb_type_b, MPEG1_VLC_MB_TYPE_B_BITS);
+    MPG1_INIT_VLC_TABLE(mb_type_d, __vlc_mb_type_d, MPEG1_VLC_MB_TYPE_D_BITS);
+    MPG1_INIT_VLC_TABLE(mb_cb_pattern, __vlc_mb_cb_pattern, MPEG1_VLC_MB_CB_PATTERN_BITS);
+    MPG1_INIT_VLC_TABLE(motion_code, __vlc_motion_code, MPEG1_VLC_MOTION_CODE_BITS);
+    MPG1_INIT_VLC_TABLE(dc_size_luma, __vlc_dc_size_y, MPEG1_VLC_DC_SIZE_LUMA_BITS);
+    MPG1_INIT_VLC_TABLE(dc_size_chroma, __vlc_dc_size_c, MPEG1_VLC_DC_SIZE_CHROMA_BITS);
+    MPG1_INIT_VLC_TABLE(run_levels, __vlc_run_levels, MPEG1_VLC_RUN_LEVELS_BITS);
+}
 
 inline int16_t get_sign(int16_t i)
 {
@@ -21,86 +82,80 @@ inline int16_t get_sign(int16_t i)
     }
 }
 
-MMFRES mpg1_dequantize_intra(int16_t *dct_table_in, int16_t *dct_table_out, int8_t *quant_matrix, int32_t scale)
+/* Builds the dequantization tables of the decoder, for the given quantization matrices
+ * (in raster order). Does nothing if they are the same as the current ones.
+ */
+static void mpg1_set_quant_matrices(MPEG1DecoderContext *dec, const uint8_t *intra, const uint8_t *inter)
 {
-    /* The quantization scale factor is a multiplicative constant applied to all
-     * of the AC coefficients, but not to the DC term.
-     */
-    int x, y, coeff;
+    int scale, i;
 
-    for(x=0; x<8; x++) {
-        for(y=0; y<8; y++) {
-            int8_t ind = y * 8 + x;
-            int8_t zigzag_ind = __zigzag_coords[ind];
+    if(!memcmp(dec->qm_intra, intra, 64) && !memcmp(dec->qm_inter, inter, 64)) {
+        return;
+    }
 
-            /* De-quantize coefficient */
-            coeff = (2 * dct_table_in[zigzag_ind] * scale * quant_matrix[zigzag_ind]) / 16;
+    memcpy(dec->qm_intra, intra, 64);
+    memcpy(dec->qm_inter, inter, 64);
 
-            /* If even, oddify */
-            if((coeff & 1) == 0) {
-                coeff = coeff - get_sign(dct_table_in[zigzag_ind]);
-            }
+    for(scale=0; scale<32; scale++) {
+        for(i=0; i<64; i++) {
+            dec->dq_intra[scale][i] = scale * dec->qm_intra[i];
+            dec->dq_inter[scale][i] = scale * dec->qm_inter[i];
+        }
+    }
+}
 
-            if(coeff > 2047) {
-                coeff = 2047;
-            }
-            if(coeff < -2048) {
-                coeff = -2048;
-            }
+/* Dequantizes a single intra AC coefficient, found at raster position "pos".
+ * "dq" is the dequantization table for the current quant_scale.
+ */
+static inline int16_t mpg1_dequantize_intra(int32_t level, const int16_t *dq, int32_t pos)
+{
+    /* The quantization scale factor is a multiplicative constant applied to all
+     * of the AC coefficients, but not to the DC term. (2 * level * scale * matrix) / 16
+     */
+    int32_t coeff = (level * dq[pos]) / 8;
 
-            dct_table_out[zigzag_ind] = coeff;
-        }
+    /* If even, oddify */
+    if((coeff & 1) == 0) {
+        coeff = coeff - get_sign(level);
     }
 
-    /* Overrule calculation for DC coef. */
-    dct_table_out[0] = dct_table_in[0] * 8;
+    if(coeff > 2047) {
+        coeff = 2047;
+    }
+    if(coeff < -2048) {
+        coeff = -2048;
+    }
 
-    return RC_OK;
+    return coeff;
 }
 
-MMFRES mpg1_dequantize_non_intra(int16_t *dct_table_in, int16_t *dct_table_out, int8_t *quant_matrix, int32_t scale)
+/* Dequantizes a single non-intra coefficient, found at raster position "pos".
+ * "dq" is the dequantization table for the current quant_scale.
+ */
+static inline int16_t mpg1_dequantize_non_intra(int32_t level, const int16_t *dq, int32_t pos)
 {
     /* Since here is no DC coefficient prediction, the nonintra block dequantization function
      * does not distinguish between luminance and chrominance blocks, or between DC and AC coeffs.
      */
-    int8_t sign;
-    int i, j, coeff;
-
-    for(i=0; i<8; i++) {
-        for(j=0; j<8; j++) {
-            int8_t ind = j * 8 + i;
-            int8_t zigzag_ind = __zigzag_coords[ind];
-
-            /* Get sign */
-            //sign = dct_table_in[ind] > 0 ? dct_table_in[ind] == 0 ? 0 : 1 : -1;
-            sign = get_sign(dct_table_in[zigzag_ind]);
+    int8_t sign = get_sign(level);
 
-            /* Resultant DCT coeff  */
-            coeff = (((2 * dct_table_in[zigzag_ind]) + sign) * scale * quant_matrix[zigzag_ind]) / 16;
+    /* Resultant DCT coeff  */
+    int32_t coeff = (((2 * level) + sign) * dq[pos]) / 16;
 
-            /* If even, oddify */
-            if((coeff & 1) == 0) {
-                coeff -= sign;
-            }
-
-            /* Clamp to [-2048..2047] */
-            if(coeff > 2047) {
-                coeff = 2047;
-            }
-            if(coeff < -2048) {
-                coeff = -2048;
-            }
-
-            /* If quantized coeff is zero, force dequantized coeff to zero also */
-            if(dct_table_in[zigzag_ind] == 0) {
-                coeff = 0;
-            }
+    /* If even, oddify */
+    if((coeff & 1) == 0) {
+        coeff -= sign;
+    }
 
-            dct_table_out[zigzag_ind] = coeff;
-        }
+    /* Clamp to [-2048..2047] */
+    if(coeff > 2047) {
+        coeff = 2047;
+    }
+    if(coeff < -2048) {
+        coeff = -2048;
     }
 
-    return RC_OK;
+    return coeff;
 }
 
 /* Positions the bit-stream at the next sequence start code.
@@ -108,23 +163,7 @@ MMFRES mpg1_dequantize_non_intra(int16_t *dct_table_in, int16_t *dct_table_out,
  */
 MMFRES mpg1_next_start_code(MMFBitstream *bs)
 {
-    MMFRES rc;
-    uint32_t bits;
-
-    bitstream_align_to_byte(bs);
-
-    do {
-        bits = bitstream_peek_bits(bs, 32, &rc);
-        if((bits >> 8) == 1) {
-            /* Found */
-            return RC_OK;
-        }
-
-        /* Move to next byte */
-        rc = bitstream_discard_bits(bs, 8);
-    } while(succeeded(rc));
-
-    return rc;
+    return bitstream_next_start_code(bs);
 }
 
 MMFRES mpg1_read_seqence_header(MMFBitstream *bs, MPEG1SeqHeader *target)
@@ -175,12 +214,13 @@ MMFRES mpg1_read_seqence_header(MMFBitstream *bs, MPEG1SeqHeader *target)
     int8_t has_intra_qm;
     has_intra_qm = bitstream_read_bits(bs, 1, NULL);
 
-    //TODO: following load mechanism won't work. Matrix should be load in
-    //zigzag
+    //Matrices are coded in zigzag order, and we keep them in raster order
     if(has_intra_qm) {
         for(i=0; i<64; i++) {
-            //target->quant_matrix_intra[i] = bitstream_read_bits(bs, 8, NULL); //TODO
+            target->quant_matrix_intra[__zigzag_coords[i] / 8][__zigzag_coords[i] % 8] = bitstream_read_bits(bs, 8, NULL);
         }
+    }else {
+        memcpy(target->quant_matrix_intra, __quant_matrix_intra, 64);
     }
 
     //Read quantization matrix flags (and matrix itself) for non-intra-frames
@@ -189,8 +229,10 @@ MMFRES mpg1_read_seqence_header(MMFBitstream *bs, MPEG1SeqHeader *target)
 
     if(has_non_intra_qm) {
         for(i=0; i<64; i++) {
-            //target->quant_matrix_non_intra[i] = bitstream_read_bits(bs, 8, NULL); //TODO
+            target->quant_matrix_non_intra[__zigzag_coords[i] / 8][__zigzag_coords[i] % 8] = bitstream_read_bits(bs, 8, NULL);
         }
+    }else {
+        memcpy(target->quant_matrix_non_intra, __quant_matrix_non_intra, 64);
     }
 
     /*
@@ -353,168 +395,246 @@ MMFRES mpg1_read_slice_header(MMFBitstream *bs, MPEG1SliceHeader *slice)
     slice->last_dc_cb = 0;
     slice->last_dc_cr = 0;
 
+    /* Motion vector prediction starts over in each slice too */
+    slice->mb_count = 0;
+    slice->pmv_fwd.x = slice->pmv_fwd.y = 0;
+    slice->pmv_bwd.x = slice->pmv_bwd.y = 0;
+    slice->last_forward = 0;
+    slice->last_backward = 0;
+    slice->fwd_rows = 0;
+    slice->bwd_rows = 0;
+    slice->first_row = 0;
+
     return RC_OK;
 }
 
-MMFRES mpg1_decode_coeffs(MPEG1DecoderContext *dec, int16_t *dct, int read_dc)
+/*
+ * Decodes the run-levels of a block, and places them dequantized in DCT buffer (in raster order).
+ * The buffer should be zero-filled by the caller. Only the coefficients in the top-left
+ * "kept" x "kept" corner are stored (8 for all of them), the others are only parsed, since
+ * the reduced iDCT doesn't use them. The zigzag position of the last stored coefficient is
+ * returned in "last", so the iDCT can skip the zero part of the block.
+ */
+MMFRES mpg1_decode_coeffs(MPEG1DecoderContext *dec, MMFBitstream *bs, MPEG1MacroblockHeader *mb, int16_t *dct, int read_dc, int32_t kept, int32_t *last)
 {
-    MMFRES rc;
-    RunLevel rl_buff[64];
-    int rl_index = 0;
-    int i;
-    int j;
     uint32_t bits;
-    uint8_t rl_code;
-    int32_t decoded_bytes;
+    int32_t rl_code;
+    int32_t run, level, pos, last_pos = 0;
     int pass=0;
+    int zigzag_idx = 0;
+    const int16_t *dq = mb->t_intra ? dec->dq_intra[mb->quant_scale] : dec->dq_inter[mb->quant_scale];
 
     if(!read_dc) {
         /* If read_dc==false, then DC coeff is already read, and we have to read the following
          * (AC) coeffs.
          */
         pass = 1;
+        zigzag_idx = 1;
     }
 
     /* Decode all run-levels. There is an exception with END_OF_BLOCK code. Since it can't
      * appear before the DC coeff (pass 0), therefore it's code (10) is treated as 0/1 run level.
      * On second pass and so on, it is treated as EOB.
      */
-    while(((bits = bitstream_peek_bits(dec->bs, 2, &rc)) != MPEG2_END_OF_BLOCK) || (pass==0)) {
+    while(((bits = bitstream_show_bits(bs, 2)) != MPEG2_END_OF_BLOCK) || (pass==0)) {
+        /* Running out of data in the middle of a block */
+        if(bs->cache_bits < 2) {
+            return RC_END_OF_STREAM;
+        }
+
         /* Handle '10' and '11' bit strings differently for first coeff */
         if(pass==0) {
-            int8_t bits;
-
-            bits = bitstream_peek_bits(dec->bs, 2, &rc);
-            if(failed(rc)) return rc;
-
             if(bits == 2) { //'10' is run level 0/1
                 rl_code = 2; //map it to '110'
-                bitstream_discard_bits(dec->bs, 2);
+                bitstream_skip_bits(bs, 2);
             }else if(bits == 3) { //'11' is run level 0/-1
                 rl_code = 3; //map it to '111'
-                bitstream_discard_bits(dec->bs, 2);
+                bitstream_skip_bits(bs, 2);
             }else {
                 /* It's neither 10 or 11, so use traditional vlc decoding */
-                vlc_decode_bitstream(dec->bs, dec->vlc_run_levels, 1, &rl_code, &decoded_bytes);
+                rl_code = vlc_table_get_symbol(bs, dec->vlc_run_levels);
             }
         }else {
-            vlc_decode_bitstream(dec->bs, dec->vlc_run_levels, 1, &rl_code, &decoded_bytes);
+            rl_code = vlc_table_get_symbol(bs, dec->vlc_run_levels);
+        }
+
+        if(rl_code == VLC_INVALID_SYMBOL) {
+            return RC_INVALIDDATA;
         }
 
+        /* Symbols are stored as (signed) char in the prefix table */
+        rl_code &= 0xFF;
+
         /* Combinations of run-levels which are not found in vlc_run_level table
          * are coded by escape code, followed by a six-bit code for run length
          * and eight or 16-bit code for level.
          */
         if(rl_code == RL_ESCAPE_CODE) {
-            rl_buff[rl_index].zero_cnt = bitstream_read_bits(dec->bs, 6, &rc);
+            run = bitstream_get_bits(bs, 6);
 
             /* Read level */
-            int32_t l = bitstream_read_bits(dec->bs, 8, &rc);
+            level = bitstream_get_bits(bs, 8);
 
-            if(l == 0) {
-                l = bitstream_read_bits(dec->bs, 8, NULL);
-            }else if(l == 128) {
-                l = (int32_t)bitstream_read_bits(dec->bs, 8, NULL) - 256;
+            if(level == 0) {
+                level = bitstream_get_bits(bs, 8);
+            }else if(level == 128) {
+                level = (int32_t)bitstream_get_bits(bs, 8) - 256;
             }else {
-                l = (l << 24) >> 24;
+                level = (int8_t)level;
             }
+        }else {
+            run = __run_levels[rl_code].zero_cnt;
+            level = __run_levels[rl_code].coeff;
+        }
+
+        pass++;
+
+        /* Skip the zero run, and place the dequantized coefficient */
+        zigzag_idx += run;
+        if(zigzag_idx > 63) {
+            return RC_INVALIDDATA;
+        }
 
-            rl_buff[rl_index].coeff = (int16_t)l;
-            rl_index ++;
+        pos = __zigzag_coords[zigzag_idx++];
 
+        /* Column and row are both below "kept", which is a power of 2 */
+        if(((pos & 7) | (pos >> 3)) >= kept) {
             continue;
         }
 
-        /* Add to run-level array */
-        rl_buff[rl_index++] = __run_levels[rl_code];
-        pass++;
+        last_pos = zigzag_idx - 1;
+
+        if(mb->t_intra) {
+            dct[pos] = mpg1_dequantize_intra(level, dq, pos);
+        }else {
+            dct[pos] = mpg1_dequantize_non_intra(level, dq, pos);
+        }
     }
 
     /* Discard end_of_block bits (10) */
-    bitstream_discard_bits(dec->bs, 2);
+    bitstream_skip_bits(bs, 2);
 
-    /* Decode run-level codes and deploy them to DCT buffer
-     */
-    int zigzag_idx = 0;
-    if(!read_dc) zigzag_idx++;
+    *last = last_pos;
+
+    return RC_OK;
+}
 
-    for(i=0; i<rl_index; i++) {
-        for(j=0; j<rl_buff[i].zero_cnt; j++) {
-            dct[__zigzag_coords[zigzag_idx++]] = 0;
+/*
+ * Skips the AC run-levels of an intra block, up to and including the end_of_block code. The
+ * codes are only measured, nothing is dequantized or stored.
+ */
+static MMFRES mpg1_skip_coeffs(MPEG1DecoderContext *dec, MMFBitstream *bs)
+{
+    int32_t rl_code;
+    int32_t count = 0;
+
+    while(bitstream_show_bits(bs, 2) != MPEG2_END_OF_BLOCK) {
+        /* Running out of data in the middle of a block */
+        if(bs->cache_bits < 2) {
+            return RC_END_OF_STREAM;
+        }
+
+        rl_code = vlc_table_get_symbol(bs, dec->vlc_run_levels);
+        if(rl_code == VLC_INVALID_SYMBOL) {
+            return RC_INVALIDDATA;
         }
-        dct[__zigzag_coords[zigzag_idx++]] = rl_buff[i].coeff;
-    }
 
-    /* Remaining coeffs are filled with zeroes */
-    for(i=zigzag_idx; i<64; i++) {
-        dct[__zigzag_coords[i]] = 0;
+        if((rl_code & 0xFF) == RL_ESCAPE_CODE) {
+            /* Six bits of run, and eight bits of level, or 16 if the first eight are 0 or 128 */
+            int32_t level = bitstream_show_bits(bs, 14) & 0xFF;
+            bitstream_skip_bits(bs, (level == 0 || level == 128) ? 22 : 14);
+        }
+
+        /* There are at most 63 AC coefficients */
+        if(++count > 63) {
+            return RC_INVALIDDATA;
+        }
     }
 
+    /* Discard end_of_block bits (10) */
+    bitstream_skip_bits(bs, 2);
+
     return RC_OK;
 }
 
 /*
- * Reads MPEG-1/2 Block from bitstream.
+ * Reads the DC coefficient of an intra block (size and differential), and reconstructs it
+ * from the prediction. The predictors are reset by the caller, after non-intra macroblocks.
  */
-MMFRES mpg1_read_coded_block(MPEG1DecoderContext *dec, MPEG1MacroblockHeader *mb, MPEG1SliceHeader *s, int8_t pic_type, int8_t block_type, int8_t *dct)
+static MMFRES mpg1_read_intra_dc(MPEG1DecoderContext *dec, MMFBitstream *bs, MPEG1SliceHeader *s, int8_t block_type, int16_t *dc)
 {
     MMFRES rc;
-    int32_t diff;
+    int32_t diff = 0;
     int32_t decoded_symbols;
-    int read_dc;
-    int8_t dc_size;
-    int16_t temp_dct[64], temp_dct2[64];
+    int8_t dc_size = 0;
 
-    if(mb->t_intra) {
-        if(block_type <= MPEG2_BLOCK_TYPE_Y4) {
-            /* Luminance block (Y1 to Y4)
-             */
-            vlc_decode_bitstream(dec->bs, dec->vlc_dc_size_luma, 1, &dc_size, &decoded_symbols);
+    /* Each luminance block's DC coefficient is coded as a difference to the previous Y
+     * block's one, which spans across the macroblocks. Cb and Cr blocks have their own.
+     */
+    if(block_type <= MPEG2_BLOCK_TYPE_Y4) {
+        rc = vlc_decode_table(bs, dec->vlc_dc_size_luma, 1, &dc_size, &decoded_symbols);
+    }else {
+        rc = vlc_decode_table(bs, dec->vlc_dc_size_chroma, 1, &dc_size, &decoded_symbols);
+    }
 
-            /* If size not zero -> read "dc_size" bits, which is delta-DC. Since DC coefficients in neighbour blocks
-             * are likely similar, each Y block's DC coefficient is coded as a difference between the previous Y block's DC,
-             * which spans across the macroblock.
-             */
-            if(dc_size) {
-                diff = bitstream_read_bits(dec->bs, dc_size, &rc);
+    if(failed(rc)) return rc;
 
-                /* If difference is negative, 1 is subtracted.
-                 */
-                if(!(diff & __bit_test[32-dc_size])) {
-                  diff = __bit_mask_r[dc_size] | (diff + 1);
-                }
-                //if(diff >> (dc_size-1) == 0) {
-                //    diff = (0xFFFFFFFF << (dc_size-1)) | (diff + 1);
-                //}
-                *temp_dct = diff;
-            } else {
-                /* If dc_size = 0, it means that DC coeff is zero
-                 */
-                *temp_dct = 0;
-            }
-        }else {
-            /* Chrominance block (CR & CB)
-             */
-            vlc_decode_bitstream(dec->bs, dec->vlc_dc_size_chroma, 1, &dc_size, &decoded_symbols);
+    /* Decoded run-level indexes should not overflow byte boundary. */
+    if(decoded_symbols != 1) {
+        return RC_INVALIDDATA;
+    }
 
-            if(dc_size) {
-                diff = bitstream_read_bits(dec->bs, dc_size, &rc);
-                if(!(diff & __bit_test[32-dc_size])) {
-                  diff = __bit_mask_r[dc_size] | (diff + 1);
-                }
-                //diff = diff << 3;
-                *temp_dct = diff;
-            } else {
-                /* If dc_size = 0, it means that DC coeff is zero
-                 */
-                *temp_dct = 0;
-            }
-        }
+    /* If size not zero -> read "dc_size" bits, which is delta-DC. Otherwise the
+     * difference is zero.
+     */
+    if(dc_size) {
+        diff = bitstream_get_bits(bs, dc_size);
 
-        /* Decoded run-level indexes should not overflow byte boundary. */
-        if(decoded_symbols != 1) {
-            return RC_INVALIDDATA;
+        /* If difference is negative, 1 is subtracted.
+         */
+        if(!(diff & __bit_test[32-dc_size])) {
+          diff = __bit_mask_r[dc_size] | (diff + 1);
         }
+    }
+
+    /* The DC term is not scaled by the quantizer */
+    diff *= 8;
+
+    switch(block_type) {
+    case MPEG2_BLOCK_TYPE_Y1:
+    case MPEG2_BLOCK_TYPE_Y2:
+    case MPEG2_BLOCK_TYPE_Y3:
+    case MPEG2_BLOCK_TYPE_Y4:
+        *dc = s->last_dc_y = s->last_dc_y + diff;
+        break;
+    case MPEG2_BLOCK_TYPE_CB:
+        *dc = s->last_dc_cb = s->last_dc_cb + diff;
+        break;
+    default:
+        *dc = s->last_dc_cr = s->last_dc_cr + diff;
+        break;
+    }
+
+    return RC_OK;
+}
+
+/*
+ * Reads MPEG-1/2 Block from bitstream. The output is the dequantized DCT block, the iDCT
+ * is done by mpg1_read_mb(), straight into the picture. Only the top-left "kept" x "kept"
+ * coefficients are stored (see mpg1_decode_coeffs()). The zigzag position of the last
+ * stored coefficient is returned in "last".
+ */
+MMFRES mpg1_read_coded_block(MPEG1DecoderContext *dec, MMFBitstream *bs, MPEG1MacroblockHeader *mb, MPEG1SliceHeader *s, int8_t pic_type, int8_t block_type, int16_t *dct, int32_t kept, int32_t *last)
+{
+    MMFRES rc = RC_OK;
+    int read_dc;
+
+    memset(dct, 0, 64 * sizeof(int16_t));
+
+    if(mb->t_intra) {
+        /* Perform DC prediction. It applies to intra macroblocks of all picture types. */
+        rc = mpg1_read_intra_dc(dec, bs, s, block_type, dct);
+        if(failed(rc)) return rc;
 
         read_dc = 0;
     } else { /* If non_intra mb */
@@ -524,236 +644,356 @@ MMFRES mpg1_read_coded_block(MPEG1DecoderContext *dec, MPEG1MacroblockHeader *mb
         read_dc = 1;
     }
 
-    /* For D-frames, AC coeffs and EOB code are skipped.
-     */
     if(pic_type == MPEG2_FRAME_TYPE_D) {
-        return RC_OK;
-    }
-
-    /* Read DCT coeffs. If read_dc==0 it will treat '10' bit-sequence as EOB.
-     * Otherwise the first-appeared '10' will be treated as run level 1/1, and
-     * all the following '10' will be treated as EOB.
-     */
-    rc = mpg1_decode_coeffs(dec, temp_dct, read_dc);
-
-    /* Dequantize */
-    if(mb->t_intra) {
-        mpg1_dequantize_intra(temp_dct, temp_dct2, dec->qm_intra, mb->quant_scale);
-
-        if(pic_type == MPEG2_FRAME_TYPE_I) {
-			/* Perform DC prediction
-			 */
-			switch(block_type) {
-			case MPEG2_BLOCK_TYPE_Y1:
-			case MPEG2_BLOCK_TYPE_Y2:
-			case MPEG2_BLOCK_TYPE_Y3:
-			case MPEG2_BLOCK_TYPE_Y4:
-				temp_dct2[0] += s->last_dc_y;
-				s->last_dc_y = temp_dct2[0];
-				break;
-			case MPEG2_BLOCK_TYPE_CB:
-				temp_dct2[0] += s->last_dc_cb;
-				s->last_dc_cb = temp_dct2[0];
-				break;
-			case MPEG2_BLOCK_TYPE_CR:
-				temp_dct2[0] += s->last_dc_cr;
-				s->last_dc_cr = temp_dct2[0];
-				break;
-			}
-        }
+        /* For D-frames, AC coeffs and EOB code are skipped.
+         */
+        *last = 0;
     }else {
-        mpg1_dequantize_non_intra(temp_dct, temp_dct2, dec->qm_inter, mb->quant_scale);
+        /* Read DCT coeffs. If read_dc==0 it will treat '10' bit-sequence as EOB.
+         * Otherwise the first-appeared '10' will be treated as run level 1/1, and
+         * all the following '10' will be treated as EOB.
+         */
+        rc = mpg1_decode_coeffs(dec, bs, mb, dct, read_dc, kept, last);
+        if(failed(rc)) return rc;
     }
 
-    /* Perform iDCT */
-    //mpg1_idct_2d(temp_dct);
-    mmf_idct(temp_dct2);
+    return rc;
+}
 
+/* Fills a block of "size" x "size" pixels with a single value (the iDCT of DC-only block),
+ * clamped to [0..255]
+ */
+static inline void mpg1_put_block_dc(uint8_t *dst, int32_t stride, int32_t size, int32_t value)
+{
     int i;
 
-    /* Copy-back temp buffer and clamp values between [0..255] */
-    for(i=0; i<64; i++) {
-        if(temp_dct2[i] > 255) {
-            dct[i] = 255;
-        }else if(temp_dct2[i] < 0) {
-            dct[i] = 0;
-        }else {
-            dct[i] = temp_dct2[i];
-        }
+    value = value > 255 ? 255 : value < 0 ? 0 : value;
+
+    for(i=0; i<size; i++) {
+        memset(dst + i * stride, value, size);
     }
+}
 
-    return rc;
+/* Adds a value to a block of the prediction, with clamping to [0..255] (the residual of DC-only block) */
+static inline void mpg1_add_block_dc(uint8_t *dst, int32_t stride, int32_t size, int32_t value)
+{
+    int i, j;
+
+    for(i=0; i<size; i++, dst += stride) {
+        for(j=0; j<size; j++) {
+            int32_t v = dst[j] + value;
+            dst[j] = v > 255 ? 255 : v < 0 ? 0 : v;
+        }
+    }
 }
 
-/* Reads a motion vector inside a macroblock header */
-MMFRES mpg1_read_mb_motion_vector(MPEG1DecoderContext *dec, MPEG1Picture *pic, MPEG1MacroblockHeader *mb, int32_t mb_address, int fwd)
+/*
+ * Reads one component of a motion vector (motion code and residual), and reconstructs it
+ * by adding the decoded difference to the predictor. The result wraps around, so it stays
+ * in the range of the f_code.
+ */
+static MMFRES mpg1_read_motion_component(MPEG1DecoderContext *dec, MMFBitstream *bs, int32_t f_code, int8_t *code, int8_t *residual, int16_t *pmv)
 {
     int32_t decoded_bytes;
-    int8_t f, r, residual_size, motion_residual;
-    int8_t sign;
-    int32_t dMD;
+    int32_t r_size = f_code - 1;
+    int32_t f = 1 << r_size;
+    int32_t delta, v;
     MMFRES rc;
 
-    /* TODO: Calculate MOTION DISPLACEMENT
-     */
+    /* Motion code ranges between [-16..+16] */
+    rc = vlc_decode_table(bs, dec->vlc_motion_code, 1, code, &decoded_bytes);
+    if(failed(rc)) return rc;
 
-    if(fwd) {
-        /* Decode horizontal forward motion vector. It ranges between [-16..+16] */
-        vlc_decode_bitstream(dec->bs, dec->vlc_motion_code, 1, &mb->mv_fwd.horiz, &decoded_bytes);
+    if(decoded_bytes != 1) {
+        return RC_END_OF_STREAM;
+    }
 
-        //motion_residual = ???
-        residual_size = pic->hdr.forward_f_code - 1;
-        f = 1 << residual_size;
-        mmf_assert(f>=1);
+    *residual = 0;
 
-        if((f != 1) && (mb->mv_fwd.horiz != 0)) {
-            /* Read "r_size" bits */
-            r = bitstream_read_bits(dec->bs, residual_size, &rc);
-            if(failed(rc)) return rc;
+    if(*code == 0) {
+        /* Same as the predictor */
+        return RC_OK;
+    }
 
-            /* The principal part, which we designate by dMB is signed int, given by product
-             * of motionc_code x f */
-            dMD = 1 + f * (abs(mb->mv_fwd.horiz) - 1);
+    if(f != 1) {
+        *residual = bitstream_get_bits(bs, r_size);
+    }
 
-            /* The residual is a positive integer */
-            //r = abs(dMDp) - abs(dMD);
+    /* The principal part is (|code| - 1) * f, the residual refines it */
+    delta = ((abs(*code) - 1) << r_size) + *residual + 1;
+    if(*code < 0) {
+        delta = -delta;
+    }
 
-            //dMD = dMD + r;
+    v = *pmv + delta;
 
-            //mb->mv_fwd.horiz = dMB + PMD;
-            //range = 32 * f;
+    if(v > 16 * f - 1) {
+        v -= 32 * f;
+    }else if(v < -16 * f) {
+        v += 32 * f;
+    }
 
-            /*
-            if(MD > max) {
-                MD = MD - range;
-            }
-            if(MD < min) {
-                MD = MD + range;
-            }
-            */
-        }
-        //PMD = ...
-        //pic->mv_forward[mb_address] = PMD;
+    *pmv = v;
+    return RC_OK;
+}
 
-        /* Decode vertical forward motion vector */
-        vlc_decode_bitstream(dec->bs, dec->vlc_motion_code, 1, &mb->mv_fwd.vert, &decoded_bytes);
+/* Reads a motion vector inside a macroblock header, and reconstructs it into the
+ * predictor of the slice.
+ */
+MMFRES mpg1_read_mb_motion_vector(MPEG1DecoderContext *dec, MMFBitstream *bs, MPEG1Picture *pic, MPEG1SliceHeader *slice, MPEG1MacroblockHeader *mb, int fwd)
+{
+    MPEG1MacroblockMotionVector *mv = fwd ? &mb->mv_fwd : &mb->mv_bwd;
+    MPEG1MotionVector *pmv = fwd ? &slice->pmv_fwd : &slice->pmv_bwd;
+    int32_t f_code = fwd ? pic->hdr.forward_f_code : pic->hdr.backward_f_code;
+    MMFRES rc;
 
-        if((f != 1) && (mb->mv_fwd.vert != 0)) {
-            /* Read "r_size" bits */
-            r = bitstream_read_bits(dec->bs, residual_size, &rc);
-            if(failed(rc)) return rc;
+    if(f_code < 1 || f_code > 7) {
+        return RC_INVALIDDATA;
+    }
 
-            //TODO
-        }
-    }else {
-        /* Decode horizontal backward motion vector */
-        vlc_decode_bitstream(dec->bs, dec->vlc_motion_code, 1, &mb->mv_bwd.horiz, &decoded_bytes);
+    rc = mpg1_read_motion_component(dec, bs, f_code, &mv->horiz, &mv->horiz_r, &pmv->x);
+    if(failed(rc)) return rc;
 
-        if(pic->hdr.backward_f_code != 1 && mb->mv_bwd.horiz) {
-            residual_size = pic->hdr.forward_f_code - 1;
-            f = (int8_t)pow(2, residual_size);
+    return mpg1_read_motion_component(dec, bs, f_code, &mv->vert, &mv->vert_r, &pmv->y);
+}
 
-            /* Read "r_size" bits */
-            r = bitstream_read_bits(dec->bs, residual_size, &rc);
-            if(failed(rc)) return rc;
+/* Copies a block of a plane, which reaches out of it, with the edge pixels repeated */
+static const uint8_t* mpg1_emulate_edge(uint8_t *buf, int32_t buf_stride, const uint8_t *plane, int32_t stride,
+                                        int32_t x, int32_t y, int32_t w, int32_t h, int32_t plane_w, int32_t plane_h)
+{
+    int32_t i, j;
 
-            //TODO: decode mv_bwd.horiz_r
-            return RC_FALSE;
+    for(j=0; j<h; j++) {
+        int32_t sy = y + j < 0 ? 0 : y + j >= plane_h ? plane_h - 1 : y + j;
+
+        for(i=0; i<w; i++) {
+            int32_t sx = x + i < 0 ? 0 : x + i >= plane_w ? plane_w - 1 : x + i;
+            buf[j * buf_stride + i] = plane[sy * stride + sx];
         }
+    }
+
+    return buf;
+}
 
-        /* Decode vertical backward motion vector */
-        vlc_decode_bitstream(dec->bs, dec->vlc_motion_code, 1, &mb->mv_bwd.vert, &decoded_bytes);
+/* Predicts a block of one plane, at a vector in half pels of that plane */
+static void mpg1_predict_block(MMFMCFunc *put, uint8_t *dst, int32_t dst_stride, const uint8_t *plane, int32_t stride,
+                               int32_t x, int32_t y, int32_t size, int32_t mv_x, int32_t mv_y, int32_t plane_w, int32_t plane_h)
+{
+    uint8_t edge[17 * 17];
+    int32_t half = ((mv_y & 1) << 1) | (mv_x & 1);
 
-        if(pic->hdr.backward_f_code != 1 && mb->mv_bwd.vert) {
-            residual_size = pic->hdr.forward_f_code - 1;
-            f = (int8_t)pow(2, residual_size);
+    x += mv_x >> 1;
+    y += mv_y >> 1;
 
-            /* Read "r_size" bits */
-            r = bitstream_read_bits(dec->bs, residual_size, &rc);
-            if(failed(rc)) return rc;
+    if(x < 0 || y < 0 || x + size + (half & 1) > plane_w || y + size + (half >> 1) > plane_h) {
+        /* Vectors shouldn't point out of the picture, but damaged streams can do it */
+        put[half](dst, dst_stride, mpg1_emulate_edge(edge, 17, plane, stride, x, y, size + 1, size + 1, plane_w, plane_h), 17, size);
+    }else {
+        put[half](dst, dst_stride, plane + y * stride + x, stride, size);
+    }
+}
 
-            //TODO: decode mv_bwd.vert_r
-            return RC_FALSE;
+/*
+ * Forms the prediction of a macroblock from a reference picture, at the given vector. The
+ * vector is in the units of the picture (full pels if "full_pel" is set, half pels otherwise).
+ * If "avg" is set, the prediction is averaged with the one already in the macroblock.
+ * With frame threads the reference might be still decoded, so it waits for the rows it reads.
+ */
+static void mpg1_predict_mb(MPEG1DecoderContext *dec, MPEG1Picture *pic, MPEG1Picture *ref, int32_t *ref_rows,
+                            int32_t mb_x, int32_t mb_y, MPEG1MotionVector mv, int8_t full_pel, int8_t avg)
+{
+    int32_t mb_width = dec->seq_hdr->mb_width;
+    int32_t mb_height = dec->seq_hdr->mb_height;
+    int32_t lowres = pic->lowres;
+    int32_t y_size = 16 >> lowres;
+    int32_t c_size = 8 >> lowres;
+    uint8_t *y_dst = pic->Y_plane + (mb_y * pic->Y_stride + mb_x) * y_size;
+    uint8_t *u_dst = pic->U_plane + (mb_y * pic->UV_stride + mb_x) * c_size;
+    uint8_t *v_dst = pic->V_plane + (mb_y * pic->UV_stride + mb_x) * c_size;
+    MMFMCFunc (*mc)[4] = avg ? mmf_mc_funcs.avg : mmf_mc_funcs.put;
+    int32_t i, rows, bottom;
+
+    if(ref == NULL) {
+        if(avg) {
+            /* Keep the other prediction */
+            return;
         }
+
+        /* The reference is missing (e.g. the stream starts with a P picture). Predict grey. */
+        for(i=0; i<y_size; i++) memset(y_dst + i * pic->Y_stride, 128, y_size);
+        for(i=0; i<c_size; i++) memset(u_dst + i * pic->UV_stride, 128, c_size);
+        for(i=0; i<c_size; i++) memset(v_dst + i * pic->UV_stride, 128, c_size);
+        return;
     }
 
-    return RC_OK;
+    int32_t mv_x = mv.x * (1 << full_pel);
+    int32_t mv_y = mv.y * (1 << full_pel);
+    int32_t round = (1 << lowres) >> 1;
+
+    /* Chrominance vectors are the halves of the luminance ones, rounded towards zero */
+    int32_t cmv_x = mv_x / 2;
+    int32_t cmv_y = mv_y / 2;
+
+    /* Wait for the reference rows, the luminance and chrominance blocks read */
+    bottom = mb_y * 16 + (mv_y >> 1) + 16 + (mv_y & 1) - 1;
+    rows = bottom / 16;
+
+    bottom = mb_y * 8 + (cmv_y >> 1) + 8 + (cmv_y & 1) - 1;
+    if(bottom / 8 > rows) rows = bottom / 8;
+
+    rows = rows < 0 ? 1 : rows + 1;
+    if(rows > mb_height) rows = mb_height;
+
+    if(*ref_rows < rows) {
+        *ref_rows = mpg1_picture_await_rows(dec, ref, rows);
+    }
+
+    /* At reduced resolution, the blocks are smaller, and the vectors are rounded down
+     * to half pels of the smaller planes.
+     */
+    mpg1_predict_block(mc[MC_BLOCK_16 + lowres], y_dst, pic->Y_stride, ref->Y_plane, ref->Y_stride,
+                       mb_x * y_size, mb_y * y_size, y_size, (mv_x + round) >> lowres, (mv_y + round) >> lowres, mb_width * y_size, mb_height * y_size);
+    mpg1_predict_block(mc[MC_BLOCK_8 + lowres], u_dst, pic->UV_stride, ref->U_plane, ref->UV_stride,
+                       mb_x * c_size, mb_y * c_size, c_size, (cmv_x + round) >> lowres, (cmv_y + round) >> lowres, mb_width * c_size, mb_height * c_size);
+    mpg1_predict_block(mc[MC_BLOCK_8 + lowres], v_dst, pic->UV_stride, ref->V_plane, ref->UV_stride,
+                       mb_x * c_size, mb_y * c_size, c_size, (cmv_x + round) >> lowres, (cmv_y + round) >> lowres, mb_width * c_size, mb_height * c_size);
+}
+
+/*
+ * Forms the prediction of a non-intra macroblock, in the directions of the slice's last
+ * macroblock, with the vectors in the slice's predictors.
+ */
+static void mpg1_predict_inter_mb(MPEG1DecoderContext *dec, MPEG1Picture *pic, MPEG1SliceHeader *slice, int32_t addr)
+{
+    int32_t mb_x = addr % dec->seq_hdr->mb_width;
+    int32_t mb_y = addr / dec->seq_hdr->mb_width;
+
+    /* Bidirectional macroblocks average the backward prediction into the forward one */
+    if(slice->last_forward) {
+        mpg1_predict_mb(dec, pic, pic->ref_fwd, &slice->fwd_rows, mb_x, mb_y, slice->pmv_fwd, pic->hdr.forward_vec_full_pel, 0);
+        pic->mv_forward[addr] = slice->pmv_fwd;
+    }
+
+    if(slice->last_backward) {
+        mpg1_predict_mb(dec, pic, pic->ref_bwd, &slice->bwd_rows, mb_x, mb_y, slice->pmv_bwd, pic->hdr.backward_vec_full_pel,
+                        slice->last_forward && pic->ref_fwd);
+        pic->mv_backward[addr] = slice->pmv_bwd;
+    }
 }
 
 /*
- * Reads MPEG-1/2 Macroblock header from bitstream.
+ * Reads MPEG-1/2 Macroblock header from bitstream, and reconstructs the macroblock (with
+ * the skipped ones before it).
  */
-MMFRES mpg1_read_mb(MPEG1DecoderContext *dec, MPEG1Picture *pic, MPEG1SliceHeader *slice, MPEG1MacroblockHeader *mb, int32_t mb_address, int8_t *y, int8_t *u, int8_t *v)
+MMFRES mpg1_read_mb(MPEG1DecoderContext *dec, MMFBitstream *bs, MPEG1Picture *pic, MPEG1SliceHeader *slice, MPEG1MacroblockHeader *mb, int32_t mb_address)
 {
     MMFRES rc;
-    uint8_t type;
+    uint8_t type, increment;
     int escape_cnt = 0;
     int decoded_bytes;
     int i;
 
+    /* Full (not sparse) blocks are gathered in pairs here, for the two-block iDCT */
+    int16_t coeffs[2][64] __attribute__((aligned(32)));
+    uint8_t *coded_dst[2];
+    int32_t coded_stride[2];
+    int coded_cnt = 0;
+    int32_t last;
+
     /* Discard stuffing bits */
-    while(bitstream_peek_bits(dec->bs, 11, &rc) == 0x0F) { //0000 0001 111
-        bitstream_discard_bits(dec->bs, 11);
+    while(bitstream_show_bits(bs, 11) == 0x0F) { //0000 0001 111
+        bitstream_skip_bits(bs, 11);
     }
 
     /* Handle escape codes */
-    while(bitstream_peek_bits(dec->bs, 11, &rc) == 0x08) { //0000 0001 000
+    while(bitstream_show_bits(bs, 11) == 0x08) { //0000 0001 000
         escape_cnt++;
-        bitstream_discard_bits(dec->bs, 11);
+        bitstream_skip_bits(bs, 11);
     }
 
     /* Decode macroblock address increment (1 to 11 bits), using VLC decoder */
-    vlc_decode_bitstream(dec->bs, dec->vlc_mb_addr_increment, 1, &mb->address_increment, &decoded_bytes);
+    rc = vlc_decode_table(bs, dec->vlc_mb_addr_increment, 1, &increment, &decoded_bytes);
+    if(failed(rc)) return rc;
+
+    if(decoded_bytes != 1) {
+        return RC_END_OF_STREAM;
+    }
 
     /* Calculate total macroblock address increment */
-    mb->address_increment += 33 * escape_cnt;
+    mb->address_increment = increment + 33 * escape_cnt;
 
     /* Finds actual YUV buffer offsets, for this particular mb address */
-    int8_t *y_offs = y + (mb->address_increment + mb_address) * 64 * 4;
-    int8_t *u_offs = u + (mb->address_increment + mb_address) * 64;
-    int8_t *v_offs = v + (mb->address_increment + mb_address) * 64;
-
-	/* If there are macroblocks skipped, reset DC prediction values */
-	if(mb->address_increment != 1) {
-		slice->last_dc_y = 1024;
-		slice->last_dc_cb = 1024;
-		slice->last_dc_cr = 1024;
-	}
+    int32_t addr = mb_address + mb->address_increment;
+    int32_t mb_x = addr % dec->seq_hdr->mb_width;
+    int32_t mb_y = addr / dec->seq_hdr->mb_width;
 
-    #ifdef DEBUG
-    /* addr increment should decode to a value between 1 and 33 */
-    mmf_assert(decoded_bytes == 1);
-    #endif //DEBUG
+    if(addr < 0 || mb_y >= dec->seq_hdr->mb_height) {
+        return RC_INVALIDDATA;
+    }
 
-    /* Decode macroblock type (1 to 6 bits) */
-    switch (pic->hdr.frame_type) {
-    case MPEG2_FRAME_TYPE_I:
-        vlc_decode_bitstream(dec->bs, dec->vlc_mb_type_i, 1, &type, &decoded_bytes);
+    /* Size of the blocks in the picture, smaller at reduced resolution */
+    int32_t block_size = 8 >> pic->lowres;
+
+    uint8_t *y_offs = pic->Y_plane + (mb_y * pic->Y_stride + mb_x) * block_size * 2;
+    uint8_t *u_offs = pic->U_plane + (mb_y * pic->UV_stride + mb_x) * block_size;
+    uint8_t *v_offs = pic->V_plane + (mb_y * pic->UV_stride + mb_x) * block_size;
 
-        #ifdef DEBUG
-        if(type != 0x10 && type != 0x11) {
+    /* The increment of the first macroblock of a slice only gives it's position. Otherwise
+     * the macroblocks in between are skipped, and they are predicted without residual.
+     */
+    if(mb->address_increment != 1 && slice->mb_count > 0) {
+        if(pic->hdr.frame_type == MPEG2_FRAME_TYPE_I || pic->hdr.frame_type == MPEG2_FRAME_TYPE_D) {
+            /* Intra pictures have no skipped macroblocks */
             return RC_INVALIDDATA;
         }
-        #endif // DEBUG
 
+        /* Skipped macroblocks of P pictures have zero vector. The ones of B pictures repeat
+         * the prediction of the macroblock before them.
+         */
+        if(pic->hdr.frame_type == MPEG2_FRAME_TYPE_P) {
+            slice->pmv_fwd.x = slice->pmv_fwd.y = 0;
+            slice->last_forward = 1;
+            slice->last_backward = 0;
+        }
+
+        for(i=mb_address+1; i<addr; i++) {
+            if(i / dec->seq_hdr->mb_width >= slice->first_row) {
+                mpg1_predict_inter_mb(dec, pic, slice, i);
+            }
+        }
+
+        /* Reset DC prediction values */
+        slice->last_dc_y = 0;
+        slice->last_dc_cb = 0;
+        slice->last_dc_cr = 0;
+    }
+
+    slice->mb_count++;
+
+    /* Decode macroblock type (1 to 6 bits) */
+    switch (pic->hdr.frame_type) {
+    case MPEG2_FRAME_TYPE_I:
+        rc = vlc_decode_table(bs, dec->vlc_mb_type_i, 1, &type, &decoded_bytes);
         break;
     case MPEG2_FRAME_TYPE_P:
-        vlc_decode_bitstream(dec->bs, dec->vlc_mb_type_p, 1, &type, &decoded_bytes);
+        rc = vlc_decode_table(bs, dec->vlc_mb_type_p, 1, &type, &decoded_bytes);
         break;
     case MPEG2_FRAME_TYPE_B:
-        vlc_decode_bitstream(dec->bs, dec->vlc_mb_type_b, 1, &type, &decoded_bytes);
+        rc = vlc_decode_table(bs, dec->vlc_mb_type_b, 1, &type, &decoded_bytes);
         break;
     case MPEG2_FRAME_TYPE_D:
-        vlc_decode_bitstream(dec->bs, dec->vlc_mb_type_d, 1, &type, &decoded_bytes);
+        rc = vlc_decode_table(bs, dec->vlc_mb_type_d, 1, &type, &decoded_bytes);
         break;
     default:
         return RC_INVALIDDATA;
     }
 
-    #ifdef DEBUG
-    //type should decode to 1 byte value, containing 5 bit flags
-    mmf_assert(decoded_bytes == 1);
-    #endif //DEBUG
+    if(failed(rc)) return rc;
+
+    //type should decode to 1 byte value, containing 5 bit flags
+    if(decoded_bytes != 1) {
+        return RC_END_OF_STREAM;
+    }
 
     /* Extract each flags from bit field */
     mb->t_intra = type & 0x10; //10000
@@ -762,14 +1002,9 @@ MMFRES mpg1_read_mb(MPEG1DecoderContext *dec, MPEG1Picture *pic, MPEG1SliceHeade
     mb->t_motion_forward = type & 0x02; //00010
     mb->t_quant = type & 0x01; //00001
 
-    /* For intra macroblocks address incremen should be always 1 */
-    if((pic->hdr.frame_type == MPEG2_FRAME_TYPE_I) && (mb->address_increment != 1)) {
-        return RC_INVALIDDATA;
-    }
-
     /* Read quantization scale factor */
     if(mb->t_quant) {
-        mb->quant_scale = bitstream_read_bits(dec->bs, 5, &rc);
+        mb->quant_scale = bitstream_get_bits(bs, 5);
         slice->quant_scale = mb->quant_scale; //???
     }else {
         mb->quant_scale = slice->quant_scale;
@@ -777,19 +1012,20 @@ MMFRES mpg1_read_mb(MPEG1DecoderContext *dec, MPEG1Picture *pic, MPEG1SliceHeade
 
     /* Read forward motion vector */
     if(mb->t_motion_forward) {
-        rc = mpg1_read_mb_motion_vector(dec, pic, mb, mb_address, 1);
+        rc = mpg1_read_mb_motion_vector(dec, bs, pic, slice, mb, 1);
         if(failed(rc)) return rc;
     }
 
     /* Read backward motion vector */
     if(mb->t_motion_backward) {
-        rc = mpg1_read_mb_motion_vector(dec, pic, mb, mb_address, 0);
+        rc = mpg1_read_mb_motion_vector(dec, bs, pic, slice, mb, 0);
         if(failed(rc)) return rc;
     }
 
     /* Read coded block pattern */
     if(mb->t_pattern) {
-        vlc_decode_bitstream(dec->bs, dec->vlc_mb_cb_pattern, 1, &mb->coded_block_pattern, &decoded_bytes);
+        rc = vlc_decode_table(bs, dec->vlc_mb_cb_pattern, 1, &mb->coded_block_pattern, &decoded_bytes);
+        if(failed(rc)) return rc;
     }else {
         if(mb->t_intra) {
             /* Documentation: Note that for intra-coded macroblocks pattern_code[i] is always one. */
@@ -799,6 +1035,37 @@ MMFRES mpg1_read_mb(MPEG1DecoderContext *dec, MPEG1Picture *pic, MPEG1SliceHeade
         }
     }
 
+    if(mb->t_intra) {
+        /* Intra macroblocks reset the motion vector prediction */
+        slice->pmv_fwd.x = slice->pmv_fwd.y = 0;
+        slice->pmv_bwd.x = slice->pmv_bwd.y = 0;
+        slice->last_forward = 0;
+        slice->last_backward = 0;
+    }else {
+        if(pic->hdr.frame_type == MPEG2_FRAME_TYPE_P) {
+            /* P macroblocks without motion vector are predicted with zero vector */
+            if(!mb->t_motion_forward) {
+                slice->pmv_fwd.x = slice->pmv_fwd.y = 0;
+            }
+
+            slice->last_forward = 1;
+            slice->last_backward = 0;
+        }else {
+            slice->last_forward = mb->t_motion_forward;
+            slice->last_backward = mb->t_motion_backward;
+        }
+
+        /* The residual of the blocks is added to the prediction */
+        if(mb_y >= slice->first_row) {
+            mpg1_predict_inter_mb(dec, pic, slice, addr);
+        }
+
+        /* DC prediction of intra blocks starts over after non-intra macroblocks */
+        slice->last_dc_y = 0;
+        slice->last_dc_cb = 0;
+        slice->last_dc_cr = 0;
+    }
+
     /* Read and decode block data */
     for(i=0; i<6; i++) {
         if(!((mb->coded_block_pattern >> (5-i)) & 1)) {
@@ -808,26 +1075,91 @@ MMFRES mpg1_read_mb(MPEG1DecoderContext *dec, MPEG1Picture *pic, MPEG1SliceHeade
             continue;
         }
 
-        int8_t *dct_ptr;
+        uint8_t *dct_ptr;
+        int32_t stride = pic->Y_stride;
 
-        /* Get pointer in DCT table for corresponding block. */
+        /* Get pointer in the picture for corresponding block. Y blocks are
+         * ordered left to right, top to bottom inside the macroblock.
+         */
         switch(i) {
             case MPEG2_BLOCK_TYPE_Y1: dct_ptr = y_offs; break;
-            case MPEG2_BLOCK_TYPE_Y2: dct_ptr = y_offs + 64; break;
-            case MPEG2_BLOCK_TYPE_Y3: dct_ptr = y_offs + 128; break;
-            case MPEG2_BLOCK_TYPE_Y4: dct_ptr = y_offs + 192; break;
-            case MPEG2_BLOCK_TYPE_CB: dct_ptr = u_offs; break;
-            case MPEG2_BLOCK_TYPE_CR: dct_ptr = v_offs; break;
+            case MPEG2_BLOCK_TYPE_Y2: dct_ptr = y_offs + block_size; break;
+            case MPEG2_BLOCK_TYPE_Y3: dct_ptr = y_offs + block_size * stride; break;
+            case MPEG2_BLOCK_TYPE_Y4: dct_ptr = y_offs + block_size * stride + block_size; break;
+            case MPEG2_BLOCK_TYPE_CB: dct_ptr = u_offs; stride = pic->UV_stride; break;
+            default:                  dct_ptr = v_offs; stride = pic->UV_stride; break;
         }
 
         /* Decode block */
-        rc = mpg1_read_coded_block(dec, mb, slice, pic->hdr.frame_type, i, dct_ptr);
+        rc = mpg1_read_coded_block(dec, bs, mb, slice, pic->hdr.frame_type, i, coeffs[coded_cnt], block_size, &last);
         if (failed(rc)) return rc; //...?!
+
+        if(mb_y < slice->first_row) {
+            /* Above the region of interest, the blocks are only parsed */
+            continue;
+        }
+
+        if(pic->lowres) {
+            /* Reduced resolution blocks are transformed one by one, from their low frequencies.
+             * The ones with only a DC left (all of them at 1/8) are filled, like at full size.
+             */
+            if(last == 0) {
+                if(mb->t_intra) {
+                    mpg1_put_block_dc(dct_ptr, stride, block_size, mmf_dct_funcs.idct_dc(coeffs[0][0]));
+                }else {
+                    mpg1_add_block_dc(dct_ptr, stride, block_size, mmf_dct_funcs.idct_dc(coeffs[0][0]) - 128);
+                }
+            }else if(mb->t_intra) {
+                mmf_idct_scaled_put(coeffs[0], dct_ptr, stride, pic->lowres);
+            }else {
+                mmf_idct_scaled_add(coeffs[0], dct_ptr, stride, pic->lowres);
+            }
+            continue;
+        }
+
+        /* Sparse blocks (most of the inter ones) are transformed right away, with the
+         * reduced routines. The rest are transformed in pairs. Intra blocks are stored,
+         * the residual of the others is added to the prediction.
+         */
+        if(last == 0) {
+            if(mb->t_intra) {
+                mpg1_put_block_dc(dct_ptr, stride, 8, mmf_dct_funcs.idct_dc(coeffs[coded_cnt][0]));
+            }else {
+                mpg1_add_block_dc(dct_ptr, stride, 8, mmf_dct_funcs.idct_dc(coeffs[coded_cnt][0]) - 128);
+            }
+        }else if(last < MPEG1_IDCT_4X4_LAST) {
+            if(mb->t_intra) {
+                mmf_dct_funcs.idct_put_4x4(coeffs[coded_cnt], dct_ptr, stride);
+            }else {
+                mmf_dct_funcs.idct_add_4x4(coeffs[coded_cnt], dct_ptr, stride);
+            }
+        }else {
+            coded_dst[coded_cnt] = dct_ptr;
+            coded_stride[coded_cnt++] = stride;
+
+            if(coded_cnt == 2) {
+                if(mb->t_intra) {
+                    mmf_dct_funcs.idct_put_x2(coeffs[0], coded_dst[0], coded_stride[0], coded_dst[1], coded_stride[1]);
+                }else {
+                    mmf_dct_funcs.idct_add_x2(coeffs[0], coded_dst[0], coded_stride[0], coded_dst[1], coded_stride[1]);
+                }
+                coded_cnt = 0;
+            }
+        }
+    }
+
+    /* Remaining unpaired block */
+    if(coded_cnt) {
+        if(mb->t_intra) {
+            mmf_dct_funcs.idct_put(coeffs[0], coded_dst[0], coded_stride[0]);
+        }else {
+            mmf_dct_funcs.idct_add(coeffs[0], coded_dst[0], coded_stride[0]);
+        }
     }
 
     /* For D pictures read 1 bit which marks the end of D-picture macroblock */
     if(pic->hdr.frame_type == MPEG2_FRAME_TYPE_D) {
-        i = bitstream_read_bits(dec->bs, 1, &rc);
+        i = bitstream_read_bits(bs, 1, &rc);
         if(i != 1) {
             /* Error in bitstream */
             return RC_INVALIDDATA;
@@ -878,46 +1210,277 @@ MMFRES mpg2_read_sequence_header_ex(MMFBitstream *bs, MPEG1SeqHeader *target)
 }
 */
 
+static void mpg1_pool_put(MPEG1PicturePool *pool, MPEG1Picture *p);
+
+MMFRES mpg1_picture_unref(MPEG1Picture **pic);
+
 MMFRES mpg1_picture_free(MPEG1Picture **pic)
 {
-    //TODO
+    MPEG1Picture *p = *pic;
+
+    if(p == NULL) {
+        /* Already freed */
+        return RC_OK;
+    }
+
+    mmf_free(p->buffers[0]);
+    mmf_free(p->buffers[1]);
+    mmf_free(p->buffers[2]);
+
+    mmf_free(p->mv_backward);
+    mmf_free(p->mv_forward);
+
+    mpg1_picture_unref(&p->ref_fwd);
+    mpg1_picture_unref(&p->ref_bwd);
+
+    mmf_free(p);
+    *pic = NULL;
+
+    return RC_OK;
+}
+
+/* Releases a reference to a picture. Without references, it returns to it's pool, or it
+ * is freed if it has none.
+ */
+MMFRES mpg1_picture_unref(MPEG1Picture **pic)
+{
+    MPEG1Picture *p = *pic;
+
+    if(p == NULL) {
+        return RC_OK;
+    }
+
+    *pic = NULL;
+
+    if(--p->refs > 0) {
+        return RC_OK;
+    }
+
+    if(p->pool) {
+        mpg1_pool_put(p->pool, p);
+        return RC_OK;
+    }
+
+    return mpg1_picture_free(&p);
+}
+
+/*
+ * Points the planes of a picture to the sample's planes, so it is decoded directly there,
+ * or to it's own planes if "sample" is NULL. Either way the planes should span whole macroblocks.
+ */
+static void mpg1_picture_set_planes(MPEG1Picture *p, MMFSample *sample)
+{
+    if(sample) {
+        p->Y_plane = sample->buffer_data[0];
+        p->U_plane = sample->buffer_data[1];
+        p->V_plane = sample->buffer_data[2];
+        p->Y_stride = sample->buffer_stride[0];
+        p->UV_stride = sample->buffer_stride[1];
+        p->own_planes = 0;
+
+        /* Our planes share the chroma stride */
+        mmf_assert(sample->buffer_stride[1] == sample->buffer_stride[2]);
+    }else {
+        p->Y_plane = p->buffers[0];
+        p->U_plane = p->buffers[1];
+        p->V_plane = p->buffers[2];
+        p->Y_stride = ((p->width + 15) / 16) * (16 >> p->lowres);
+        p->UV_stride = ((p->width + 15) / 16) * (8 >> p->lowres);
+        p->own_planes = 1;
+    }
+}
+
+/* Size of a frame decoded at 1/2^lowres, rounded up to even for the chrominance planes */
+static inline int32_t mpg1_lowres_size(int32_t size, int8_t lowres)
+{
+    return ((size + (2 << lowres) - 1) >> (lowres + 1)) << 1;
 }
 
-MMFRES mpg1_picture_alloc(int32_t width, int32_t height, MPEG1Picture **pic)
+/*
+ * Allocates a picture with it's own planes. The planes are 1/2^lowres of the picture size.
+ */
+MMFRES mpg1_picture_alloc(int32_t width, int32_t height, int8_t lowres, MPEG1Picture **pic)
 {
     MPEG1Picture *p = mmf_allocz(sizeof(MPEG1Picture));
     if(!p) {
         return RC_OUTOFMEM;
     }
 
+    p->refs = 1;
+    p->width = width;
+    p->height = height;
+    p->lowres = lowres;
+
+    /* Number of macroblocks */
+    int mb_w = (width + 15) / 16;
+    int mb_h = (height + 15) / 16;
+
     /* Size of the Y plane */
-    int32_t y_size = width * height;
+    int32_t y_size = (mb_w * 16 >> lowres) * (mb_h * 16 >> lowres);
 
     /* Allocate data buffers */
-    p->Y_plane = mmf_allocz(y_size);
-    p->U_plane = mmf_allocz(y_size / 4);
-    p->V_plane = mmf_allocz(y_size / 4);
+    p->buffers[0] = mmf_allocz(y_size);
+    p->buffers[1] = mmf_allocz(y_size / 4);
+    p->buffers[2] = mmf_allocz(y_size / 4);
 
     /* Allocate motion vector arrays. Since we don't know the picture
      * type yet, we have to allocate both buffers.
      */
-    int mb_w = width / 32;
-    int mb_h = height / 32;
-
     p->mv_backward = mmf_allocz(sizeof(MPEG1MotionVector)* mb_w * mb_h);
     p->mv_forward = mmf_allocz(sizeof(MPEG1MotionVector)* mb_w * mb_h);
 
+    if(!p->buffers[0] || !p->buffers[1] || !p->buffers[2] || !p->mv_backward || !p->mv_forward) {
+        mpg1_picture_free(&p);
+        return RC_OUTOFMEM;
+    }
+
+    mpg1_picture_set_planes(p, NULL);
+
     (*pic) = p;
     return RC_OK;
 }
 
+/* Pictures in use at a time, besides the ones being decoded (one per frame thread): the two
+ * references, and the picture held back for reordering. After a seek or a broken link, it
+ * isn't one of the references.
+ */
+#define MPEG1_POOL_HELD_PICTURES    3
+
+/* Takes a released picture back. Pictures of a previous size are freed. */
+static void mpg1_pool_put(MPEG1PicturePool *pool, MPEG1Picture *p)
+{
+    mpg1_picture_unref(&p->ref_fwd);
+    mpg1_picture_unref(&p->ref_bwd);
+
+    if(p->width != pool->width || p->height != pool->height || p->lowres != pool->lowres) {
+        pool->size--;
+        p->pool = NULL;
+        mpg1_picture_free(&p);
+        return;
+    }
+
+    pool->free[pool->free_count++] = p;
+}
+
+/* Allocates a picture for the pool, and adds it to the free ones */
+static MMFRES mpg1_pool_grow(MPEG1PicturePool *pool)
+{
+    MMFRES rc;
+    MPEG1Picture *p;
+    MPEG1Picture **free = mmf_realloc(pool->free, (pool->size + 1) * sizeof(MPEG1Picture*));
+
+    if(!free) return RC_OUTOFMEM;
+    pool->free = free;
+
+    rc = mpg1_picture_alloc(pool->width, pool->height, pool->lowres, &p);
+    if(failed(rc)) return rc;
+
+    p->pool = pool;
+    pool->size++;
+    pool->free[pool->free_count++] = p;
+
+    return RC_OK;
+}
+
+/* Frees the pictures, which are not in use. The ones in use are freed when they are released. */
+static void mpg1_pool_clear(MPEG1PicturePool *pool)
+{
+    while(pool->free_count > 0) {
+        MPEG1Picture *p = pool->free[--pool->free_count];
+
+        pool->size--;
+        mpg1_picture_free(&p);
+    }
+}
+
+static void mpg1_pool_free(MPEG1PicturePool *pool)
+{
+    mpg1_pool_clear(pool);
+
+    mmf_free(pool->free);
+    pool->free = NULL;
+}
+
+/*
+ * Takes a picture of the current size from the decoder's pool. If "sample" is not NULL,
+ * the picture is decoded directly into the sample's planes. The pool is filled up for the
+ * current frame threads first, and it grows only if all of those pictures are in use.
+ */
+static MMFRES mpg1_pool_get(MPEG1DecoderContext *dec, MMFSample *sample, MPEG1Picture **pic)
+{
+    MPEG1PicturePool *pool = &dec->pool;
+    int32_t size = MPEG1_POOL_HELD_PICTURES + (dec->frame_thread_count > 0 ? dec->frame_thread_count : 1);
+    MPEG1Picture *p;
+    MMFRES rc;
+
+    if(pool->width != dec->seq_hdr->width || pool->height != dec->seq_hdr->height || pool->lowres != dec->lowres) {
+        /* The pictures in use are freed, when they are released */
+        mpg1_pool_clear(pool);
+
+        pool->width = dec->seq_hdr->width;
+        pool->height = dec->seq_hdr->height;
+        pool->lowres = dec->lowres;
+    }
+
+    while(pool->size < size || pool->free_count == 0) {
+        rc = mpg1_pool_grow(pool);
+        if(failed(rc)) return rc;
+    }
+
+    p = pool->free[--pool->free_count];
+
+    p->refs = 1;
+    p->rows_done = 0;
+    p->broken = 0;
+    p->scaling = 0;
+
+    mpg1_picture_set_planes(p, sample);
+
+    *pic = p;
+    return RC_OK;
+}
+
+/*
+ * Assigns the reference pictures of a picture, which is about to be decoded. P pictures are
+ * predicted from the last I or P picture, B pictures from the last two of them.
+ */
+static void mpg1_picture_set_refs(MPEG1DecoderContext *dec, MPEG1Picture *p)
+{
+    switch(p->hdr.frame_type) {
+    case MPEG2_FRAME_TYPE_P:
+        p->ref_fwd = dec->ref_pic_last;
+        break;
+    case MPEG2_FRAME_TYPE_B:
+        p->ref_fwd = dec->ref_pic_penult;
+        p->ref_bwd = dec->ref_pic_last;
+
+        /* B pictures of a closed GOP, which precede it's first I picture, are predicted
+         * only backward. Other B pictures need both references.
+         */
+        p->broken = p->ref_bwd == NULL || (p->ref_fwd == NULL && !(dec->group && dec->group->closed_flag));
+        break;
+    default:
+        break;
+    }
+
+    if(p->ref_fwd) p->ref_fwd->refs++;
+    if(p->ref_bwd) p->ref_bwd->refs++;
+}
+
+/* Releases the reference pictures of a picture, once it is decoded */
+static void mpg1_picture_drop_refs(MPEG1Picture *p)
+{
+    mpg1_picture_unref(&p->ref_fwd);
+    mpg1_picture_unref(&p->ref_bwd);
+}
+
 MMFRES mpg1_decoder_set_last_refpic(MPEG1DecoderContext *dec, MPEG1Picture *p)
 {
 	if(dec->ref_pic_penult != NULL) {
 		MMFRES rc;
 
 		/* Release penult (one before last) ref picture */
-		rc = mpg1_picture_free(&dec->ref_pic_penult);
+		rc = mpg1_picture_unref(&dec->ref_pic_penult);
 		if(failed(rc)) return rc;
 	}
 
@@ -927,328 +1490,2003 @@ MMFRES mpg1_decoder_set_last_refpic(MPEG1DecoderContext *dec, MPEG1Picture *p)
 	return RC_OK;
 }
 
+/*
+ * Takes a decoded picture (in decoding order), and returns the picture to output next in
+ * display order, or NULL if there is none yet. The caller gets a reference to the returned
+ * picture. Passing NULL flushes the reference picture, which is still held back.
+ */
+static MPEG1Picture* mpg1_reorder_picture(MPEG1DecoderContext *dec, MPEG1Picture *p)
+{
+    MPEG1Picture *out;
+
+    if(p && p->hdr.frame_type == MPEG2_FRAME_TYPE_B) {
+        /* B pictures are displayed before the last reference picture. They are dropped,
+         * if it was output already.
+         */
+        if(p->broken || dec->discard >= MPEG1_DISCARD_B || dec->reorder_early) {
+            return NULL;
+        }
+
+        p->refs++;
+        return p;
+    }
+
+    if(p) {
+        dec->reorder_early = 0;
+    }
+
+    if(p && dec->discard >= MPEG1_DISCARD_B && dec->reorder_pic == NULL) {
+        /* No B pictures are output, so there is nothing to wait for */
+        dec->reorder_early = 1;
+        p->refs++;
+        return p;
+    }
+
+    /* I and P pictures are displayed after the B pictures which follow them. When flushed,
+     * the B pictures up to the next reference picture come too late.
+     */
+    out = dec->reorder_pic;
+    dec->reorder_pic = p;
+
+    if(p) {
+        p->refs++;
+    }else if(out) {
+        dec->reorder_early = 1;
+    }
+
+    return out;
+}
+
+/*
+ * Assigns the presentation and decoding time stamps of a picture, in frames. The temporal
+ * reference gives the display position within the GOP.
+ */
+static void mpg1_decoder_stamp_picture(MPEG1DecoderContext *dec, MPEG1PictureHeader *hdr)
+{
+    hdr->pts = dec->gop_frame + hdr->seq_number;
+    hdr->dts = dec->picture_count++;
+}
+
 MMFRES mpg1_decoder_release_refpics(MPEG1DecoderContext *dec)
 {
-	MMFRES rc;
+	MMFRES rc = RC_OK;
 
 	if(dec->ref_pic_penult) {
 		/* Release penult (one before last) ref picture */
-		rc = mpg1_picture_free(&dec->ref_pic_penult);
+		rc = mpg1_picture_unref(&dec->ref_pic_penult);
 		if(failed(rc)) return rc;
 	}
 
 	if(dec->ref_pic_last) {
 		/* Release last ref picture */
-		rc = mpg1_picture_free(&dec->ref_pic_last);
+		rc = mpg1_picture_unref(&dec->ref_pic_last);
 		if(failed(rc)) return rc;
 	}
 
 	return rc;
 }
 
-MMFRES mpg1_decode_picture(MPEG1DecoderContext *dec, MPEG1Picture **pic)
+/*
+ * Decodes a slice, from it's start code up to the next start code. Slices don't depend
+ * on each other, so they can be decoded in parallel, each with it's own bit reader. Only the
+ * macroblock rows first_row to last_row - 1 are reconstructed, and the slice is left after them.
+ */
+static MMFRES mpg1_decode_slice(MPEG1DecoderContext *dec, MMFBitstream *bs, MPEG1Picture *p, int32_t first_row, int32_t last_row, int32_t *last_address)
 {
-	MMFRES rc;
-	MPEG1Picture *p;
-    uint32_t next_bits;
+    MMFRES rc;
+    MPEG1SliceHeader s;
+    MPEG1MacroblockHeader mb;
 
-	rc = mpg1_picture_alloc(dec->seq_hdr->width, dec->seq_hdr->height, &p);
-	if(failed(rc)) goto fail;
+    /* Read slice header */
+    rc = mpg1_read_slice_header(bs, &s);
+    if(failed(rc)) return rc;
 
-    /* Read picture header */
-    rc = mpg1_read_picture_header(dec->bs, &p->hdr);
-    if(failed(rc)) goto fail;
+    /* Address of the macroblock before the first one in the slice */
+    int32_t mb_address = s.row * dec->seq_hdr->mb_width - 1;
+    s.first_row = first_row;
 
-    /* Read slices */
+    /* Iterate and read all macroblocks in the slice, until the zero bits of the next start code.
+     * Bits past the end of the data read as zeroes too, so slices may end with the stream.
+     */
     do {
-        MPEG1SliceHeader s;
-
-        /* Read slice header */
-        rc = mpg1_read_slice_header(dec->bs, &s);
-        if(failed(rc)) goto fail;
-
-        int mbs = s.row * dec->seq_hdr->mb_width;
-
-        /* Get offset in the YUV buffer, corresponding to the slice row
-         */
-        int8_t *y_ptr = p->Y_plane + (mbs * 64 * 4);
-        int8_t *u_ptr = p->U_plane + (mbs * 64);
-        int8_t *v_ptr = p->V_plane + (mbs * 64);
+        rc = mpg1_read_mb(dec, bs, p, &s, &mb, mb_address);
+        if(failed(rc)) break;
 
-        MPEG1MacroblockHeader mb;
-        int32_t mb_address = -1;
+        /* Increment macroblock address. */
+        mb_address += mb.address_increment;
 
-        /* Iterate and read all macroblocks in current slice
-         */
-        do {
-            /* Check if last peek_bits() has performed well */
-            if(failed(rc)) goto fail;
+        /* The rest of the slice is below the rows to decode */
+        if((mb_address + 1) / dec->seq_hdr->mb_width >= last_row) {
+            break;
+        }
 
-            /* Decode macroblock */
-            rc = mpg1_read_mb(dec, p, &s, &mb, mb_address, y_ptr, u_ptr, v_ptr);
-            if(failed(rc)) goto success; //goto fail;
+    } while(bitstream_show_bits(bs, 23) != 0);
 
-            /* Increment macroblock address. */
-            mb_address += mb.address_increment;
+    if(last_address) *last_address = mb_address;
+    return rc;
+}
 
-        } while(bitstream_peek_bits(dec->bs, 23, &rc) != 0);
+typedef struct {
+    MPEG1DecoderContext *dec;
+    MPEG1Picture *pic;
 
-        /* Locate next start code */
-        rc = mpg1_next_start_code(dec->bs);
-        if(failed(rc)) return rc;
+    /* Macroblock rows to reconstruct */
+    int32_t first_row;
+    int32_t last_row;
 
-        /* Peek at next 32 bits. Search for slice start code. */
-        next_bits = bitstream_peek_bits(dec->bs, 32, &rc);
-        if(failed(rc)) goto fail;
-    } while (next_bits >= MPEG2_SLICE_MIN_STARTCODE && next_bits <= MPEG2_SLICE_MAX_STARTCODE);
+    /* Buffer of the stream, and it's position in the stream */
+    const uint8_t *data;
+    int64_t data_offset;
+} MPEG1SliceJobs;
 
-success:
-    *pic = p;
+/* Thread pool job, which decodes one slice of a picture.
+ */
+static void mpg1_decode_slice_job(void *ctx, int32_t job, int32_t thread)
+{
+    MPEG1SliceJobs *j = ctx;
+    MPEG1SliceRef *ref = &j->dec->slices[job];
+    MMFBitstream bs;
 
-    /* Success */
-    return RC_OK;
+    bitstream_init_wrap(&bs, j->data + (ref->offset - j->data_offset), ref->size);
 
-fail:
-    mpg1_picture_free(&p);
-    return rc;
+    /* Errors damage only the rest of the slice, other slices are decoded as usual */
+    mpg1_decode_slice(j->dec, &bs, j->pic, j->first_row, j->last_row, NULL);
 }
 
 /*
- * Allocates and initializes a MPEG-1 decoder context.
+ * Scans for the slices of a picture, from the current position up to the first start code,
+ * which doesn't start a slice. The positions of the ones, which cover any of the macroblock
+ * rows first_row to last_row - 1, are stored in "slices", which grows if needed. Pull-mode
+ * streams keep the picture data in the buffer while the scan runs ahead, until the caller
+ * clears the mark of the bitstream.
  */
-MMFRES mpg1_decoder_create(MPEG1DecoderContext **dec, char *filename)
+static MMFRES mpg1_scan_slices(MMFBitstream *bs, int32_t first_row, int32_t last_row,
+                               MPEG1SliceRef **slices, int32_t *capacity, int32_t *count)
 {
     MMFRES rc;
-    MPEG1DecoderContext *d = mmf_allocz(sizeof(MPEG1DecoderContext));
-
-    /* Create bit-stream reader
-     */
-    d->bs = bitstream_alloc_load_file(filename, &rc);
-    if(failed(rc)) goto fail;
-
-    /* Generate VLC trees, which later will be used to decode different parts of the bitstream.
-     * Passing 0 to element_size means that vlc_tree_create2() will add every prefix node until
-     * it reach a node with bit_count=0.
-     */
-    rc = vlc_tree_create2(__vlc_mb_addr_increment, 0, &d->vlc_mb_addr_increment);
-    if(failed(rc)) goto fail;
-
-    rc = vlc_tree_create2(__vlc_mb_type_i, 0, &d->vlc_mb_type_i); //macroblock type for I-frames
-    if(failed(rc)) goto fail;
+    int32_t i, k, n = 0;
+    int64_t end;
 
-    rc = vlc_tree_create2(__vlc_mb_type_p, 0, &d->vlc_mb_type_p);
-    if(failed(rc)) goto fail;
+    bitstream_set_mark(bs, bitstream_tell(bs));
 
-    rc = vlc_tree_create2(__vlc_mb_type_b, 0, &d->vlc_mb_type_b);
-    if(failed(rc)) goto fail;
+    for(;;) {
+        rc = mpg1_next_start_code(bs);
+        if(failed(rc)) {
+            /* The picture ends with the stream */
+            end = bs->buffer_offset + bs->write_index;
+            break;
+        }
 
-    rc = vlc_tree_create2(__vlc_mb_type_d, 0, &d->vlc_mb_type_d);
-    if(failed(rc)) goto fail;
+        uint32_t code = bitstream_peek_bits(bs, 32, NULL);
+        if(code < MPEG2_SLICE_MIN_STARTCODE || code > MPEG2_SLICE_MAX_STARTCODE) {
+            end = bitstream_tell(bs);
+            break;
+        }
 
-    rc = vlc_tree_create2(__vlc_mb_cb_pattern, 0, &d->vlc_mb_cb_pattern);
-    if(failed(rc)) goto fail;
+        if(n == *capacity) {
+            int32_t c = *capacity ? *capacity * 2 : 64;
+            MPEG1SliceRef *s = mmf_realloc(*slices, c * sizeof(MPEG1SliceRef));
+            if(!s) return RC_OUTOFMEM;
 
-    rc = vlc_tree_create2(__vlc_motion_code, 0, &d->vlc_motion_code);
-    if(failed(rc)) goto fail;
+            *slices = s;
+            *capacity = c;
+        }
 
-    rc = vlc_tree_create2(__vlc_dc_size_y, 0, &d->vlc_dc_size_luma);
-    if(failed(rc)) goto fail;
+        (*slices)[n].offset = bitstream_tell(bs);
+        (*slices)[n++].row = (code & 0xFF) - 1;
+        bitstream_skip_bits(bs, 32);
+    }
 
-    rc = vlc_tree_create2(__vlc_dc_size_c, 0, &d->vlc_dc_size_chroma);
-    if(failed(rc)) goto fail;
+    for(i=0; i<n-1; i++) {
+        (*slices)[i].size = (*slices)[i+1].offset - (*slices)[i].offset;
+    }
 
-    rc = vlc_tree_create2(__vlc_run_levels, 0, &d->vlc_run_levels);
-    if(failed(rc)) goto fail;
+    if(n > 0) {
+        (*slices)[n-1].size = end - (*slices)[n-1].offset;
+    }
 
-    /* Load default quantization matrices */
-    memcpy(&d->qm_intra, __quant_matrix_intra, 64);
-    memcpy(&d->qm_inter, __quant_matrix_non_intra, 64);
+    /* A slice spans the rows up to the one, where the next slice starts */
+    for(i=0, k=0; i<n; i++) {
+        int32_t end_row = i < n-1 ? (*slices)[i+1].row : last_row;
 
-    /* Initialize decoder by passing NULL sample to mpg1_decode_sample() */
-    mpg1_decode_sample(d, NULL);
+        if((*slices)[i].row < last_row && end_row >= first_row) {
+            (*slices)[k++] = (*slices)[i];
+        }
+    }
 
-    /* Copy pointer of the decoder context to the output parameter.
-     */
-    (*dec) = d;
+    *count = k;
     return RC_OK;
-
-fail:
-    mpg1_decoder_free(&d);
-    return rc;
 }
 
-MMFRES mpg1_decoder_free(MPEG1DecoderContext **dec)
+/*
+ * Finds the slices of a picture, which cover the macroblock rows first_row to last_row - 1, and
+ * decodes them on the slice thread pool (or one by one without it). The bitstream is left at
+ * the first start code after the slices.
+ */
+static MMFRES mpg1_decode_slices_parallel(MPEG1DecoderContext *dec, MPEG1Picture *p, int32_t first_row, int32_t last_row)
 {
-    MPEG1DecoderContext *d = *dec;
-    //destroy VLC trees
-    vlc_tree_free(&d->vlc_mb_addr_increment);
-    //vlc_tree_free(d->vlc_mb_type); //TODO
+    MMFRES rc;
+    MMFBitstream *bs = dec->bs;
+    int32_t count;
 
-    mmf_free(*dec);
-    *dec = NULL;
+    rc = mpg1_scan_slices(bs, first_row, last_row, &dec->slices, &dec->slice_capacity, &count);
 
-    return RC_OK;
-}
+    if(succeeded(rc) && count > 0) {
+        MPEG1SliceJobs jobs = { dec, p, first_row, last_row, bs->buffer, bs->buffer_offset };
 
-MMFRES mpg1_perform_prediction(MPEG1DecoderContext *dec, MPEG1Picture *p, MPEG1Picture *refpic)
-{
-	if(p->hdr.frame_type != MPEG2_FRAME_TYPE_P && p->hdr.frame_type != MPEG2_FRAME_TYPE_B) {
-		return RC_INVALIDARG;
-	}
+        if(dec->slice_pool) {
+            rc = mmf_threadpool_run(dec->slice_pool, mpg1_decode_slice_job, &jobs, count);
+        }else {
+            int32_t i;
+
+            for(i=0; i<count; i++) {
+                mpg1_decode_slice_job(&jobs, i, 0);
+            }
+        }
+    }
+
+    bitstream_set_mark(bs, -1);
+    return rc;
+}
+
+/*
+ * Decides whether a picture is skipped, by the discard level. Pictures predicted from a
+ * skipped one are skipped too, since they can't be reconstructed.
+ */
+static int mpg1_picture_discarded(MPEG1DecoderContext *dec, MPEG1PictureHeader *hdr)
+{
+    int8_t type = hdr->frame_type;
+    int skip;
+
+    if(type == MPEG2_FRAME_TYPE_I) {
+        dec->skipped_ref = 0;
+    }
+
+    switch(dec->discard) {
+    case MPEG1_DISCARD_B:
+        skip = type == MPEG2_FRAME_TYPE_B;
+        break;
+    case MPEG1_DISCARD_NONREF:
+        skip = type == MPEG2_FRAME_TYPE_B || type == MPEG2_FRAME_TYPE_D;
+        break;
+    case MPEG1_DISCARD_NONKEY:
+        skip = type != MPEG2_FRAME_TYPE_I;
+        break;
+    default:
+        skip = 0;
+        break;
+    }
+
+    if(dec->skipped_ref && (type == MPEG2_FRAME_TYPE_P || type == MPEG2_FRAME_TYPE_B)) {
+        skip = 1;
+    }
+
+    if(skip && type == MPEG2_FRAME_TYPE_P) {
+        /* The B pictures, which precede the next I picture in display order, can't be
+         * predicted either. Without the references, they are dropped like after a seek.
+         */
+        dec->skipped_ref = 1;
+        mpg1_decoder_release_refpics(dec);
+    }
+
+    return skip;
+}
+
+/*
+ * Returns the macroblock rows first_row to last_row - 1 of a picture, which are decoded
+ * with the region of interest. Only B and D pictures are restricted to the band: the rows
+ * of a reference picture, which the pictures predicted from it need, depend on the vectors
+ * and the number of the P pictures up to the next I picture, which aren't known yet.
+ */
+static void mpg1_picture_roi_rows(MPEG1DecoderContext *dec, MPEG1PictureHeader *hdr, int32_t *first_row, int32_t *last_row)
+{
+    int32_t mb_height = dec->seq_hdr->mb_height;
+
+    *first_row = 0;
+    *last_row = mb_height;
+
+    if(dec->roi_height == 0 || hdr->frame_type == MPEG2_FRAME_TYPE_I || hdr->frame_type == MPEG2_FRAME_TYPE_P) {
+        return;
+    }
+
+    *first_row = dec->roi_top / 16;
+    *last_row = (dec->roi_top + dec->roi_height + 15) / 16;
+
+    if(*last_row > mb_height) *last_row = mb_height;
+}
+
+/*
+ * Skips the slices of a picture, i.e. everything up to the next start code, which is not
+ * a slice start code. Only start codes are searched for, the slices are not parsed.
+ */
+static MMFRES mpg1_skip_picture(MMFBitstream *bs)
+{
+    MMFRES rc;
+    uint32_t code;
+
+    for(;;) {
+        rc = mpg1_next_start_code(bs);
+        if(failed(rc)) return rc;
+
+        code = bitstream_peek_bits(bs, 32, &rc);
+        if(failed(rc)) return rc;
+
+        if(code < MPEG2_SLICE_MIN_STARTCODE || code > MPEG2_SLICE_MAX_STARTCODE) {
+            return RC_OK;
+        }
+
+        bitstream_skip_bits(bs, 32);
+    }
+}
+
+/*
+ * Prepares the scaling of a picture to the output sample, when their sizes differ. "target" is set to
+ * the YUV420P frame, which the picture is scaled to: the sample itself, or the decoder's frame which
+ * is converted to the sample. It is set to NULL, if the picture is output at its decoded size.
+ */
+static MMFRES mpg1_output_target(MPEG1DecoderContext *dec, MPEG1Picture *pic, MMFSample *sample, MMFSample **target)
+{
+    int32_t w = mpg1_lowres_size(pic->width, pic->lowres);
+    int32_t h = mpg1_lowres_size(pic->height, pic->lowres);
+    MMFScalePlane *p = dec->scaler ? &dec->scaler->planes[0] : NULL;
+    MMFRES rc;
+
+    *target = NULL;
+
+    if(sample->width == w && sample->height == h) {
+        return RC_OK;
+    }
+
+    if(!p || p->src_width != w || p->src_height != h || p->dst_width != sample->width ||
+       p->dst_height != sample->height || dec->scaler->filter != dec->out_filter) {
+        mmf_scaler_free(&dec->scaler);
+
+        rc = mmf_scaler_create(w, h, sample->width, sample->height, dec->out_filter, &dec->scaler);
+        if(failed(rc)) return rc;
+    }
+
+    if(sample->format == SAMPLE_FORMAT_YUV420P) {
+        *target = sample;
+        return RC_OK;
+    }
+
+    /* Other formats are converted from a scaled YUV420P frame */
+    if(dec->scaled && (dec->scaled->width != sample->width || dec->scaled->height != sample->height)) {
+        mmf_sample_free(&dec->scaled);
+    }
+
+    if(dec->scaled == NULL) {
+        rc = mmf_allocate_video_frame(SAMPLE_FORMAT_YUV420P, sample->width, sample->height, &dec->scaled);
+        if(failed(rc)) {
+            mmf_sample_free(&dec->scaled);
+            return rc;
+        }
+    }
+
+    *target = dec->scaled;
+    return RC_OK;
+}
+
+/*
+ * Decodes a picture, which starts at the current position. If the picture is skipped
+ * (see mpg1_decoder_set_discard()), "pic" is set to NULL. Pictures which are not used as
+ * reference (B and D) are decoded directly into "sample", if it's not NULL, it's YUV420P
+ * and its planes span whole macroblocks.
+ */
+MMFRES mpg1_decode_picture(MPEG1DecoderContext *dec, MMFSample *sample, MPEG1Picture **pic)
+{
+	MMFRES rc;
+	MPEG1Picture *p = NULL;
+	MPEG1PictureHeader hdr;
+    MMFSample *planes = sample, *target = NULL;
+    uint32_t next_bits;
+    int32_t first_row, last_row, last_address, w, h;
+
+    /* Read picture header */
+    rc = mpg1_read_picture_header(dec->bs, &hdr);
+    if(failed(rc)) goto fail;
+
+    mpg1_decoder_stamp_picture(dec, &hdr);
+
+    if(mpg1_picture_discarded(dec, &hdr)) {
+        *pic = NULL;
+
+        /* At the end of stream, the next call reports it */
+        rc = mpg1_skip_picture(dec->bs);
+        return rc == RC_END_OF_STREAM ? RC_OK : rc;
+    }
+
+    mpg1_decoder_get_frame_size(dec, &w, &h);
+
+    if(hdr.frame_type == MPEG2_FRAME_TYPE_I || hdr.frame_type == MPEG2_FRAME_TYPE_P ||
+       (dec->seq_hdr->width % 16) || (dec->seq_hdr->height % 16) ||
+       (sample && (sample->format != SAMPLE_FORMAT_YUV420P || sample->width != w || sample->height != h))) {
+        planes = NULL;
+    }
+
+	rc = mpg1_pool_get(dec, planes, &p);
+	if(failed(rc)) goto fail;
+
+    p->hdr = hdr;
+    mpg1_picture_set_refs(dec, p);
+
+    /* Pictures which are output right away are scaled as their macroblock rows are decoded,
+     * while the rows are still in the cache.
+     */
+    if(sample && !planes && (hdr.frame_type == MPEG2_FRAME_TYPE_B || hdr.frame_type == MPEG2_FRAME_TYPE_D) &&
+       !(dec->slice_pool || dec->roi_height)) {
+        rc = mpg1_output_target(dec, p, sample, &target);
+        if(failed(rc)) goto fail;
+
+        if(target) {
+            mmf_scaler_reset(dec->scaler);
+            p->scaling = 1;
+        }
+    }
+
+    mpg1_picture_roi_rows(dec, &hdr, &first_row, &last_row);
+
+    /* With a region of interest, the slices are scanned first, to know where they end */
+    if(dec->slice_pool || dec->roi_height) {
+        rc = mpg1_decode_slices_parallel(dec, p, first_row, last_row);
+        if(failed(rc)) goto fail;
+
+        goto success;
+    }
+
+    /* Read slices */
+    for(;;) {
+        /* Locate next start code. At the end of stream the picture is still complete,
+         * and the next call reports the end.
+         */
+        rc = mpg1_next_start_code(dec->bs);
+        if(failed(rc)) goto success;
+
+        /* Peek at next 32 bits. Search for slice start code. */
+        next_bits = bitstream_peek_bits(dec->bs, 32, &rc);
+        if(failed(rc)) goto fail;
+
+        if(next_bits < MPEG2_SLICE_MIN_STARTCODE || next_bits > MPEG2_SLICE_MAX_STARTCODE) {
+            break;
+        }
+
+        /* Errors damage only the rest of the slice, decoding resumes at the next one */
+        last_address = -1;
+        mpg1_decode_slice(dec, dec->bs, p, 0, dec->seq_hdr->mb_height, &last_address);
+
+        if(p->scaling) {
+            /* The rows above the last macroblock are complete */
+            mmf_scaler_scale_yuv420p(dec->scaler, p->Y_plane, p->U_plane, p->V_plane, p->Y_stride, p->UV_stride,
+                                     ((last_address + 1) / dec->seq_hdr->mb_width) * (16 >> p->lowres), target);
+        }
+    }
+
+success:
+    mpg1_picture_drop_refs(p);
+    *pic = p;
+
+    /* Success */
+    return RC_OK;
+
+fail:
+    /* Returns it to the pool */
+    mpg1_picture_unref(&p);
+    return rc;
+}
+
+/*
+ * Allocates and initializes a MPEG-1 decoder context, which reads from a file.
+ */
+MMFRES mpg1_decoder_create(MPEG1DecoderContext **dec, char *filename)
+{
+    MMFRES rc;
+
+    /* Create bit-stream reader. Prefer mapping the file in memory, and fall back
+     * to reading it, if mapping is not possible.
+     */
+    MMFBitstream *bs = bitstream_alloc_map_file(filename, &rc);
+    if(failed(rc)) {
+        bs = bitstream_alloc_load_file(filename, &rc);
+        if(failed(rc)) return rc;
+    }
+
+    return mpg1_decoder_create_from_bitstream(dec, bs);
+}
+
+/*
+ * Allocates and initializes a MPEG-1 decoder context, which reads from memory.
+ */
+MMFRES mpg1_decoder_create_from_memory(MPEG1DecoderContext **dec, const uint8_t *data, int64_t size)
+{
+    MMFRES rc;
+
+    MMFBitstream *bs = bitstream_alloc_wrap(data, size, &rc);
+    if(failed(rc)) return rc;
+
+    return mpg1_decoder_create_from_bitstream(dec, bs);
+}
+
+/*
+ * Allocates and initializes a MPEG-1 decoder context, which pulls data through a callback.
+ */
+MMFRES mpg1_decoder_create_from_callback(MPEG1DecoderContext **dec, MMFBitstreamReadFunc read_func, void *opaque)
+{
+    MMFRES rc;
+
+    MMFBitstream *bs = bitstream_alloc_callback(read_func, opaque, 0, &rc);
+    if(failed(rc)) return rc;
+
+    return mpg1_decoder_create_from_bitstream(dec, bs);
+}
+
+/*
+ * Allocates and initializes a MPEG-1 decoder context around an existing bit-stream.
+ */
+MMFRES mpg1_decoder_create_from_bitstream(MPEG1DecoderContext **dec, MMFBitstream *bs)
+{
+    MMFRES rc;
+    MPEG1DecoderContext *d = mmf_allocz(sizeof(MPEG1DecoderContext));
+    if(!d) {
+        bitstream_free(&bs);
+        return RC_OUTOFMEM;
+    }
+
+    /* The decoder takes ownership of the bit-stream */
+    d->bs = bs;
+
+    pthread_mutex_init(&d->progress_lock, NULL);
+    pthread_cond_init(&d->progress_cond, NULL);
+
+    /* Get the shared VLC lookup tables, which are used to decode different parts of the bitstream.
+     * They are built on first use, and never released.
+     */
+    pthread_once(&mpg1_vlc_tables_once, mpg1_init_vlc_tables);
+
+    rc = mpg1_vlc_tables_rc;
+    if(failed(rc)) goto fail;
+
+    d->vlc_mb_addr_increment = &mpg1_vlc_mb_addr_increment;
+    d->vlc_mb_type_i = &mpg1_vlc_mb_type_i; //macroblock type for I-frames
+    d->vlc_mb_type_p = &mpg1_vlc_mb_type_p;
+    d->vlc_mb_type_b = &mpg1_vlc_mb_type_b;
+    d->vlc_mb_type_d = &mpg1_vlc_mb_type_d;
+    d->vlc_mb_cb_pattern = &mpg1_vlc_mb_cb_pattern;
+    d->vlc_motion_code = &mpg1_vlc_motion_code;
+    d->vlc_dc_size_luma = &mpg1_vlc_dc_size_luma;
+    d->vlc_dc_size_chroma = &mpg1_vlc_dc_size_chroma;
+    d->vlc_run_levels = &mpg1_vlc_run_levels;
+
+    /* Load default quantization matrices */
+    mpg1_set_quant_matrices(d, __quant_matrix_intra, __quant_matrix_non_intra);
+
+    /* The reach of the motion vectors is unknown until the first GOP is decoded */
+
+    /* Initialize decoder by passing NULL sample to mpg1_decode_sample() */
+    mpg1_decode_sample(d, NULL);
+
+    /* Copy pointer of the decoder context to the output parameter.
+     */
+    (*dec) = d;
+    return RC_OK;
+
+fail:
+    mpg1_decoder_free(&d);
+    return rc;
+}
+
+MMFRES mpg1_decoder_free(MPEG1DecoderContext **dec)
+{
+    MPEG1DecoderContext *d = *dec;
+
+    /* VLC tables are shared, so they are not released here */
+
+    /* Stop frame threads first, they might use everything else */
+    mpg1_frame_threads_free(d);
+
+    if(d->bs) {
+        bitstream_free(&d->bs);
+    }
+
+    mpg1_decoder_release_refpics(d);
+    mpg1_picture_unref(&d->reorder_pic);
+
+    /* All pictures are released by now */
+    mpg1_pool_free(&d->pool);
+
+    mmf_free(d->seq_hdr);
+    mmf_free(d->group);
+
+    if(d->index) {
+        mpg1_index_free(&d->index);
+    }
+
+    mmf_threadpool_free(&d->slice_pool);
+    mmf_free(d->slices);
+
+    mmf_scaler_free(&d->scaler);
+    mmf_sample_free(&d->scaled);
+
+    pthread_cond_destroy(&d->progress_cond);
+    pthread_mutex_destroy(&d->progress_lock);
+
+    mmf_free(*dec);
+    *dec = NULL;
+
+    return RC_OK;
+}
+
+MMFRES mpg1_decoder_set_threads(MPEG1DecoderContext *dec, int32_t threads)
+{
+    if(threads < 0) {
+        return RC_INVALIDARG;
+    }
+
+    if(threads == 0) {
+        threads = mmf_get_cpu_count();
+    }
+
+    mmf_threadpool_free(&dec->slice_pool);
+
+    if(threads == 1) {
+        /* Decode slices one by one */
+        return RC_OK;
+    }
+
+    return mmf_threadpool_create(threads, &dec->slice_pool);
+}
+
+/* Reads a sequence header into the decoder context, and loads it's quantization matrices.
+ */
+static MMFRES mpg1_decoder_read_seq_header(MPEG1DecoderContext *dec)
+{
+    MMFRES rc;
+
+    if(dec->seq_hdr == NULL) {
+        /* Allocate sequence header struct */
+        dec->seq_hdr = mmf_allocz(sizeof(MPEG1SeqHeader));
+        if(!dec->seq_hdr) return RC_OUTOFMEM;
+    }
+
+    /* Parse video sequence header. It is zeroed, so that it can be compared as a whole. */
+    MPEG1SeqHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+
+    rc = mpg1_read_seqence_header(dec->bs, &hdr);
+    if(failed(rc)) return rc;
+
+    if(memcmp(&hdr, dec->seq_hdr, sizeof(hdr)) == 0) {
+        /* Repeated header, nothing changes */
+        return RC_OK;
+    }
+
+    if(dec->frame_pending > 0) {
+        /* Pictures in the pipeline use the current header and matrices */
+        mpg1_frame_threads_wait_all(dec);
+    }
+
+    *dec->seq_hdr = hdr;
+
+    mpg1_set_quant_matrices(dec, dec->seq_hdr->quant_matrix_intra[0], dec->seq_hdr->quant_matrix_non_intra[0]);
+    return RC_OK;
+}
+
+/* Reads a GOP header into the decoder context.
+ */
+static MMFRES mpg1_decoder_read_group_header(MPEG1DecoderContext *dec)
+{
+    MMFRES rc;
+
+    if(dec->group == NULL) {
+        dec->group = mmf_alloc(sizeof(MPEG1GroupHeader));
+        if(!dec->group) return RC_OUTOFMEM;
+    }
+
+    rc = mpg1_read_group_header(dec->bs, dec->group);
+    if(failed(rc)) return rc;
+
+    /* Temporal references restart from zero in each GOP */
+    dec->gop_frame = dec->picture_count;
+
+    if(dec->group->broken_flag) {
+        /* The pictures before the GOP were edited out, so the B pictures after it's first
+         * I picture can't be predicted. Without the references, they are dropped.
+         */
+        rc = mpg1_decoder_release_refpics(dec);
+    }
+
+    return rc;
+}
+
+/* Reads the headers which precede the next picture (sequence and GOP headers), and skips
+ * user data, extensions and any garbage. Stops at the picture start code.
+ */
+static MMFRES mpg1_read_headers(MPEG1DecoderContext *dec)
+{
+    MMFRES rc;
+    uint32_t code;
+
+    for(;;) {
+        rc = mpg1_next_start_code(dec->bs);
+        if(failed(rc)) return rc;
+
+        code = bitstream_peek_bits(dec->bs, 32, &rc);
+        if(failed(rc)) return rc;
+
+        switch(code) {
+        case MPEG2_PICTURE_STARTCODE:
+            return RC_OK;
+
+        case MPEG2_SEQ_STARTCODE:
+            rc = mpg1_decoder_read_seq_header(dec);
+            if(failed(rc)) return rc;
+            break;
+
+        case MPEG2_GOP_STARTCODE:
+            rc = mpg1_decoder_read_group_header(dec);
+            if(failed(rc)) return rc;
+            break;
+
+        default:
+            /* Skip start code, the data is skipped by the search for the next one */
+            bitstream_skip_bits(dec->bs, 32);
+            break;
+        }
+    }
+}
+
+/* States of frame threads */
+#define MPEG1_FRAME_IDLE        0
+#define MPEG1_FRAME_QUEUED      1
+#define MPEG1_FRAME_DONE        2
+
+struct MPEG1FrameThread {
+    MPEG1DecoderContext *dec;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int8_t state;
+    int8_t quit;
+
+    /* Picture to decode */
+    MPEG1Picture *pic;
+
+    /* Slices of the picture, and the data they are in */
+    MPEG1SliceRef *slices;
+    int32_t slice_count;
+    int32_t slice_capacity;
+    const uint8_t *data;
+    int64_t data_offset;
+
+    /* Macroblock rows to reconstruct */
+    int32_t first_row;
+    int32_t last_row;
+
+    /* Copy of the picture data, for streams which don't keep all of their data in memory */
+    uint8_t *copy;
+    int32_t copy_capacity;
+};
+
+/* Marks the first "rows" macroblock rows of a picture as complete, and wakes up the
+ * frame threads, which wait for them.
+ */
+static void mpg1_picture_report_rows(MPEG1DecoderContext *dec, MPEG1Picture *p, int32_t rows)
+{
+    pthread_mutex_lock(&dec->progress_lock);
+
+    if(rows > p->rows_done) {
+        p->rows_done = rows;
+        pthread_cond_broadcast(&dec->progress_cond);
+    }
+
+    pthread_mutex_unlock(&dec->progress_lock);
+}
+
+/* Waits until the first "rows" macroblock rows of a picture are complete. Returns the number
+ * of complete rows, which might be more.
+ */
+static int32_t mpg1_picture_await_rows(MPEG1DecoderContext *dec, MPEG1Picture *p, int32_t rows)
+{
+    if(rows > dec->seq_hdr->mb_height) {
+        rows = dec->seq_hdr->mb_height;
+    }
+
+    pthread_mutex_lock(&dec->progress_lock);
+
+    while(p->rows_done < rows) {
+        pthread_cond_wait(&dec->progress_cond, &dec->progress_lock);
+    }
+
+    rows = p->rows_done;
+    pthread_mutex_unlock(&dec->progress_lock);
+
+    return rows;
+}
+
+/* Decodes the picture of a frame thread. Macroblocks wait for the reference rows they are
+ * predicted from (see mpg1_predict_mb()), and each slice reports the rows it completes.
+ */
+static void mpg1_frame_thread_decode(MPEG1FrameThread *t)
+{
+    MPEG1DecoderContext *dec = t->dec;
+    MPEG1Picture *p = t->pic;
+    int32_t mb_width = dec->seq_hdr->mb_width;
+    int32_t mb_height = dec->seq_hdr->mb_height;
+    int32_t i, last;
+
+    for(i=0; i<t->slice_count; i++) {
+        MMFBitstream bs;
+
+        bitstream_init_wrap(&bs, t->data + (t->slices[i].offset - t->data_offset), t->slices[i].size);
+
+        /* Errors damage only the rest of the slice */
+        last = -1;
+        mpg1_decode_slice(dec, &bs, p, t->first_row, t->last_row, &last);
+
+        /* The picture is complete up to the last decoded macroblock */
+        mpg1_picture_report_rows(dec, p, (last + 1) / mb_width);
+    }
+
+    mpg1_picture_report_rows(dec, p, mb_height);
+}
+
+static void* mpg1_frame_thread_main(void *arg)
+{
+    MPEG1FrameThread *t = arg;
+
+    pthread_mutex_lock(&t->lock);
+
+    for(;;) {
+        while(t->state != MPEG1_FRAME_QUEUED && !t->quit) {
+            pthread_cond_wait(&t->cond, &t->lock);
+        }
+
+        if(t->quit) {
+            break;
+        }
+
+        pthread_mutex_unlock(&t->lock);
+        mpg1_frame_thread_decode(t);
+        pthread_mutex_lock(&t->lock);
+
+        t->state = MPEG1_FRAME_DONE;
+        pthread_cond_broadcast(&t->cond);
+    }
+
+    pthread_mutex_unlock(&t->lock);
+    return NULL;
+}
+
+/* Waits until the frame thread has finished it's picture.
+ */
+static void mpg1_frame_thread_wait(MPEG1FrameThread *t)
+{
+    pthread_mutex_lock(&t->lock);
+
+    while(t->state == MPEG1_FRAME_QUEUED) {
+        pthread_cond_wait(&t->cond, &t->lock);
+    }
+
+    pthread_mutex_unlock(&t->lock);
+}
+
+/* Returns the frame thread, which holds the oldest picture in the pipeline.
+ */
+static inline MPEG1FrameThread* mpg1_frame_thread_tail(MPEG1DecoderContext *dec)
+{
+    int32_t n = dec->frame_thread_count;
+    return &dec->frame_threads[(dec->frame_head - dec->frame_pending + n) % n];
+}
+
+/* Waits until all pictures in the pipeline are decoded. They are not handed out.
+ */
+static void mpg1_frame_threads_wait_all(MPEG1DecoderContext *dec)
+{
+    int32_t i;
+
+    for(i=0; i<dec->frame_thread_count; i++) {
+        mpg1_frame_thread_wait(&dec->frame_threads[i]);
+    }
+}
+
+/* Takes the oldest picture out of the pipeline, and releases it (and it's reference).
+ */
+static void mpg1_frame_thread_release(MPEG1DecoderContext *dec, MPEG1FrameThread *t)
+{
+    /* Reference counts are changed by the calling thread only */
+    mpg1_picture_drop_refs(t->pic);
+    mpg1_picture_unref(&t->pic);
+
+    t->state = MPEG1_FRAME_IDLE;
+    dec->frame_pending--;
+}
+
+/* Drops all pictures in the pipeline (e.g. before seeking).
+ */
+static void mpg1_frame_threads_flush(MPEG1DecoderContext *dec)
+{
+    mpg1_frame_threads_wait_all(dec);
+
+    while(dec->frame_pending > 0) {
+        mpg1_frame_thread_release(dec, mpg1_frame_thread_tail(dec));
+    }
+
+    dec->frame_eos = 0;
+}
+
+static void mpg1_frame_threads_free(MPEG1DecoderContext *dec)
+{
+    int32_t i;
+
+    if(dec->frame_threads == NULL) {
+        return;
+    }
+
+    mpg1_frame_threads_flush(dec);
+
+    for(i=0; i<dec->frame_thread_count; i++) {
+        MPEG1FrameThread *t = &dec->frame_threads[i];
+
+        pthread_mutex_lock(&t->lock);
+        t->quit = 1;
+        pthread_cond_signal(&t->cond);
+        pthread_mutex_unlock(&t->lock);
+
+        pthread_join(t->thread, NULL);
+
+        pthread_cond_destroy(&t->cond);
+        pthread_mutex_destroy(&t->lock);
+
+        mmf_free(t->slices);
+        mmf_free(t->copy);
+    }
+
+    mmf_free(dec->frame_threads);
+
+    dec->frame_threads = NULL;
+    dec->frame_thread_count = 0;
+    dec->frame_head = 0;
+}
+
+MMFRES mpg1_decoder_set_frame_threads(MPEG1DecoderContext *dec, int32_t threads)
+{
+    int32_t i;
+
+    if(threads < 0) {
+        return RC_INVALIDARG;
+    }
+
+    if(dec->frame_pending > 0) {
+        /* Pictures in the pipeline would be lost */
+        return RC_NOT_ALLOWED;
+    }
+
+    if(threads == 0) {
+        threads = mmf_get_cpu_count();
+    }
+
+    mpg1_frame_threads_free(dec);
+
+    if(threads == 1) {
+        /* Decode pictures one by one */
+        return RC_OK;
+    }
+
+    dec->frame_threads = mmf_allocz(threads * sizeof(MPEG1FrameThread));
+    if(!dec->frame_threads) return RC_OUTOFMEM;
+
+    for(i=0; i<threads; i++) {
+        MPEG1FrameThread *t = &dec->frame_threads[i];
+
+        t->dec = dec;
+        pthread_mutex_init(&t->lock, NULL);
+        pthread_cond_init(&t->cond, NULL);
+
+        if(pthread_create(&t->thread, NULL, mpg1_frame_thread_main, t) != 0) {
+            pthread_cond_destroy(&t->cond);
+            pthread_mutex_destroy(&t->lock);
+            mpg1_frame_threads_free(dec);
+            return RC_EXTERNAL;
+        }
+
+        dec->frame_thread_count++;
+    }
+
+    return RC_OK;
+}
+
+MMFRES mpg1_decoder_set_discard(MPEG1DecoderContext *dec, int32_t level)
+{
+    if(level < MPEG1_DISCARD_NONE || level > MPEG1_DISCARD_NONKEY) {
+        return RC_INVALIDARG;
+    }
+
+    dec->discard = level;
+    return RC_OK;
+}
+
+MMFRES mpg1_decoder_set_lowres(MPEG1DecoderContext *dec, int32_t scale)
+{
+    if(scale < 0 || scale > 3) {
+        return RC_INVALIDARG;
+    }
+
+    if(dec->frame_pending > 0) {
+        /* Pictures in the pipeline are decoded at the current scale */
+        return RC_NOT_ALLOWED;
+    }
+
+    if(scale == dec->lowres) {
+        return RC_OK;
+    }
+
+    dec->lowres = scale;
+
+    /* Pictures of the previous scale can't be output, nor used as references. The pictures
+     * predicted from them are skipped, up to the next I picture.
+     */
+    mpg1_picture_unref(&dec->reorder_pic);
+    dec->reorder_early = 0;
+    if(dec->ref_pic_last) {
+        dec->skipped_ref = 1;
+    }
+
+    return mpg1_decoder_release_refpics(dec);
+}
+
+MMFRES mpg1_decoder_set_roi(MPEG1DecoderContext *dec, int32_t top, int32_t height)
+{
+    if(top < 0 || height < 0) {
+        return RC_INVALIDARG;
+    }
+
+    dec->roi_top = top;
+    dec->roi_height = height;
+
+    return RC_OK;
+}
+
+MMFRES mpg1_decoder_get_frame_size(MPEG1DecoderContext *dec, int32_t *width, int32_t *height)
+{
+    if(dec->seq_hdr == NULL) {
+        *width = *height = 0;
+        return RC_INVALIDDATA;
+    }
+
+    /* Rounded up to even sizes, for the chrominance planes. The pictures cover
+     * whole macroblocks, so the extra column or row is decoded anyway.
+     */
+    *width = mpg1_lowres_size(dec->seq_hdr->width, dec->lowres);
+    *height = mpg1_lowres_size(dec->seq_hdr->height, dec->lowres);
+
+    return RC_OK;
+}
+
+MMFRES mpg1_decoder_set_output_size(MPEG1DecoderContext *dec, int32_t width, int32_t height, MMFScaleFilter filter)
+{
+    if(width < 0 || height < 0 || (width | height) & 1 || (width == 0) != (height == 0)) {
+        return RC_INVALIDARG;
+    }
+
+    if(filter != SCALE_FILTER_BILINEAR && filter != SCALE_FILTER_AREA) {
+        return RC_INVALIDARG;
+    }
+
+    dec->out_width = width;
+    dec->out_height = height;
+    dec->out_filter = filter;
+
+    return RC_OK;
+}
+
+MMFRES mpg1_decoder_get_output_size(MPEG1DecoderContext *dec, int32_t *width, int32_t *height)
+{
+    MMFRES rc = mpg1_decoder_get_frame_size(dec, width, height);
+
+    if(succeeded(rc) && dec->out_width) {
+        *width = dec->out_width;
+        *height = dec->out_height;
+    }
+
+    return rc;
+}
+
+/* Parses the next picture, and hands it to the next frame thread. Picture types are known here,
+ * so the reference pictures are updated in decoding order, before the picture is decoded.
+ */
+static MMFRES mpg1_frame_thread_submit(MPEG1DecoderContext *dec)
+{
+    MMFRES rc;
+    MPEG1FrameThread *t = &dec->frame_threads[dec->frame_head];
+    MPEG1PictureHeader hdr;
+    MPEG1Picture *p = NULL;
+    MMFBitstream *bs = dec->bs;
+
+    /* Skipped pictures don't take a frame thread */
+    for(;;) {
+        rc = mpg1_read_headers(dec);
+        if(failed(rc)) return rc;
+
+        if(dec->seq_hdr == NULL) {
+            return RC_INVALIDDATA;
+        }
+
+        rc = mpg1_read_picture_header(bs, &hdr);
+        if(failed(rc)) return rc;
+
+        mpg1_decoder_stamp_picture(dec, &hdr);
+
+        if(!mpg1_picture_discarded(dec, &hdr)) {
+            break;
+        }
+
+        rc = mpg1_skip_picture(bs);
+        if(failed(rc)) return rc;
+    }
+
+    rc = mpg1_pool_get(dec, NULL, &p);
+    if(failed(rc)) return rc;
+
+    p->hdr = hdr;
+
+    mpg1_picture_roi_rows(dec, &hdr, &t->first_row, &t->last_row);
+
+    rc = mpg1_scan_slices(bs, t->first_row, t->last_row, &t->slices, &t->slice_capacity, &t->slice_count);
+    if(failed(rc)) goto fail;
+
+    /* Rows are reported as the slices complete, so a slice going back to a reported row would
+     * race with the frame threads reading it. Such slices exist only in damaged streams.
+     */
+    int32_t i, k;
+
+    for(i=0, k=0; i<t->slice_count; i++) {
+        MPEG1SliceRef *s = &t->slices[i];
+
+        if(s->row >= dec->seq_hdr->mb_height || (k > 0 && s->row < t->slices[k-1].row)) {
+            continue;
+        }
+
+        mmf_assert(s->size > 0);
+        mmf_assert(k == 0 || s->offset > t->slices[k-1].offset);
+
+        t->slices[k++] = *s;
+    }
+
+    t->slice_count = k;
+    mmf_assert(t->slice_count <= dec->seq_hdr->mb_height * dec->seq_hdr->mb_width);
+
+    if(bs->mapped || bs->wrapped || t->slice_count == 0) {
+        t->data = bs->buffer;
+        t->data_offset = bs->buffer_offset;
+    }else {
+        /* The buffer of pull-mode streams moves, when it is refilled */
+        MPEG1SliceRef *last = &t->slices[t->slice_count - 1];
+        int64_t start = t->slices[0].offset;
+        int64_t size = last->offset + last->size - start;
+
+        if(size > t->copy_capacity) {
+            if(size > INT32_MAX) {
+                rc = RC_BUFFER_OVERFLOW;
+                goto fail;
+            }
+
+            mmf_free(t->copy);
+            t->copy = mmf_alloc((int32_t)size);
+            t->copy_capacity = t->copy ? (int32_t)size : 0;
+
+            if(!t->copy) {
+                rc = RC_OUTOFMEM;
+                goto fail;
+            }
+        }
+
+        memcpy(t->copy, bs->buffer + (start - bs->buffer_offset), size);
+        t->data = t->copy;
+        t->data_offset = start;
+    }
+
+    bitstream_set_mark(bs, -1);
+
+    /* The frame thread owns the picture, and the picture references the ones it predicts from */
+    t->pic = p;
+    mpg1_picture_set_refs(dec, p);
+
+    if(hdr.frame_type == MPEG2_FRAME_TYPE_I || hdr.frame_type == MPEG2_FRAME_TYPE_P) {
+        p->refs++;
+        mpg1_decoder_set_last_refpic(dec, p);
+    }
+
+    pthread_mutex_lock(&t->lock);
+    t->state = MPEG1_FRAME_QUEUED;
+    pthread_cond_signal(&t->cond);
+    pthread_mutex_unlock(&t->lock);
+
+    dec->frame_head = (dec->frame_head + 1) % dec->frame_thread_count;
+    dec->frame_pending++;
+
+    return RC_OK;
+
+fail:
+    bitstream_set_mark(bs, -1);
+    mpg1_picture_unref(&p);
+    return rc;
+}
+
+/* Copies a decoded picture to the output sample (unless it was decoded there directly),
+ * scaling and converting it to the sample's size and pixel format, and releases it.
+ */
+static MMFRES mpg1_output_picture(MPEG1DecoderContext *dec, MPEG1Picture *pic, MMFSample *sample)
+{
+    MMFSample *target;
+    MMFRES rc;
+
+    rc = mpg1_output_target(dec, pic, sample, &target);
+
+    if(succeeded(rc) && target) {
+        /* Scale the rows, which were not scaled while the picture was decoded */
+        if(!pic->scaling) {
+            mmf_scaler_reset(dec->scaler);
+        }
+
+        mmf_scaler_scale_yuv420p(dec->scaler, pic->Y_plane, pic->U_plane, pic->V_plane, pic->Y_stride, pic->UV_stride,
+                                 dec->scaler->planes[0].src_height, target);
+
+        if(target != sample) {
+            mmf_convert_yuv420p(target->buffer_data[0], target->buffer_data[1], target->buffer_data[2],
+                                target->buffer_stride[0], target->buffer_stride[1], sample, 0, sample->height);
+        }
+    }else if(succeeded(rc) && pic->own_planes) {
+        mmf_convert_yuv420p(pic->Y_plane, pic->U_plane, pic->V_plane, pic->Y_stride, pic->UV_stride,
+                            sample, 0, sample->height);
+    }
+
+    sample->pts = pic->hdr.pts;
+    mpg1_picture_unref(&pic);
+
+    return rc;
+}
+
+/* Keeps the pipeline full, and hands out the pictures in display order.
+ */
+static MMFRES mpg1_decode_sample_threaded(MPEG1DecoderContext *dec, MMFSample *sample)
+{
+    MMFRES rc = RC_OK;
+    MPEG1Picture *out = NULL;
+
+    while(out == NULL) {
+        while(dec->frame_pending < dec->frame_thread_count && !dec->frame_eos) {
+            rc = mpg1_frame_thread_submit(dec);
+
+            if(rc == RC_END_OF_STREAM) {
+                dec->frame_eos = 1;
+            }
+
+            /* Other errors are retried on the next call, after the pipeline is drained a bit */
+            if(failed(rc)) break;
+        }
+
+        if(dec->frame_pending == 0) {
+            if(failed(rc) && rc != RC_END_OF_STREAM) {
+                return rc;
+            }
+
+            /* The last reference picture is still held back */
+            out = mpg1_reorder_picture(dec, NULL);
+            if(out == NULL) {
+                return RC_END_OF_STREAM;
+            }
+
+            break;
+        }
+
+        MPEG1FrameThread *t = mpg1_frame_thread_tail(dec);
+
+        if(dec->reorder_pic && dec->discard >= MPEG1_DISCARD_B) {
+            /* B pictures are skipped now, the held back picture is displayed next */
+            out = mpg1_reorder_picture(dec, NULL);
+            break;
+        }
+
+        mpg1_frame_thread_wait(t);
+
+        out = mpg1_reorder_picture(dec, t->pic);
+        mpg1_frame_thread_release(dec, t);
+    }
+
+    return mpg1_output_picture(dec, out, sample);
+}
+
+MMFRES mpg1_decode_sample(MPEG1DecoderContext *dec, MMFSample *sample)
+{
+    MMFRES rc = RC_OK;
+
+    /* Frame threads read the headers themselves, ahead of the output */
+    if(!(dec->frame_threads && dec->seq_hdr && sample)) {
+        /* Read the headers up to the next picture. At the end of stream, the last reference
+         * picture might be still to output.
+         */
+        rc = mpg1_read_headers(dec);
+        if(failed(rc) && !(rc == RC_END_OF_STREAM && dec->reorder_pic)) return rc;
+
+        if(dec->seq_hdr == NULL) {
+            /* The stream doesn't start with a sequence header */
+            return RC_INVALIDDATA;
+        }
+
+        if(sample == NULL) {
+            /* Passing NULL sample to decoder causes it to initialize only */
+            return RC_OK;
+        }
+    }
+
+    /* Validate sample */
+    int32_t w, h;
+    mpg1_decoder_get_output_size(dec, &w, &h);
+
+    if(sample->buffer_count == 0 || sample->width != w || sample->height != h) {
+        /* Sample not initialized correctly */
+        return RC_INVALIDARG;
+    }
+
+    /* Validate pixel format. Pictures are converted from YUV420P on output. */
+    if(sample->format != SAMPLE_FORMAT_YUV420P && sample->format != SAMPLE_FORMAT_NV12 &&
+       sample->format != SAMPLE_FORMAT_RGBA32) {
+        /* Unsupported pix fmt */
+        return RC_INVALIDARG;
+    }
+
+    if(dec->frame_threads) {
+        return mpg1_decode_sample_threaded(dec, sample);
+    }
+
+    /*
+     * Decode pictures until one can be output. B pictures are output right away, the
+     * I and P pictures after the B pictures which follow them.
+     */
+    MPEG1Picture *pic, *out = NULL;
+
+    while(out == NULL) {
+        if(rc == RC_END_OF_STREAM || (dec->reorder_pic && dec->discard >= MPEG1_DISCARD_B)) {
+            /* At the end of stream, or when the B pictures are skipped, the held back
+             * picture is displayed next.
+             */
+            out = mpg1_reorder_picture(dec, NULL);
+            if(out == NULL) return rc;
 
-	int i;
-	int pixels=dec->seq_hdr->width * dec->seq_hdr->height;
-	int8_t *src, *dst;
+            break;
+        }
 
-    /* Perform conditional replenishment (frame prediction) */
+        rc = mpg1_decode_picture(dec, sample, &pic);
+        if(failed(rc)) return rc;
 
-	dst = p->Y_plane;
-	src = refpic->Y_plane;
-	for(i=0; i<pixels; i++) {
-		*(dst++) += *(src++);
-	}
+        if(pic == NULL) {
+            /* Skipped */
+            rc = mpg1_read_headers(dec);
+            if(failed(rc) && rc != RC_END_OF_STREAM) return rc;
 
-	/* U and V planes has 4 times less pixels */
-	pixels /= 4;
+            continue;
+        }
 
-	dst = p->U_plane;
-	src = refpic->U_plane;
-	for(i=0; i<pixels; i++) {
-		*(dst++) += *(src++);
-	}
+        /* The picture is complete, in case frame threads use it later */
+        pic->rows_done = dec->seq_hdr->mb_height;
 
-	dst = p->V_plane;
-	src = refpic->V_plane;
-	for(i=0; i<pixels; i++) {
-		*(dst++) += *(src++);
-	}
+        out = mpg1_reorder_picture(dec, pic);
 
-	return RC_OK;
+        switch(pic->hdr.frame_type) {
+        case MPEG2_FRAME_TYPE_I:
+        case MPEG2_FRAME_TYPE_P:
+            /*
+             * Keep this frame, since it will be used as a reference picture
+             * when decoding next pictures.
+             */
+            mpg1_decoder_set_last_refpic(dec, pic);
+            break;
+        default:
+            /* Release MMFPicture */
+            mpg1_picture_unref(&pic);
+            break;
+        }
+
+        if(out == NULL) {
+            rc = mpg1_read_headers(dec);
+            if(failed(rc) && rc != RC_END_OF_STREAM) return rc;
+        }
+    }
+
+    return mpg1_output_picture(dec, out, sample);
 }
 
-MMFRES mpg1_decode_sample(MPEG1DecoderContext *dec, MMFSample *sample)
+/*
+ * Decodes the DC coefficients of an intra slice into a keyframe mosaic, one pixel per block.
+ * The AC coefficients are skipped.
+ */
+static MMFRES mpg1_decode_slice_dc(MPEG1DecoderContext *dec, MMFBitstream *bs, MMFSample *sample)
 {
     MMFRES rc;
+    MPEG1SliceHeader s;
+    int8_t increment;
+    uint8_t type;
+    int16_t dc;
+    int decoded_bytes;
+    int escape_cnt;
+    int i;
+
+    rc = mpg1_read_slice_header(bs, &s);
+    if(failed(rc)) return rc;
+
+    int32_t mb_address = s.row * dec->seq_hdr->mb_width - 1;
+
+    do {
+        /* Discard stuffing bits, and count escape codes */
+        while(bitstream_show_bits(bs, 11) == 0x0F) {
+            bitstream_skip_bits(bs, 11);
+        }
+
+        escape_cnt = 0;
+        while(bitstream_show_bits(bs, 11) == 0x08) {
+            escape_cnt++;
+            bitstream_skip_bits(bs, 11);
+        }
+
+        rc = vlc_decode_table(bs, dec->vlc_mb_addr_increment, 1, &increment, &decoded_bytes);
+        if(failed(rc)) return rc;
+
+        if(decoded_bytes != 1) {
+            return RC_END_OF_STREAM;
+        }
+
+        mb_address += increment + 33 * escape_cnt;
+
+        int32_t mb_x = mb_address % dec->seq_hdr->mb_width;
+        int32_t mb_y = mb_address / dec->seq_hdr->mb_width;
+
+        if(mb_address < 0 || mb_y >= dec->seq_hdr->mb_height) {
+            return RC_INVALIDDATA;
+        }
+
+        /* Intra macroblocks differ only by the quantizer scale, which the DC term doesn't use */
+        rc = vlc_decode_table(bs, dec->vlc_mb_type_i, 1, &type, &decoded_bytes);
+        if(failed(rc)) return rc;
+
+        if(decoded_bytes != 1) {
+            return RC_END_OF_STREAM;
+        }
+
+        if(type & 0x01) {
+            bitstream_skip_bits(bs, 5);
+        }
+
+        for(i=0; i<6; i++) {
+            rc = mpg1_read_intra_dc(dec, bs, &s, i, &dc);
+            if(failed(rc)) return rc;
+
+            rc = mpg1_skip_coeffs(dec, bs);
+            if(failed(rc)) return rc;
 
+            uint8_t *dst;
+            int32_t value = mmf_dct_funcs.idct_dc(dc);
+
+            switch(i) {
+            case MPEG2_BLOCK_TYPE_CB:
+                dst = (uint8_t*)sample->buffer_data[1] + mb_y * sample->buffer_stride[1] + mb_x;
+                break;
+            case MPEG2_BLOCK_TYPE_CR:
+                dst = (uint8_t*)sample->buffer_data[2] + mb_y * sample->buffer_stride[2] + mb_x;
+                break;
+            default:
+                /* Y blocks are ordered left to right, top to bottom inside the macroblock */
+                dst = (uint8_t*)sample->buffer_data[0] + (mb_y * 2 + (i >> 1)) * sample->buffer_stride[0] + mb_x * 2 + (i & 1);
+                break;
+            }
+
+            *dst = value > 255 ? 255 : value < 0 ? 0 : value;
+        }
+    } while(bitstream_show_bits(bs, 23) != 0);
+
+    return RC_OK;
+}
+
+MMFRES mpg1_decoder_get_keyframe_size(MPEG1DecoderContext *dec, int32_t *width, int32_t *height)
+{
     if(dec->seq_hdr == NULL) {
-        /* Allocate sequence header struct */
-        dec->seq_hdr = mmf_alloc(sizeof(MPEG1SeqHeader));
-        if(!dec->seq_hdr) return RC_OUTOFMEM;
+        *width = *height = 0;
+        return RC_INVALIDDATA;
+    }
+
+    *width = dec->seq_hdr->mb_width * 2;
+    *height = dec->seq_hdr->mb_height * 2;
+
+    return RC_OK;
+}
 
-        /* Parse video sequence header */
-        rc = mpg1_read_seqence_header(dec->bs, dec->seq_hdr);
+MMFRES mpg1_decode_keyframe(MPEG1DecoderContext *dec, MMFSample *sample)
+{
+    MMFRES rc;
+    MPEG1PictureHeader hdr;
+    uint32_t code;
+    int32_t w, h;
+
+    if(dec->frame_threads) {
+        mpg1_frame_threads_flush(dec);
+    }
+
+    /* The pictures, which mpg1_decode_sample() holds, would be out of date. Pictures predicted
+     * from before the next I picture are skipped, like after a seek.
+     */
+    mpg1_picture_unref(&dec->reorder_pic);
+    dec->reorder_early = 0;
+    dec->skipped_ref = 1;
+
+    rc = mpg1_decoder_release_refpics(dec);
+    if(failed(rc)) return rc;
+
+    for(;;) {
+        rc = mpg1_read_headers(dec);
+        if(failed(rc)) return rc;
+
+        if(dec->seq_hdr == NULL) {
+            /* The stream doesn't start with a sequence header */
+            return RC_INVALIDDATA;
+        }
+
+        /* The size may change with a sequence header in front of the picture */
+        mpg1_decoder_get_keyframe_size(dec, &w, &h);
+
+        if(sample->buffer_count != 3 || sample->format != SAMPLE_FORMAT_YUV420P || sample->width != w || sample->height != h) {
+            /* Sample not initialized correctly */
+            return RC_INVALIDARG;
+        }
+
+        rc = mpg1_read_picture_header(dec->bs, &hdr);
+        if(failed(rc)) return rc;
+
+        mpg1_decoder_stamp_picture(dec, &hdr);
+
+        if(hdr.frame_type == MPEG2_FRAME_TYPE_I) {
+            break;
+        }
+
+        rc = mpg1_skip_picture(dec->bs);
         if(failed(rc)) return rc;
     }
 
-    /* Check if we are currently in a GOP */
-    if(dec->group == NULL) {
-        /* Apparently not. Find and read GOP */
-        dec->group = mmf_alloc(sizeof(MPEG1GroupHeader));
-        if(!dec->group) return RC_OUTOFMEM;
+    for(;;) {
+        rc = mpg1_next_start_code(dec->bs);
+        if(failed(rc)) break;
 
-        rc = mpg1_read_group_header(dec->bs, dec->group);
+        code = bitstream_peek_bits(dec->bs, 32, &rc);
         if(failed(rc)) return rc;
+
+        if(code < MPEG2_SLICE_MIN_STARTCODE || code > MPEG2_SLICE_MAX_STARTCODE) {
+            break;
+        }
+
+        /* Errors damage only the rest of the slice, decoding resumes at the next one */
+        mpg1_decode_slice_dc(dec, dec->bs, sample);
     }
 
-    if(sample == NULL) {
-        /* Passing NULL sample to decoder causes it to initialize only */
-        return RC_OK;
+    sample->pts = hdr.pts;
+    return RC_OK;
+}
+
+/* Appends an entry to the index, growing it when needed.
+ */
+static MMFRES mpg1_index_append(MPEG1Index *index, MPEG1IndexEntry *e)
+{
+    if(index->count == index->capacity) {
+        int32_t capacity = index->capacity ? index->capacity * 2 : 256;
+        MPEG1IndexEntry *entries = mmf_realloc(index->entries, capacity * sizeof(MPEG1IndexEntry));
+        if(!entries) return RC_OUTOFMEM;
+
+        index->entries = entries;
+        index->capacity = capacity;
     }
 
-    /* Validate sample */
-    if(sample->buffer_count == 0 || sample->width != dec->seq_hdr->width || sample->height != dec->seq_hdr->height) {
-        /* Sample not initialized correctly */
-        return RC_INVALIDARG;
+    index->entries[index->count++] = *e;
+    return RC_OK;
+}
+
+/*
+ * Scans the stream for start codes, and records the positions of sequence headers,
+ * GOP headers and pictures.
+ */
+MMFRES mpg1_index_build(MMFBitstream *bs, MPEG1Index **index)
+{
+    MMFRES rc;
+    MPEG1IndexEntry e;
+    MPEG1PictureHeader hdr;
+    uint32_t code;
+
+    /* Number of the first frame in the current GOP */
+    int32_t gop_frame = 0;
+
+    MPEG1Index *idx = mmf_allocz(sizeof(MPEG1Index));
+    if(!idx) return RC_OUTOFMEM;
+
+    while(succeeded(rc = bitstream_next_start_code(bs))) {
+        memset(&e, 0, sizeof(e));
+        e.offset = bitstream_tell(bs);
+
+        code = bitstream_peek_bits(bs, 32, &rc);
+        if(failed(rc)) break;
+
+        switch(code) {
+        case MPEG2_SEQ_STARTCODE:
+            e.type = MPEG1_INDEX_SEQ_HEADER;
+            bitstream_skip_bits(bs, 32);
+            break;
+
+        case MPEG2_GOP_STARTCODE:
+            /* Temporal references restart from zero in each GOP */
+            gop_frame = idx->frame_count;
+
+            e.type = MPEG1_INDEX_GOP;
+            e.frame = gop_frame;
+            rc = mpg1_read_group_header(bs, &e.gop);
+            break;
+
+        case MPEG2_PICTURE_STARTCODE:
+            rc = mpg1_read_picture_header(bs, &hdr);
+            if(failed(rc)) {
+                /* Damaged picture, skip it */
+                rc = RC_OK;
+                continue;
+            }
+
+            e.type = MPEG1_INDEX_PICTURE;
+            e.frame_type = hdr.frame_type;
+            e.seq_number = hdr.seq_number;
+            e.frame = gop_frame + hdr.seq_number;
+            idx->frame_count++;
+            break;
+
+        default:
+            /* Slices and other data are not indexed */
+            bitstream_skip_bits(bs, 32);
+            continue;
+        }
+
+        if(failed(rc)) goto fail;
+
+        rc = mpg1_index_append(idx, &e);
+        if(failed(rc)) goto fail;
     }
 
-    /* Validate pixel format */
-    if(sample->format != SAMPLE_FORMAT_YUV420P) {
-        /* Unsupported pix fmt */
-        return RC_INVALIDARG;
+    if(rc != RC_END_OF_STREAM) goto fail;
+
+    idx->stream_size = bitstream_tell(bs);
+    if(bs->file_size > idx->stream_size) {
+        idx->stream_size = bs->file_size;
     }
 
-    /* Read a picture */
-    MPEG1Picture *pic;
-    rc = mpg1_decode_picture(dec, &pic);
+    *index = idx;
+    return RC_OK;
+
+fail:
+    mpg1_index_free(&idx);
+    return rc;
+}
+
+MMFRES mpg1_index_free(MPEG1Index **index)
+{
+    MPEG1Index *idx = *index;
+
+    if(idx) {
+        mmf_free(idx->entries);
+        mmf_free(idx);
+    }
+
+    *index = NULL;
+    return RC_OK;
+}
+
+/* The sidecar file consists of a header and fixed-size entries. All fields are
+ * little-endian:
+ *
+ *   header: "M1VI", version (u32), entry count (u32), frame count (u32), stream size (u64)
+ *   entry:  offset (u64), type (u8), frame type (u8), temporal reference (u16), frame (u32),
+ *           drop, hour, minute, second, frame, closed and broken flags of GOPs (7 x u8), padding (u8)
+ */
+#define MPEG1_INDEX_MAGIC           "M1VI"
+#define MPEG1_INDEX_VERSION         1
+#define MPEG1_INDEX_HEADER_SIZE     24
+#define MPEG1_INDEX_ENTRY_SIZE      24
+
+static void mpg1_index_put_le(uint8_t *p, uint64_t v, int32_t n)
+{
+    int32_t i;
+
+    for(i=0; i<n; i++) {
+        p[i] = (uint8_t)(v >> (i * 8));
+    }
+}
+
+static uint64_t mpg1_index_get_le(const uint8_t *p, int32_t n)
+{
+    uint64_t v = 0;
+    int32_t i;
+
+    for(i=n-1; i>=0; i--) {
+        v = (v << 8) | p[i];
+    }
+
+    return v;
+}
+
+MMFRES mpg1_index_save(MPEG1Index *index, char *filename)
+{
+    uint8_t buf[MPEG1_INDEX_ENTRY_SIZE];
+    int32_t i;
+
+    FILE *f = fopen(filename, "wb");
+    if(!f) return RC_INVALIDARG;
+
+    memcpy(buf, MPEG1_INDEX_MAGIC, 4);
+    mpg1_index_put_le(buf + 4, MPEG1_INDEX_VERSION, 4);
+    mpg1_index_put_le(buf + 8, index->count, 4);
+    mpg1_index_put_le(buf + 12, index->frame_count, 4);
+    mpg1_index_put_le(buf + 16, index->stream_size, 8);
+
+    if(fwrite(buf, MPEG1_INDEX_HEADER_SIZE, 1, f) != 1) goto fail;
+
+    for(i=0; i<index->count; i++) {
+        MPEG1IndexEntry *e = &index->entries[i];
+
+        mpg1_index_put_le(buf, e->offset, 8);
+        buf[8] = e->type;
+        buf[9] = e->frame_type;
+        mpg1_index_put_le(buf + 10, (uint16_t)e->seq_number, 2);
+        mpg1_index_put_le(buf + 12, (uint32_t)e->frame, 4);
+        buf[16] = e->gop.drop_flag;
+        buf[17] = e->gop.hour;
+        buf[18] = e->gop.minute;
+        buf[19] = e->gop.second;
+        buf[20] = e->gop.frame;
+        buf[21] = e->gop.closed_flag;
+        buf[22] = e->gop.broken_flag;
+        buf[23] = 0;
+
+        if(fwrite(buf, MPEG1_INDEX_ENTRY_SIZE, 1, f) != 1) goto fail;
+    }
+
+    if(fclose(f) != 0) return RC_FAIL;
+    return RC_OK;
+
+fail:
+    fclose(f);
+    return RC_FAIL;
+}
+
+MMFRES mpg1_index_load(char *filename, MPEG1Index **index)
+{
+    MMFRES rc = RC_INVALIDDATA;
+    uint8_t buf[MPEG1_INDEX_ENTRY_SIZE];
+    MPEG1Index *idx = NULL;
+    int32_t i, count;
+
+    FILE *f = fopen(filename, "rb");
+    if(!f) return RC_INVALIDARG;
+
+    if(fread(buf, MPEG1_INDEX_HEADER_SIZE, 1, f) != 1) goto fail;
+
+    if(memcmp(buf, MPEG1_INDEX_MAGIC, 4) != 0 || mpg1_index_get_le(buf + 4, 4) != MPEG1_INDEX_VERSION) {
+        /* Not an index file, or unknown version */
+        goto fail;
+    }
+
+    count = (int32_t)mpg1_index_get_le(buf + 8, 4);
+    if(count < 0 || count > INT32_MAX / (int32_t)sizeof(MPEG1IndexEntry)) goto fail;
+
+    idx = mmf_allocz(sizeof(MPEG1Index));
+    if(!idx) {
+        rc = RC_OUTOFMEM;
+        goto fail;
+    }
+
+    idx->frame_count = (int32_t)mpg1_index_get_le(buf + 12, 4);
+    idx->stream_size = (int64_t)mpg1_index_get_le(buf + 16, 8);
+
+    if(count > 0) {
+        idx->entries = mmf_alloc(count * sizeof(MPEG1IndexEntry));
+        if(!idx->entries) {
+            rc = RC_OUTOFMEM;
+            goto fail;
+        }
+    }
+
+    idx->capacity = count;
+
+    for(i=0; i<count; i++) {
+        MPEG1IndexEntry *e = &idx->entries[i];
+
+        if(fread(buf, MPEG1_INDEX_ENTRY_SIZE, 1, f) != 1) goto fail;
+
+        e->offset = (int64_t)mpg1_index_get_le(buf, 8);
+        e->type = buf[8];
+        e->frame_type = buf[9];
+        e->seq_number = (int16_t)mpg1_index_get_le(buf + 10, 2);
+        e->frame = (int32_t)mpg1_index_get_le(buf + 12, 4);
+        e->gop.drop_flag = buf[16];
+        e->gop.hour = buf[17];
+        e->gop.minute = buf[18];
+        e->gop.second = buf[19];
+        e->gop.frame = buf[20];
+        e->gop.closed_flag = buf[21];
+        e->gop.broken_flag = buf[22];
+
+        if(e->type < MPEG1_INDEX_SEQ_HEADER || e->type > MPEG1_INDEX_PICTURE || e->offset < 0) goto fail;
+
+        idx->count++;
+    }
+
+    fclose(f);
+
+    *index = idx;
+    return RC_OK;
+
+fail:
+    fclose(f);
+    if(idx) mpg1_index_free(&idx);
+    return rc;
+}
+
+/*
+ * Builds the index from the beginning of the stream, and restores the reading position.
+ */
+MMFRES mpg1_decoder_build_index(MPEG1DecoderContext *dec)
+{
+    MMFRES rc;
+    MPEG1Index *index;
+    int64_t pos = bitstream_tell(dec->bs);
+    int32_t bit_offset = dec->bs->read_bit_index & 7;
+
+    rc = bitstream_seek(dec->bs, 0);
     if(failed(rc)) return rc;
 
-    /* Perform conditional replenishment */
-    if(pic->hdr.frame_type == MPEG2_FRAME_TYPE_P || pic->hdr.frame_type == MPEG2_FRAME_TYPE_B) {
-		/* Get the reference picture, which we will use as a base
-		 * to reconstruct current picture.
-		 */
-    	rc = mpg1_perform_prediction(dec, pic, dec->ref_pic_last);
-    	if(failed(rc)) return rc;
+    rc = mpg1_index_build(dec->bs, &index);
+
+    /* Go back where we were */
+    if(failed(bitstream_seek(dec->bs, pos))) {
+        if(succeeded(rc)) mpg1_index_free(&index);
+        return RC_FAIL;
     }
 
-    //fill with zeroes (test)
-    /*
-    memset(pic->Y_plane, 0, dec->seq_hdr->width * dec->seq_hdr->height);
-    memset(pic->U_plane, 64, dec->seq_hdr->width * dec->seq_hdr->height / 4);
-    memset(pic->V_plane, 64, dec->seq_hdr->width * dec->seq_hdr->height / 4);
+    bitstream_skip_bits(dec->bs, bit_offset);
+    if(failed(rc)) return rc;
 
-    memset(sample->buffer_data[0], 251, dec->seq_hdr->width * dec->seq_hdr->height);
-    memset(sample->buffer_data[1], 100, dec->seq_hdr->width * dec->seq_hdr->height / 4);
-    memset(sample->buffer_data[2], 50, dec->seq_hdr->width * dec->seq_hdr->height / 4);
-*/
+    return mpg1_decoder_set_index(dec, index);
+}
 
-    int mb_x = dec->seq_hdr->mb_width;
-    int mb_y = dec->seq_hdr->mb_height;
-    int i, j;
+MMFRES mpg1_decoder_set_index(MPEG1DecoderContext *dec, MPEG1Index *index)
+{
+    int64_t size = dec->bs->file_size;
 
-    /*
-     * Copy decoded picture data to sample (macroblock by macroblock)
+    if(size > 0 && index->stream_size != size) {
+        /* The index is not made for this stream */
+        mpg1_index_free(&index);
+        return RC_INVALIDDATA;
+    }
+
+    if(dec->index) {
+        mpg1_index_free(&dec->index);
+    }
+
+    dec->index = index;
+    return RC_OK;
+}
+
+MMFRES mpg1_decoder_seek(MPEG1DecoderContext *dec, int64_t frame, int64_t *actual)
+{
+    MMFRES rc;
+    int32_t i, pic = -1;
+
+    /* Drop the pictures, which are decoded ahead */
+    if(dec->frame_threads) {
+        mpg1_frame_threads_flush(dec);
+    }
+
+    if(dec->index == NULL) {
+        rc = mpg1_decoder_build_index(dec);
+        if(failed(rc)) return rc;
+    }
+
+    MPEG1Index *idx = dec->index;
+
+    /* Find the last I-frame, which is displayed not later than the target. I-frames
+     * are displayed in the order they are coded. If the target precedes all of them,
+     * the first one is taken.
      */
-    for(i=0; i<mb_x*mb_y; i++) {
-        int x = (i * 16) % dec->seq_hdr->width;
-        int y = ((i * 16) / dec->seq_hdr->width) * 16;
+    for(i=0; i<idx->count; i++) {
+        MPEG1IndexEntry *e = &idx->entries[i];
+
+        if(e->type != MPEG1_INDEX_PICTURE || e->frame_type != MPEG2_FRAME_TYPE_I) {
+            continue;
+        }
+
+        if(pic >= 0 && e->frame > frame) {
+            break;
+        }
+
+        pic = i;
+    }
+
+    if(pic < 0) {
+        /* No I-frames in the stream */
+        return RC_INVALIDDATA;
+    }
 
-        int8_t *y1_block = pic->Y_plane + (i * 4 * 64);
-        int8_t *y2_block = pic->Y_plane + (i * 4 * 64) + 64;
-        int8_t *y3_block = pic->Y_plane + (i * 4 * 64) + 128;
-        int8_t *y4_block = pic->Y_plane + (i * 4 * 64) + 192;
+    rc = mpg1_decoder_seek_entry(dec, idx, pic);
+    if(failed(rc)) return rc;
+
+    if(actual) *actual = idx->entries[pic].frame;
+    return RC_OK;
+}
+
+MMFRES mpg1_decoder_seek_entry(MPEG1DecoderContext *dec, MPEG1Index *idx, int32_t entry)
+{
+    MMFRES rc;
+    int32_t i, seq = -1, gop = -1;
+
+    if(entry < 0 || entry >= idx->count || idx->entries[entry].type != MPEG1_INDEX_PICTURE) {
+        return RC_INVALIDARG;
+    }
 
-        int8_t *y_dst = sample->buffer_data[0] + (y * sample->buffer_stride[0]) + (x);
+    if(dec->frame_threads) {
+        mpg1_frame_threads_flush(dec);
+    }
 
-        /* Copy Y blocks */
-        for(j=0; j<8; j++) {
-            /* Copy block line by line */
-            memcpy(y_dst + (j * sample->buffer_stride[0]), y1_block + (j * 8), 8);
-            memcpy(y_dst + (j * sample->buffer_stride[0]) + 8, y2_block + (j * 8), 8);
-            memcpy(y_dst + ((j+8) * sample->buffer_stride[0]), y3_block + (j * 8), 8);
-            memcpy(y_dst + ((j+8) * sample->buffer_stride[0]) + 8, y4_block + (j * 8), 8);
+    /* Find the sequence and GOP headers, which are in effect for the picture */
+    for(i=entry-1; i>=0 && seq < 0; i--) {
+        if(idx->entries[i].type == MPEG1_INDEX_GOP && gop < 0) {
+            gop = i;
+        } else if(idx->entries[i].type == MPEG1_INDEX_SEQ_HEADER) {
+            seq = i;
         }
+    }
+
+    if(seq >= 0) {
+        rc = bitstream_seek(dec->bs, idx->entries[seq].offset);
+        if(failed(rc)) return rc;
+
+        rc = mpg1_decoder_read_seq_header(dec);
+        if(failed(rc)) return rc;
+    }
+
+    /* Pictures are counted from the GOP, like in the index, so the time stamps don't change */
+    dec->picture_count = gop >= 0 ? idx->entries[gop].frame : 0;
 
-        int8_t *u_block = pic->U_plane + i * 64;
-        int8_t *v_block = pic->V_plane + i * 64;
+    if(gop >= 0) {
+        rc = bitstream_seek(dec->bs, idx->entries[gop].offset);
+        if(failed(rc)) return rc;
 
-        int8_t *u_dst = sample->buffer_data[1] + (y * sample->buffer_stride[1] / 2) + (x/2);
-        int8_t *v_dst = sample->buffer_data[2] + (y * sample->buffer_stride[2] / 2) + (x/2);
+        rc = mpg1_decoder_read_group_header(dec);
+        if(failed(rc)) return rc;
+    }
 
-        /* Copy U, V blocks */
-        for(j=0; j<8; j++) {
-            /* Copy block line by line */
-            memcpy(u_dst + (j * sample->buffer_stride[1]), u_block + (j * 8), 8);
-            memcpy(v_dst + (j * sample->buffer_stride[2]), v_block + (j * 8), 8);
-   //         memset(u_dst + (j * sample->buffer_stride[1]), -128, 8);
-   //         memset(v_dst + (j * sample->buffer_stride[2]), -128, 8);
+    for(i=(gop >= 0 ? gop : 0); i<entry; i++) {
+        if(idx->entries[i].type == MPEG1_INDEX_PICTURE) {
+            dec->picture_count++;
         }
     }
 
-    switch(pic->hdr.frame_type) {
-    case MPEG2_FRAME_TYPE_I:
-    case MPEG2_FRAME_TYPE_P:
-    	/*
-    	 * Keep this frame, since it will be used as a reference picture
-    	 * when decoding next pictures.
-    	 */
-    	mpg1_decoder_set_last_refpic(dec, pic);
-    	break;
-    default:
-    	/* Release MMFPicture */
-    	mpg1_picture_free(&pic);
-    	break;
+    rc = bitstream_seek(dec->bs, idx->entries[entry].offset);
+    if(failed(rc)) return rc;
+
+    /* Pictures before the entry are neither output, nor used as references anymore */
+    mpg1_picture_unref(&dec->reorder_pic);
+    dec->reorder_early = 0;
+    dec->skipped_ref = 0;
+
+    return mpg1_decoder_release_refpics(dec);
+}
+
+MMFRES mpg1_decoder_seek_time(MPEG1DecoderContext *dec, double seconds, int64_t *actual)
+{
+    if(dec->seq_hdr == NULL || dec->seq_hdr->frame_rate_den == 0 || dec->seq_hdr->frame_rate_num == 0) {
+        /* Frame rate is unknown */
+        return RC_INVALIDDATA;
     }
 
-    return rc;
+    int64_t frame = (int64_t)(seconds * dec->seq_hdr->frame_rate_num / dec->seq_hdr->frame_rate_den);
+    return mpg1_decoder_seek(dec, frame, actual);
 }
@@ -3,7 +3,9 @@
 
 #include "..\mmfutil.h"
 #include "..\mmfsample.h"
+#include "..\mmfscale.h"
 #include "vlc_coding.h"
+#include "..\generic\threadpool.h"
 
 //Constants
 #define MPEG2_SEQ_STARTCODE     0x000001B3
@@ -13,6 +15,7 @@
 #define MPEG2_PICTURE_STARTCODE 0x00000100
 #define MPEG2_SLICE_MIN_STARTCODE   0x00000101
 #define MPEG2_SLICE_MAX_STARTCODE   0x000001AF
+#define MPEG2_USER_DATA_STARTCODE   0x000001B2
 
 #define MPEG2_FRAME_TYPE_I      0x1
 #define MPEG2_FRAME_TYPE_P      0x2
@@ -105,32 +108,182 @@ typedef struct {
     int64_t dts;
 } MPEG1PictureHeader;
 
+/*
+ * Discard levels: pictures, which are skipped without decoding (see mpg1_decoder_set_discard())
+ */
+#define MPEG1_DISCARD_NONE      0x0 //Decode all pictures (default)
+#define MPEG1_DISCARD_B         0x1 //Skip B pictures
+#define MPEG1_DISCARD_NONREF    0x2 //Skip all pictures, which are not references (B and D pictures)
+#define MPEG1_DISCARD_NONKEY    0x3 //Skip all pictures, except I pictures
+
+/*
+ * Kinds of stream index entries
+ */
+#define MPEG1_INDEX_SEQ_HEADER  0x1
+#define MPEG1_INDEX_GOP         0x2
+#define MPEG1_INDEX_PICTURE     0x3
+
+/*
+ * Stream index entry. It records the position of a sequence header, GOP header or picture.
+ */
 typedef struct {
-	int8_t x;
-	int8_t y;
-} MPEG1MotionVector;
+    /* Byte offset of the start code in the stream */
+    int64_t offset;
+
+    /* MPEG1_INDEX_* */
+    int8_t type;
+
+    /* Pictures only: frame type and temporal reference */
+    int8_t frame_type;
+    int16_t seq_number;
 
+    /* Pictures: frame number in display order. GOPs: number of the first frame in the group. */
+    int32_t frame;
+
+    /* GOPs only: time code and flags */
+    MPEG1GroupHeader gop;
+} MPEG1IndexEntry;
+
+/*
+ * Stream index, built by an indexing pass over the whole stream. It can be persisted
+ * in a sidecar file, so the pass is needed only once per stream.
+ */
+typedef struct {
+    MPEG1IndexEntry *entries;
+    int32_t count;
+    int32_t capacity;
+
+    /* Number of pictures in the stream */
+    int32_t frame_count;
+
+    /* Size of the indexed stream in bytes */
+    int64_t stream_size;
+} MPEG1Index;
+
+/*
+ * Position of a slice in the stream, found by the scan which precedes parallel slice decoding
+ */
 typedef struct {
+    int64_t offset;
+    int64_t size;
+
+    /* Macroblock row of the first macroblock */
+    int32_t row;
+} MPEG1SliceRef;
+
+/* Reconstructed motion vector. It is in half pels, unless the picture has full-pel vectors. */
+typedef struct {
+	int16_t x;
+	int16_t y;
+} MPEG1MotionVector;
+
+typedef struct MPEG1Picture {
     MPEG1PictureHeader hdr;
 
-    int8_t *Y_plane;
-    int8_t *U_plane;
-    int8_t *V_plane;
+    /* Size of the picture */
+    int32_t width;
+    int32_t height;
+
+    /* The planes are 1/2^lowres of the picture size (see mpg1_decoder_set_lowres()) */
+    int8_t lowres;
+
+    /* Planes are in raster order, and cover whole macroblocks. They are either
+     * owned by the picture, or borrowed from the output sample (own_planes == 0).
+     */
+    uint8_t *Y_plane;
+    uint8_t *U_plane;
+    uint8_t *V_plane;
+
+    int32_t Y_stride;
+    int32_t UV_stride;
+    int8_t own_planes;
+
+    /* Planes allocated by the picture. They are kept while the sample's planes are
+     * borrowed, so the picture can be reused either way.
+     */
+    uint8_t *buffers[3];
 
     MPEG1MotionVector *mv_forward;
     MPEG1MotionVector *mv_backward;
+
+    /* Pictures it is predicted from (forward and backward). They are referenced only
+     * while the picture is being decoded.
+     */
+    struct MPEG1Picture *ref_fwd;
+    struct MPEG1Picture *ref_bwd;
+
+    /* Number of references (the decoder's reference slots, and frame-thread jobs) */
+    int32_t refs;
+
+    /* Number of macroblock rows, which are completely reconstructed. Frame threads
+     * wait on it, before they read a reference picture.
+     */
+    int32_t rows_done;
+
+    /* Set for B pictures, which refer to a picture before a seek or a broken link.
+     * They are decoded (for simplicity), but not output.
+     */
+    int8_t broken;
+
+    /* Set when the picture's rows are scaled to the output while they are decoded
+     * (see mpg1_decode_picture()), so only the rest is scaled when it's output.
+     */
+    int8_t scaling;
+
+    /* Pool, the picture returns to when it's last reference is released (or NULL) */
+    struct MPEG1PicturePool *pool;
 } MPEG1Picture;
 
+/*
+ * Pictures of a decoder, which are reused instead of being allocated for each picture.
+ * It is filled up front with the pictures needed at a time, and grows only if a stream
+ * holds more. Like the reference counts, it is used by the calling thread only.
+ */
+typedef struct MPEG1PicturePool {
+    /* Pictures, which are not in use. There is room for all pictures of the pool. */
+    MPEG1Picture **free;
+    int32_t free_count;
+
+    /* Number of pictures of the pool (free and in use) */
+    int32_t size;
+
+    /* Size and scale of the pictures. Other pictures are freed, when they are released. */
+    int32_t width;
+    int32_t height;
+    int8_t lowres;
+} MPEG1PicturePool;
+
+/* Frame decoding thread (private to the decoder) */
+typedef struct MPEG1FrameThread MPEG1FrameThread;
+
 /*
  * Slice header
  */
 typedef struct {
-    int8_t row;
+    int16_t row;
     int8_t quant_scale;
 
     int16_t last_dc_y;
     int16_t last_dc_cb;
     int16_t last_dc_cr;
+
+    /* Number of macroblocks decoded in the slice so far */
+    int32_t mb_count;
+
+    /* Motion vector predictors, and the prediction directions of the last macroblock,
+     * which are repeated by skipped macroblocks of B pictures.
+     */
+    MPEG1MotionVector pmv_fwd;
+    MPEG1MotionVector pmv_bwd;
+    int8_t last_forward;
+    int8_t last_backward;
+
+    /* Rows of the reference pictures, which are known to be complete */
+    int32_t fwd_rows;
+    int32_t bwd_rows;
+
+    /* Macroblocks above this row are parsed, but not reconstructed (see mpg1_decoder_set_roi()) */
+    int32_t first_row;
 } MPEG1SliceHeader;
 
 /* Motion vector
@@ -146,7 +299,7 @@ typedef struct {
 /*
  */
 typedef struct {
-    int8_t address_increment;
+    int32_t address_increment; //Skipped macroblocks + 1, more than 127 with escape codes
     int16_t type;
     int8_t quant_scale;
     int8_t coded_block_pattern;
@@ -177,20 +330,62 @@ typedef struct {
     MPEG1SeqHeader *seq_hdr;
     MPEG1GroupHeader *group;
 
-    //VLC decoding trees
-    VLCTreeNode *vlc_mb_addr_increment;
-    VLCTreeNode *vlc_mb_type_i;
-    VLCTreeNode *vlc_mb_type_p;
-    VLCTreeNode *vlc_mb_type_b;
-    VLCTreeNode *vlc_mb_type_d;
-    VLCTreeNode *vlc_mb_cb_pattern;
-    VLCTreeNode *vlc_motion_code;
-    VLCTreeNode *vlc_dc_size_luma;
-    VLCTreeNode *vlc_dc_size_chroma;
-    VLCTreeNode *vlc_run_levels;
-
-    /* Last decoded picture id */
-    uint64_t last_pts;
+    //VLC decoding tables (shared by all decoder instances)
+    const VLCTable *vlc_mb_addr_increment;
+    const VLCTable *vlc_mb_type_i;
+    const VLCTable *vlc_mb_type_p;
+    const VLCTable *vlc_mb_type_b;
+    const VLCTable *vlc_mb_type_d;
+    const VLCTable *vlc_mb_cb_pattern;
+    const VLCTable *vlc_motion_code;
+    const VLCTable *vlc_dc_size_luma;
+    const VLCTable *vlc_dc_size_chroma;
+    const VLCTable *vlc_run_levels;
+
+    /* Number of pictures read so far (in decoding order), and the number of the first
+     * picture of the current GOP. Presentation time stamps are counted from them, the same
+     * way the index numbers the frames.
+     */
+    int64_t picture_count;
+    int64_t gop_frame;
+
+    /* Worker threads for slice decoding (NULL if slices are decoded one by one),
+     * and the slices of the current picture.
+     */
+    MMFThreadPool *slice_pool;
+    MPEG1SliceRef *slices;
+    int32_t slice_capacity;
+
+    /* Frame threads. Pictures are decoded in a pipeline, one per thread, and handed out
+     * in order. frame_head is the thread, which gets the next picture, and frame_pending
+     * is the number of pictures in the pipeline.
+     */
+    MPEG1FrameThread *frame_threads;
+    int32_t frame_thread_count;
+    int32_t frame_head;
+    int32_t frame_pending;
+    int8_t frame_eos;
+
+    /* Discard level (MPEG1_DISCARD_*). skipped_ref is set after a reference picture is
+     * skipped, so the pictures predicted from it are skipped too, up to the next I picture.
+     */
+    int8_t discard;
+    int8_t skipped_ref;
+
+    /* Region of interest, in lines of the stream (roi_height == 0 for whole pictures), see
+     * mpg1_decoder_set_roi()
+     */
+    int32_t roi_top;
+    int32_t roi_height;
+
+    /* Guards the rows_done field of pictures */
+    pthread_mutex_t progress_lock;
+    pthread_cond_t progress_cond;
+
+    /* Stream index, used for seeking. It is built on the first seek, unless it is given
+     * by mpg1_decoder_set_index().
+     */
+    MPEG1Index *index;
 
     /**
      * Keeps track of the last reference frame (either I or P).
@@ -202,15 +397,236 @@ typedef struct {
      */
     MPEG1Picture *ref_pic_penult;
 
+    /* Recycled pictures */
+    MPEG1PicturePool pool;
+
+    /* Reference picture, which is decoded but not output yet. Pictures are output in display
+     * order: a reference picture follows the B pictures which are decoded after it.
+     */
+    MPEG1Picture *reorder_pic;
+
+    /* Set when a reference picture is output before the B pictures which follow it (while
+     * they are skipped). The ones still decoded are dropped up to the next reference picture.
+     */
+    int8_t reorder_early;
+
+    /* Pictures are decoded at 1/2^lowres of the stream's size */
+    int8_t lowres;
+
+    /* Size of the output frames (0 for the decoded size) and the filter, which they are
+     * scaled with (see mpg1_decoder_set_output_size()). The scaler is created for the
+     * current sizes when a picture is output. Frames in other formats than YUV420P are
+     * scaled into "scaled" first, and converted from it.
+     */
+    int32_t out_width;
+    int32_t out_height;
+    MMFScaleFilter out_filter;
+    MMFScaler *scaler;
+    MMFSample *scaled;
+
     /* Current quantization matrices */
-    int8_t qm_intra[64];
-    int8_t qm_inter[64];
+    uint8_t qm_intra[64];
+    uint8_t qm_inter[64];
+
+    /* Dequantization tables, i.e. the quantization matrices multiplied by each
+     * quant_scale (1..31). They are rebuilt only when the matrices change.
+     */
+    int16_t dq_intra[32][64];
+    int16_t dq_inter[32][64];
 } MPEG1DecoderContext;
 
 MMFRES mpg1_decoder_create(MPEG1DecoderContext **dec, char *filename);
+
+/**
+ * Creates a decoder, which reads the stream directly from memory (without copying it).
+ * The memory should stay valid until the decoder is freed.
+ */
+MMFRES mpg1_decoder_create_from_memory(MPEG1DecoderContext **dec, const uint8_t *data, int64_t size);
+
+/**
+ * Creates a decoder, which pulls the stream through a read callback (e.g. from a pipe,
+ * shared memory or a network connection).
+ */
+MMFRES mpg1_decoder_create_from_callback(MPEG1DecoderContext **dec, MMFBitstreamReadFunc read_func, void *opaque);
+
+/**
+ * Creates a decoder around an existing bitstream. The decoder takes ownership of the bitstream,
+ * even on failure.
+ */
+MMFRES mpg1_decoder_create_from_bitstream(MPEG1DecoderContext **dec, MMFBitstream *bs);
 MMFRES mpg1_decoder_free(MPEG1DecoderContext **dec);
+
+/**
+ * Decodes the next frame in display order. Reference pictures are held back until the
+ * B pictures which precede them in display order are output, and the last one is output
+ * at the end of stream. The sample's pts is set to the frame number, counted like in the index.
+ * @param dec Pointer to decoder context
+ * @param sample YUV420P, NV12 or RGBA32 frame of the size given by mpg1_decoder_get_output_size().
+ *               Other formats than YUV420P are converted when the frame is output (see
+ *               mmf_convert_yuv420p()). If NULL, only the headers are read.
+ * @return RC_OK on success, RC_END_OF_STREAM when there are no more frames, error otherwise.
+ */
 MMFRES mpg1_decode_sample(MPEG1DecoderContext *dec, MMFSample *sample);
 
+/**
+ * Decodes the next I picture as a keyframe mosaic, e.g. for scene change detection or seek bar
+ * previews. Each pixel is the average of an 8x8 block, which is given by the block's DC coefficient,
+ * so the AC coefficients are only skipped over, and the other pictures aren't decoded at all.
+ * Pictures held by mpg1_decode_sample() are dropped, and it resumes at the next I picture.
+ * @param dec Pointer to decoder context
+ * @param sample YUV420P frame of the size given by mpg1_decoder_get_keyframe_size(). Its pts is
+ *               set to the frame number.
+ * @return RC_OK on success, RC_END_OF_STREAM when there are no more I pictures, error otherwise.
+ */
+MMFRES mpg1_decode_keyframe(MPEG1DecoderContext *dec, MMFSample *sample);
+
+/**
+ * Returns the size of keyframe mosaics: one pixel per 8x8 block of the stream, i.e. the size
+ * in macroblocks times 2. The sequence header should be read already.
+ * @return RC_OK on success, RC_INVALIDDATA if no sequence header has been read.
+ */
+MMFRES mpg1_decoder_get_keyframe_size(MPEG1DecoderContext *dec, int32_t *width, int32_t *height);
+
+/**
+ * Sets the number of threads, which decode the slices of each picture in parallel.
+ * @param dec Pointer to decoder context
+ * @param threads Number of threads (including the calling one). 1 disables parallel decoding,
+ *                and 0 selects the number of logical processors.
+ * @return RC_OK on success, error otherwise.
+ */
+MMFRES mpg1_decoder_set_threads(MPEG1DecoderContext *dec, int32_t threads);
+
+/**
+ * Sets the number of frame threads. Each one decodes a whole picture, so the next pictures are
+ * parsed and reconstructed while the current one is being finished. Pictures wait only for the
+ * reference picture rows they need. Output still comes one picture per mpg1_decode_sample() call.
+ * @param dec Pointer to decoder context
+ * @param threads Number of frame threads. 1 disables frame threading, and 0 selects the number
+ *                of logical processors.
+ * @return RC_OK on success, error otherwise.
+ */
+MMFRES mpg1_decoder_set_frame_threads(MPEG1DecoderContext *dec, int32_t threads);
+
+/**
+ * Sets which pictures are skipped, e.g. for fast-forward, or to keep up with a live stream
+ * when the CPU is overloaded. Skipped pictures are jumped over at the start code level,
+ * without decoding their slices, and they are not output. It takes effect with the next
+ * picture, which is read from the stream.
+ * @param dec Pointer to decoder context
+ * @param level One of MPEG1_DISCARD_* values
+ * @return RC_OK on success, RC_INVALIDARG if the level is unknown.
+ */
+MMFRES mpg1_decoder_set_discard(MPEG1DecoderContext *dec, int32_t level);
+
+/**
+ * Sets the scale of the decoded frames, e.g. for thumbnails or previews. Only the low frequency
+ * coefficients of each block are transformed, straight into the smaller frame, and motion
+ * compensation runs on the smaller frames (so the errors of P and B pictures build up until the
+ * next I picture). Pictures predicted from the ones at the previous scale are skipped.
+ * @param dec Pointer to decoder context
+ * @param scale 0 for full size, 1, 2 or 3 for 1/2, 1/4 or 1/8 of the width and height.
+ * @return RC_OK on success, RC_INVALIDARG if the scale is out of range, RC_NOT_ALLOWED while
+ *         frame threads are decoding.
+ */
+MMFRES mpg1_decoder_set_lowres(MPEG1DecoderContext *dec, int32_t scale);
+
+/**
+ * Restricts decoding to a band of lines, e.g. when only a ticker at the bottom is analyzed. Slices
+ * outside the band are skipped at the start code level, and the parts of slices above it are only
+ * parsed. Only B and D pictures are restricted to the band. I and P pictures are decoded whole,
+ * since the rows which the following pictures predict from can't be known in advance. The lines
+ * outside the band are undefined in the output. It takes effect with the next picture, which is
+ * read from the stream.
+ * @param dec Pointer to decoder context
+ * @param top First line of the band, at the stream's size (mpg1_decoder_set_lowres() doesn't change it)
+ * @param height Number of lines in the band. 0 decodes whole pictures (default).
+ * @return RC_OK on success, RC_INVALIDARG if the band is negative.
+ */
+MMFRES mpg1_decoder_set_roi(MPEG1DecoderContext *dec, int32_t top, int32_t height);
+
+/**
+ * Returns the size of the decoded frames: the stream's size, reduced by the scale set with
+ * mpg1_decoder_set_lowres() and rounded up to even numbers. The sequence header should be
+ * read already.
+ * @return RC_OK on success, RC_INVALIDDATA if no sequence header has been read.
+ */
+MMFRES mpg1_decoder_get_frame_size(MPEG1DecoderContext *dec, int32_t *width, int32_t *height);
+
+/**
+ * Scales the output frames to a fixed size, e.g. a rung of a transcoding ladder. The frames are
+ * scaled while they are copied to the output sample, and B pictures as their macroblock rows are
+ * decoded, so the decoded rows are scaled while they are still in the cache. It takes effect with
+ * the next frame, and can be combined with mpg1_decoder_set_lowres() for large reductions.
+ * @param dec Pointer to decoder context
+ * @param width Width of the output frames (even), or 0 to output the frames at the decoded size
+ * @param height Height of the output frames (even), or 0
+ * @param filter One of MMFScaleFilter values
+ * @return RC_OK on success, RC_INVALIDARG if a size is odd or negative, or the filter is unknown.
+ */
+MMFRES mpg1_decoder_set_output_size(MPEG1DecoderContext *dec, int32_t width, int32_t height, MMFScaleFilter filter);
+
+/**
+ * Returns the size of the output frames, i.e. the one set with mpg1_decoder_set_output_size(),
+ * or the size of the decoded frames (see mpg1_decoder_get_frame_size()).
+ * @return RC_OK on success, RC_INVALIDDATA if no sequence header has been read.
+ */
+MMFRES mpg1_decoder_get_output_size(MPEG1DecoderContext *dec, int32_t *width, int32_t *height);
+
+MMFRES mpg1_read_seqence_header(MMFBitstream *bs, MPEG1SeqHeader *target);
+MMFRES mpg1_read_group_header(MMFBitstream *bs, MPEG1GroupHeader *g);
+MMFRES mpg1_read_picture_header(MMFBitstream *bs, MPEG1PictureHeader *picture);
+
+/**
+ * Builds an index of the sequence headers, GOP headers and pictures of a stream, by scanning
+ * it for start codes from the current position to the end.
+ */
+MMFRES mpg1_index_build(MMFBitstream *bs, MPEG1Index **index);
+MMFRES mpg1_index_free(MPEG1Index **index);
+
+/**
+ * Writes an index to a sidecar file, or reads it back.
+ */
+MMFRES mpg1_index_save(MPEG1Index *index, char *filename);
+MMFRES mpg1_index_load(char *filename, MPEG1Index **index);
+
+/**
+ * Builds the index of the decoder's stream, without disturbing the decoding position.
+ * The stream should be seekable.
+ */
+MMFRES mpg1_decoder_build_index(MPEG1DecoderContext *dec);
+
+/**
+ * Assigns an index (e.g. one loaded from a sidecar file) to the decoder. The decoder takes
+ * ownership of it. Returns RC_INVALIDDATA if the index doesn't match the stream size.
+ */
+MMFRES mpg1_decoder_set_index(MPEG1DecoderContext *dec, MPEG1Index *index);
+
+/**
+ * Positions the decoder at the nearest I-frame, which precedes the given frame (in display order).
+ * The next mpg1_decode_sample() decodes that I-frame. Frames up to the target should be decoded
+ * and discarded by the caller.
+ * @param dec Pointer to decoder context
+ * @param frame Target frame number
+ * @param actual Receives the frame number of the I-frame. NULL is allowed.
+ * @return RC_OK on success, error otherwise.
+ */
+MMFRES mpg1_decoder_seek(MPEG1DecoderContext *dec, int64_t frame, int64_t *actual);
+
+/**
+ * Positions the decoder at a picture of an index, after reading the sequence and GOP headers,
+ * which are in effect for it. The index may belong to another decoder of the same stream.
+ * @param dec Pointer to decoder context
+ * @param idx Stream index
+ * @param entry Index of a MPEG1_INDEX_PICTURE entry
+ * @return RC_OK on success, error otherwise.
+ */
+MMFRES mpg1_decoder_seek_entry(MPEG1DecoderContext *dec, MPEG1Index *idx, int32_t entry);
+
+/**
+ * Same as mpg1_decoder_seek(), but the target is a time in seconds.
+ */
+MMFRES mpg1_decoder_seek_time(MPEG1DecoderContext *dec, double seconds, int64_t *actual);
+
 float mpg2_seq_hdr_get_frame_rate(MPEG1SeqHeader *seq_hdr);
 
 #endif // MPEG1DEC_H_INCLUDED
@@ -0,0 +1,1143 @@
+#ifndef MPEG1DEC_TEST_H_INCLUDED
+#define MPEG1DEC_TEST_H_INCLUDED
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "mpeg1dec.h"
+#include "mpeg1batch.h"
+#include "..\mmfscale.h"
+#include "..\mmfconvert.h"
+
+/* Tests of the decoding modes. Each one decodes a MPEG-1 video stream (file name) in some
+ * mode, and compares the frames with the serial decode of the whole stream, the reference.
+ */
+
+/* Decoded frames, packed one after another as YUV420P without padding */
+typedef struct {
+    uint8_t *data;
+    int64_t *pts;
+    int32_t width;
+    int32_t height;
+    int32_t count;
+    int32_t capacity;
+} MPEG1TestFrames;
+
+int32_t mpg1_test_frame_size(MPEG1TestFrames *f)
+{
+    return f->width * f->height + 2 * (f->width / 2) * (f->height / 2);
+}
+
+uint8_t* mpg1_test_frame(MPEG1TestFrames *f, int32_t i)
+{
+    return f->data + i * mpg1_test_frame_size(f);
+}
+
+void mpg1_test_frames_free(MPEG1TestFrames *f)
+{
+    mmf_free(f->data);
+    mmf_free(f->pts);
+    memset(f, 0, sizeof(MPEG1TestFrames));
+}
+
+/* Appends a YUV420P sample */
+MMFRES mpg1_test_frames_add(MPEG1TestFrames *f, MMFSample *s)
+{
+    int32_t w = s->width, h = s->height;
+
+    if(f->count == 0) {
+        f->width = w;
+        f->height = h;
+    }else if(f->width != w || f->height != h) {
+        return RC_INVALIDARG;
+    }
+
+    if(f->count == f->capacity) {
+        int32_t capacity = f->capacity ? f->capacity * 2 : 32;
+        uint8_t *data = mmf_realloc(f->data, capacity * mpg1_test_frame_size(f));
+        int64_t *pts = mmf_realloc(f->pts, capacity * sizeof(int64_t));
+
+        if(data) f->data = data;
+        if(pts) f->pts = pts;
+        if(!data || !pts) return RC_OUTOFMEM;
+
+        f->capacity = capacity;
+    }
+
+    uint8_t *dst = mpg1_test_frame(f, f->count);
+
+    mmf_sample_copy_plane(s->buffer_data[0], s->buffer_stride[0], dst, w, w, h);
+    dst += w * h;
+    mmf_sample_copy_plane(s->buffer_data[1], s->buffer_stride[1], dst, w / 2, w / 2, h / 2);
+    dst += (w / 2) * (h / 2);
+    mmf_sample_copy_plane(s->buffer_data[2], s->buffer_stride[2], dst, w / 2, w / 2, h / 2);
+
+    f->pts[f->count++] = s->pts;
+    return RC_OK;
+}
+
+/* Decodes up to <i>max_frames</i> frames with mpg1_decode_sample(), at the output size */
+MMFRES mpg1_test_decode(MPEG1DecoderContext *dec, MPEG1TestFrames *f, int32_t max_frames)
+{
+    MMFSample *sample = NULL;
+    MMFRES rc;
+    int32_t w, h, i;
+
+    /* Read the headers, so the frame size is known */
+    rc = mpg1_decode_sample(dec, NULL);
+    if(failed(rc)) return rc;
+
+    mpg1_decoder_get_output_size(dec, &w, &h);
+
+    rc = mmf_allocate_video_frame(SAMPLE_FORMAT_YUV420P, w, h, &sample);
+    if(failed(rc)) return rc;
+
+    for(i=0; i<max_frames; i++) {
+        rc = mpg1_decode_sample(dec, sample);
+        if(failed(rc)) break;
+
+        rc = mpg1_test_frames_add(f, sample);
+        if(failed(rc)) break;
+    }
+
+    mmf_sample_free(&sample);
+    return rc == RC_END_OF_STREAM ? RC_OK : rc;
+}
+
+/* Serial decode of the whole stream */
+MMFRES mpg1_test_reference(char *fn, MPEG1TestFrames *f)
+{
+    MPEG1DecoderContext *dec;
+    MMFRES rc;
+
+    memset(f, 0, sizeof(MPEG1TestFrames));
+
+    rc = mpg1_decoder_create(&dec, fn);
+    if(failed(rc)) return rc;
+
+    rc = mpg1_test_decode(dec, f, INT32_MAX);
+    mpg1_decoder_free(&dec);
+
+    if(succeeded(rc) && f->count == 0) {
+        rc = RC_INVALIDDATA;
+    }
+
+    return rc;
+}
+
+/* Compares the luminance rows top to top + rows - 1, and the chrominance rows
+ * covering them, of two frames of the same size. Returns 0 if they are equal.
+ */
+int mpg1_test_compare_rows(MPEG1TestFrames *a, int32_t ia, MPEG1TestFrames *b, int32_t ib, int32_t top, int32_t rows)
+{
+    int32_t w = a->width, h = a->height;
+    uint8_t *pa = mpg1_test_frame(a, ia);
+    uint8_t *pb = mpg1_test_frame(b, ib);
+    int32_t c_top = top / 2, c_rows = (top + rows + 1) / 2 - c_top;
+
+    if(b->width != w || b->height != h) {
+        return 1;
+    }
+
+    if(memcmp(pa + top * w, pb + top * w, rows * w) != 0) {
+        return 1;
+    }
+
+    pa += w * h;
+    pb += w * h;
+
+    if(memcmp(pa + c_top * (w / 2), pb + c_top * (w / 2), c_rows * (w / 2)) != 0) {
+        return 1;
+    }
+
+    pa += (w / 2) * (h / 2);
+    pb += (w / 2) * (h / 2);
+
+    return memcmp(pa + c_top * (w / 2), pb + c_top * (w / 2), c_rows * (w / 2)) != 0;
+}
+
+/* Compares decoded frames with the reference frames of the same numbers (pts). The frames
+ * should be in display order, without repeats. Returns the number of differing frames.
+ */
+int mpg1_test_compare(char *name, MPEG1TestFrames *ref, MPEG1TestFrames *f, int32_t top, int32_t rows)
+{
+    int failures = 0;
+    int32_t i;
+
+    for(i=0; i<f->count; i++) {
+        int64_t n = f->pts[i];
+
+        if(n < 0 || n >= ref->count || (i > 0 && n <= f->pts[i - 1])) {
+            printf("%s: frame %d has number %d\n", name, (int)i, (int)n);
+            failures++;
+        }else if(mpg1_test_compare_rows(ref, n, f, i, top, rows) != 0) {
+            if(failures < 5) {
+                printf("%s: frame %d differs\n", name, (int)n);
+            }
+
+            failures++;
+        }
+    }
+
+    return failures;
+}
+
+/* Peak signal to noise ratio of the luminance of two frames of the same size, in dB */
+double mpg1_test_psnr(MPEG1TestFrames *a, int32_t ia, MPEG1TestFrames *b, int32_t ib)
+{
+    uint8_t *pa = mpg1_test_frame(a, ia);
+    uint8_t *pb = mpg1_test_frame(b, ib);
+    int64_t sse = 0;
+    int32_t i, n = a->width * a->height;
+
+    for(i=0; i<n; i++) {
+        sse += (pa[i] - pb[i]) * (pa[i] - pb[i]);
+    }
+
+    return sse ? 10.0 * log10(255.0 * 255.0 * n / sse) : 99.0;
+}
+
+/* Scales each frame to another size, with mmf_scaler */
+MMFRES mpg1_test_scale(MPEG1TestFrames *src, MPEG1TestFrames *dst, int32_t width, int32_t height, MMFScaleFilter filter)
+{
+    MMFScaler *scaler = NULL;
+    MMFSample *sample = NULL;
+    MMFRES rc;
+    int32_t w = src->width, h = src->height, i;
+
+    memset(dst, 0, sizeof(MPEG1TestFrames));
+
+    rc = mmf_scaler_create(w, h, width, height, filter, &scaler);
+    if(failed(rc)) return rc;
+
+    rc = mmf_allocate_video_frame(SAMPLE_FORMAT_YUV420P, width, height, &sample);
+
+    for(i=0; i<src->count && succeeded(rc); i++) {
+        uint8_t *y = mpg1_test_frame(src, i);
+
+        mmf_scaler_reset(scaler);
+        rc = mmf_scaler_scale_yuv420p(scaler, y, y + w * h, y + w * h + (w / 2) * (h / 2), w, w / 2, h, sample);
+        if(failed(rc)) break;
+
+        sample->pts = src->pts[i];
+        rc = mpg1_test_frames_add(dst, sample);
+    }
+
+    mmf_sample_free(&sample);
+    mmf_scaler_free(&scaler);
+
+    return rc;
+}
+
+/* Decodes the rest of the stream with a configured decoder, and frees it. All the frames of
+ * the reference should be output, and their rows top to top + rows - 1 should match.
+ * Returns the number of failed checks.
+ */
+int mpg1_test_run(char *name, MPEG1TestFrames *ref, MPEG1DecoderContext *dec, int32_t top, int32_t rows)
+{
+    MPEG1TestFrames f;
+    int failures = 0;
+
+    memset(&f, 0, sizeof(f));
+
+    if(failed(mpg1_test_decode(dec, &f, INT32_MAX))) {
+        printf("%s: decoding failed\n", name);
+        failures++;
+    }else if(f.count != ref->count) {
+        printf("%s: %d frames, expected %d\n", name, (int)f.count, (int)ref->count);
+        failures++;
+    }else {
+        failures += mpg1_test_compare(name, ref, &f, top, rows);
+    }
+
+    mpg1_test_frames_free(&f);
+    mpg1_decoder_free(&dec);
+
+    return failures;
+}
+
+/* Seeks to frames around the stream with the index, and compares the frames decoded from
+ * each I-frame with the reference. Returns the number of failed checks.
+ */
+int mpg1_test_seek(char *fn)
+{
+    MPEG1TestFrames ref, f;
+    MPEG1DecoderContext *dec;
+    int failures = 0;
+    int32_t i;
+
+    if(failed(mpg1_test_reference(fn, &ref))) {
+        printf("mpg1_test_seek: failed to decode '%s'\n", fn);
+        return 1;
+    }
+
+    if(failed(mpg1_decoder_create(&dec, fn)) || failed(mpg1_decoder_build_index(dec))) {
+        printf("mpg1_test_seek: failed to index '%s'\n", fn);
+        mpg1_test_frames_free(&ref);
+        return 1;
+    }
+
+    /* Forward and backward, the last frame and the first one */
+    int64_t targets[] = { ref.count / 2, ref.count / 3, ref.count - 1, 0, ref.count * 3 / 4 };
+
+    for(i=0; i<5; i++) {
+        int64_t actual = -1;
+
+        memset(&f, 0, sizeof(f));
+
+        if(failed(mpg1_decoder_seek(dec, targets[i], &actual)) || actual < 0 || actual > targets[i]) {
+            printf("mpg1_test_seek: seek to %d failed (actual %d)\n", (int)targets[i], (int)actual);
+            failures++;
+            continue;
+        }
+
+        /* Decode past the target, into the next GOP */
+        if(failed(mpg1_test_decode(dec, &f, targets[i] - actual + 30)) || f.count == 0) {
+            printf("mpg1_test_seek: decoding after seek to %d failed\n", (int)targets[i]);
+            failures++;
+        }else if(f.pts[0] != actual) {
+            printf("mpg1_test_seek: first frame after seek to %d is %d, not %d\n",
+                   (int)targets[i], (int)f.pts[0], (int)actual);
+            failures++;
+        }else {
+            failures += mpg1_test_compare("mpg1_test_seek", &ref, &f, 0, ref.height);
+        }
+
+        mpg1_test_frames_free(&f);
+    }
+
+    mpg1_decoder_free(&dec);
+    mpg1_test_frames_free(&ref);
+
+    printf("mpg1_test_seek: %s\n", failures ? "FAILED" : "passed");
+    return failures;
+}
+
+/* Returns 0 if two indexes have the same entries. */
+int mpg1_test_index_compare(MPEG1Index *a, MPEG1Index *b)
+{
+    int32_t i;
+
+    if(a->count != b->count || a->frame_count != b->frame_count || a->stream_size != b->stream_size) {
+        return 1;
+    }
+
+    for(i=0; i<a->count; i++) {
+        MPEG1IndexEntry *x = &a->entries[i], *y = &b->entries[i];
+
+        if(x->offset != y->offset || x->type != y->type || x->frame_type != y->frame_type ||
+           x->seq_number != y->seq_number || x->frame != y->frame ||
+           x->gop.drop_flag != y->gop.drop_flag || x->gop.hour != y->gop.hour || x->gop.minute != y->gop.minute ||
+           x->gop.second != y->gop.second || x->gop.frame != y->gop.frame ||
+           x->gop.closed_flag != y->gop.closed_flag || x->gop.broken_flag != y->gop.broken_flag) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Saves the index of the stream to a sidecar file and loads it back, seeks with the loaded index
+ * and by time, and checks that an index of another stream is rejected. Returns the number of failed checks.
+ */
+int mpg1_test_index(char *fn)
+{
+    const char *idx_fn = "mpg1_test_index.idx";
+
+    MPEG1TestFrames ref, f;
+    MPEG1DecoderContext *dec;
+    MPEG1Index *idx = NULL, *other = NULL;
+    MMFBitstream *bs, *half;
+    MMFRES rc;
+    int failures = 0;
+    int64_t actual = -1, expected = -1;
+
+    if(failed(mpg1_test_reference(fn, &ref))) {
+        printf("mpg1_test_index: failed to decode '%s'\n", fn);
+        return 1;
+    }
+
+    if(failed(mpg1_decoder_create(&dec, fn)) || failed(mpg1_decoder_build_index(dec))) {
+        printf("mpg1_test_index: failed to index '%s'\n", fn);
+        mpg1_test_frames_free(&ref);
+        return 1;
+    }
+
+    /* Round trip through the sidecar file */
+    if(failed(mpg1_index_save(dec->index, (char*)idx_fn)) || failed(mpg1_index_load((char*)idx_fn, &idx))) {
+        printf("mpg1_test_index: failed to save and load the index\n");
+        failures++;
+    }else if(mpg1_test_index_compare(dec->index, idx) != 0) {
+        printf("mpg1_test_index: loaded index differs from the saved one\n");
+        failures++;
+    }
+
+    if(failed(mpg1_decoder_seek(dec, ref.count / 2, &expected))) {
+        printf("mpg1_test_index: seek to %d failed\n", (int)(ref.count / 2));
+        failures++;
+    }
+
+    mpg1_decoder_free(&dec);
+
+    /* A new decoder seeks with the loaded index, to the same I-frame */
+    if(idx && succeeded(mpg1_decoder_create(&dec, fn))) {
+        memset(&f, 0, sizeof(f));
+
+        rc = mpg1_decoder_set_index(dec, idx);
+        idx = NULL;
+
+        if(failed(rc) || failed(mpg1_decoder_seek(dec, ref.count / 2, &actual)) || actual != expected) {
+            printf("mpg1_test_index: seek with the loaded index failed (%d, actual %d, expected %d)\n",
+                   (int)rc, (int)actual, (int)expected);
+            failures++;
+        }else if(failed(mpg1_test_decode(dec, &f, 30)) || f.count == 0 || f.pts[0] != actual) {
+            printf("mpg1_test_index: decoding after seek with the loaded index failed\n");
+            failures++;
+        }else {
+            failures += mpg1_test_compare("mpg1_test_index", &ref, &f, 0, ref.height);
+        }
+
+        mpg1_test_frames_free(&f);
+        mpg1_decoder_free(&dec);
+    }
+
+    mpg1_index_free(&idx);
+    remove(idx_fn);
+
+    /* Seeking by time, before anything is decoded */
+    if(succeeded(mpg1_decoder_create(&dec, fn))) {
+        memset(&f, 0, sizeof(f));
+
+        double frame_time = 0;
+        rc = mpg1_decoder_seek_time(dec, 0, &actual);
+
+        /* The middle of the frame, so rounding doesn't matter */
+        if(succeeded(rc) && dec->seq_hdr->frame_rate_num > 0) {
+            frame_time = (double)dec->seq_hdr->frame_rate_den / dec->seq_hdr->frame_rate_num;
+            rc = mpg1_decoder_seek_time(dec, (ref.count / 2 + 0.5) * frame_time, &actual);
+        }
+
+        if(failed(rc) || actual != expected) {
+            printf("mpg1_test_index: seek to %.3f s failed (%d, actual %d, expected %d)\n",
+                   (ref.count / 2 + 0.5) * frame_time, (int)rc, (int)actual, (int)expected);
+            failures++;
+        }else if(failed(mpg1_test_decode(dec, &f, 30)) || f.count == 0 || f.pts[0] != actual) {
+            printf("mpg1_test_index: decoding after seek by time failed\n");
+            failures++;
+        }else {
+            failures += mpg1_test_compare("mpg1_test_index", &ref, &f, 0, ref.height);
+        }
+
+        mpg1_test_frames_free(&f);
+        mpg1_decoder_free(&dec);
+    }
+
+    /* The index of the first half of the stream doesn't fit the whole one */
+    bs = bitstream_alloc_map_file(fn, &rc);
+    half = bs ? bitstream_alloc_wrap(bs->buffer, bs->write_index / 2, &rc) : NULL;
+
+    if(!half || failed(mpg1_index_build(half, &other)) || failed(mpg1_decoder_create(&dec, fn))) {
+        printf("mpg1_test_index: failed to index the first half of '%s'\n", fn);
+        mpg1_index_free(&other);
+        failures++;
+    }else {
+        /* The decoder takes the index, even when it rejects it */
+        rc = mpg1_decoder_set_index(dec, other);
+
+        if(rc != RC_INVALIDDATA) {
+            printf("mpg1_test_index: index of another stream is not rejected (%d)\n", (int)rc);
+            failures++;
+        }
+
+        mpg1_decoder_free(&dec);
+    }
+
+    if(half) bitstream_free(&half);
+    if(bs) bitstream_free(&bs);
+    mpg1_test_frames_free(&ref);
+
+    printf("mpg1_test_index: %s\n", failures ? "FAILED" : "passed");
+    return failures;
+}
+
+/* Decodes the slices of each picture with 2 and 4 threads. Returns the number of failed checks. */
+int mpg1_test_slice_threads(char *fn)
+{
+    MPEG1TestFrames ref;
+    MPEG1DecoderContext *dec;
+    int failures = 0;
+    int32_t threads;
+
+    if(failed(mpg1_test_reference(fn, &ref))) {
+        printf("mpg1_test_slice_threads: failed to decode '%s'\n", fn);
+        return 1;
+    }
+
+    for(threads=2; threads<=4; threads+=2) {
+        if(failed(mpg1_decoder_create(&dec, fn)) || failed(mpg1_decoder_set_threads(dec, threads))) {
+            printf("mpg1_test_slice_threads: failed to create decoder\n");
+            failures++;
+            break;
+        }
+
+        failures += mpg1_test_run("mpg1_test_slice_threads", &ref, dec, 0, ref.height);
+    }
+
+    mpg1_test_frames_free(&ref);
+
+    printf("mpg1_test_slice_threads: %s\n", failures ? "FAILED" : "passed");
+    return failures;
+}
+
+/* Read callback of mpg1_test_frame_threads(). It reads at most 7 bytes per call, so the
+ * buffer of the pull-mode stream is refilled and flushed often, while frame threads read it.
+ */
+int32_t mpg1_test_read_file(void *opaque, uint8_t *buf, int32_t n)
+{
+    if(n > 7) n = 7;
+    return fread(buf, 1, n, (FILE*)opaque);
+}
+
+/* Decodes the stream with frame threads, from the file and from a read callback, and with
+ * frame and slice threads together. Returns the number of failed checks.
+ */
+int mpg1_test_frame_threads(char *fn)
+{
+    MPEG1TestFrames ref;
+    MPEG1DecoderContext *dec;
+    FILE *f;
+    int failures = 0;
+
+    if(failed(mpg1_test_reference(fn, &ref))) {
+        printf("mpg1_test_frame_threads: failed to decode '%s'\n", fn);
+        return 1;
+    }
+
+    if(succeeded(mpg1_decoder_create(&dec, fn)) && succeeded(mpg1_decoder_set_frame_threads(dec, 3))) {
+        failures += mpg1_test_run("mpg1_test_frame_threads", &ref, dec, 0, ref.height);
+    }else {
+        printf("mpg1_test_frame_threads: failed to create decoder\n");
+        failures++;
+    }
+
+    if(succeeded(mpg1_decoder_create(&dec, fn)) && succeeded(mpg1_decoder_set_frame_threads(dec, 2)) &&
+       succeeded(mpg1_decoder_set_threads(dec, 2))) {
+        failures += mpg1_test_run("mpg1_test_frame_threads", &ref, dec, 0, ref.height);
+    }else {
+        printf("mpg1_test_frame_threads: failed to create decoder with slice threads\n");
+        failures++;
+    }
+
+    f = fopen(fn, "rb");
+
+    if(f && succeeded(mpg1_decoder_create_from_callback(&dec, mpg1_test_read_file, f)) &&
+       succeeded(mpg1_decoder_set_frame_threads(dec, 3))) {
+        failures += mpg1_test_run("mpg1_test_frame_threads", &ref, dec, 0, ref.height);
+    }else {
+        printf("mpg1_test_frame_threads: failed to create decoder with read callback\n");
+        failures++;
+    }
+
+    if(f) fclose(f);
+    mpg1_test_frames_free(&ref);
+
+    printf("mpg1_test_frame_threads: %s\n", failures ? "FAILED" : "passed");
+    return failures;
+}
+
+/* Batch callback of mpg1_test_batch(). It collects the frames. */
+MMFRES mpg1_test_batch_frame(void *opaque, MMFSample *sample, int64_t frame)
+{
+    return mpg1_test_frames_add(opaque, sample);
+}
+
+/* Decodes the stream with GOP-parallel batch decoding, with 1 and 4 threads. Streams without
+ * closed GOPs are decoded too (by one thread). Returns the number of failed checks.
+ */
+int mpg1_test_batch(char *fn)
+{
+    MPEG1TestFrames ref, f;
+    MMFRES rc;
+    int failures = 0;
+    int32_t threads;
+
+    if(failed(mpg1_test_reference(fn, &ref))) {
+        printf("mpg1_test_batch: failed to decode '%s'\n", fn);
+        return 1;
+    }
+
+    for(threads=1; threads<=4; threads+=3) {
+        memset(&f, 0, sizeof(f));
+
+        rc = mpg1_batch_decode_file(fn, threads, mpg1_test_batch_frame, &f);
+
+        if(rc == RC_FALSE) {
+            printf("mpg1_test_batch: no closed GOPs, decoded by one thread\n");
+        }
+
+        if(failed(rc)) {
+            printf("mpg1_test_batch: decoding with %d threads failed (%d)\n", (int)threads, (int)rc);
+            failures++;
+        }else if(f.count != ref.count) {
+            printf("mpg1_test_batch: %d frames, expected %d\n", (int)f.count, (int)ref.count);
+            failures++;
+        }else {
+            failures += mpg1_test_compare("mpg1_test_batch", &ref, &f, 0, ref.height);
+        }
+
+        mpg1_test_frames_free(&f);
+    }
+
+    mpg1_test_frames_free(&ref);
+
+    printf("mpg1_test_batch: %s\n", failures ? "FAILED" : "passed");
+    return failures;
+}
+
+/* Adler-32 of the data, continuing <i>adler</i> (0 to start, like ffmpeg's framecrc) */
+uint32_t mpg1_test_adler32(uint32_t adler, const uint8_t *data, int32_t n)
+{
+    uint32_t a = adler & 0xffff, b = adler >> 16;
+    int32_t i;
+
+    for(i=0; i<n; i++) {
+        a = (a + data[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+
+    return (b << 16) | a;
+}
+
+/* Decodes the stream serially, and compares the pts and the Adler-32 of each frame, as
+ * YUV420P, with a checksum file written by another decoder (ffmpeg -i fn -f framecrc crc_fn).
+ * Returns the number of failed checks.
+ */
+int mpg1_test_checksums(char *fn, char *crc_fn)
+{
+    MPEG1TestFrames f;
+    FILE *crc;
+    char line[256];
+    int failures = 0;
+    int32_t i = 0;
+
+    if(failed(mpg1_test_reference(fn, &f))) {
+        printf("mpg1_test_checksums: failed to decode '%s'\n", fn);
+        return 1;
+    }
+
+    crc = fopen(crc_fn, "r");
+    if(!crc) {
+        printf("mpg1_test_checksums: failed to open '%s'\n", crc_fn);
+        mpg1_test_frames_free(&f);
+        return 1;
+    }
+
+    while(fgets(line, sizeof(line), crc)) {
+        long long dts, pts;
+        int stream, duration, size;
+        unsigned int adler;
+
+        if(line[0] == '#') continue;
+
+        if(sscanf(line, "%d, %lld, %lld, %d, %d, 0x%x", &stream, &dts, &pts, &duration, &size, &adler) != 6) {
+            printf("mpg1_test_checksums: bad line in '%s': %s", crc_fn, line);
+            failures++;
+            break;
+        }
+
+        if(i >= f.count) {
+            i++;
+            continue;
+        }
+
+        if(size != mpg1_test_frame_size(&f)) {
+            printf("mpg1_test_checksums: frame %d has %d bytes, expected %d\n",
+                   (int)i, (int)mpg1_test_frame_size(&f), size);
+            failures++;
+        }else if(f.pts[i] != pts) {
+            printf("mpg1_test_checksums: frame %d has pts %lld, expected %lld\n", (int)i, (long long)f.pts[i], pts);
+            failures++;
+        }else if(mpg1_test_adler32(0, mpg1_test_frame(&f, i), size) != adler) {
+            printf("mpg1_test_checksums: frame %d (pts %lld) differs\n", (int)i, pts);
+            failures++;
+        }
+
+        i++;
+    }
+
+    fclose(crc);
+
+    if(i != f.count) {
+        printf("mpg1_test_checksums: %d frames, expected %d\n", (int)f.count, (int)i);
+        failures++;
+    }
+
+    mpg1_test_frames_free(&f);
+
+    printf("mpg1_test_checksums: %s\n", failures ? "FAILED" : "passed");
+    return failures;
+}
+
+/* Decodes the stream at each discard level. The pictures which are kept are decoded the same
+ * as without discarding, and each level keeps fewer of them. Returns the number of failed checks.
+ */
+int mpg1_test_discard(char *fn)
+{
+    MPEG1TestFrames ref, f;
+    MPEG1DecoderContext *dec;
+    int failures = 0;
+    int32_t level, last_count;
+
+    if(failed(mpg1_test_reference(fn, &ref))) {
+        printf("mpg1_test_discard: failed to decode '%s'\n", fn);
+        return 1;
+    }
+
+    last_count = ref.count;
+
+    for(level=MPEG1_DISCARD_B; level<=MPEG1_DISCARD_NONKEY; level++) {
+        memset(&f, 0, sizeof(f));
+
+        if(failed(mpg1_decoder_create(&dec, fn)) || failed(mpg1_decoder_set_discard(dec, level))) {
+            printf("mpg1_test_discard: failed to create decoder\n");
+            failures++;
+            break;
+        }
+
+        if(failed(mpg1_test_decode(dec, &f, INT32_MAX)) || f.count == 0) {
+            printf("mpg1_test_discard: decoding at level %d failed\n", (int)level);
+            failures++;
+        }else if(f.count > last_count) {
+            printf("mpg1_test_discard: level %d keeps %d frames, more than %d\n", (int)level, (int)f.count, (int)last_count);
+            failures++;
+        }else {
+            failures += mpg1_test_compare("mpg1_test_discard", &ref, &f, 0, ref.height);
+            last_count = f.count;
+        }
+
+        mpg1_test_frames_free(&f);
+        mpg1_decoder_free(&dec);
+    }
+
+    mpg1_test_frames_free(&ref);
+
+    printf("mpg1_test_discard: %s\n", failures ? "FAILED" : "passed");
+    return failures;
+}
+
+/* Decodes the stream at 1/2, 1/4 and 1/8 scale, and compares the frames with the reference
+ * downscaled by averaging, which the reduced iDCT approximates. I pictures must be close to
+ * it; the errors of the reduced motion compensation build up until the next I picture, so
+ * only the average of all pictures is checked. Scales, at which the frame size is rounded up,
+ * are skipped, since the frames cover more than the picture. Returns the number of failed checks.
+ */
+int mpg1_test_lowres(char *fn)
+{
+    /* Minimum luma PSNR in dB: of each I picture, and average of all pictures */
+    const double min_key_psnr = 30.0, min_avg_psnr = 20.0;
+
+    MPEG1TestFrames ref, scaled, f;
+    MPEG1DecoderContext *dec;
+    int failures = 0;
+    int32_t scale, key, i;
+
+    if(failed(mpg1_test_reference(fn, &ref))) {
+        printf("mpg1_test_lowres: failed to decode '%s'\n", fn);
+        return 1;
+    }
+
+    for(scale=1; scale<=3; scale++) {
+        for(key=0; key<2; key++) {
+            double psnr, min_psnr = 99.0, sum_psnr = 0.0;
+
+            memset(&f, 0, sizeof(f));
+            memset(&scaled, 0, sizeof(scaled));
+
+            if(failed(mpg1_decoder_create(&dec, fn)) || failed(mpg1_decoder_set_lowres(dec, scale)) ||
+               failed(mpg1_decoder_set_discard(dec, key ? MPEG1_DISCARD_NONKEY : MPEG1_DISCARD_NONE))) {
+                printf("mpg1_test_lowres: failed to create decoder\n");
+                failures++;
+                break;
+            }
+
+            if(failed(mpg1_test_decode(dec, &f, INT32_MAX)) || f.count == 0 || (!key && f.count != ref.count)) {
+                printf("mpg1_test_lowres: decoding at 1/%d failed\n", 1 << scale);
+                failures++;
+            }else if(f.width << scale != ref.width || f.height << scale != ref.height) {
+                if(!key) printf("mpg1_test_lowres: %dx%d is rounded up at 1/%d, skipped\n", (int)ref.width, (int)ref.height, 1 << scale);
+            }else if(failed(mpg1_test_scale(&ref, &scaled, f.width, f.height, SCALE_FILTER_AREA))) {
+                printf("mpg1_test_lowres: failed to scale the reference to %dx%d\n", (int)f.width, (int)f.height);
+                failures++;
+            }else {
+                for(i=0; i<f.count; i++) {
+                    if(f.pts[i] < 0 || f.pts[i] >= scaled.count) {
+                        printf("mpg1_test_lowres: frame %d has number %d\n", (int)i, (int)f.pts[i]);
+                        failures++;
+                        break;
+                    }
+
+                    psnr = mpg1_test_psnr(&scaled, f.pts[i], &f, i);
+                    sum_psnr += psnr;
+                    if(psnr < min_psnr) min_psnr = psnr;
+                }
+
+                if(i == f.count && (key ? min_psnr < min_key_psnr : sum_psnr / f.count < min_avg_psnr)) {
+                    printf("mpg1_test_lowres: %s pictures at 1/%d differ from the downscaled reference (PSNR %.1f dB, min %.1f dB)\n",
+                           key ? "I" : "all", 1 << scale, sum_psnr / f.count, min_psnr);
+                    failures++;
+                }
+            }
+
+            mpg1_test_frames_free(&f);
+            mpg1_test_frames_free(&scaled);
+            mpg1_decoder_free(&dec);
+        }
+    }
+
+    mpg1_test_frames_free(&ref);
+
+    printf("mpg1_test_lowres: %s\n", failures ? "FAILED" : "passed");
+    return failures;
+}
+
+/* Largest difference between the pixels of a keyframe mosaic plane and the averages of the
+ * 8x8 blocks of the reference plane. Blocks, which aren't entirely in the picture, are skipped.
+ */
+int32_t mpg1_test_mosaic_diff(const uint8_t *mosaic, int32_t mosaic_stride, const uint8_t *ref, int32_t width, int32_t height)
+{
+    int32_t max_diff = 0, bx, by, x, y;
+
+    for(by=0; by<height / 8; by++) {
+        for(bx=0; bx<width / 8; bx++) {
+            int32_t sum = 0, diff;
+
+            for(y=0; y<8; y++) {
+                for(x=0; x<8; x++) {
+                    sum += ref[(by * 8 + y) * width + bx * 8 + x];
+                }
+            }
+
+            diff = abs(mosaic[by * mosaic_stride + bx] - (sum + 32) / 64);
+            if(diff > max_diff) max_diff = diff;
+        }
+    }
+
+    return max_diff;
+}
+
+/* Decodes the keyframe mosaics, and compares them with the averages of the 8x8 blocks of the
+ * reference I pictures. The averages differ from the DC coefficients only by the rounding and
+ * clipping of the full iDCT. The mosaics must come for the same pictures as the decode with
+ * MPEG1_DISCARD_NONKEY. Returns the number of failed checks.
+ */
+int mpg1_test_keyframes(char *fn)
+{
+    /* Largest difference from the block average */
+    const int32_t max_diff = 3;
+
+    MPEG1TestFrames ref, keys, mosaics;
+    MPEG1DecoderContext *dec = NULL;
+    MMFSample *sample = NULL;
+    int failures = 0;
+    int32_t w, h, i, p;
+    MMFRES rc;
+
+    if(failed(mpg1_test_reference(fn, &ref))) {
+        printf("mpg1_test_keyframes: failed to decode '%s'\n", fn);
+        return 1;
+    }
+
+    memset(&keys, 0, sizeof(keys));
+    memset(&mosaics, 0, sizeof(mosaics));
+
+    if(failed(mpg1_decoder_create(&dec, fn)) || failed(mpg1_decoder_set_discard(dec, MPEG1_DISCARD_NONKEY)) ||
+       failed(mpg1_test_decode(dec, &keys, INT32_MAX))) {
+        printf("mpg1_test_keyframes: decoding I pictures failed\n");
+        failures++;
+    }
+
+    if(dec) mpg1_decoder_free(&dec);
+
+    rc = mpg1_decoder_create(&dec, fn);
+    if(succeeded(rc)) rc = mpg1_decoder_get_keyframe_size(dec, &w, &h);
+    if(succeeded(rc)) rc = mmf_allocate_video_frame(SAMPLE_FORMAT_YUV420P, w, h, &sample);
+
+    while(succeeded(rc)) {
+        rc = mpg1_decode_keyframe(dec, sample);
+        if(succeeded(rc)) rc = mpg1_test_frames_add(&mosaics, sample);
+    }
+
+    if(rc != RC_END_OF_STREAM) {
+        printf("mpg1_test_keyframes: decoding keyframes failed\n");
+        failures++;
+    }else if(mosaics.count != keys.count) {
+        printf("mpg1_test_keyframes: %d keyframes, but %d I pictures\n", (int)mosaics.count, (int)keys.count);
+        failures++;
+    }else {
+        for(i=0; i<mosaics.count; i++) {
+            int32_t n = (int32_t)mosaics.pts[i], diff;
+            uint8_t *m, *r;
+
+            if(mosaics.pts[i] != keys.pts[i] || n < 0 || n >= ref.count) {
+                printf("mpg1_test_keyframes: keyframe %d has number %d\n", (int)i, (int)n);
+                failures++;
+                continue;
+            }
+
+            m = mpg1_test_frame(&mosaics, i);
+            r = mpg1_test_frame(&ref, n);
+            diff = 0;
+
+            for(p=0; p<3; p++) {
+                int32_t shift = p ? 1 : 0;
+
+                int32_t d = mpg1_test_mosaic_diff(m, w >> shift, r, ref.width >> shift, ref.height >> shift);
+
+                if(d > diff) diff = d;
+                m += (w >> shift) * (h >> shift);
+                r += (ref.width >> shift) * (ref.height >> shift);
+            }
+
+            if(diff > max_diff) {
+                if(failures < 5) {
+                    printf("mpg1_test_keyframes: keyframe of frame %d differs from the block averages by %d\n", (int)n, (int)diff);
+                }
+
+                failures++;
+            }
+        }
+    }
+
+    mmf_sample_free(&sample);
+    if(dec) mpg1_decoder_free(&dec);
+    mpg1_test_frames_free(&mosaics);
+    mpg1_test_frames_free(&keys);
+    mpg1_test_frames_free(&ref);
+
+    printf("mpg1_test_keyframes: %s\n", failures ? "FAILED" : "passed");
+    return failures;
+}
+
+/* Decodes bands of lines with mpg1_decoder_set_roi(), serially and with slice and frame threads,
+ * and compares the lines of the bands with the reference. The bands are at the top, across
+ * the middle (not aligned to macroblocks), at the bottom, and past the end of the picture.
+ * Returns the number of failed checks.
+ */
+int mpg1_test_roi(char *fn)
+{
+    MPEG1TestFrames ref;
+    MPEG1DecoderContext *dec;
+    int failures = 0;
+    int32_t band, mode, h;
+
+    if(failed(mpg1_test_reference(fn, &ref))) {
+        printf("mpg1_test_roi: failed to decode '%s'\n", fn);
+        return 1;
+    }
+
+    h = ref.height;
+
+    const int32_t bands[4][2] = { { 0, 16 }, { h / 2 - 5, 23 }, { h - 24, 24 }, { h - 8, 100 } };
+
+    for(band=0; band<4; band++) {
+        int32_t top = bands[band][0];
+        int32_t rows = top + bands[band][1] > h ? h - top : bands[band][1];
+
+        for(mode=0; mode<3; mode++) {
+            MMFRES rc = mpg1_decoder_create(&dec, fn);
+
+            if(succeeded(rc)) rc = mpg1_decoder_set_roi(dec, bands[band][0], bands[band][1]);
+            if(succeeded(rc) && mode == 1) rc = mpg1_decoder_set_threads(dec, 2);
+            if(succeeded(rc) && mode == 2) rc = mpg1_decoder_set_frame_threads(dec, 3);
+
+            if(failed(rc)) {
+                printf("mpg1_test_roi: failed to create decoder\n");
+                failures++;
+                break;
+            }
+
+            if(mpg1_test_run("mpg1_test_roi", &ref, dec, top, rows) != 0) {
+                printf("mpg1_test_roi: lines %d..%d with %s differ\n", (int)top, (int)(top + rows - 1),
+                       mode == 0 ? "serial decoding" : mode == 1 ? "2 slice threads" : "3 frame threads");
+                failures++;
+            }
+        }
+    }
+
+    mpg1_test_frames_free(&ref);
+
+    printf("mpg1_test_roi: %s\n", failures ? "FAILED" : "passed");
+    return failures;
+}
+
+/* Compares two video samples of the same format and size, row by row. Returns 0 if they are equal. */
+int mpg1_test_compare_samples(MMFSample *a, MMFSample *b)
+{
+    int32_t i, row;
+
+    if(a->format != b->format || a->width != b->width || a->height != b->height || a->buffer_count != b->buffer_count) {
+        return 1;
+    }
+
+    for(i=0; i<a->buffer_count; i++) {
+        /* Bytes and rows of the plane */
+        int32_t bytes = a->format == SAMPLE_FORMAT_RGBA32 ? 4 * a->width : i == 0 || a->format == SAMPLE_FORMAT_NV12 ? a->width : a->width / 2;
+        int32_t rows = i == 0 ? a->height : a->height / 2;
+
+        for(row=0; row<rows; row++) {
+            if(memcmp((uint8_t*)a->buffer_data[i] + row * a->buffer_stride[i],
+                      (uint8_t*)b->buffer_data[i] + row * b->buffer_stride[i], bytes) != 0) {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Decodes the stream to NV12 and RGBA32 samples, serially and with frame threads, and compares
+ * the frames with the reference converted by mmf_convert_yuv420p(). The conversion routines
+ * are compared with the BT.601 formulas by dsp_test_convert(). Returns the number of failed checks.
+ */
+int mpg1_test_convert(char *fn)
+{
+    const MMFSampleFormat formats[] = { SAMPLE_FORMAT_NV12, SAMPLE_FORMAT_RGBA32 };
+    const char *names[] = { "NV12", "RGBA32" };
+
+    MPEG1TestFrames ref;
+    MPEG1DecoderContext *dec = NULL;
+    MMFSample *sample = NULL, *expected = NULL;
+    int failures = 0;
+    int32_t format, threads, count, w, h;
+    int64_t last_pts;
+    MMFRES rc;
+
+    if(failed(mpg1_test_reference(fn, &ref))) {
+        printf("mpg1_test_convert: failed to decode '%s'\n", fn);
+        return 1;
+    }
+
+    w = ref.width;
+    h = ref.height;
+
+    for(format=0; format<2; format++) {
+        for(threads=1; threads<=3; threads+=2) {
+            count = 0;
+            last_pts = -1;
+
+            rc = mpg1_decoder_create(&dec, fn);
+            if(succeeded(rc)) rc = mpg1_decoder_set_frame_threads(dec, threads);
+            if(succeeded(rc)) rc = mmf_allocate_video_frame(formats[format], w, h, &sample);
+            if(succeeded(rc)) rc = mmf_allocate_video_frame(formats[format], w, h, &expected);
+
+            while(succeeded(rc)) {
+                uint8_t *y;
+
+                rc = mpg1_decode_sample(dec, sample);
+                if(failed(rc)) break;
+
+                if(sample->pts <= last_pts || sample->pts >= ref.count) {
+                    printf("mpg1_test_convert: frame %d has number %d\n", (int)count, (int)sample->pts);
+                    failures++;
+                    break;
+                }
+
+                y = mpg1_test_frame(&ref, sample->pts);
+                mmf_convert_yuv420p(y, y + w * h, y + w * h + (w / 2) * (h / 2), w, w / 2, expected, 0, h);
+
+                if(mpg1_test_compare_samples(sample, expected) != 0) {
+                    if(failures < 5) {
+                        printf("mpg1_test_convert: %s frame %d differs\n", names[format], (int)sample->pts);
+                    }
+
+                    failures++;
+                }
+
+                last_pts = sample->pts;
+                count++;
+            }
+
+            if(rc != RC_END_OF_STREAM && failed(rc)) {
+                printf("mpg1_test_convert: decoding to %s failed\n", names[format]);
+                failures++;
+            }else if(rc == RC_END_OF_STREAM && count != ref.count) {
+                printf("mpg1_test_convert: %d %s frames, expected %d\n", (int)count, names[format], (int)ref.count);
+                failures++;
+            }
+
+            mmf_sample_free(&expected);
+            mmf_sample_free(&sample);
+            if(dec) mpg1_decoder_free(&dec);
+        }
+    }
+
+    mpg1_test_frames_free(&ref);
+
+    printf("mpg1_test_convert: %s\n", failures ? "FAILED" : "passed");
+    return failures;
+}
+
+/* Decodes the stream scaled with mpg1_decoder_set_output_size(), down to 1/2 and 2/3, and up to
+ * 3/2 of its size, with both filters, serially and with slice and frame threads. B pictures are
+ * scaled as their rows are decoded, so the frames are compared with the reference scaled as
+ * whole frames by mmf_scaler, and must match it exactly. Returns the number of failed checks.
+ */
+int mpg1_test_scaling(char *fn)
+{
+    MPEG1TestFrames ref, scaled;
+    MPEG1DecoderContext *dec;
+    int failures = 0;
+    int32_t size, filter, mode, w, h;
+
+    if(failed(mpg1_test_reference(fn, &ref))) {
+        printf("mpg1_test_scaling: failed to decode '%s'\n", fn);
+        return 1;
+    }
+
+    /* Even sizes */
+    const int32_t sizes[3][2] = { { ref.width / 4 * 2, ref.height / 4 * 2 }, { ref.width / 3 * 2, ref.height / 3 * 2 },
+                                  { ref.width * 3 / 4 * 2, ref.height * 3 / 4 * 2 } };
+
+    for(size=0; size<3; size++) {
+        w = sizes[size][0];
+        h = sizes[size][1];
+
+        for(filter=SCALE_FILTER_BILINEAR; filter<=SCALE_FILTER_AREA; filter++) {
+            if(failed(mpg1_test_scale(&ref, &scaled, w, h, filter))) {
+                printf("mpg1_test_scaling: failed to scale the reference to %dx%d\n", (int)w, (int)h);
+                failures++;
+                continue;
+            }
+
+            for(mode=0; mode<3; mode++) {
+                MMFRES rc = mpg1_decoder_create(&dec, fn);
+
+                if(succeeded(rc)) rc = mpg1_decoder_set_output_size(dec, w, h, filter);
+                if(succeeded(rc) && mode == 1) rc = mpg1_decoder_set_threads(dec, 2);
+                if(succeeded(rc) && mode == 2) rc = mpg1_decoder_set_frame_threads(dec, 3);
+
+                if(failed(rc)) {
+                    printf("mpg1_test_scaling: failed to create decoder\n");
+                    failures++;
+                    break;
+                }
+
+                if(mpg1_test_run("mpg1_test_scaling", &scaled, dec, 0, h) != 0) {
+                    printf("mpg1_test_scaling: %dx%d (filter %d) with %s differs\n", (int)w, (int)h, (int)filter,
+                           mode == 0 ? "serial decoding" : mode == 1 ? "2 slice threads" : "3 frame threads");
+                    failures++;
+                }
+            }
+
+            mpg1_test_frames_free(&scaled);
+        }
+    }
+
+    mpg1_test_frames_free(&ref);
+
+    printf("mpg1_test_scaling: %s\n", failures ? "FAILED" : "passed");
+    return failures;
+}
+
+#endif // MPEG1DEC_TEST_H_INCLUDED
@@ -167,7 +167,7 @@ MMFRES vlc_find_leaf(VLCTreeNode *entry, uint64_t path, int8_t path_bit_count, V
     (*depth) ++;
 
     //Invoke recursion
-    return vlc_find_leaf(entry->branches[dir], path & ((1 << (path_bit_count-1))-1), path_bit_count-1, result, depth);
+    return vlc_find_leaf(entry->branches[dir], path & (((uint64_t)1 << (path_bit_count-1))-1), path_bit_count-1, result, depth);
 }
 
 MMFRES vlc_decode_bitstream(MMFBitstream *bs, VLCTreeNode *vlc_tree, int32_t symbol_limit, void *dst, int32_t *len)
@@ -181,20 +181,14 @@ MMFRES vlc_decode_bitstream(MMFBitstream *bs, VLCTreeNode *vlc_tree, int32_t sym
     while (symbol_limit > 0 || symbol_limit == -1) {
         int bits_to_read = 32;
 
-        bits = bitstream_peek_bits(bs, bits_to_read, &rc);
+        /* Bits past the end of stream are shown as zeroes, so there is no need
+         * to peek at less bits near the end.
+         */
+        bits = bitstream_show_bits(bs, bits_to_read);
 
-        //No enought bits in stream, try to read less
-        if(rc == RC_NEED_MORE_INPUT) {
-            bits_to_read = bitstream_get_size(bs);
-            if(bits_to_read > 0) {
-                bits = bitstream_peek_bits(bs, bits_to_read, &rc);
-            }
-        }
-
-        if(rc == RC_END_OF_STREAM || rc == RC_NEED_MORE_INPUT) {
+        if(bs->cache_bits <= 0) {
             return RC_OK;
-        }else if(failed(rc))
-            return rc;
+        }
 
         //find first leaf
         VLCTreeNode *leaf;
@@ -205,7 +199,7 @@ MMFRES vlc_decode_bitstream(MMFBitstream *bs, VLCTreeNode *vlc_tree, int32_t sym
         if(failed(rc)) return rc;
 
         //Flush that much bits, as the leaf's path is
-        bitstream_discard_bits(bs, depth);
+        bitstream_skip_bits(bs, depth);
 
         *(target++) = leaf->symbol;
         (*len)++;
@@ -249,3 +243,228 @@ MMFRES vlc_tree_create2(const VLCPrefixEntry *prefixes, int32_t element_count, V
 
     return rc;
 }
+
+/* Reserves "count" entries at the end of a VLC lookup table. Returns the offset
+ * of the first reserved entry, or -1 if out of memory.
+ */
+static int32_t vlc_table_reserve(VLCTable *table, int32_t count)
+{
+    if(table->size + count > table->capacity) {
+        if(table->static_storage) {
+            return -1;
+        }
+
+        int32_t new_capacity = table->capacity ? table->capacity : 256;
+
+        while(table->size + count > new_capacity) {
+            new_capacity *= 2;
+        }
+
+        VLCTableEntry *entries = mmf_realloc(table->entries, new_capacity * sizeof(VLCTableEntry));
+        if(!entries) {
+            return -1;
+        }
+
+        table->entries = entries;
+        table->capacity = new_capacity;
+    }
+
+    int32_t offset = table->size;
+    table->size += count;
+
+    return offset;
+}
+
+/* Builds a (sub)table with 2^bits entries, for all prefixes which start with the
+ * "prefix_len" bits of "code_prefix". Codes longer than prefix_len+bits are placed
+ * recursively in secondary tables.
+ */
+static MMFRES vlc_table_build(VLCTable *table, int32_t bits, const VLCPrefixEntry *prefixes, int32_t element_count, uint32_t code_prefix, int32_t prefix_len, int32_t *offset)
+{
+    int32_t i, j, len;
+    int32_t table_size = 1 << bits;
+
+    int32_t offs = vlc_table_reserve(table, table_size);
+    if(offs < 0) {
+        return table->static_storage ? RC_BUFFER_OVERFLOW : RC_OUTOFMEM;
+    }
+
+    /* Secondary tables are addressed by 16-bit offset */
+    if(offs + table_size > 0x7FFF) {
+        return RC_FAIL;
+    }
+
+    for(i=0; i<table_size; i++) {
+        table->entries[offs + i].symbol = VLC_INVALID_SYMBOL;
+        table->entries[offs + i].length = 0;
+    }
+
+    /* Fill entries for the codes, which fit in this table. Shorter codes go first, so
+     * when two codes conflict, the longer one wins (same as with the tree decoder).
+     */
+    for(len = prefix_len + 1; len <= prefix_len + bits; len++) {
+        for(i=0; i<element_count; i++) {
+            const VLCPrefixEntry *p = &prefixes[i];
+
+            if(p->bit_count != len || (p->bits >> (len - prefix_len)) != code_prefix) {
+                continue;
+            }
+
+            /* Every index, which starts with the code, resolves to it */
+            int32_t code_len = len - prefix_len;
+            int32_t first = (p->bits & ((1 << code_len) - 1)) << (bits - code_len);
+
+            for(j=0; j<(1 << (bits - code_len)); j++) {
+                table->entries[offs + first + j].symbol = p->symbol;
+                table->entries[offs + first + j].length = code_len;
+            }
+        }
+    }
+
+    /* Codes which don't fit, go to a secondary table, one per entry of this table */
+    for(j=0; j<table_size; j++) {
+        uint32_t sub_prefix = (code_prefix << bits) | j;
+        int32_t sub_bits = 0;
+        int32_t sub_offs;
+        MMFRES rc;
+
+        for(i=0; i<element_count; i++) {
+            const VLCPrefixEntry *p = &prefixes[i];
+            int32_t extra_bits = p->bit_count - prefix_len - bits;
+
+            if(extra_bits > sub_bits && (p->bits >> extra_bits) == sub_prefix) {
+                sub_bits = extra_bits;
+            }
+        }
+
+        if(sub_bits == 0) {
+            continue;
+        }
+
+        /* Very long codes take more than two levels */
+        if(sub_bits > bits) {
+            sub_bits = bits;
+        }
+
+        rc = vlc_table_build(table, sub_bits, prefixes, element_count, sub_prefix, prefix_len + bits, &sub_offs);
+        if(failed(rc)) return rc;
+
+        table->entries[offs + j].symbol = sub_offs;
+        table->entries[offs + j].length = -sub_bits;
+    }
+
+    *offset = offs;
+    return RC_OK;
+}
+
+/* Counts the prefixes in a NULL terminated prefix table.
+ */
+static int32_t vlc_prefix_count(const VLCPrefixEntry *prefixes)
+{
+    int32_t element_count = 0;
+
+    while(prefixes[element_count].bit_count > 0) {
+        element_count++;
+    }
+
+    return element_count;
+}
+
+MMFRES vlc_table_create(const VLCPrefixEntry *prefixes, int32_t element_count, int32_t bits, VLCTable **table)
+{
+    int32_t offset;
+
+    //Find number of elements if element_count=0
+    if(element_count == 0) {
+        element_count = vlc_prefix_count(prefixes);
+    }
+
+    if(bits <= 0 || bits > 16) {
+        return RC_INVALIDARG;
+    }
+
+    VLCTable *t = mmf_allocz(sizeof(VLCTable));
+    if(!t) {
+        return RC_OUTOFMEM;
+    }
+
+    t->bits = bits;
+
+    MMFRES rc = vlc_table_build(t, bits, prefixes, element_count, 0, 0, &offset);
+    if(failed(rc)) {
+        vlc_table_free(&t);
+        return rc;
+    }
+
+    *table = t;
+    return RC_OK;
+}
+
+MMFRES vlc_table_init_static(VLCTable *table, VLCTableEntry *storage, int32_t storage_size, const VLCPrefixEntry *prefixes, int32_t element_count, int32_t bits)
+{
+    int32_t offset;
+
+    if(element_count == 0) {
+        element_count = vlc_prefix_count(prefixes);
+    }
+
+    if(bits <= 0 || bits > 16) {
+        return RC_INVALIDARG;
+    }
+
+    memset(table, 0, sizeof(VLCTable));
+    table->entries = storage;
+    table->capacity = storage_size;
+    table->bits = bits;
+    table->static_storage = 1;
+
+    return vlc_table_build(table, bits, prefixes, element_count, 0, 0, &offset);
+}
+
+MMFRES vlc_table_free(VLCTable **table)
+{
+    if(*table == NULL) {
+        return RC_OK;
+    }
+
+    /* Tables with static storage are not owned by anyone */
+    if((*table)->static_storage) {
+        *table = NULL;
+        return RC_OK;
+    }
+
+    mmf_free((*table)->entries);
+    mmf_free(*table);
+    *table = NULL;
+
+    return RC_OK;
+}
+
+MMFRES vlc_decode_table(MMFBitstream *bs, const VLCTable *table, int32_t symbol_limit, void *dst, int32_t *len)
+{
+    uint8_t *target = (uint8_t*)dst;
+
+    (*len) = 0;
+
+    while (symbol_limit > 0 || symbol_limit == -1) {
+        /* Stop at end of stream */
+        bitstream_show_bits(bs, 1);
+        if(bs->cache_bits <= 0) {
+            return RC_OK;
+        }
+
+        int32_t symbol = vlc_table_get_symbol(bs, table);
+        if(symbol == VLC_INVALID_SYMBOL) {
+            return RC_INVALIDDATA;
+        }
+
+        *(target++) = (uint8_t)symbol;
+        (*len)++;
+
+        if(symbol_limit != -1) {
+            symbol_limit--;
+        }
+    }
+
+    return RC_OK;
+}
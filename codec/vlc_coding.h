@@ -20,6 +20,42 @@ typedef struct {
     char symbol;
 } VLCPrefixEntry;
 
+/**
+ * Value returned by the table decoder, when the bits don't match any known prefix.
+ */
+#define VLC_INVALID_SYMBOL  0x7FFF
+
+/**
+ * Single entry of a VLC lookup table.
+ *  - If <i>length</i> is positive, the entry is resolved. <i>symbol</i> is the decoded symbol, and
+ *    <i>length</i> is the actual length of the prefix code.
+ *  - If <i>length</i> is negative, the code is longer than the table index. <i>symbol</i> holds the
+ *    offset of a secondary table, indexed by the next -<i>length</i> bits.
+ *  - If <i>length</i> is zero, the code is invalid.
+ */
+typedef struct {
+    int16_t symbol;
+    int8_t length;
+} VLCTableEntry;
+
+/**
+ * Multi-level lookup table for VLC decoding. The primary table is indexed by the next <i>bits</i> bits
+ * of the stream, and secondary tables (for longer codes) are stored after it in the same array.
+ */
+typedef struct {
+    VLCTableEntry *entries;
+
+    /* Number of used entries and capacity of <i>entries</i> */
+    int32_t size;
+    int32_t capacity;
+
+    /* Width of the primary table index in bits */
+    int32_t bits;
+
+    /* Set if <i>entries</i> is provided by the caller, and can't be reallocated */
+    int8_t static_storage;
+} VLCTable;
+
 MMFRES vlc_tree_create(char *symbols, uint64_t *bit_codes, uint8_t *bit_counts, int32_t element_count, VLCTreeNode **tree_root);
 
 /**
@@ -42,6 +78,75 @@ MMFRES vlc_tree_free(VLCTreeNode **root);
 
 
 MMFRES vlc_decode_bitstream(MMFBitstream *bs, VLCTreeNode *vlc_tree, int32_t symbol_limit, void *dst, int32_t *len);
+
+/**
+ * Creates a multi-level lookup table from a given table of prefixes.
+ *
+ * @param prefixes Array of prefixes
+ * @param element_count Length of <i>prefixes</i>. It can be <i>0</i>, in this case it will thread the array as NULL terminated.
+ * @param bits Width of the primary table index. Codes up to that length are decoded with a single lookup.
+ * @param table Pointer to a variable which will receive pointer to the new table.
+ * @return RC_OK on success, error otherwise.
+ */
+MMFRES vlc_table_create(const VLCPrefixEntry *prefixes, int32_t element_count, int32_t bits, VLCTable **table);
+
+/**
+ * Initializes a VLC lookup table in caller-provided storage, without allocating memory. This
+ * is intended for tables with static storage duration, which are shared among decoder instances.
+ *
+ * @param table Pointer to the table struct to be initialized.
+ * @param storage Array which will hold the table entries.
+ * @param storage_size Number of entries in <i>storage</i>.
+ * @param prefixes Array of prefixes
+ * @param element_count Length of <i>prefixes</i>, or <i>0</i> if it is NULL terminated.
+ * @param bits Width of the primary table index.
+ * @return RC_OK on success, RC_BUFFER_OVERFLOW if <i>storage</i> is too small.
+ */
+MMFRES vlc_table_init_static(VLCTable *table, VLCTableEntry *storage, int32_t storage_size, const VLCPrefixEntry *prefixes, int32_t element_count, int32_t bits);
+
+/**
+ * Releases a VLC lookup table.
+ *
+ * @param table Double pointer to the table.
+ * @return RC_OK on success, error otherwise.
+ */
+MMFRES vlc_table_free(VLCTable **table);
+
+/**
+ * Decodes up to <i>symbol_limit</i> symbols (or until end of stream if it is -1) using a lookup table.
+ * Symbols are stored in <i>dst</i> as bytes, same as vlc_decode_bitstream().
+ *
+ * @return RC_OK on success, RC_INVALIDDATA if a code is not found in the table.
+ */
+MMFRES vlc_decode_table(MMFBitstream *bs, const VLCTable *table, int32_t symbol_limit, void *dst, int32_t *len);
+
+/**
+ * Decodes a single symbol using a lookup table. It takes one lookup for codes which fit
+ * in the primary table, and one more for each secondary table level.
+ *
+ * @param bs Pointer to MMF bitstream
+ * @param table Pointer to VLC lookup table
+ * @return The decoded symbol, or VLC_INVALID_SYMBOL if the code is not found.
+ */
+static inline int32_t vlc_table_get_symbol(MMFBitstream *bs, const VLCTable *table)
+{
+    int32_t n = table->bits;
+    const VLCTableEntry *e = &table->entries[bitstream_show_bits(bs, n)];
+
+    while(e->length < 0) {
+        /* Descend to the secondary table */
+        bitstream_skip_bits(bs, n);
+        n = -e->length;
+        e = &table->entries[e->symbol + bitstream_show_bits(bs, n)];
+    }
+
+    if(e->length == 0) {
+        return VLC_INVALID_SYMBOL;
+    }
+
+    bitstream_skip_bits(bs, e->length);
+    return e->symbol;
+}
 /*
 MMFRES vlc_decode_buffer()
 */
@@ -1,12 +1,35 @@
 #include "bitstream.h"
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 /* Writes arbitrary buffer to the bit stream.
  */
 MMFRES bitstream_write(MMFBitstream *str, uint8_t *src_data, int32_t data_size)
 {
+    if(str->mapped || str->wrapped) {
+        //The buffer is read-only
+        return RC_NOT_ALLOWED;
+    }
+
     if(str->buffer_capacity - str->write_index < data_size) {
-        //Buffer overflow
-        return RC_BUFFER_OVERFLOW;
+        //Make room by discarding the data, which is already read
+        bitstream_flush(str);
+
+        if(str->buffer_capacity - str->write_index < data_size) {
+            //Buffer overflow
+            return RC_BUFFER_OVERFLOW;
+        }
     }
 
     uint8_t *dst = str->buffer;
@@ -32,47 +55,24 @@ uint32_t bitstream_read_bits(MMFBitstream *str, int32_t n, MMFRES *rc)
     }
     #endif // DEBUG
 
-    //Check if there are enough bits present in stream
-    if((str->read_bit_index + n) > str->write_index * 8) {
-        if(str->source_file == NULL) {
-            if(rc) *rc = RC_NEED_MORE_INPUT;
-            return 0;
-        }
+    if(n == 0) {
+        if(rc) *rc = RC_OK;
+        return 0;
+    }
 
-        MMFRES retcode = bitstream_replenish(str);
-        if(failed(retcode)) {
-            if(rc) *rc = retcode;
-            return 0;
-        }
+    //Check if there are enough bits present in the cache
+    if(str->cache_bits < n) {
+        MMFRES retcode = bitstream_refill_cache(str, n);
 
-        //We have reached end of file, and we try to read more bits than we actually have.
-        if((str->read_bit_index + n) > str->write_index * 8) {
-            if(rc) *rc = RC_END_OF_STREAM;
+        //We have reached end of stream, and we try to read more bits than we actually have.
+        if(str->cache_bits < n) {
+            if(rc) *rc = retcode;
             return 0;
         }
     }
 
-    //Reset the result value
-    uint32_t result = 0;
-
-    while(n > 0) {
-        int bits_in_byte = 8 - str->read_bit_index % 8; //how many unread bits have remained in current byte
-        int bits_to_read = (n > bits_in_byte) ? bits_in_byte : n; //how many bits to read from current byte
-        int bits_left = bits_in_byte - bits_to_read; //bits, that will remain in current byte, after reading
-
-        //Read bits from current byte
-        result = (result << bits_to_read) | ((str->buffer[str->read_index] >> bits_left) & ((1 << bits_to_read)-1));
-
-        //Move index
-        str->read_bit_index += bits_to_read;
-        str->read_index = str->read_bit_index / 8;
-
-        //Decrement n (since we use it as a counter)
-        n -= bits_to_read;
-    }
-
     if(rc) *rc = RC_OK;
-    return result;
+    return bitstream_get_bits(str, n);
 }
 
 /* Discards "n" bits from the stream. The idea is same as *_read_bits, it just
@@ -80,14 +80,18 @@ uint32_t bitstream_read_bits(MMFBitstream *str, int32_t n, MMFRES *rc)
  */
 MMFRES bitstream_discard_bits(MMFBitstream *str, int32_t n)
 {
-    /* For sake of simplicity, we will redirect to *_read_bits.
-     * Anyway in future versions, this function could be implemented
-     * separately, which will benefit performance.
-     */
-    MMFRES rc;
-    bitstream_read_bits(str, n, &rc);
+    MMFRES rc = RC_OK;
 
-    return rc;
+    //Check if there are enough bits present in the cache
+    if(str->cache_bits < n) {
+        rc = bitstream_refill_cache(str, n);
+        if(str->cache_bits < n) {
+            return rc;
+        }
+    }
+
+    bitstream_skip_bits(str, n);
+    return RC_OK;
 }
 
 /* Reads the following "n" bits, but doesn't move the read index.
@@ -102,126 +106,184 @@ uint32_t bitstream_peek_bits(MMFBitstream *str, int32_t n, MMFRES *rc)
     }
     #endif // DEBUG
 
-    //Check if there are enough bits present in stream
-    if((str->read_bit_index + n) > str->write_index * 8) {
-        if(str->source_file == NULL) {
-            if(rc) *rc = RC_NEED_MORE_INPUT;
-            return 0;
-        }
+    if(n == 0) {
+        if(rc) *rc = RC_OK;
+        return 0;
+    }
 
-        MMFRES retcode = bitstream_replenish(str);
-        if(failed(retcode)) {
-            if(rc) *rc = retcode;
-            return 0;
-        }
+    //Check if there are enough bits present in the cache
+    if(str->cache_bits < n) {
+        MMFRES retcode = bitstream_refill_cache(str, n);
 
-        //We have reached end of file, and we try to read more bits than we actually have.
-        if((str->read_bit_index + n) > str->write_index * 8) {
-            if(rc) *rc = RC_END_OF_STREAM;
+        //We have reached end of stream, and we try to peek more bits than we actually have.
+        if(str->cache_bits < n) {
+            if(rc) *rc = retcode;
             return 0;
         }
     }
 
-    uint32_t result = 0;
-
-    int32_t temp_index = str->read_index;
-    int32_t temp_bit_index = str->read_bit_index;
+    if(rc) *rc = RC_OK;
+    return bitstream_show_bits(str, n);
+}
 
-    while(n > 0) {
-        int bits_in_byte = 8 - temp_bit_index % 8; //how many unread bits have remained in current byte
-        int bits_to_read = (n > bits_in_byte) ? bits_in_byte : n; //how many bits to read from current byte
-        int bits_left = bits_in_byte - bits_to_read; //bits, that will remain in current byte, after reading
+/* Reloads the cache word from the byte, which holds the read index. This is
+ * the slow path of bitstream_show_bits() and friends.
+ */
+MMFRES bitstream_refill_cache(MMFBitstream *bs, int32_t n)
+{
+    MMFRES rc = RC_OK;
+
+    //Check if there are enough bits present in the buffer
+    if((bs->read_bit_index + n) > bs->write_index * 8) {
+        if(bs->mapped || bs->wrapped) {
+            //The whole stream is in the buffer
+            rc = RC_END_OF_STREAM;
+        } else if(bs->read_func == NULL) {
+            rc = RC_NEED_MORE_INPUT;
+        } else {
+            //The callback might return less than requested (e.g. when reading a pipe)
+            do {
+                rc = bitstream_replenish(bs);
+            } while(succeeded(rc) && (bs->read_bit_index + n) > bs->write_index * 8);
+        }
+    }
 
-        //Read bits from current byte
-        result = (result << bits_to_read) | ((str->buffer[temp_index] >> bits_left) & ((1 << bits_to_read)-1));
+    int64_t bytes_left = bs->write_index - bs->read_index;
+    int32_t bit_offset = bs->read_bit_index & 7;
+    uint64_t word = 0;
 
-        //Move index
-        temp_bit_index += bits_to_read;
-        temp_index = temp_bit_index / 8;
+    if(bytes_left >= 8) {
+        //Common case, load the whole word at once
+        word = bitstream_load_be64(bs->buffer + bs->read_index);
+        bs->cache_bits = 64 - bit_offset;
+    } else {
+        //Near the end of the buffer, assemble it byte by byte to avoid reading past it
+        int i;
+        for(i=0; i<8; i++) {
+            word <<= 8;
+            if(i < bytes_left) {
+                word |= bs->buffer[bs->read_index + i];
+            }
+        }
 
-        //Decrement n (since we use it as a counter)
-        n -= bits_to_read;
+        bs->cache_bits = bytes_left > 0 ? (bytes_left * 8) - bit_offset : 0;
     }
 
-    if(rc) *rc = RC_OK;
-    return result;
+    bs->cache = word << bit_offset;
+    return rc;
 }
 
-
 /* Discards the already read data (i.e. all bytes before the read index).
  * This cause the remaining data in buffer moved to the beginning of the buffer,
  * and read indexes to be updated.
  */
 MMFRES bitstream_flush(MMFBitstream *bs)
 {
+    int64_t shift = bs->read_index;
+
+    if(bs->mark >= 0 && bs->mark - bs->buffer_offset < shift) {
+        //Keep the marked data
+        shift = bs->mark > bs->buffer_offset ? bs->mark - bs->buffer_offset : 0;
+    }
+
+    if(bs->mapped || bs->wrapped || shift == 0) {
+        //Nothing to do
+        return RC_OK;
+    }
+
+    //Move the unread part (including the partially read byte) to the beginning
+    memmove(bs->buffer, bs->buffer + shift, bs->write_index - shift);
 
+    bs->buffer_offset += shift;
+    bs->write_index -= shift;
+    bs->read_index -= shift;
+    bs->read_bit_index -= shift * 8;
+
+    /* The cache word holds a copy of the data, so it stays valid */
+    return RC_OK;
 }
 
-/* Reads more data from the assigned file. If no file is assigned, it returns
- * error.
+/* Pulls more data from the read callback directly in the free part of the
+ * inner buffer. If no callback is assigned, it returns error.
  */
 MMFRES bitstream_replenish(MMFBitstream *bs)
 {
-    if(bs->source_file == NULL) {
+    if(bs->read_func == NULL) {
         return RC_NOT_ALLOWED;
     }
 
-    //Decide how much bytes to read from the file
-    size_t bytes_to_read = bs->buffer_capacity - bs->write_index;
-    int bytes_read = 0;
-
+    if(bs->eos) {
+        return RC_END_OF_STREAM;
+    }
 
     //If there is less than half space free, flush the stream
-    if(bytes_to_read > bs->buffer_capacity / 2) {
+    if(bs->buffer_capacity - bs->write_index < bs->buffer_capacity / 2) {
         bitstream_flush(bs);
-        bytes_to_read = bs->buffer_capacity - bs->write_index;
     }
 
-    #ifdef DEBUG
-    //Catch unexpected cases.
-    mmf_assert(bytes_to_read>=0);
-    #endif
-
-    //See how much bytes remain to end of file
-    bytes_to_read = bytes_to_read > bs->file_size ? bs->file_size : bytes_to_read;
+    //Decide how much bytes to read
+    int64_t bytes_to_read = bs->buffer_capacity - bs->write_index;
 
     if(bytes_to_read == 0) {
-        /* There is no space in the buffer. The user should read
-         * more data to free some space.
-         */
-        return RC_BUFFER_OVERFLOW;
+        if(bs->mark < 0 || bs->buffer_capacity > INT32_MAX / 2) {
+            /* There is no space in the buffer. The user should read
+             * more data to free some space.
+             */
+            return RC_BUFFER_OVERFLOW;
+        }
+
+        //The buffer is full of marked data, so grow it
+        uint8_t *buffer = mmf_realloc(bs->buffer, (int32_t)(bs->buffer_capacity * 2));
+        if(!buffer) return RC_OUTOFMEM;
+
+        bs->buffer = buffer;
+        bytes_to_read = bs->buffer_capacity;
+        bs->buffer_capacity *= 2;
     }
 
-    //Create static array, residing in the stack
-    uint8_t *data = mmf_alloc(bytes_to_read);
+    if(bytes_to_read > INT32_MAX) {
+        bytes_to_read = INT32_MAX;
+    }
 
-    //Read from file
-    bytes_read = fread(data, 1, bytes_to_read, bs->source_file);
+    int32_t bytes_read = bs->read_func(bs->read_opaque, bs->buffer + bs->write_index, (int32_t)bytes_to_read);
 
-    //Check if end of file is reached.
-    if(bytes_read <= 0) {
-        int err = ferror(bs->source_file);
+    if(bytes_read < 0) {
+        //Failed to read from source
+        return RC_FAIL;
+    }
 
-        #ifdef DEBUG
-        char *err_msg = strerror(err);
-        //TODO: log
-        #endif // DEBUG
+    if(bytes_read == 0) {
+        bs->eos = 1;
+        return RC_END_OF_STREAM;
+    }
 
-        mmf_free(data);
+    bs->write_index += bytes_read;
+    return RC_OK;
+}
 
-        if(err != 0) {
-            //Failed to read from file
-            return RC_FAIL;
-        }
+/* Read callback of streams, created with bitstream_alloc_load_file().
+ */
+static int32_t bitstream_read_file(void *opaque, uint8_t *buf, int32_t n)
+{
+    FILE *f = opaque;
+    size_t bytes_read = fread(buf, 1, n, f);
 
-        return RC_END_OF_STREAM;
+    if(bytes_read == 0 && ferror(f)) {
+        return -1;
     }
 
-    //Add to inner buffer
-    bitstream_write(bs, data, bytes_read);
+    return (int32_t)bytes_read;
+}
 
-    mmf_free(data);
-    return RC_OK;
+/* Seek callback of streams, created with bitstream_alloc_load_file().
+ */
+static int32_t bitstream_seek_file(void *opaque, int64_t offset)
+{
+    #ifdef _WIN32
+    return _fseeki64((FILE*)opaque, offset, SEEK_SET) == 0 ? 0 : -1;
+    #else
+    return fseeko((FILE*)opaque, offset, SEEK_SET) == 0 ? 0 : -1;
+    #endif
 }
 
 /*
@@ -245,15 +307,152 @@ MMFRES bitstream_align_to_byte(MMFBitstream *bs)
     return bitstream_discard_bits(bs, 8 - (bs->read_bit_index % 8));
 }
 
+/* Moves the read index to the given byte of the buffer, and reloads the cache word.
+ */
+static void bitstream_seek_byte(MMFBitstream *bs, int64_t index)
+{
+    bs->read_index = index;
+    bs->read_bit_index = index * 8;
+    bitstream_refill_cache(bs, 0);
+}
+
+/* Returns pointer to the first "00 00 01" prefix in [p; end), or NULL if there
+ * is none.
+ */
+const uint8_t* bitstream_find_prefix_c(const uint8_t *p, const uint8_t *end)
+{
+    //The third byte of a prefix is 1, so the scan can step by 3 bytes, until
+    //it hits a byte which might be part of a prefix.
+    while(end - p >= 3) {
+        if(p[2] > 1) {
+            p += 3;
+        } else if(p[2] == 0) {
+            p += 1;
+        } else if(p[0] == 0 && p[1] == 0) {
+            return p;
+        } else {
+            p += 3;
+        }
+    }
+
+    return NULL;
+}
+
+#ifdef __SSE2__
+/* Same as bitstream_find_prefix_c(), 16 positions at a time.
+ */
+const uint8_t* bitstream_find_prefix_sse2(const uint8_t *p, const uint8_t *end)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+
+    //Compare 16 candidate positions at once. The loads at p+1 and p+2 give the
+    //second and third byte of each candidate.
+    while(end - p >= 18) {
+        __m128i b0 = _mm_loadu_si128((const __m128i*)p);
+        __m128i b1 = _mm_loadu_si128((const __m128i*)(p + 1));
+        __m128i b2 = _mm_loadu_si128((const __m128i*)(p + 2));
+
+        __m128i m = _mm_and_si128(_mm_cmpeq_epi8(b0, zero), _mm_cmpeq_epi8(b1, zero));
+        int mask = _mm_movemask_epi8(_mm_and_si128(m, _mm_cmpeq_epi8(b2, one)));
+
+        if(mask) {
+            return p + __builtin_ctz(mask);
+        }
+
+        p += 16;
+    }
+
+    //Tail
+    return bitstream_find_prefix_c(p, end);
+}
+#endif
+
+/* Seeks to an absolute position. Buffered positions are reached by moving the
+ * read index, others by dropping the buffer and seeking the source.
+ */
+MMFRES bitstream_seek(MMFBitstream *bs, int64_t offset)
+{
+    if(offset < 0) {
+        return RC_INVALIDARG;
+    }
+
+    if(offset >= bs->buffer_offset && offset <= bs->buffer_offset + bs->write_index) {
+        bitstream_seek_byte(bs, offset - bs->buffer_offset);
+        return RC_OK;
+    }
+
+    if(bs->seek_func == NULL) {
+        //The position is not in the buffer, and the source can't seek
+        return bs->mapped || bs->wrapped ? RC_INVALIDARG : RC_NOT_ALLOWED;
+    }
+
+    if(bs->seek_func(bs->read_opaque, offset) < 0) {
+        return RC_FAIL;
+    }
+
+    //Drop the buffered data
+    bs->buffer_offset = offset;
+    bs->write_index = 0;
+    bs->read_index = 0;
+    bs->read_bit_index = 0;
+    bs->cache = 0;
+    bs->cache_bits = 0;
+    bs->eos = 0;
+
+    return RC_OK;
+}
+
+/* Searches the raw buffer for the next start code, replenishing it when needed.
+ */
+MMFRES bitstream_next_start_code(MMFBitstream *bs)
+{
+    MMFRES rc = bitstream_align_to_byte(bs);
+    if(failed(rc)) return rc;
+
+    for(;;) {
+        const uint8_t *start = bs->buffer + bs->read_index;
+        const uint8_t *end = bs->buffer + bs->write_index;
+        #ifdef __SSE2__
+        const uint8_t *p = bitstream_find_prefix_sse2(start, end);
+        #else
+        const uint8_t *p = bitstream_find_prefix_c(start, end);
+        #endif
+
+        if(p) {
+            bitstream_seek_byte(bs, p - bs->buffer);
+
+            //The start code value should follow the prefix
+            bitstream_peek_bits(bs, 32, &rc);
+            return rc;
+        }
+
+        //Keep the last two bytes, since they might be beginning of a prefix
+        bitstream_seek_byte(bs, bs->write_index - 2 > bs->read_index ? bs->write_index - 2 : bs->read_index);
+
+        //Get more data
+        rc = bitstream_refill_cache(bs, 32);
+        if(failed(rc)) return rc;
+    }
+}
+
 /*
  * Allocates a MMFBitstream structure and it's respective inner buffer.
  */
 MMFBitstream* bitstream_alloc(int32_t capacity)
 {
     MMFBitstream *bs = mmf_allocz(sizeof(MMFBitstream));
+    if(!bs) {
+        return NULL;
+    }
 
     bs->buffer_capacity = capacity;
+    bs->mark = -1;
     bs->buffer = mmf_alloc(bs->buffer_capacity);
+    if(!bs->buffer) {
+        mmf_free(bs);
+        return NULL;
+    }
 
     return bs;
 }
@@ -273,20 +472,201 @@ MMFBitstream* bitstream_alloc_load_file(char *filename, MMFRES *res)
         return NULL;
     }
 
+    //Get file size. Files may exceed 2 GiB, where long (ftell) is 32 bits on Windows.
+    int64_t size;
+
+    #ifdef _WIN32
+    size = _fseeki64(srcfile, 0, SEEK_END) == 0 ? _ftelli64(srcfile) : -1;
+    #else
+    size = fseeko(srcfile, 0, SEEK_END) == 0 ? ftello(srcfile) : -1;
+    #endif
+
+    if(size < 0 || bitstream_seek_file(srcfile, 0) != 0) {
+        fclose(srcfile);
+        if(res) *res = RC_FAIL;
+        return NULL;
+    }
+
     //File opened successfully, so we create new bit-stream.
-    MMFBitstream *bs = bitstream_alloc(1024*1024*1024);
+    MMFBitstream *bs = bitstream_alloc_callback(bitstream_read_file, srcfile, 0, res);
+    if(!bs) {
+        fclose(srcfile);
+        return NULL;
+    }
+
     bs->source_file = srcfile;
+    bs->seek_func = bitstream_seek_file;
+    bs->file_size = size;
+
+    //Success
+    if(res) *res = RC_OK;
+    return bs;
+}
+
+/* Maps the whole file in memory, and uses it as buffer of the bit-stream.
+ */
+MMFBitstream* bitstream_alloc_map_file(char *filename, MMFRES *res)
+{
+    MMFBitstream *bs;
+    uint8_t *view;
+    int64_t size;
+
+    #ifdef _WIN32
+    LARGE_INTEGER li;
+    HANDLE file, mapping;
+
+    //The flag is the Windows counterpart of MADV_SEQUENTIAL
+    file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if(file == INVALID_HANDLE_VALUE) {
+        if(res) *res = RC_INVALIDARG;
+        return NULL;
+    }
+
+    if(!GetFileSizeEx(file, &li) || li.QuadPart == 0 || (uint64_t)li.QuadPart > (SIZE_MAX >> 1)) {
+        CloseHandle(file);
+        if(res) *res = RC_FAIL;
+        return NULL;
+    }
+    size = li.QuadPart;
+
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(mapping == NULL) {
+        CloseHandle(file);
+        if(res) *res = RC_EXTERNAL;
+        return NULL;
+    }
+
+    view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if(view == NULL) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        if(res) *res = RC_EXTERNAL;
+        return NULL;
+    }
+    #else
+    struct stat st;
+
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) {
+        if(res) *res = RC_INVALIDARG;
+        return NULL;
+    }
+
+    //Empty files can't be mapped, and the size should fit in the address space
+    if(fstat(fd, &st) != 0 || st.st_size == 0 || (uint64_t)st.st_size > (SIZE_MAX >> 1)) {
+        close(fd);
+        if(res) *res = RC_FAIL;
+        return NULL;
+    }
+    size = st.st_size;
+
+    view = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    //The mapping keeps its own reference to the file
+    close(fd);
+
+    if(view == MAP_FAILED) {
+        if(res) *res = RC_EXTERNAL;
+        return NULL;
+    }
+
+    madvise(view, size, MADV_SEQUENTIAL);
+    #endif
+
+    bs = mmf_allocz(sizeof(MMFBitstream));
+    if(!bs) {
+        #ifdef _WIN32
+        UnmapViewOfFile(view);
+        CloseHandle(mapping);
+        CloseHandle(file);
+        #else
+        munmap(view, size);
+        #endif
+
+        if(res) *res = RC_OUTOFMEM;
+        return NULL;
+    }
+
+    bs->buffer = view;
+    bs->buffer_capacity = size;
+    bs->write_index = size;
+    bs->file_size = size;
+    bs->mark = -1;
+    bs->mapped = 1;
 
-    //Get file size
-    fseek(bs->source_file, 0, SEEK_END);
-    bs->file_size = ftell(bs->source_file);
-    fseek(bs->source_file, 0, SEEK_SET);
+    #ifdef _WIN32
+    bs->map_file = file;
+    bs->map_handle = mapping;
+    #endif
 
     //Success
     if(res) *res = RC_OK;
     return bs;
 }
 
+/* Wraps a caller-owned memory region, without copying it.
+ */
+MMFBitstream* bitstream_alloc_wrap(const uint8_t *data, int64_t size, MMFRES *res)
+{
+    if(data == NULL || size <= 0) {
+        if(res) *res = RC_INVALIDARG;
+        return NULL;
+    }
+
+    MMFBitstream *bs = mmf_alloc(sizeof(MMFBitstream));
+    if(!bs) {
+        if(res) *res = RC_OUTOFMEM;
+        return NULL;
+    }
+
+    bitstream_init_wrap(bs, data, size);
+
+    //Success
+    if(res) *res = RC_OK;
+    return bs;
+}
+
+void bitstream_init_wrap(MMFBitstream *bs, const uint8_t *data, int64_t size)
+{
+    memset(bs, 0, sizeof(MMFBitstream));
+
+    //The buffer is never written to, so casting away const is safe
+    bs->buffer = (uint8_t*)data;
+    bs->buffer_capacity = size;
+    bs->write_index = size;
+    bs->mark = -1;
+    bs->wrapped = 1;
+}
+
+/* Allocates bit-stream structure and inner buffer, which is filled through
+ * the given read callback.
+ */
+MMFBitstream* bitstream_alloc_callback(MMFBitstreamReadFunc read_func, void *opaque, int32_t capacity, MMFRES *res)
+{
+    if(read_func == NULL || capacity < 0) {
+        if(res) *res = RC_INVALIDARG;
+        return NULL;
+    }
+
+    MMFBitstream *bs = bitstream_alloc(capacity > 0 ? capacity : BITSTREAM_DEFAULT_CAPACITY);
+    if(!bs) {
+        if(res) *res = RC_OUTOFMEM;
+        return NULL;
+    }
+
+    bs->read_func = read_func;
+    bs->read_opaque = opaque;
+
+    //Success
+    if(res) *res = RC_OK;
+    return bs;
+}
+
+void bitstream_set_seek_callback(MMFBitstream *bs, MMFBitstreamSeekFunc seek_func)
+{
+    bs->seek_func = seek_func;
+}
+
 /*
  * Frees the inner buffer and the MMFBitstream structure.
  */
@@ -299,8 +679,19 @@ MMFRES bitstream_free(MMFBitstream **bs)
         fclose(pbs->source_file);
     }
 
-    //Free inner buffer and structure
-    mmf_free(pbs->buffer);
+    //Free inner buffer (or unmap the file) and structure
+    if(pbs->mapped) {
+        #ifdef _WIN32
+        UnmapViewOfFile(pbs->buffer);
+        CloseHandle(pbs->map_handle);
+        CloseHandle(pbs->map_file);
+        #else
+        munmap(pbs->buffer, pbs->buffer_capacity);
+        #endif
+    } else if(!pbs->wrapped) {
+        mmf_free(pbs->buffer);
+    }
+
     mmf_free(pbs);
 
     //Null the pointer
@@ -308,9 +699,9 @@ MMFRES bitstream_free(MMFBitstream **bs)
     return RC_OK;
 }
 
-int32_t bitstream_get_size(MMFBitstream *bs)
+int64_t bitstream_get_size(MMFBitstream *bs)
 {
-    if(bs->source_file) {
+    if(bs->source_file || bs->mapped) {
         return bs->file_size*8;
     }
 
@@ -3,6 +3,8 @@
  *
  * @brief      Bitstream reader
  * @details    Provides functionality to read arbitrary number of bits (up to 32) from a bit/byte stream.
+ *             Reading is done through a 64-bit cache word, so the inline show/skip/get primitives
+ *             below cost only a shift and a mask on the fast path.
  * @date       February 24, 2016
  * @author	   Anton Angelov, ant0n@mail.bg
  */
@@ -16,6 +18,30 @@
 #include <stdio.h>
 #include "..\mmfutil.h"
 
+/**
+ * Default capacity of the inner buffer of bitstreams, which pull their data from a file
+ * or a read callback.
+ */
+#define BITSTREAM_DEFAULT_CAPACITY (1024*1024)
+
+/**
+ * Read callback of pull-mode bitstreams.
+ * @param opaque User pointer, given to bitstream_alloc_callback()
+ * @param buf    Buffer, which receives the data
+ * @param n      Maximum number of bytes to read
+ * @return Number of bytes read (might be less than <i>n</i>), 0 on end of stream, or
+ *         a negative value on error.
+ */
+typedef int32_t (*MMFBitstreamReadFunc)(void *opaque, uint8_t *buf, int32_t n);
+
+/**
+ * Seek callback of pull-mode bitstreams.
+ * @param opaque User pointer, given to bitstream_alloc_callback()
+ * @param offset Absolute byte offset in the source, where the next read should start
+ * @return 0 on success, or a negative value on error.
+ */
+typedef int32_t (*MMFBitstreamSeekFunc)(void *opaque, int64_t offset);
+
 typedef struct {
     /**
      *  Inner buffer where we will store the bit stream (actually in form of a
@@ -26,35 +52,143 @@ typedef struct {
     /**
      *  Capacity of the internal buffer in bytes.
      */
-    int32_t buffer_capacity;
+    int64_t buffer_capacity;
+
+    /**
+     *  Position of the first byte of the buffer in the stream. It grows when
+     *  bitstream_flush() discards the already read data, so buffer_offset+read_index
+     *  is always the absolute position of the read index.
+     */
+    int64_t buffer_offset;
+
+    /**
+     *  Stream position, from which on bitstream_flush() keeps the data, even if it is
+     *  already read (-1 if there is no such position). The buffer grows if needed.
+     *  It allows a reader to scan ahead, and come back to the marked data.
+     */
+    int64_t mark;
 
     /**
      *  Write index in byte units
      */
-    int32_t write_index;
+    int64_t write_index;
 
     /**
      *  Read index in byte units
      */
-    int32_t read_index;
+    int64_t read_index;
 
     /**
      *  Read index in bit units (actually read_bit_index/8 == read_index should always
      *  be true.
      */
-    int32_t read_bit_index;
+    int64_t read_bit_index;
 
     /**
-     * If a FILE handle is assigned to source file, then the stream
-     *  will internally refill it's inner buffer when it exhausts.
+     *  Cache word, holding the bits which follow the read index, aligned to
+     *  the most significant bit. It is reloaded from the buffer with a single
+     *  big-endian load, whenever it runs short of bits.
+     */
+    uint64_t cache;
+
+    /**
+     *  Number of valid bits in the cache word. It is allowed to drop below zero
+     *  when the reader skips past the end of the stream.
+     */
+    int32_t cache_bits;
+
+    /**
+     * If a read callback is assigned, then the stream will internally refill it's
+     * inner buffer when it exhausts. Streams, created with bitstream_alloc_load_file(),
+     * read their FILE handle through a callback too.
+     */
+    MMFBitstreamReadFunc read_func;
+    MMFBitstreamSeekFunc seek_func;
+    void *read_opaque;
+
+    /**
+     * Set when the read callback has reported end of stream.
+     */
+    int8_t eos;
+
+    /**
+     * Source FILE handle, which is closed when the stream is freed.
      */
     FILE *source_file;
-    int32_t file_size;
+    int64_t file_size;
+
+    /**
+     * Set if the buffer is owned by the caller (see bitstream_alloc_wrap()). It holds the
+     * whole stream, and is neither written to, nor freed.
+     */
+    int8_t wrapped;
+
+    /**
+     * Set if the buffer is a read-only memory mapping of the whole source file
+     * (see bitstream_alloc_map_file()). It is never written to, and is unmapped
+     * instead of freed.
+     */
+    int8_t mapped;
+
+    /**
+     * Handles of the file and the file mapping object (used only on Windows).
+     */
+    void *map_file;
+    void *map_handle;
 }  MMFBitstream;
 
 //TODO: write comments
 MMFBitstream* bitstream_alloc(int32_t capacity);
 MMFBitstream* bitstream_alloc_load_file(char *filename, MMFRES *res);
+
+/**
+ * Creates a bitstream, which buffer is the whole file mapped in memory. Reading is zero-copy,
+ * and the OS is advised that the file will be read sequentially.
+ * @remark Mapping might fail for files, which don't fit in the address space (e.g. in 32-bit
+ *         processes). Use bitstream_alloc_load_file() as a fallback.
+ *
+ * @param filename Name of the file to map
+ * @param res Pointer to MMFRES variable, which receives the return code. NULL is allowed.
+ * @return Pointer to the new bitstream, or NULL on failure.
+ */
+MMFBitstream* bitstream_alloc_map_file(char *filename, MMFRES *res);
+
+/**
+ * Creates a bitstream, which reads directly from a memory region, without copying it.
+ * The region should hold the whole stream, and stay valid until the bitstream is freed.
+ *
+ * @param data Pointer to the stream data
+ * @param size Size of the stream data in bytes
+ * @param res Pointer to MMFRES variable, which receives the return code. NULL is allowed.
+ * @return Pointer to the new bitstream, or NULL on failure.
+ */
+MMFBitstream* bitstream_alloc_wrap(const uint8_t *data, int64_t size, MMFRES *res);
+
+/**
+ * Initializes a caller-allocated bitstream structure (e.g. one on the stack), which reads from a
+ * memory region. It is the same as bitstream_alloc_wrap(), but doesn't allocate anything, so the
+ * structure doesn't need to be freed.
+ */
+void bitstream_init_wrap(MMFBitstream *bs, const uint8_t *data, int64_t size);
+
+/**
+ * Creates a bitstream, which pulls it's data through a read callback (e.g. from a pipe,
+ * shared memory or a network connection). The callback is called whenever the inner
+ * buffer runs short of data.
+ *
+ * @param read_func Read callback
+ * @param opaque User pointer, which is passed to the callback
+ * @param capacity Capacity of the inner buffer in bytes. Pass 0 to use BITSTREAM_DEFAULT_CAPACITY.
+ * @param res Pointer to MMFRES variable, which receives the return code. NULL is allowed.
+ * @return Pointer to the new bitstream, or NULL on failure.
+ */
+MMFBitstream* bitstream_alloc_callback(MMFBitstreamReadFunc read_func, void *opaque, int32_t capacity, MMFRES *res);
+
+/**
+ * Assigns a seek callback to a bitstream, created with bitstream_alloc_callback(). Without it,
+ * the stream can only seek within the data which is currently buffered.
+ */
+void bitstream_set_seek_callback(MMFBitstream *bs, MMFBitstreamSeekFunc seek_func);
 MMFRES bitstream_free(MMFBitstream **bs);
 
 MMFRES bitstream_write(MMFBitstream *str, uint8_t *src_data, int32_t data_size);
@@ -86,24 +220,152 @@ MMFRES bitstream_is_byte_aligned(MMFBitstream *bs);
 
 MMFRES bitstream_align_to_byte(MMFBitstream *bs);
 
+/**
+ * Aligns the read index to a byte, and moves it to the next start code, i.e. to the next
+ * "00 00 01" byte sequence. The search runs over the raw buffer (with SSE2, if available),
+ * instead of reading the stream byte by byte.
+ * @param bs Pointer to MMF bitstream
+ * @return RC_OK if a start code is found, RC_END_OF_STREAM (or another error) otherwise.
+ */
+MMFRES bitstream_next_start_code(MMFBitstream *bs);
+
+/**
+ * Returns pointer to the first "00 00 01" prefix in [p; end), or NULL if there is none.
+ * These are the scans of bitstream_next_start_code(). Call the SSE2 version only if it is compiled in.
+ */
+const uint8_t* bitstream_find_prefix_c(const uint8_t *p, const uint8_t *end);
+
+#ifdef __SSE2__
+const uint8_t* bitstream_find_prefix_sse2(const uint8_t *p, const uint8_t *end);
+#endif
+
+/**
+ * Returns the absolute position of the read index in the stream, in byte units.
+ */
+static inline int64_t bitstream_tell(MMFBitstream *bs)
+{
+    return bs->buffer_offset + bs->read_index;
+}
+
+/**
+ * Moves the read index to an absolute byte position in the stream. Mapped and wrapped
+ * streams can seek anywhere; pull-mode streams call their seek callback, if the position
+ * is not buffered.
+ * @param bs Pointer to MMF bitstream
+ * @param offset Absolute position in bytes
+ * @return RC_OK on success, RC_NOT_ALLOWED if the stream can't seek, error otherwise.
+ */
+MMFRES bitstream_seek(MMFBitstream *bs, int64_t offset);
+
+/**
+ * Keeps the data from the given stream position on in the buffer, until the mark is cleared.
+ * Pass -1 to clear the mark.
+ */
+static inline void bitstream_set_mark(MMFBitstream *bs, int64_t offset)
+{
+    bs->mark = offset;
+}
+
 /**
  * Returns the size of the remaining (unread) part of the bitstream in byte units.
  * @param bs Pointer to MMF bitstream struct
  * @return Size of bitstream in bytes
  */
-int32_t bitstream_get_size(MMFBitstream *bs);
+int64_t bitstream_get_size(MMFBitstream *bs);
 
+/**
+ * Discards the already read data, by moving the unread part to the beginning of the buffer.
+ * The read position in the stream doesn't change.
+ * @remark This has no effect on streams, which don't own their buffer (mapped or wrapped).
+ *
+ * @param bs Pointer to a MMF bitstream
+ * @return RC_OK on success, error otherwise
+ */
 MMFRES bitstream_flush(MMFBitstream *bs);
 
 /**
- * Causes the bitstream to refill it's internal buffer, by reading content from it's associated file.
+ * Causes the bitstream to refill it's internal buffer, by pulling content from it's read callback.
  * It might call bitstream_flush() to create more space.
- * @remark This function is only usable for bitstream created with bitstream_alloc_load_file().
- * @see bitstream_alloc_load_file
+ * @remark This function is only usable for bitstreams created with bitstream_alloc_load_file()
+ *         or bitstream_alloc_callback().
+ * @see bitstream_alloc_callback
  *
  * @param bs Pointer to a MMF bitstream
  * @return RC_OK on success, error otherwise
  */
 MMFRES bitstream_replenish(MMFBitstream *bs);
 
+/**
+ * Reloads the cache word from the read index, so that it holds at least <i>n</i> bits.
+ * If the buffer is short of data, it tries to replenish it from the associated file.
+ * @remark This is the slow path of the inline primitives below. It is seldom needed to call it directly.
+ *
+ * @param bs Pointer to a MMF bitstream
+ * @param n  Number of bits, which are about to be read (up to 32)
+ * @return RC_OK on success, RC_NEED_MORE_INPUT or RC_END_OF_STREAM if there are less than <i>n</i> bits left.
+ */
+MMFRES bitstream_refill_cache(MMFBitstream *bs, int32_t n);
+
+/**
+ * Loads 8 bytes from an (unaligned) address as big-endian 64-bit integer.
+ */
+static inline uint64_t bitstream_load_be64(const uint8_t *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+    #if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    return v;
+    #else
+    return __builtin_bswap64(v);
+    #endif
+}
+
+/**
+ * Shows the following <i>n</i> bits, without moving the read index. Unlike bitstream_peek_bits(),
+ * this function doesn't report errors. Bits past the end of the stream are read as zeroes.
+ * @param bs Pointer to MMF bitstream
+ * @param n  Number of bits to show (1 to 32)
+ * @return The shown bits, aligned to the least significant bit.
+ */
+static inline uint32_t bitstream_show_bits(MMFBitstream *bs, int32_t n)
+{
+    if(bs->cache_bits < n) {
+        bitstream_refill_cache(bs, n);
+    }
+
+    return (uint32_t)(bs->cache >> (64 - n));
+}
+
+/**
+ * Skips <i>n</i> bits from the stream. Unlike bitstream_discard_bits(), no errors are reported.
+ * @param bs Pointer to MMF bitstream
+ * @param n  Number of bits to skip (0 to 32)
+ */
+static inline void bitstream_skip_bits(MMFBitstream *bs, int32_t n)
+{
+    if(bs->cache_bits < n) {
+        bitstream_refill_cache(bs, n);
+    }
+
+    bs->cache <<= n;
+    bs->cache_bits -= n;
+    bs->read_bit_index += n;
+    bs->read_index = bs->read_bit_index >> 3;
+}
+
+/**
+ * Reads <i>n</i> bits from the stream. This is a show+skip pair, without error reporting.
+ * @param bs Pointer to MMF bitstream
+ * @param n  Number of bits to read (1 to 32)
+ * @return The read bits, aligned to the least significant bit.
+ */
+static inline uint32_t bitstream_get_bits(MMFBitstream *bs, int32_t n)
+{
+    uint32_t result = bitstream_show_bits(bs, n);
+    bitstream_skip_bits(bs, n);
+
+    return result;
+}
+
 #endif // BITSTREAM_H_INCLUDED
@@ -5,6 +5,8 @@
 #include "..\mmfsample.h"
 #include "..\codec\mpeg1dec.h"
 #include "..\codec\dct.h"
+#include "..\codec\vlc_coding.h"
+#include "..\codec\mpeg1_consts.h"
 
 //Define some random data to test our bit reader
 const uint8_t data[] = {
@@ -80,6 +82,213 @@ void bitstream_test()
     bitstream_free(&bs);
 }
 
+/* Read callback of bitstream_test_flush_mark(). Serves the byte sequence 0, 1, 2, ...
+ * in small chunks, so the buffer is replenished (and flushed) often.
+ */
+int32_t bitstream_test_read_counter(void *opaque, uint8_t *buf, int32_t n)
+{
+    int32_t *pos = opaque;
+    int32_t i;
+
+    if(n > 7) n = 7;
+    if(*pos + n > 1000) n = 1000 - *pos;
+
+    for(i=0; i<n; i++) {
+        buf[i] = (*pos)++ & 0xFF;
+    }
+
+    return n;
+}
+
+/* Flushes a pull-mode stream with a mark behind the read position. The reader should
+ * continue where it was, and the marked data should stay buffered.
+ * Returns the number of failed checks.
+ */
+int bitstream_test_flush_mark()
+{
+    int32_t source_pos = 0;
+    int failures = 0;
+    int64_t i;
+
+    MMFBitstream *bs = bitstream_alloc_callback(bitstream_test_read_counter, &source_pos, 32, NULL);
+    if(bs == NULL) {
+        printf("bitstream_test_flush_mark: failed to create bitstream\n");
+        return 1;
+    }
+
+    for(i=0; i<1000; i++) {
+        /* Keep the last 5 bytes, like a scanner which comes back to a start code */
+        if(i >= 5) {
+            bitstream_set_mark(bs, i - 5);
+        }
+
+        if(bitstream_tell(bs) != i) {
+            printf("bitstream_test_flush_mark: position %d, expected %d\n", (int)bitstream_tell(bs), (int)i);
+            failures++;
+            break;
+        }
+
+        if(bitstream_get_bits(bs, 8) != (i & 0xFF)) {
+            printf("bitstream_test_flush_mark: wrong byte at %d\n", (int)i);
+            failures++;
+            break;
+        }
+
+        /* Flush explicitly too, with the read index in the middle of a byte */
+        if(i % 13 == 0) {
+            bitstream_get_bits(bs, 3);
+            bitstream_flush(bs);
+
+            if(bs->mark >= 0 && bs->buffer_offset > bs->mark) {
+                printf("bitstream_test_flush_mark: marked data at %d was dropped\n", (int)bs->mark);
+                failures++;
+            }
+
+            bitstream_seek(bs, i + 1);
+        }
+    }
+
+    /* Come back to the mark */
+    if(bitstream_seek(bs, 995) != RC_OK || bitstream_get_bits(bs, 8) != (995 & 0xFF)) {
+        printf("bitstream_test_flush_mark: can't read back the marked data\n");
+        failures++;
+    }
+
+    bitstream_free(&bs);
+
+    printf("bitstream_test_flush_mark: %s\n", failures ? "FAILED" : "passed");
+    return failures;
+}
+
+/* Source of bitstream_test_start_code(). It serves a buffer in chunks of a given size. */
+typedef struct {
+    const uint8_t *data;
+    int32_t size;
+    int32_t pos;
+    int32_t chunk;
+} BitstreamTestSource;
+
+int32_t bitstream_test_read_chunks(void *opaque, uint8_t *buf, int32_t n)
+{
+    BitstreamTestSource *src = opaque;
+
+    if(n > src->chunk) n = src->chunk;
+    if(src->pos + n > src->size) n = src->size - src->pos;
+
+    memcpy(buf, src->data + src->pos, n);
+    src->pos += n;
+
+    return n;
+}
+
+/* Random bytes, with many zeros and ones, so there are prefixes and near misses
+ * (00 01, 00 00 00 01, 00 00 02, ...) at any alignment.
+ */
+void bitstream_test_random_prefixes(uint8_t *p, int32_t size)
+{
+    int32_t i;
+
+    for(i=0; i<size; i++) {
+        int32_t r = rand() % 8;
+        p[i] = r < 3 ? 0 : (r < 5 ? 1 : rand() & 0xFF);
+    }
+}
+
+/* Compares the scans for start code prefixes with a byte by byte search, at all start
+ * and end positions of short buffers. Then it looks for the start codes of a stream, which
+ * is pulled through a callback in small chunks, so the prefixes are split across refills.
+ * Returns the number of failed checks.
+ */
+int bitstream_test_start_code()
+{
+    uint8_t buf[64];
+    int64_t expected[400];
+    int32_t count;
+    int failures = 0;
+    int32_t n, i, j, k, chunk;
+
+    srand(1);
+
+    for(n=0; n<200 && failures < 10; n++) {
+        bitstream_test_random_prefixes(buf, sizeof(buf));
+
+        for(i=0; i<(int32_t)sizeof(buf); i++) {
+            for(j=i; j<=(int32_t)sizeof(buf); j++) {
+                const uint8_t *ref = NULL;
+
+                for(k=i; k+3<=j && !ref; k++) {
+                    if(buf[k] == 0 && buf[k + 1] == 0 && buf[k + 2] == 1) ref = buf + k;
+                }
+
+                if(bitstream_find_prefix_c(buf + i, buf + j) != ref) {
+                    printf("bitstream_test_start_code: C scan of [%d; %d) is wrong\n", (int)i, (int)j);
+                    failures++;
+                }
+
+                #ifdef __SSE2__
+                if(bitstream_find_prefix_sse2(buf + i, buf + j) != ref) {
+                    printf("bitstream_test_start_code: SSE2 scan of [%d; %d) is wrong\n", (int)i, (int)j);
+                    failures++;
+                }
+                #endif
+            }
+        }
+    }
+
+    #ifndef __SSE2__
+    printf("bitstream_test_start_code: sse2 not compiled in, skipped\n");
+    #endif
+
+    /* A stream with start codes every few bytes, read in chunks of 1 to 7 bytes */
+    uint8_t data[1000];
+
+    bitstream_test_random_prefixes(data, sizeof(data));
+
+    for(i=0, count=0; i+4<=(int32_t)sizeof(data); i++) {
+        if(data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+            expected[count++] = i;
+            i += 3;
+        }
+    }
+
+    for(chunk=1; chunk<=7; chunk++) {
+        BitstreamTestSource src = { data, sizeof(data), 0, chunk };
+        MMFRES rc = RC_OK;
+
+        MMFBitstream *bs = bitstream_alloc_callback(bitstream_test_read_chunks, &src, 32, NULL);
+        if(bs == NULL) {
+            printf("bitstream_test_start_code: failed to create bitstream\n");
+            return failures + 1;
+        }
+
+        for(i=0; i<count; i++) {
+            rc = bitstream_next_start_code(bs);
+
+            if(failed(rc) || bitstream_tell(bs) != expected[i]) {
+                printf("bitstream_test_start_code: start code at %d, expected %d (chunks of %d)\n",
+                       (int)bitstream_tell(bs), (int)expected[i], (int)chunk);
+                failures++;
+                break;
+            }
+
+            /* Skip the start code */
+            bitstream_get_bits(bs, 32);
+        }
+
+        /* There are no more of them */
+        if(i == count && succeeded(bitstream_next_start_code(bs))) {
+            printf("bitstream_test_start_code: start code at %d after the last one (chunks of %d)\n",
+                   (int)bitstream_tell(bs), (int)chunk);
+            failures++;
+        }
+
+        bitstream_free(&bs);
+    }
+
+    printf("bitstream_test_start_code: %s\n", failures ? "FAILED" : "passed");
+    return failures;
+}
+
 void bitstream_test_file(char *fn)
 {
     MMFBitstream *bs = bitstream_alloc_load_file(fn, NULL); //discard return code
@@ -102,7 +311,7 @@ void bitstream_test_file(char *fn)
     printf("bitrate: %d bits/s\n", seq_hdr.bitrate);
     printf("frame rate: %f\n", (float)seq_hdr.frame_rate_num / seq_hdr.frame_rate_den);
     printf("aspect ratio: %d:%d\n", seq_hdr.aspect_num, seq_hdr.aspect_den);
-    printf("cursor pos: %d:%d\n", bs->read_index, bs->read_bit_index % 8);
+    printf("cursor pos: %d:%d\n", (int)bs->read_index, (int)(bs->read_bit_index % 8));
 
     MPEG1GroupHeader g;
     mpg1_read_group_header(bs, &g);
@@ -113,7 +322,7 @@ void bitstream_test_file(char *fn)
     printf("time code: %d:%d:%d:%d\n", g.hour, g.minute, g.second, g.frame);
     printf("closed: %d\n", g.closed_flag);
     printf("broken: %d\n", g.broken_flag);
-    printf("cursor pos: %d:%d\n", bs->read_index, bs->read_bit_index % 8);
+    printf("cursor pos: %d:%d\n", (int)bs->read_index, (int)(bs->read_bit_index % 8));
 
     MPEG1PictureHeader p;
     mpg1_read_picture_header(bs, &p);
@@ -140,7 +349,7 @@ void bitstream_test_file(char *fn)
     printf("frame type: %c\n", frame_type);
     printf("vbv delay: %d\n", p.vbv_delay);
     printf("forward f code: %d\n", p.forward_f_code);
-    printf("cursor pos: %d:%d\n", bs->read_index, bs->read_bit_index % 8);
+    printf("cursor pos: %d:%d\n", (int)bs->read_index, (int)(bs->read_bit_index % 8));
 
     bitstream_free(&bs);
 
@@ -242,6 +451,112 @@ fail:
     goto getch;
 }
 
+/* Encodes every code of a prefix table, then random ones, and decodes them with a lookup table
+ * and with the tree. Both should give the encoded symbols, and end at the same bit. Codes which
+ * begin a longer one are left out, since both decoders take the longer one (e.g. the "1s" of the
+ * first run-level, which the decoder reads separately). The lookup table should take <i>size</i>
+ * entries, which the decoder's static storage is made for. Returns the number of failed checks.
+ */
+int vlc_test_table(const char *name, const VLCPrefixEntry *prefixes, int32_t bits, int32_t size)
+{
+    uint8_t buf[4096], symbols[1024], out[1024];
+    int32_t codes[1024];
+    VLCTable *table = NULL;
+    VLCTreeNode *tree = NULL;
+    MMFBitstream *bs;
+    MMFRES rc;
+    int failures = 0;
+    int32_t count = 0, pos = 0, len, i, j;
+
+    for(i=0; prefixes[i].bit_count > 0; i++) {
+        const VLCPrefixEntry *p = &prefixes[i];
+
+        for(j=0; prefixes[j].bit_count > 0; j++) {
+            const VLCPrefixEntry *q = &prefixes[j];
+
+            if(q->bit_count > p->bit_count && (q->bits >> (q->bit_count - p->bit_count)) == p->bits) break;
+        }
+
+        if(prefixes[j].bit_count == 0) {
+            codes[count++] = i;
+        }
+    }
+
+    if(failed(vlc_table_create(prefixes, 0, bits, &table)) || failed(vlc_tree_create2(prefixes, 0, &tree))) {
+        printf("vlc_test_tables: failed to build the %s table\n", name);
+        vlc_table_free(&table);
+        return 1;
+    }
+
+    if(table->size != size) {
+        printf("vlc_test_tables: %s table takes %d entries, not %d\n", name, (int)table->size, (int)size);
+        failures++;
+    }
+
+    memset(buf, 0, sizeof(buf));
+
+    for(i=0; i<(int32_t)sizeof(symbols); i++) {
+        const VLCPrefixEntry *p = &prefixes[codes[i < count ? i : rand() % count]];
+
+        symbols[i] = (uint8_t)p->symbol;
+
+        for(j=p->bit_count-1; j>=0; j--, pos++) {
+            if((p->bits >> j) & 1) buf[pos >> 3] |= 0x80 >> (pos & 7);
+        }
+    }
+
+    for(j=0; j<2; j++) {
+        bs = bitstream_alloc_wrap(buf, (pos + 7) / 8, &rc);
+        if(!bs) {
+            failures++;
+            break;
+        }
+
+        if(j == 0) {
+            rc = vlc_decode_table(bs, table, sizeof(symbols), out, &len);
+        }else {
+            rc = vlc_decode_bitstream(bs, tree, sizeof(symbols), out, &len);
+        }
+
+        if(failed(rc) || len != (int32_t)sizeof(symbols) || memcmp(out, symbols, sizeof(symbols)) != 0 ||
+           bs->read_bit_index != pos) {
+            for(i=0; i<len && out[i] == symbols[i]; i++);
+
+            printf("vlc_test_tables: %s %s decodes symbol %d wrong\n", name, j ? "tree" : "table", (int)i);
+            failures++;
+        }
+
+        bitstream_free(&bs);
+    }
+
+    vlc_table_free(&table);
+    vlc_tree_free(&tree);
+
+    return failures;
+}
+
+/* Checks the VLC lookup tables of the MPEG-1 decoder against the trees. Returns the number of failed checks. */
+int vlc_test_tables()
+{
+    int failures = 0;
+
+    srand(1);
+
+    failures += vlc_test_table("mb_addr_increment", __vlc_mb_addr_increment, MPEG1_VLC_MB_ADDR_INCREMENT_BITS, MPEG1_VLC_MB_ADDR_INCREMENT_SIZE);
+    failures += vlc_test_table("mb_type_i", __vlc_mb_type_i, MPEG1_VLC_MB_TYPE_I_BITS, MPEG1_VLC_MB_TYPE_I_SIZE);
+    failures += vlc_test_table("mb_type_p", __vlc_mb_type_p, MPEG1_VLC_MB_TYPE_P_BITS, MPEG1_VLC_MB_TYPE_P_SIZE);
+    failures += vlc_test_table("mb_type_b", __vlc_mb_type_b, MPEG1_VLC_MB_TYPE_B_BITS, MPEG1_VLC_MB_TYPE_B_SIZE);
+    failures += vlc_test_table("mb_type_d", __vlc_mb_type_d, MPEG1_VLC_MB_TYPE_D_BITS, MPEG1_VLC_MB_TYPE_D_SIZE);
+    failures += vlc_test_table("mb_cb_pattern", __vlc_mb_cb_pattern, MPEG1_VLC_MB_CB_PATTERN_BITS, MPEG1_VLC_MB_CB_PATTERN_SIZE);
+    failures += vlc_test_table("motion_code", __vlc_motion_code, MPEG1_VLC_MOTION_CODE_BITS, MPEG1_VLC_MOTION_CODE_SIZE);
+    failures += vlc_test_table("dc_size_luma", __vlc_dc_size_y, MPEG1_VLC_DC_SIZE_LUMA_BITS, MPEG1_VLC_DC_SIZE_LUMA_SIZE);
+    failures += vlc_test_table("dc_size_chroma", __vlc_dc_size_c, MPEG1_VLC_DC_SIZE_CHROMA_BITS, MPEG1_VLC_DC_SIZE_CHROMA_SIZE);
+    failures += vlc_test_table("run_levels", __vlc_run_levels, MPEG1_VLC_RUN_LEVELS_BITS, MPEG1_VLC_RUN_LEVELS_SIZE);
+
+    printf("vlc_test_tables: %s\n", failures ? "FAILED" : "passed");
+    return failures;
+}
+
 void print_matrix_8b(int8_t *m, int w, int h) {
     int i, j;
 
@@ -0,0 +1,147 @@
+#include "threadpool.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+/* Takes jobs of the current batch until there are none left. Called with the
+ * lock held, and returns with it held.
+ */
+static void mmf_threadpool_work(MMFThreadPool *pool, int32_t thread)
+{
+    while(pool->next_job < pool->job_count) {
+        int32_t job = pool->next_job++;
+
+        pthread_mutex_unlock(&pool->lock);
+        pool->func(pool->ctx, job, thread);
+        pthread_mutex_lock(&pool->lock);
+
+        if(++pool->jobs_done == pool->job_count) {
+            pthread_cond_signal(&pool->done_cond);
+        }
+    }
+}
+
+static void* mmf_threadpool_worker(void *arg)
+{
+    MMFThreadPoolWorker *w = arg;
+    MMFThreadPool *pool = w->pool;
+
+    pthread_mutex_lock(&pool->lock);
+
+    while(!pool->quit) {
+        mmf_threadpool_work(pool, w->index);
+        pthread_cond_wait(&pool->work_cond, &pool->lock);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+MMFRES mmf_threadpool_create(int32_t threads, MMFThreadPool **pool)
+{
+    int32_t i;
+    MMFThreadPool *p = mmf_allocz(sizeof(MMFThreadPool));
+    if(!p) return RC_OUTOFMEM;
+
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->work_cond, NULL);
+    pthread_cond_init(&p->done_cond, NULL);
+
+    if(threads > 1) {
+        p->workers = mmf_allocz((threads - 1) * sizeof(MMFThreadPoolWorker));
+        if(!p->workers) {
+            mmf_threadpool_free(&p);
+            return RC_OUTOFMEM;
+        }
+
+        for(i=0; i<threads-1; i++) {
+            p->workers[i].pool = p;
+            p->workers[i].index = i + 1;
+
+            if(pthread_create(&p->workers[i].thread, NULL, mmf_threadpool_worker, &p->workers[i]) != 0) {
+                mmf_threadpool_free(&p);
+                return RC_EXTERNAL;
+            }
+
+            p->worker_count++;
+        }
+    }
+
+    *pool = p;
+    return RC_OK;
+}
+
+MMFRES mmf_threadpool_free(MMFThreadPool **pool)
+{
+    MMFThreadPool *p = *pool;
+    int32_t i;
+
+    if(p == NULL) {
+        return RC_OK;
+    }
+
+    /* Stop workers */
+    pthread_mutex_lock(&p->lock);
+    p->quit = 1;
+    pthread_cond_broadcast(&p->work_cond);
+    pthread_mutex_unlock(&p->lock);
+
+    for(i=0; i<p->worker_count; i++) {
+        pthread_join(p->workers[i].thread, NULL);
+    }
+
+    pthread_cond_destroy(&p->done_cond);
+    pthread_cond_destroy(&p->work_cond);
+    pthread_mutex_destroy(&p->lock);
+
+    mmf_free(p->workers);
+    mmf_free(p);
+
+    *pool = NULL;
+    return RC_OK;
+}
+
+MMFRES mmf_threadpool_run(MMFThreadPool *pool, MMFThreadPoolJob func, void *ctx, int32_t count)
+{
+    if(count <= 0) {
+        return RC_OK;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+
+    pool->func = func;
+    pool->ctx = ctx;
+    pool->job_count = count;
+    pool->next_job = 0;
+    pool->jobs_done = 0;
+
+    pthread_cond_broadcast(&pool->work_cond);
+
+    /* Take part in the batch, then wait for the jobs taken by the workers */
+    mmf_threadpool_work(pool, 0);
+
+    while(pool->jobs_done < pool->job_count) {
+        pthread_cond_wait(&pool->done_cond, &pool->lock);
+    }
+
+    pool->job_count = 0;
+    pool->next_job = 0;
+
+    pthread_mutex_unlock(&pool->lock);
+    return RC_OK;
+}
+
+int32_t mmf_get_cpu_count(void)
+{
+    #ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors > 0 ? (int32_t)si.dwNumberOfProcessors : 1;
+    #else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int32_t)n : 1;
+    #endif
+}
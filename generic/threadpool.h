@@ -0,0 +1,80 @@
+/**
+ * @file threadpool.h
+ *
+ * @brief      Worker thread pool
+ * @details    Runs a batch of independent jobs on a fixed set of worker threads. The calling
+ *             thread takes part in the batch too, and returns when all jobs are done.
+ */
+
+#ifndef THREADPOOL_H_INCLUDED
+#define THREADPOOL_H_INCLUDED
+
+#include <stdint.h>
+#include <pthread.h>
+#include "..\mmfutil.h"
+
+/**
+ * Job function.
+ * @param ctx    User pointer, given to mmf_threadpool_run()
+ * @param job    Index of the job in the batch
+ * @param thread Index of the thread, which runs the job. The calling thread has index 0, and
+ *               workers are numbered from 1, so it can be used to select per-thread scratch data.
+ */
+typedef void (*MMFThreadPoolJob)(void *ctx, int32_t job, int32_t thread);
+
+typedef struct MMFThreadPool MMFThreadPool;
+
+typedef struct {
+    MMFThreadPool *pool;
+    int32_t index;
+    pthread_t thread;
+} MMFThreadPoolWorker;
+
+struct MMFThreadPool {
+    MMFThreadPoolWorker *workers;
+    int32_t worker_count;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+
+    /* Current batch */
+    MMFThreadPoolJob func;
+    void *ctx;
+    int32_t job_count;
+    int32_t next_job;
+    int32_t jobs_done;
+
+    int8_t quit;
+};
+
+/**
+ * Creates a thread pool.
+ * @param threads Total number of threads, which run the jobs (including the calling thread).
+ *                Values less than 2 create a pool without workers, which runs the jobs in the caller.
+ * @param pool Receives the new pool.
+ * @return RC_OK on success, error otherwise.
+ */
+MMFRES mmf_threadpool_create(int32_t threads, MMFThreadPool **pool);
+MMFRES mmf_threadpool_free(MMFThreadPool **pool);
+
+/**
+ * Runs <i>count</i> jobs and waits for all of them to complete. Jobs are taken in order, but
+ * might complete in any order. Only one batch can run at a time.
+ */
+MMFRES mmf_threadpool_run(MMFThreadPool *pool, MMFThreadPoolJob func, void *ctx, int32_t count);
+
+/**
+ * Returns the number of threads, which run jobs (i.e. workers plus the calling thread).
+ */
+static inline int32_t mmf_threadpool_get_threads(MMFThreadPool *pool)
+{
+    return pool->worker_count + 1;
+}
+
+/**
+ * Returns the number of logical processors, or 1 if it can't be determined.
+ */
+int32_t mmf_get_cpu_count(void);
+
+#endif // THREADPOOL_H_INCLUDED
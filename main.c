@@ -8,6 +8,8 @@
 #include <time.h>
 #include <stdlib.h>
 #include "generic\bitstream_test.h"
+#include "codec\dsp_test.h"
+#include "codec\mpeg1dec_test.h"
 
 #define CHECKRES(x, y)          \
     if (failed(x)) {            \
@@ -59,6 +61,32 @@ void fill_sample(MMFSample *s)
 }
 
 int main() {
+    bitstream_test_flush_mark();
+    bitstream_test_start_code();
+    vlc_test_tables();
+    dsp_test_idct();
+    dsp_test_idct_ieee1180();
+    dsp_test_mc();
+    dsp_test_convert();
+    dsp_test_scale();
+    mpg1_test_seek("grb_1_copy.mpg");
+    mpg1_test_index("grb_1_copy.mpg");
+    mpg1_test_slice_threads("grb_1_copy.mpg");
+    mpg1_test_frame_threads("grb_1_copy.mpg");
+    mpg1_test_batch("grb_1_copy.mpg");
+    //175x143 closed GOPs of I pictures, which don't cover whole macroblocks
+    mpg1_test_batch("testdata/odd_size.mpg");
+    //Squares moving by whole and half pixels in P pictures, and in B pictures, checked against ffmpeg
+    mpg1_test_checksums("testdata/ip_motion.mpg", "testdata/ip_motion.crc");
+    mpg1_test_checksums("testdata/ipb_motion.mpg", "testdata/ipb_motion.crc");
+    mpg1_test_discard("grb_1_copy.mpg");
+    mpg1_test_lowres("grb_1_copy.mpg");
+    mpg1_test_keyframes("grb_1_copy.mpg");
+    mpg1_test_roi("grb_1_copy.mpg");
+    //176x144 scrolling picture, coded with GOPs of 3 pictures and then of 60
+    mpg1_test_roi("testdata/gop_change.mpg");
+    mpg1_test_convert("grb_1_copy.mpg");
+    mpg1_test_scaling("grb_1_copy.mpg");
     bitstream_test_file("grb_1_copy.mpg");
 }
 #endif
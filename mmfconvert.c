@@ -0,0 +1,278 @@
+#include "string.h"
+#include "mmfconvert.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define MMF_CONVERT_X86
+#endif
+
+/*
+ * BT.601 coefficients in Q13 fixed point. The inputs are scaled by 64, so the
+ * products keep the upper 16 bits (which is what _mm_mulhi_epi16 does) and the
+ * terms come out in Q3. Both implementations use the same arithmetic, so their
+ * output is identical.
+ */
+#define CONVERT_COEF_Y      9535    //!< 1.164 (255/219)
+#define CONVERT_COEF_RV     13074   //!< 1.596
+#define CONVERT_COEF_GU     3203    //!< 0.391
+#define CONVERT_COEF_GV     6660    //!< 0.813
+#define CONVERT_COEF_BU     16531   //!< 2.018
+
+#define CONVERT_MULHI(x, c) (((x) * (c)) >> 16)
+
+static inline uint8_t mmf_convert_clip(int32_t x)
+{
+    return x < 0 ? 0 : x > 255 ? 255 : x;
+}
+
+/*
+ * Portable version
+ */
+static inline void mmf_convert_rgba_pixel(uint8_t *dst, int32_t y, int32_t rv, int32_t g, int32_t bu)
+{
+    int32_t yt = CONVERT_MULHI((y - 16) * 64, CONVERT_COEF_Y);
+
+    dst[0] = mmf_convert_clip((yt + rv + 4) >> 3);
+    dst[1] = mmf_convert_clip((yt - g + 4) >> 3);
+    dst[2] = mmf_convert_clip((yt + bu + 4) >> 3);
+    dst[3] = 255;
+}
+
+static void mmf_convert_yuv420p_to_rgba32_c(uint8_t *dst0, uint8_t *dst1, const uint8_t *y0, const uint8_t *y1,
+                                            const uint8_t *u, const uint8_t *v, int32_t w)
+{
+    int32_t i;
+
+    for(i=0; i<w; i++) {
+        int32_t cu = (u[i >> 1] - 128) * 64;
+        int32_t cv = (v[i >> 1] - 128) * 64;
+        int32_t rv = CONVERT_MULHI(cv, CONVERT_COEF_RV);
+        int32_t g = CONVERT_MULHI(cu, CONVERT_COEF_GU) + CONVERT_MULHI(cv, CONVERT_COEF_GV);
+        int32_t bu = CONVERT_MULHI(cu, CONVERT_COEF_BU);
+
+        mmf_convert_rgba_pixel(dst0 + i * 4, y0[i], rv, g, bu);
+        mmf_convert_rgba_pixel(dst1 + i * 4, y1[i], rv, g, bu);
+    }
+}
+
+static void mmf_convert_interleave_uv_c(uint8_t *dst, const uint8_t *u, const uint8_t *v, int32_t w)
+{
+    int32_t i;
+
+    for(i=0; i<w; i++) {
+        dst[i * 2] = u[i];
+        dst[i * 2 + 1] = v[i];
+    }
+}
+
+static const MMFConvertFunctions __convert_funcs_c = {
+    .yuv420p_to_rgba32 = mmf_convert_yuv420p_to_rgba32_c,
+    .interleave_uv = mmf_convert_interleave_uv_c,
+};
+
+#ifdef MMF_CONVERT_X86
+/*
+ * SSE2 version. 16 pixels of both rows are converted at once, the rest by the C version.
+ */
+
+/* Converts 16 luminance samples and writes them, with the chrominance terms of 8 pixel pairs */
+__attribute__((target("sse2")))
+static inline void mmf_convert_sse2_rgba16(uint8_t *dst, const uint8_t *y, __m128i rv, __m128i g, __m128i bu)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i y_off = _mm_set1_epi16(16);
+    const __m128i y_coef = _mm_set1_epi16(CONVERT_COEF_Y);
+    const __m128i round = _mm_set1_epi16(4);
+    const __m128i alpha = _mm_set1_epi8(-1);
+    __m128i yv, ylo, yhi, r, gg, b, rg, ba;
+
+    yv = _mm_loadu_si128((const __m128i*)y);
+    ylo = _mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(yv, zero), y_off), 6);
+    yhi = _mm_slli_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(yv, zero), y_off), 6);
+    ylo = _mm_add_epi16(_mm_mulhi_epi16(ylo, y_coef), round);
+    yhi = _mm_add_epi16(_mm_mulhi_epi16(yhi, y_coef), round);
+
+    /* Each chrominance term is shared by two neighbouring pixels */
+    r = _mm_packus_epi16(_mm_srai_epi16(_mm_add_epi16(ylo, _mm_unpacklo_epi16(rv, rv)), 3),
+                         _mm_srai_epi16(_mm_add_epi16(yhi, _mm_unpackhi_epi16(rv, rv)), 3));
+    gg = _mm_packus_epi16(_mm_srai_epi16(_mm_sub_epi16(ylo, _mm_unpacklo_epi16(g, g)), 3),
+                          _mm_srai_epi16(_mm_sub_epi16(yhi, _mm_unpackhi_epi16(g, g)), 3));
+    b = _mm_packus_epi16(_mm_srai_epi16(_mm_add_epi16(ylo, _mm_unpacklo_epi16(bu, bu)), 3),
+                         _mm_srai_epi16(_mm_add_epi16(yhi, _mm_unpackhi_epi16(bu, bu)), 3));
+
+    /* Interleave to R, G, B, A */
+    rg = _mm_unpacklo_epi8(r, gg);
+    ba = _mm_unpacklo_epi8(b, alpha);
+    _mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi16(rg, ba));
+    _mm_storeu_si128((__m128i*)(dst + 16), _mm_unpackhi_epi16(rg, ba));
+
+    rg = _mm_unpackhi_epi8(r, gg);
+    ba = _mm_unpackhi_epi8(b, alpha);
+    _mm_storeu_si128((__m128i*)(dst + 32), _mm_unpacklo_epi16(rg, ba));
+    _mm_storeu_si128((__m128i*)(dst + 48), _mm_unpackhi_epi16(rg, ba));
+}
+
+__attribute__((target("sse2")))
+static void mmf_convert_yuv420p_to_rgba32_sse2(uint8_t *dst0, uint8_t *dst1, const uint8_t *y0, const uint8_t *y1,
+                                               const uint8_t *u, const uint8_t *v, int32_t w)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c_off = _mm_set1_epi16(128);
+    __m128i cu, cv, rv, g, bu;
+    int32_t i;
+
+    for(i=0; i+16<=w; i+=16) {
+        cu = _mm_loadl_epi64((const __m128i*)(u + i / 2));
+        cv = _mm_loadl_epi64((const __m128i*)(v + i / 2));
+        cu = _mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(cu, zero), c_off), 6);
+        cv = _mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(cv, zero), c_off), 6);
+
+        rv = _mm_mulhi_epi16(cv, _mm_set1_epi16(CONVERT_COEF_RV));
+        g = _mm_add_epi16(_mm_mulhi_epi16(cu, _mm_set1_epi16(CONVERT_COEF_GU)),
+                          _mm_mulhi_epi16(cv, _mm_set1_epi16(CONVERT_COEF_GV)));
+        bu = _mm_mulhi_epi16(cu, _mm_set1_epi16(CONVERT_COEF_BU));
+
+        mmf_convert_sse2_rgba16(dst0 + i * 4, y0 + i, rv, g, bu);
+        mmf_convert_sse2_rgba16(dst1 + i * 4, y1 + i, rv, g, bu);
+    }
+
+    if(i < w) {
+        mmf_convert_yuv420p_to_rgba32_c(dst0 + i * 4, dst1 + i * 4, y0 + i, y1 + i, u + i / 2, v + i / 2, w - i);
+    }
+}
+
+__attribute__((target("sse2")))
+static void mmf_convert_interleave_uv_sse2(uint8_t *dst, const uint8_t *u, const uint8_t *v, int32_t w)
+{
+    __m128i a, b;
+    int32_t i;
+
+    for(i=0; i+16<=w; i+=16) {
+        a = _mm_loadu_si128((const __m128i*)(u + i));
+        b = _mm_loadu_si128((const __m128i*)(v + i));
+
+        _mm_storeu_si128((__m128i*)(dst + i * 2), _mm_unpacklo_epi8(a, b));
+        _mm_storeu_si128((__m128i*)(dst + i * 2 + 16), _mm_unpackhi_epi8(a, b));
+    }
+
+    mmf_convert_interleave_uv_c(dst + i * 2, u + i, v + i, w - i);
+}
+
+static const MMFConvertFunctions __convert_funcs_sse2 = {
+    .yuv420p_to_rgba32 = mmf_convert_yuv420p_to_rgba32_sse2,
+    .interleave_uv = mmf_convert_interleave_uv_sse2,
+};
+#endif // MMF_CONVERT_X86
+
+MMFConvertFunctions mmf_convert_funcs = {
+    .yuv420p_to_rgba32 = mmf_convert_yuv420p_to_rgba32_c,
+    .interleave_uv = mmf_convert_interleave_uv_c,
+};
+
+/* Selects the fastest conversion for the CPU we are running on.
+ */
+__attribute__((constructor)) void mmf_convert_init()
+{
+    mmf_convert_set_type(CONVERT_TYPE_AUTO);
+}
+
+MMFRES mmf_convert_set_type(MMFConvertType type)
+{
+    #ifdef MMF_CONVERT_X86
+    /* Needed, since we might be called from a constructor */
+    __builtin_cpu_init();
+
+    if(type == CONVERT_TYPE_AUTO) {
+        type = __builtin_cpu_supports("sse2") ? CONVERT_TYPE_SSE2 : CONVERT_TYPE_C;
+    }
+    #else
+    if(type == CONVERT_TYPE_AUTO) {
+        type = CONVERT_TYPE_C;
+    }
+    #endif
+
+    switch(type) {
+    case CONVERT_TYPE_C:
+        mmf_convert_funcs = __convert_funcs_c;
+        break;
+    #ifdef MMF_CONVERT_X86
+    case CONVERT_TYPE_SSE2:
+        if(!__builtin_cpu_supports("sse2")) return RC_NOTIMPLEMENTED;
+
+        mmf_convert_funcs = __convert_funcs_sse2;
+        break;
+    #else
+    case CONVERT_TYPE_SSE2:
+        return RC_NOTIMPLEMENTED;
+    #endif
+    default:
+        return RC_INVALIDARG;
+    }
+
+    return RC_OK;
+}
+
+MMFRES mmf_convert_yuv420p(const uint8_t *y, const uint8_t *u, const uint8_t *v, int32_t y_stride, int32_t uv_stride,
+                           MMFSample *dst, int32_t top, int32_t rows)
+{
+    int32_t w = dst->width;
+    int32_t cw = (w + 1) / 2;
+    int32_t c_top = top / 2, c_rows = (top + rows + 1) / 2 - c_top;
+    int32_t i;
+
+    if(top & 1) {
+        /* Rows share the chrominance in pairs */
+        return RC_INVALIDARG;
+    }
+
+    y += top * y_stride;
+    u += c_top * uv_stride;
+    v += c_top * uv_stride;
+
+    switch(dst->format) {
+    case SAMPLE_FORMAT_YUV420P:
+        mmf_sample_copy_plane((void*)y, y_stride, (uint8_t*)dst->buffer_data[0] + top * dst->buffer_stride[0], dst->buffer_stride[0], w, rows);
+        mmf_sample_copy_plane((void*)u, uv_stride, (uint8_t*)dst->buffer_data[1] + c_top * dst->buffer_stride[1], dst->buffer_stride[1], cw, c_rows);
+        mmf_sample_copy_plane((void*)v, uv_stride, (uint8_t*)dst->buffer_data[2] + c_top * dst->buffer_stride[2], dst->buffer_stride[2], cw, c_rows);
+        break;
+
+    case SAMPLE_FORMAT_NV12: {
+        uint8_t *d = (uint8_t*)dst->buffer_data[1] + c_top * dst->buffer_stride[1];
+
+        mmf_sample_copy_plane((void*)y, y_stride, (uint8_t*)dst->buffer_data[0] + top * dst->buffer_stride[0], dst->buffer_stride[0], w, rows);
+
+        for(i=0; i<c_rows; i++) {
+            mmf_convert_funcs.interleave_uv(d, u, v, cw);
+
+            d += dst->buffer_stride[1];
+            u += uv_stride;
+            v += uv_stride;
+        }
+        break;
+    }
+
+    case SAMPLE_FORMAT_RGBA32: {
+        uint8_t *d = (uint8_t*)dst->buffer_data[0] + top * dst->buffer_stride[0];
+        int32_t d_stride = dst->buffer_stride[0];
+
+        for(i=0; i<rows; i+=2) {
+            /* A single last row is converted as a pair with itself */
+            int32_t next = i + 1 < rows ? 1 : 0;
+
+            mmf_convert_funcs.yuv420p_to_rgba32(d, d + next * d_stride, y, y + next * y_stride, u, v, w);
+
+            d += 2 * d_stride;
+            y += 2 * y_stride;
+            u += uv_stride;
+            v += uv_stride;
+        }
+        break;
+    }
+
+    default:
+        /* Unsupported pix fmt */
+        return RC_INVALIDARG;
+    }
+
+    return RC_OK;
+}
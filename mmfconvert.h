@@ -0,0 +1,75 @@
+#ifndef MMFCONVERT_H_INCLUDED
+#define MMFCONVERT_H_INCLUDED
+
+#include <stdint.h>
+#include "mmfutil.h"
+#include "mmfsample.h"
+
+/**
+ * Available pixel format conversion implementations
+ */
+typedef enum MMFConvertType {
+    CONVERT_TYPE_AUTO   = 0x0,  //!< Fastest implementation, supported by the CPU (default)
+    CONVERT_TYPE_C,             //!< Portable C implementation
+    CONVERT_TYPE_SSE2,          //!< SSE2 implementation
+} MMFConvertType;
+
+/**
+ * Converts two rows of a YUV420P picture, which share a row of chrominance, to RGBA32
+ * (bytes R, G, B, A in memory). The colors are BT.601, with Y in 16..235 (as in MPEG-1 video).
+ *
+ * @param dst0 Destination of the first row
+ * @param dst1 Destination of the second row
+ * @param y0 First row of luminance
+ * @param y1 Second row of luminance
+ * @param u Row of Cb, of half the width
+ * @param v Row of Cr, of half the width
+ * @param w Number of pixels (even)
+ */
+typedef void (*MMFConvertRGBAFunc)(uint8_t *dst0, uint8_t *dst1, const uint8_t *y0, const uint8_t *y1,
+                                   const uint8_t *u, const uint8_t *v, int32_t w);
+
+/**
+ * Interleaves a row of Cb and a row of Cr, into the chrominance plane of NV12.
+ * @param w Number of Cb (and Cr) samples
+ */
+typedef void (*MMFConvertInterleaveFunc)(uint8_t *dst, const uint8_t *u, const uint8_t *v, int32_t w);
+
+/**
+ * Table of the conversion routines. Like mmf_mc_funcs, it is initialized at startup depending
+ * on the CPU features, and can be changed with mmf_convert_set_type().
+ */
+typedef struct MMFConvertFunctions {
+    MMFConvertRGBAFunc yuv420p_to_rgba32;
+    MMFConvertInterleaveFunc interleave_uv;
+} MMFConvertFunctions;
+
+extern MMFConvertFunctions mmf_convert_funcs;
+
+void mmf_convert_init();
+
+/**
+ * Selects the conversion implementation, used through mmf_convert_funcs.
+ * @param type One of MMFConvertType values
+ * @return RC_OK on success, RC_NOTIMPLEMENTED if the CPU doesn't support it, RC_INVALIDARG if the type is unknown.
+ */
+MMFRES mmf_convert_set_type(MMFConvertType type);
+
+/**
+ * Writes rows of YUV420P planes to a video sample, in the sample's format (YUV420P, NV12 or
+ * RGBA32). Each row is read and written once, so the conversion costs no more than a copy
+ * from a cached picture.
+ * @param y Luminance plane
+ * @param u Cb plane
+ * @param v Cr plane
+ * @param y_stride Distance in bytes between two rows of luminance
+ * @param uv_stride Distance in bytes between two rows of Cb and Cr
+ * @param dst Destination sample. Its width is the number of pixels in a row.
+ * @param top First row to write (even)
+ * @param rows Number of rows (even, unless they end at the bottom of the sample)
+ * @return RC_OK on success, RC_INVALIDARG if the format is not supported.
+ */
+MMFRES mmf_convert_yuv420p(const uint8_t *y, const uint8_t *u, const uint8_t *v, int32_t y_stride, int32_t uv_stride,
+                           MMFSample *dst, int32_t top, int32_t rows);
+
+#endif // MMFCONVERT_H_INCLUDED
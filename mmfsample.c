@@ -166,11 +166,11 @@ MMFRES mmf_sample_copy_plane(void *src, int src_stride, void *dst, int dst_strid
 
     if (src_stride == dst_stride && src_stride == bytewidth) {
         //If both strides are identical, copy whole plane
-        memcpy(s, d, bytewidth*h);
+        memcpy(d, s, bytewidth*h);
     } else {
         //Copy plane line by line
         for(; h>0; h--) {
-            memcpy(s, d, bytewidth);
+            memcpy(d, s, bytewidth);
 
             s+=src_stride;
             d+=dst_stride;
@@ -0,0 +1,465 @@
+#include "string.h"
+#include "mmfscale.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define MMF_SCALE_X86
+#endif
+
+/* Weights are in Q14, horizontally filtered rows in Q7 */
+#define SCALE_WEIGHT_BITS   14
+#define SCALE_ROW_BITS      7
+#define SCALE_ONE           (1 << SCALE_WEIGHT_BITS)
+
+/* Horizontal filters are padded to multiples of this many taps, for the SSE2 version */
+#define SCALE_H_ALIGN       8
+
+/*
+ * Portable version
+ */
+static void mmf_scale_horizontal_range_c(int16_t *dst, const uint8_t *src, const MMFScaleTable *t, int32_t from, int32_t to)
+{
+    int32_t i, k;
+
+    for(i=from; i<to; i++) {
+        const uint8_t *s = src + t->pos[i];
+        const int16_t *w = t->weights + i * t->size;
+        int32_t sum = 0;
+
+        for(k=0; k<t->size; k++) {
+            sum += s[k] * w[k];
+        }
+
+        dst[i] = (sum + (1 << (SCALE_WEIGHT_BITS - SCALE_ROW_BITS - 1))) >> (SCALE_WEIGHT_BITS - SCALE_ROW_BITS);
+    }
+}
+
+static void mmf_scale_horizontal_c(int16_t *dst, const uint8_t *src, const MMFScaleTable *t, int32_t w)
+{
+    mmf_scale_horizontal_range_c(dst, src, t, 0, w);
+}
+
+static void mmf_scale_vertical_range_c(uint8_t *dst, const int16_t **rows, const int16_t *weights, int32_t size, int32_t from, int32_t to)
+{
+    int32_t x, k;
+
+    for(x=from; x<to; x++) {
+        int32_t sum = 1 << (SCALE_WEIGHT_BITS + SCALE_ROW_BITS - 1);
+
+        for(k=0; k<size; k++) {
+            sum += rows[k][x] * weights[k];
+        }
+
+        sum >>= SCALE_WEIGHT_BITS + SCALE_ROW_BITS;
+        dst[x] = sum < 0 ? 0 : sum > 255 ? 255 : sum;
+    }
+}
+
+static void mmf_scale_vertical_c(uint8_t *dst, const int16_t **rows, const int16_t *weights, int32_t size, int32_t w)
+{
+    mmf_scale_vertical_range_c(dst, rows, weights, size, 0, w);
+}
+
+static const MMFScaleFunctions __scale_funcs_c = {
+    .horizontal = mmf_scale_horizontal_c,
+    .vertical = mmf_scale_vertical_c,
+};
+
+#ifdef MMF_SCALE_X86
+/*
+ * SSE2 version. Both use the same integer arithmetic as the C version, so the output is identical.
+ */
+
+/* Filters 4 pixels at once, 8 taps at a time. The filter size is a multiple of 8 then. */
+__attribute__((target("sse2")))
+static void mmf_scale_horizontal_sse2(int16_t *dst, const uint8_t *src, const MMFScaleTable *t, int32_t w)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi32(1 << (SCALE_WEIGHT_BITS - SCALE_ROW_BITS - 1));
+    __m128i acc[4], a, b;
+    int32_t i, j, k;
+
+    if(t->size % SCALE_H_ALIGN) {
+        /* Narrow sources, which can't be padded */
+        mmf_scale_horizontal_range_c(dst, src, t, 0, w);
+        return;
+    }
+
+    for(i=0; i+4<=w; i+=4) {
+        for(k=0; k<4; k++) {
+            const uint8_t *s = src + t->pos[i + k];
+            const int16_t *wt = t->weights + (i + k) * t->size;
+
+            acc[k] = zero;
+
+            for(j=0; j<t->size; j+=8) {
+                a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(s + j)), zero);
+                acc[k] = _mm_add_epi32(acc[k], _mm_madd_epi16(a, _mm_loadu_si128((const __m128i*)(wt + j))));
+            }
+        }
+
+        /* Add up the 4 partial sums of each pixel */
+        a = _mm_add_epi32(_mm_unpacklo_epi32(acc[0], acc[1]), _mm_unpackhi_epi32(acc[0], acc[1]));
+        b = _mm_add_epi32(_mm_unpacklo_epi32(acc[2], acc[3]), _mm_unpackhi_epi32(acc[2], acc[3]));
+        a = _mm_add_epi32(_mm_unpacklo_epi64(a, b), _mm_unpackhi_epi64(a, b));
+
+        a = _mm_srai_epi32(_mm_add_epi32(a, round), SCALE_WEIGHT_BITS - SCALE_ROW_BITS);
+        _mm_storel_epi64((__m128i*)(dst + i), _mm_packs_epi32(a, a));
+    }
+
+    mmf_scale_horizontal_range_c(dst, src, t, i, w);
+}
+
+/* Filters 8 pixels at once, two rows at a time */
+__attribute__((target("sse2")))
+static void mmf_scale_vertical_sse2(uint8_t *dst, const int16_t **rows, const int16_t *weights, int32_t size, int32_t w)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi32(1 << (SCALE_WEIGHT_BITS + SCALE_ROW_BITS - 1));
+    __m128i lo, hi, a, b, wv;
+    int32_t x, k;
+
+    for(x=0; x+8<=w; x+=8) {
+        lo = hi = round;
+
+        for(k=0; k<size; k+=2) {
+            a = _mm_loadu_si128((const __m128i*)(rows[k] + x));
+
+            if(k + 1 < size) {
+                b = _mm_loadu_si128((const __m128i*)(rows[k + 1] + x));
+                wv = _mm_set1_epi32((uint16_t)weights[k] | ((int32_t)weights[k + 1] << 16));
+            }else {
+                b = zero;
+                wv = _mm_set1_epi32((uint16_t)weights[k]);
+            }
+
+            lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), wv));
+            hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), wv));
+        }
+
+        lo = _mm_srai_epi32(lo, SCALE_WEIGHT_BITS + SCALE_ROW_BITS);
+        hi = _mm_srai_epi32(hi, SCALE_WEIGHT_BITS + SCALE_ROW_BITS);
+        a = _mm_packs_epi32(lo, hi);
+        _mm_storel_epi64((__m128i*)(dst + x), _mm_packus_epi16(a, a));
+    }
+
+    mmf_scale_vertical_range_c(dst, rows, weights, size, x, w);
+}
+
+static const MMFScaleFunctions __scale_funcs_sse2 = {
+    .horizontal = mmf_scale_horizontal_sse2,
+    .vertical = mmf_scale_vertical_sse2,
+};
+#endif // MMF_SCALE_X86
+
+MMFScaleFunctions mmf_scale_funcs = {
+    .horizontal = mmf_scale_horizontal_c,
+    .vertical = mmf_scale_vertical_c,
+};
+
+/* Selects the fastest scaling for the CPU we are running on.
+ */
+__attribute__((constructor)) void mmf_scale_init()
+{
+    mmf_scale_set_type(SCALE_TYPE_AUTO);
+}
+
+MMFRES mmf_scale_set_type(MMFScaleType type)
+{
+    #ifdef MMF_SCALE_X86
+    /* Needed, since we might be called from a constructor */
+    __builtin_cpu_init();
+
+    if(type == SCALE_TYPE_AUTO) {
+        type = __builtin_cpu_supports("sse2") ? SCALE_TYPE_SSE2 : SCALE_TYPE_C;
+    }
+    #else
+    if(type == SCALE_TYPE_AUTO) {
+        type = SCALE_TYPE_C;
+    }
+    #endif
+
+    switch(type) {
+    case SCALE_TYPE_C:
+        mmf_scale_funcs = __scale_funcs_c;
+        break;
+    #ifdef MMF_SCALE_X86
+    case SCALE_TYPE_SSE2:
+        if(!__builtin_cpu_supports("sse2")) return RC_NOTIMPLEMENTED;
+
+        mmf_scale_funcs = __scale_funcs_sse2;
+        break;
+    #else
+    case SCALE_TYPE_SSE2:
+        return RC_NOTIMPLEMENTED;
+    #endif
+    default:
+        return RC_INVALIDARG;
+    }
+
+    return RC_OK;
+}
+
+/*
+ * Builds the filter of one axis. The filter size is padded to a multiple of "align" taps
+ * (unless the source is narrower), and the filters near the end are moved back, so no
+ * filter reads past the source.
+ */
+static MMFRES mmf_scale_table_build(MMFScaleTable *t, int32_t src, int32_t dst, MMFScaleFilter filter, int32_t align)
+{
+    int32_t area = filter == SCALE_FILTER_AREA && src > dst;
+    int32_t taps = area ? (src + dst - 1) / dst + 1 : 2;
+    int32_t w[taps];
+    int32_t i, k;
+
+    if(taps > src) taps = src;
+
+    t->size = ((taps + align - 1) / align) * align;
+    if(t->size > src) t->size = src;
+
+    t->pos = mmf_alloc(dst * sizeof(int32_t));
+    t->weights = mmf_allocz(dst * t->size * sizeof(int16_t));
+
+    if(!t->pos || !t->weights) {
+        return RC_OUTOFMEM;
+    }
+
+    for(i=0; i<dst; i++) {
+        int32_t first, shift;
+
+        memset(w, 0, sizeof(w));
+
+        if(area) {
+            /* Source pixel j spans [j*dst, (j+1)*dst), destination pixel i spans [i*src, (i+1)*src) */
+            int64_t start = (int64_t)i * src, end = start + src;
+            int32_t sum = 0, largest = 0;
+
+            first = start / dst;
+
+            for(k=0; k<taps && first + k < src; k++) {
+                int64_t lo = (int64_t)(first + k) * dst, hi = lo + dst;
+
+                if(lo < start) lo = start;
+                if(hi > end) hi = end;
+
+                if(hi > lo) {
+                    w[k] = (hi - lo) * SCALE_ONE / src;
+                    sum += w[k];
+
+                    if(w[k] > w[largest]) largest = k;
+                }
+            }
+
+            /* The weights add up to one */
+            w[largest] += SCALE_ONE - sum;
+        }else {
+            /* Center of the destination pixel in the source, in Q16 */
+            int64_t x = (((int64_t)(2 * i + 1) * src) << 16) / (2 * dst) - (1 << 15);
+
+            if(x < 0) x = 0;
+
+            first = x >> 16;
+
+            if(first >= src - 1) {
+                first = src - 1;
+                w[0] = SCALE_ONE;
+            }else {
+                w[1] = (x & 0xFFFF) >> (16 - SCALE_WEIGHT_BITS);
+                w[0] = SCALE_ONE - w[1];
+            }
+        }
+
+        /* Keep the filter inside the source */
+        shift = first + t->size > src ? first + t->size - src : 0;
+        t->pos[i] = first - shift;
+
+        for(k=0; k<taps && first + k < src; k++) {
+            t->weights[i * t->size + k + shift] = w[k];
+        }
+    }
+
+    return RC_OK;
+}
+
+static void mmf_scale_table_free(MMFScaleTable *t)
+{
+    mmf_free(t->pos);
+    mmf_free(t->weights);
+    t->pos = NULL;
+    t->weights = NULL;
+}
+
+static MMFRES mmf_scale_plane_init(MMFScalePlane *p, int32_t src_width, int32_t src_height,
+                                   int32_t dst_width, int32_t dst_height, MMFScaleFilter filter)
+{
+    MMFRES rc;
+
+    p->src_width = src_width;
+    p->src_height = src_height;
+    p->dst_width = dst_width;
+    p->dst_height = dst_height;
+
+    if(src_width == dst_width && src_height == dst_height) {
+        /* Copied */
+        return RC_OK;
+    }
+
+    rc = mmf_scale_table_build(&p->horizontal, src_width, dst_width, filter, SCALE_H_ALIGN);
+    if(failed(rc)) return rc;
+
+    rc = mmf_scale_table_build(&p->vertical, src_height, dst_height, filter, 1);
+    if(failed(rc)) return rc;
+
+    p->ring = mmf_alloc(p->vertical.size * dst_width * sizeof(int16_t));
+    p->ring_rows = mmf_alloc(p->vertical.size * sizeof(int32_t));
+    p->rows = mmf_alloc(p->vertical.size * sizeof(int16_t*));
+
+    if(!p->ring || !p->ring_rows || !p->rows) {
+        return RC_OUTOFMEM;
+    }
+
+    return RC_OK;
+}
+
+static void mmf_scale_plane_free(MMFScalePlane *p)
+{
+    mmf_scale_table_free(&p->horizontal);
+    mmf_scale_table_free(&p->vertical);
+
+    mmf_free(p->ring);
+    mmf_free(p->ring_rows);
+    mmf_free(p->rows);
+}
+
+/* Writes the destination rows, which depend on the first "rows" rows of the source only */
+static void mmf_scale_plane(MMFScalePlane *p, const uint8_t *src, int32_t src_stride, int32_t rows, uint8_t *dst, int32_t dst_stride)
+{
+    int32_t size = p->vertical.size;
+    int32_t k;
+
+    if(p->ring == NULL) {
+        if(rows > p->next_row) {
+            mmf_sample_copy_plane((void*)(src + p->next_row * src_stride), src_stride, dst + p->next_row * dst_stride,
+                                  dst_stride, p->dst_width, rows - p->next_row);
+            p->next_row = rows;
+        }
+
+        return;
+    }
+
+    while(p->next_row < p->dst_height && p->vertical.pos[p->next_row] + size <= rows) {
+        int32_t first = p->vertical.pos[p->next_row];
+
+        /* Filter the source rows horizontally, unless they are in the ring already */
+        for(k=0; k<size; k++) {
+            int32_t row = first + k, slot = row % size;
+            int16_t *r = p->ring + slot * p->dst_width;
+
+            if(p->ring_rows[slot] != row) {
+                mmf_scale_funcs.horizontal(r, src + row * src_stride, &p->horizontal, p->dst_width);
+                p->ring_rows[slot] = row;
+            }
+
+            p->rows[k] = r;
+        }
+
+        mmf_scale_funcs.vertical(dst + p->next_row * dst_stride, p->rows, p->vertical.weights + p->next_row * size,
+                                 size, p->dst_width);
+        p->next_row++;
+    }
+}
+
+MMFRES mmf_scaler_create(int32_t src_width, int32_t src_height, int32_t dst_width, int32_t dst_height,
+                         MMFScaleFilter filter, MMFScaler **scaler)
+{
+    MMFScaler *s;
+    MMFRES rc;
+    int32_t i;
+
+    if(src_width <= 0 || src_height <= 0 || dst_width <= 0 || dst_height <= 0 ||
+       (src_width | src_height | dst_width | dst_height) & 1) {
+        return RC_INVALIDARG;
+    }
+
+    if(filter != SCALE_FILTER_BILINEAR && filter != SCALE_FILTER_AREA) {
+        return RC_INVALIDARG;
+    }
+
+    s = mmf_allocz(sizeof(MMFScaler));
+    if(!s) return RC_OUTOFMEM;
+
+    s->filter = filter;
+
+    for(i=0; i<3; i++) {
+        int32_t shift = i ? 1 : 0;
+
+        rc = mmf_scale_plane_init(&s->planes[i], src_width >> shift, src_height >> shift,
+                                  dst_width >> shift, dst_height >> shift, filter);
+        if(failed(rc)) {
+            mmf_scaler_free(&s);
+            return rc;
+        }
+    }
+
+    mmf_scaler_reset(s);
+
+    *scaler = s;
+    return RC_OK;
+}
+
+MMFRES mmf_scaler_free(MMFScaler **scaler)
+{
+    int32_t i;
+
+    if(*scaler == NULL) {
+        return RC_OK;
+    }
+
+    for(i=0; i<3; i++) {
+        mmf_scale_plane_free(&(*scaler)->planes[i]);
+    }
+
+    mmf_free(*scaler);
+    *scaler = NULL;
+
+    return RC_OK;
+}
+
+void mmf_scaler_reset(MMFScaler *scaler)
+{
+    int32_t i, k;
+
+    for(i=0; i<3; i++) {
+        MMFScalePlane *p = &scaler->planes[i];
+
+        p->next_row = 0;
+
+        for(k=0; p->ring && k<p->vertical.size; k++) {
+            p->ring_rows[k] = -1;
+        }
+    }
+}
+
+MMFRES mmf_scaler_scale_yuv420p(MMFScaler *scaler, const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                                int32_t y_stride, int32_t uv_stride, int32_t rows, MMFSample *dst)
+{
+    MMFScalePlane *p = scaler->planes;
+    int32_t c_rows;
+
+    if(dst->format != SAMPLE_FORMAT_YUV420P || dst->width != p[0].dst_width || dst->height != p[0].dst_height) {
+        return RC_INVALIDARG;
+    }
+
+    if(rows > p[0].src_height) {
+        rows = p[0].src_height;
+    }
+
+    /* Each chrominance row belongs to two luminance rows */
+    c_rows = rows == p[0].src_height ? p[1].src_height : rows / 2;
+
+    mmf_scale_plane(&p[0], y, y_stride, rows, dst->buffer_data[0], dst->buffer_stride[0]);
+    mmf_scale_plane(&p[1], u, uv_stride, c_rows, dst->buffer_data[1], dst->buffer_stride[1]);
+    mmf_scale_plane(&p[2], v, uv_stride, c_rows, dst->buffer_data[2], dst->buffer_stride[2]);
+
+    return RC_OK;
+}
@@ -0,0 +1,133 @@
+#ifndef MMFSCALE_H_INCLUDED
+#define MMFSCALE_H_INCLUDED
+
+#include <stdint.h>
+#include "mmfutil.h"
+#include "mmfsample.h"
+
+/**
+ * Available scaling implementations
+ */
+typedef enum MMFScaleType {
+    SCALE_TYPE_AUTO     = 0x0,  //!< Fastest implementation, supported by the CPU (default)
+    SCALE_TYPE_C,               //!< Portable C implementation
+    SCALE_TYPE_SSE2,            //!< SSE2 implementation
+} MMFScaleType;
+
+/**
+ * Scaling filters
+ */
+typedef enum MMFScaleFilter {
+    SCALE_FILTER_BILINEAR = 0x0,    //!< Interpolates between the two nearest pixels (fast, aliases when downscaling by more than 2)
+    SCALE_FILTER_AREA,              //!< Averages the pixels covered by each destination pixel (same as bilinear when upscaling)
+} MMFScaleFilter;
+
+/**
+ * Filter of one axis. Destination pixel i is the sum of "size" source pixels,
+ * starting at pos[i], multiplied by weights[i * size ...]. The weights are in Q14.
+ */
+typedef struct MMFScaleTable {
+    int32_t size;
+    int32_t *pos;
+    int16_t *weights;
+} MMFScaleTable;
+
+/**
+ * Filters a row horizontally. The results are in Q7 (the source pixels multiplied by 128).
+ *
+ * @param dst Destination row
+ * @param src Source row
+ * @param t Horizontal filter
+ * @param w Number of destination pixels
+ */
+typedef void (*MMFScaleHorizontalFunc)(int16_t *dst, const uint8_t *src, const MMFScaleTable *t, int32_t w);
+
+/**
+ * Filters a row vertically, from horizontally filtered rows.
+ *
+ * @param dst Destination row
+ * @param rows The rows of the filter, in order
+ * @param weights Weights of the rows in Q14
+ * @param size Number of rows
+ * @param w Number of pixels
+ */
+typedef void (*MMFScaleVerticalFunc)(uint8_t *dst, const int16_t **rows, const int16_t *weights, int32_t size, int32_t w);
+
+/**
+ * Table of the scaling routines. Like mmf_convert_funcs, it is initialized at startup depending
+ * on the CPU features, and can be changed with mmf_scale_set_type().
+ */
+typedef struct MMFScaleFunctions {
+    MMFScaleHorizontalFunc horizontal;
+    MMFScaleVerticalFunc vertical;
+} MMFScaleFunctions;
+
+extern MMFScaleFunctions mmf_scale_funcs;
+
+/**
+ * Scaler of one plane. Horizontally filtered source rows are kept in a ring of
+ * "vertical.size" rows, so each of them is filtered once.
+ */
+typedef struct MMFScalePlane {
+    int32_t src_width;
+    int32_t src_height;
+    int32_t dst_width;
+    int32_t dst_height;
+
+    MMFScaleTable horizontal;
+    MMFScaleTable vertical;
+
+    int16_t *ring;
+    int32_t *ring_rows;     //!< Source row in each slot of the ring (-1 if none)
+    const int16_t **rows;   //!< Rows of the vertical filter, in order
+    int32_t next_row;       //!< Next destination row to output
+} MMFScalePlane;
+
+/**
+ * Scales YUV420P frames of one size to another, as the rows of the source frame become
+ * available (e.g. as macroblock rows are decoded).
+ */
+typedef struct MMFScaler {
+    MMFScaleFilter filter;
+    MMFScalePlane planes[3];
+} MMFScaler;
+
+void mmf_scale_init();
+
+/**
+ * Selects the scaling implementation, used through mmf_scale_funcs.
+ * @param type One of MMFScaleType values
+ * @return RC_OK on success, RC_NOTIMPLEMENTED if the CPU doesn't support it, RC_INVALIDARG if the type is unknown.
+ */
+MMFRES mmf_scale_set_type(MMFScaleType type);
+
+/**
+ * Creates a scaler of YUV420P frames. The sizes should be even.
+ * @return RC_OK on success, RC_INVALIDARG if a size or the filter is invalid, RC_OUTOFMEM.
+ */
+MMFRES mmf_scaler_create(int32_t src_width, int32_t src_height, int32_t dst_width, int32_t dst_height,
+                         MMFScaleFilter filter, MMFScaler **scaler);
+MMFRES mmf_scaler_free(MMFScaler **scaler);
+
+/**
+ * Starts a new frame.
+ */
+void mmf_scaler_reset(MMFScaler *scaler);
+
+/**
+ * Writes the destination rows, which can be computed from the first "rows" rows of the source
+ * frame, and which were not written since mmf_scaler_reset(). When the sizes are equal, the
+ * rows are copied with mmf_sample_copy_plane().
+ * @param y Luminance plane
+ * @param u Cb plane
+ * @param v Cr plane
+ * @param y_stride Distance in bytes between two rows of luminance
+ * @param uv_stride Distance in bytes between two rows of Cb and Cr
+ * @param rows Number of luminance rows available (all of them, at the end of the frame)
+ * @param dst YUV420P sample of the destination size
+ * @return RC_OK on success, RC_INVALIDARG if the sample doesn't match.
+ */
+MMFRES mmf_scaler_scale_yuv420p(MMFScaler *scaler, const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                                int32_t y_stride, int32_t uv_stride, int32_t rows, MMFSample *dst);
+
+#endif // MMFSCALE_H_INCLUDED